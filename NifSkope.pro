@@ -176,8 +176,12 @@ HEADERS += \
 	src/io/MeshFile.h \
 	src/io/nifstream.h \
 	src/lib/importex/3ds.h \
+	src/lib/animsampler.h \
+	src/lib/mopp.h \
 	src/lib/nvtristripwrapper.h \
+	src/lib/parallel.h \
 	src/lib/qhull.h \
+	src/lib/skinpartition.h \
 	src/model/basemodel.h \
 	src/model/kfmmodel.h \
 	src/model/nifmodel.h \
@@ -258,8 +262,11 @@ SOURCES += \
 	src/lib/importex/obj.cpp \
 	src/lib/importex/col.cpp \
 	src/lib/importex/gltf.cpp \
+	src/lib/animsampler.cpp \
+	src/lib/mopp.cpp \
 	src/lib/nvtristripwrapper.cpp \
 	src/lib/qhull.cpp \
+	src/lib/skinpartition.cpp \
 	src/model/basemodel.cpp \
 	src/model/kfmmodel.cpp \
 	src/model/nifdelegate.cpp \
@@ -295,6 +302,7 @@ SOURCES += \
 	src/spells/tangentspace.cpp \
 	src/spells/texture.cpp \
 	src/spells/transform.cpp \
+	src/spells/vertexcache.cpp \
 	src/ui/widgets/colorwheel.cpp \
 	src/ui/widgets/filebrowser.cpp \
 	src/ui/widgets/fileselect.cpp \
@@ -329,9 +337,12 @@ SOURCES += \
 	lib/half.cpp \
 	lib/meshlet.cpp \
 	lib/meshoptimizer/clusterizer.cpp \
+	lib/meshoptimizer/overdrawoptimizer.cpp \
 	lib/meshoptimizer/simplifier.cpp \
 	lib/meshoptimizer/spatialorder.cpp \
-	lib/meshoptimizer/vcacheoptimizer.cpp
+	lib/meshoptimizer/vcacheanalyzer.cpp \
+	lib/meshoptimizer/vcacheoptimizer.cpp \
+	lib/meshoptimizer/vfetchoptimizer.cpp
 
 RESOURCES += \
 	res/nifskope.qrc
@@ -31,169 +31,663 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***** END LICENCE BLOCK *****/
 
 #include "bsamodel.h"
-#include "qtcompat.h"
+#include "lib/parallel.h"
 
-#include <QByteArray>
-#include <QDateTime>
-#include <QStringBuilder>
+#include <QRegularExpression>
+#include <QThread>
 
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
 
-BSAModel::BSAModel( QObject * parent )
-	: QStandardItemModel( parent )
+
+//! File list of an archive, shared with the filter threads and not modified after it is built
+struct BSAModel::ArchiveIndex
+{
+	//! Path components, name n is names[nameOffsets[n]] to names[nameOffsets[n + 1]]
+	std::string	names;
+	//! Lower case copy of names, for the filter
+	std::string	lowerNames;
+	std::vector<std::uint32_t>	nameOffsets{ 0 };
+
+	struct Folder
+	{
+		std::uint32_t	parent;
+		std::uint32_t	name;
+		//! Subfolders, consecutive and sorted by name
+		std::uint32_t	firstFolder = 0;
+		std::uint32_t	folderCount = 0;
+		//! Files, consecutive and sorted by name
+		std::uint32_t	firstFile = 0;
+		std::uint32_t	fileCount = 0;
+	};
+	//! Folders in breadth first order, the first one is the listed folder itself
+	std::vector<Folder>	folders;
+
+	struct File
+	{
+		std::uint32_t	folder;
+		std::uint32_t	name;
+		std::uint64_t	size;
+	};
+	std::vector<File>	files;
+
+	//! Path of the listed folder, with a trailing '/' if not empty
+	std::string	prefix;
+
+	//! Names containing a trigram with hash h are trigramNames[trigramOffsets[h]] to trigramNames[trigramOffsets[h + 1]]
+	std::vector<std::uint32_t>	trigramOffsets;
+	std::vector<std::uint32_t>	trigramNames;
+
+	static constexpr unsigned int trigramBits = 16;
+
+	static std::uint32_t trigramHash( const char * s )
+	{
+		std::uint32_t	v = std::uint32_t( std::uint8_t( s[0] ) ) | ( std::uint32_t( std::uint8_t( s[1] ) ) << 8 ) | ( std::uint32_t( std::uint8_t( s[2] ) ) << 16 );
+		return ( v * 0x9E3779B1U ) >> ( 32 - trigramBits );
+	}
+
+	size_t nameCount() const { return nameOffsets.size() - 1; }
+
+	std::string_view name( std::uint32_t n ) const
+	{
+		return std::string_view( names.data() + nameOffsets[n], nameOffsets[n + 1] - nameOffsets[n] );
+	}
+
+	std::string_view lowerName( std::uint32_t n ) const
+	{
+		return std::string_view( lowerNames.data() + nameOffsets[n], nameOffsets[n + 1] - nameOffsets[n] );
+	}
+
+	QString filePath( std::uint32_t file ) const;
+	//! Sorts the folders and files, and builds the trigram index
+	void finalize();
+};
+
+//! Temporary data for BSAModel::fileListScanFunction()
+struct BSAModel::ArchiveScan
+{
+	struct StringHash
+	{
+		using is_transparent = void;
+		size_t operator()( std::string_view s ) const { return std::hash<std::string_view>()( s ); }
+	};
+
+	ArchiveIndex *	index;
+	std::unordered_map<std::string, std::uint32_t, StringHash, std::equal_to<>>	nameIds;
+	//! Folders by parent folder and name
+	std::unordered_map<std::uint64_t, std::uint32_t>	folderIds;
+
+	std::uint32_t intern( std::string_view s )
+	{
+		auto	i = nameIds.find( s );
+		if ( i != nameIds.end() )
+			return i->second;
+
+		std::uint32_t	n = std::uint32_t( index->nameCount() );
+		index->names.append( s );
+		index->nameOffsets.push_back( std::uint32_t( index->names.length() ) );
+		nameIds.emplace( std::string( s ), n );
+		return n;
+	}
+
+	std::uint32_t folder( std::uint32_t parent, std::uint32_t name )
+	{
+		auto	i = folderIds.try_emplace( ( std::uint64_t( parent ) << 32 ) | name, std::uint32_t( index->folders.size() ) );
+		if ( i.second )
+			index->folders.push_back( ArchiveIndex::Folder{ parent, name } );
+		return i.first->second;
+	}
+};
+
+//! Files and folders that match a filter
+struct BSAModel::FilterResult
+{
+	std::vector<std::uint8_t>	files;
+	std::vector<std::uint8_t>	folders;
+	int	matches = 0;
+};
+
+QString BSAModel::ArchiveIndex::filePath( std::uint32_t file ) const
+{
+	std::uint32_t	n[256];
+	size_t	depth = 0;
+	for ( std::uint32_t f = files[file].folder; f != 0 && depth < 256; f = folders[f].parent )
+		n[depth++] = folders[f].name;
+
+	std::string	path( prefix );
+	while ( depth-- > 0 ) {
+		path += name( n[depth] );
+		path += '/';
+	}
+	path += name( files[file].name );
+
+	return QString::fromLatin1( path.data(), qsizetype( path.length() ) );
+}
+
+void BSAModel::ArchiveIndex::finalize()
 {
+	auto	nameLess = [this]( std::uint32_t a, std::uint32_t b ) {
+		return name( a ) < name( b );
+	};
+
+	// Subfolders of each folder, sorted by name
+	size_t	folderCnt = folders.size();
+	std::vector<std::uint32_t>	childOffsets( folderCnt + 1, 0 );
+	for ( size_t i = 1; i < folderCnt; i++ )
+		childOffsets[folders[i].parent + 1]++;
+	for ( size_t i = 0; i < folderCnt; i++ )
+		childOffsets[i + 1] += childOffsets[i];
+	std::vector<std::uint32_t>	children( folderCnt - 1 );
+	{
+		std::vector<std::uint32_t>	pos( childOffsets.begin(), childOffsets.end() - 1 );
+		for ( size_t i = 1; i < folderCnt; i++ )
+			children[pos[folders[i].parent]++] = std::uint32_t( i );
+	}
+	for ( size_t i = 0; i < folderCnt; i++ ) {
+		std::sort( children.begin() + childOffsets[i], children.begin() + childOffsets[i + 1], [this, &nameLess]( std::uint32_t a, std::uint32_t b ) {
+			return nameLess( folders[a].name, folders[b].name );
+		} );
+	}
+
+	// Number the folders breadth first, so that the subfolders of each folder are consecutive
+	std::vector<Folder>	sorted;
+	std::vector<std::uint32_t>	order{ 0 };
+	std::vector<std::uint32_t>	newIds( folderCnt, 0 );
+	sorted.reserve( folderCnt );
+	order.reserve( folderCnt );
+	for ( size_t i = 0; i < order.size(); i++ ) {
+		std::uint32_t	f = order[i];
+		newIds[f] = std::uint32_t( i );
+
+		Folder	folder = folders[f];
+		folder.parent = ( i == 0 ? 0 : newIds[folder.parent] );
+		folder.firstFolder = std::uint32_t( order.size() );
+		folder.folderCount = childOffsets[f + 1] - childOffsets[f];
+		order.insert( order.end(), children.begin() + childOffsets[f], children.begin() + childOffsets[f + 1] );
+		sorted.push_back( folder );
+	}
+	folders = std::move( sorted );
+
+	// Files sorted by folder and name
+	for ( File & file : files )
+		file.folder = newIds[file.folder];
+	std::sort( files.begin(), files.end(), [&nameLess]( const File & a, const File & b ) {
+		if ( a.folder != b.folder )
+			return a.folder < b.folder;
+		return nameLess( a.name, b.name );
+	} );
+	for ( size_t i = files.size(); i-- > 0; ) {
+		Folder &	folder = folders[files[i].folder];
+		folder.firstFile = std::uint32_t( i );
+		folder.fileCount++;
+	}
 
+	lowerNames = names;
+	for ( char & c : lowerNames ) {
+		if ( c >= 'A' && c <= 'Z' )
+			c = char( c + ( 'a' - 'A' ) );
+	}
+
+	// Trigram index of the lower case names
+	std::vector<std::uint64_t>	trigrams;
+	for ( std::uint32_t n = 0; n < std::uint32_t( nameCount() ); n++ ) {
+		std::string_view	s = lowerName( n );
+		for ( size_t i = 0; i + 3 <= s.length(); i++ )
+			trigrams.push_back( ( std::uint64_t( trigramHash( s.data() + i ) ) << 32 ) | n );
+	}
+	std::sort( trigrams.begin(), trigrams.end() );
+	trigrams.erase( std::unique( trigrams.begin(), trigrams.end() ), trigrams.end() );
+
+	trigramOffsets.assign( ( size_t( 1 ) << trigramBits ) + 1, 0 );
+	trigramNames.resize( trigrams.size() );
+	for ( size_t i = 0; i < trigrams.size(); i++ ) {
+		trigramOffsets[( trigrams[i] >> 32 ) + 1]++;
+		trigramNames[i] = std::uint32_t( trigrams[i] );
+	}
+	for ( size_t h = 0; h + 1 < trigramOffsets.size(); h++ )
+		trigramOffsets[h + 1] += trigramOffsets[h];
 }
 
-void BSAModel::init()
+
+BSAModel::BSAModel( QObject * parent )
+	: QAbstractItemModel( parent )
 {
-	setColumnCount( 3 );
-	setHorizontalHeaderLabels( { "File", "Path", "Size" } );
 }
 
-Qt::ItemFlags BSAModel::flags( const QModelIndex & index ) const
+BSAModel::~BSAModel()
 {
-	return QStandardItemModel::flags( index ) ^ Qt::ItemIsEditable;
+	if ( filterThread ) {
+		filterGeneration++;
+		filterThread->wait();
+	}
 }
 
 bool BSAModel::fillModel( const BA2File * bsa, const QString & folder )
 {
-	if ( !bsa )
-		return false;
+	beginResetModel();
+	filterGeneration++;
+	archive.reset();
+	filter.reset();
+
+	if ( bsa ) {
+		auto	a = std::make_shared<ArchiveIndex>();
+		a->prefix = folder.toStdString();
+		if ( !a->prefix.empty() && !a->prefix.ends_with( '/' ) )
+			a->prefix += '/';
+		a->folders.push_back( ArchiveIndex::Folder{ 0, 0 } );
+
+		ArchiveScan	data;
+		data.index = a.get();
+
+		// List files
+		bsa->scanFileList( &fileListScanFunction, &data );
+
+		a->finalize();
+		if ( !a->files.empty() )
+			archive = std::move( a );
+	}
 
-	FileScanFuncData	data;
-	data.p = this;
-	data.bsa = bsa;
-	data.path = folder.toStdString();
-	if ( !data.path.empty() && !data.path.ends_with( '/' ) )
-		data.path += '/';
+	matchCount = ( archive ? int( archive->files.size() ) : 0 );
+	resetNodes();
+	endResetModel();
 
-	// List files
-	bsa->scanFileList( &fileListScanFunction, &data );
+	if ( archive && !filterText.isEmpty() )
+		startFilter();
 
-	return ( rowCount() > 0 );
+	return bool( archive );
+}
+
+void BSAModel::clear()
+{
+	beginResetModel();
+	filterGeneration++;
+	archive.reset();
+	filter.reset();
+	matchCount = 0;
+	resetNodes();
+	endResetModel();
 }
 
 bool BSAModel::fileListScanFunction( void * p, const BA2File::FileInfo & fd )
 {
-	FileScanFuncData & o = *( reinterpret_cast< FileScanFuncData * >( p ) );
+	ArchiveScan & o = *( reinterpret_cast< ArchiveScan * >( p ) );
+	const std::string &	prefix = o.index->prefix;
 
-	if ( fd.fileName.length() <= o.path.length() || !( o.path.empty() || fd.fileName.starts_with( o.path ) ) )
+	std::string_view	path( fd.fileName.data(), fd.fileName.length() );
+	if ( path.length() <= prefix.length() || !path.starts_with( prefix ) )
 		return false;
+	path.remove_prefix( prefix.length() );
 
-	qsizetype	bytes = qsizetype( fd.archiveType < 64 || fd.packedSize == 0 ? fd.unpackedSize : fd.packedSize );
-	QString	fileSize( (bytes > 1024) ? QString::number( bytes / 1024 ) + "KB" : QString::number( bytes ) + "B" );
+	// Recurse through folders
+	std::uint32_t	folder = 0;
+	for ( size_t i; ( i = path.find( '/' ) ) != std::string_view::npos; path.remove_prefix( i + 1 ) ) {
+		if ( i > 0 )
+			folder = o.folder( folder, o.intern( path.substr( 0, i ) ) );
+	}
+	if ( path.empty() )
+		return false;
 
-	QString	fullPath( QString::fromLatin1( fd.fileName.data(), qsizetype(fd.fileName.length()) ) );
-	qsizetype	dirNameLen = fullPath.lastIndexOf( QChar( '/' ) );
-	QString	baseName( fullPath.mid( dirNameLen + 1 ) );
-	auto	folderItem = o.p->insertFolder( fullPath, o.path.length(), dirNameLen, o.folderMap );
+	std::uint64_t	bytes = ( fd.archiveType < 64 || fd.packedSize == 0 ? fd.unpackedSize : fd.packedSize );
+	o.index->files.push_back( ArchiveIndex::File{ folder, o.intern( path ), bytes } );
 
-	auto	fileItem = new QStandardItem( baseName );
-	auto	pathItem = new QStandardItem( fullPath );
-	auto	sizeItem = new QStandardItem( fileSize );
+	return false;
+}
 
-	folderItem->appendRow( { fileItem, pathItem, sizeItem } );
+void BSAModel::setFilter( const QString & text )
+{
+	filterText = text;
+	startFilter();
+}
 
-	return false;
+void BSAModel::setFilterByNameOnly( bool nameOnly )
+{
+	filterByNameOnly = nameOnly;
+	startFilter();
 }
 
-QStandardItem * BSAModel::insertFolder( const QString & path, qsizetype pos1, qsizetype pos2, QHash< QString, QStandardItem * > & folderMap )
+void BSAModel::startFilter()
 {
-	if ( pos2 <= pos1 )
-		return invisibleRootItem();
+	filterGeneration++;
+	if ( !archive || filterText.isEmpty() ) {
+		applyFilter( nullptr );
+		return;
+	}
 
-	QString	key( path.left( pos2 ) );
-	for ( auto i = folderMap.find( key ); i != folderMap.end(); )
-		return i.value();
+	// A running filter is cancelled, and the current one is started when it has finished
+	if ( !filterThread )
+		launchFilter();
+}
 
-	qsizetype	i1 = path.lastIndexOf( QChar('/'), pos2 - 1 );
-	QStandardItem *	parent;
-	// Recurse through folders
-	if ( i1 > pos1 )
-		parent = insertFolder( path, pos1, i1, folderMap );
-	else
-		parent = invisibleRootItem();
-	QStandardItem *	folderItem = new QStandardItem( path.mid( i1 + 1, pos2 - ( i1 + 1 ) ) );
-	auto pathDummy = new QStandardItem();
-	auto sizeDummy = new QStandardItem();
+void BSAModel::launchFilter()
+{
+	std::uint64_t	generation = filterGeneration;
+	auto	result = std::make_shared<std::shared_ptr<FilterResult>>();
+	filterThread = QThread::create( [this, a = archive, text = filterText, nameOnly = filterByNameOnly, generation, result]() {
+		*result = runFilter( a, text, nameOnly, filterGeneration, generation );
+	} );
+	filterThread->setParent( this );
+	connect( filterThread, &QThread::finished, this, [this, generation, result]() {
+		filterThread->deleteLater();
+		filterThread = nullptr;
+		if ( generation == filterGeneration )
+			applyFilter( *result );
+		else if ( archive && !filterText.isEmpty() )
+			launchFilter();
+	} );
+	filterThread->start();
+}
 
-	parent->appendRow( { folderItem, pathDummy, sizeDummy } );
-	folderMap.insert( key, folderItem );
+std::shared_ptr<BSAModel::FilterResult> BSAModel::runFilter(
+	std::shared_ptr<const ArchiveIndex> archive, const QString & pattern, bool nameOnly,
+	const std::atomic<std::uint64_t> & generation, std::uint64_t expected )
+{
+	auto	cancelled = [&generation, expected]() {
+		return generation.load( std::memory_order_relaxed ) != expected;
+	};
+
+	const ArchiveIndex &	a = *archive;
+	auto	result = std::make_shared<FilterResult>();
+	result->files.assign( a.files.size(), 1 );
+	result->folders.assign( a.folders.size(), 0 );
+
+	QRegularExpression	re = QRegularExpression::fromWildcard( pattern, Qt::CaseInsensitive, QRegularExpression::UnanchoredWildcardConversion );
+	if ( !re.isValid() ) {
+		std::fill( result->files.begin(), result->files.end(), 0 );
+		return result;
+	}
+
+	// The literal parts of the pattern must each be found in a path component
+	std::vector<std::string>	literals;
+	bool	useIndex = true;
+	for ( QChar c : pattern )
+		useIndex &= ( c.unicode() < 128 && c != QChar( '[' ) && c != QChar( '\\' ) );
+	if ( useIndex ) {
+		std::string	s;
+		for ( QChar c : pattern.toLower() ) {
+			char	ch = char( c.unicode() );
+			if ( ch == '*' || ch == '?' || ch == '/' ) {
+				if ( !s.empty() )
+					literals.push_back( std::move( s ) );
+				s.clear();
+			} else {
+				s += ch;
+			}
+		}
+		if ( !s.empty() )
+			literals.push_back( std::move( s ) );
+	}
+
+	std::string	lowerPrefix( a.prefix );
+	std::transform( lowerPrefix.begin(), lowerPrefix.end(), lowerPrefix.begin(), []( char c ) {
+		return ( c >= 'A' && c <= 'Z' ? char( c + ( 'a' - 'A' ) ) : c );
+	} );
+
+	std::vector<std::uint8_t>	nameMatch( a.nameCount() );
+	std::vector<std::uint8_t>	folderMatch( a.folders.size() );
+	for ( const std::string & l : literals ) {
+		if ( cancelled() )
+			return nullptr;
+		std::fill( nameMatch.begin(), nameMatch.end(), 0 );
+		if ( l.length() >= 3 ) {
+			// Only check the names that contain the least common trigram of the literal
+			std::uint32_t	h = ArchiveIndex::trigramHash( l.data() );
+			for ( size_t i = 1; i + 3 <= l.length(); i++ ) {
+				std::uint32_t	h2 = ArchiveIndex::trigramHash( l.data() + i );
+				if ( a.trigramOffsets[h2 + 1] - a.trigramOffsets[h2] < a.trigramOffsets[h + 1] - a.trigramOffsets[h] )
+					h = h2;
+			}
+			for ( std::uint32_t i = a.trigramOffsets[h]; i < a.trigramOffsets[h + 1]; i++ ) {
+				std::uint32_t	n = a.trigramNames[i];
+				nameMatch[n] = std::uint8_t( a.lowerName( n ).find( l ) != std::string_view::npos );
+			}
+		} else {
+			for ( std::uint32_t n = 0; n < std::uint32_t( a.nameCount() ); n++ )
+				nameMatch[n] = std::uint8_t( a.lowerName( n ).find( l ) != std::string_view::npos );
+		}
+
+		if ( nameOnly ) {
+			for ( size_t f = 0; f < a.files.size(); f++ )
+				result->files[f] &= nameMatch[a.files[f].name];
+		} else {
+			// Parents are always before their subfolders
+			folderMatch[0] = std::uint8_t( lowerPrefix.find( l ) != std::string::npos );
+			for ( size_t f = 1; f < a.folders.size(); f++ )
+				folderMatch[f] = nameMatch[a.folders[f].name] | folderMatch[a.folders[f].parent];
+			for ( size_t f = 0; f < a.files.size(); f++ )
+				result->files[f] &= ( folderMatch[a.files[f].folder] | nameMatch[a.files[f].name] );
+		}
+	}
+
+	// Match the candidates against the full pattern
+	const size_t	chunkSize = 4096;
+	parallelFor( ( a.files.size() + chunkSize - 1 ) / chunkSize, [&]( size_t c ) {
+		if ( cancelled() )
+			return;
+		QRegularExpression	r( re.pattern(), re.patternOptions() );
+		size_t	end = std::min( ( c + 1 ) * chunkSize, a.files.size() );
+		for ( size_t f = c * chunkSize; f < end; f++ ) {
+			if ( !result->files[f] )
+				continue;
+
+			QString	key;
+			if ( nameOnly ) {
+				std::string_view	s = a.name( a.files[f].name );
+				key = QString::fromLatin1( s.data(), qsizetype( s.length() ) );
+			} else {
+				key = a.filePath( std::uint32_t( f ) );
+			}
+			result->files[f] = std::uint8_t( key.contains( r ) );
+		}
+	} );
+	if ( cancelled() )
+		return nullptr;
+
+	for ( size_t f = 0; f < a.files.size(); f++ ) {
+		if ( !result->files[f] )
+			continue;
+		result->matches++;
+		for ( std::uint32_t d = a.files[f].folder; !result->folders[d]; d = a.folders[d].parent ) {
+			result->folders[d] = 1;
+			if ( d == 0 )
+				break;
+		}
+	}
+
+	return result;
+}
+
+void BSAModel::applyFilter( std::shared_ptr<FilterResult> result )
+{
+	beginResetModel();
+	filter = std::move( result );
+	matchCount = ( filter ? filter->matches : ( archive ? int( archive->files.size() ) : 0 ) );
+	resetNodes();
+	endResetModel();
 
-	return folderItem;
+	emit filterFinished( matchCount );
 }
 
+void BSAModel::resetNodes()
+{
+	nodes.clear();
+	if ( archive )
+		nodes.push_back( TreeNode{ 0, 0, 0, false } );
+}
 
-BSAProxyModel::BSAProxyModel( QObject * parent )
-	: QSortFilterProxyModel( parent )
+const BSAModel::TreeNode & BSAModel::populate( std::uint32_t node ) const
 {
+	if ( nodes[node].populated || nodes[node].isFile )
+		return nodes[node];
+
+	// Subfolders first, then files
+	const ArchiveIndex::Folder &	folder = archive->folders[nodes[node].item];
+	std::vector<std::uint32_t>	children;
+	for ( std::uint32_t i = folder.firstFolder; i < folder.firstFolder + folder.folderCount; i++ ) {
+		if ( filter && !filter->folders[i] )
+			continue;
+		children.push_back( std::uint32_t( nodes.size() ) );
+		nodes.push_back( TreeNode{ node, std::uint32_t( children.size() - 1 ), i, false } );
+	}
+	for ( std::uint32_t i = folder.firstFile; i < folder.firstFile + folder.fileCount; i++ ) {
+		if ( filter && !filter->files[i] )
+			continue;
+		children.push_back( std::uint32_t( nodes.size() ) );
+		nodes.push_back( TreeNode{ node, std::uint32_t( children.size() - 1 ), i, true } );
+	}
 
+	sortChildren( children );
+	TreeNode &	n = nodes[node];
+	n.children = std::move( children );
+	n.populated = true;
+	return n;
 }
 
-void BSAProxyModel::setFiletypes( QStringList types )
+void BSAModel::sortChildren( std::vector<std::uint32_t> & children ) const
 {
-	filetypes = types;
+	// Folders and files are numbered in name order within their parent folder
+	std::sort( children.begin(), children.end(), [this]( std::uint32_t a, std::uint32_t b ) {
+		const TreeNode &	x = nodes[a];
+		const TreeNode &	y = nodes[b];
+		if ( x.isFile != y.isFile )
+			return y.isFile;
+		if ( sortColumn == 2 && x.isFile ) {
+			std::uint64_t	sizeX = archive->files[x.item].size;
+			std::uint64_t	sizeY = archive->files[y.item].size;
+			if ( sizeX != sizeY )
+				return ( sortOrder == Qt::AscendingOrder ? sizeX < sizeY : sizeX > sizeY );
+		}
+		return ( sortOrder == Qt::AscendingOrder ? x.item < y.item : x.item > y.item );
+	} );
+
+	for ( size_t i = 0; i < children.size(); i++ )
+		nodes[children[i]].row = std::uint32_t( i );
 }
 
-void BSAProxyModel::setFilterByNameOnly( bool nameOnly )
+void BSAModel::sort( int column, Qt::SortOrder order )
 {
-	filterByNameOnly = nameOnly;
+	if ( column == sortColumn && order == sortOrder )
+		return;
+
+	emit layoutAboutToBeChanged();
+	sortColumn = column;
+	sortOrder = order;
+
+	// Rows that have already been created keep their node, only their row number changes
+	for ( TreeNode & n : nodes ) {
+		if ( n.populated )
+			sortChildren( n.children );
+	}
+	QModelIndexList	oldIndexes = persistentIndexList();
+	QModelIndexList	newIndexes;
+	for ( const QModelIndex & i : oldIndexes )
+		newIndexes.append( createIndex( int( nodes[i.internalId()].row ), i.column(), i.internalId() ) );
+	changePersistentIndexList( oldIndexes, newIndexes );
 
-	setFilterRegularExpression( filterRegularExpression() );
+	emit layoutChanged();
 }
 
-void BSAProxyModel::resetFilter()
+QModelIndex BSAModel::index( int row, int column, const QModelIndex & parent ) const
 {
-	setFilterRegularExpression( QRegularExpression() );
+	if ( !archive || row < 0 || column < 0 || column >= 3 || parent.column() > 0 )
+		return QModelIndex();
+
+	const TreeNode &	p = populate( parent.isValid() ? std::uint32_t( parent.internalId() ) : 0 );
+	if ( size_t( row ) >= p.children.size() )
+		return QModelIndex();
+
+	return createIndex( row, column, quintptr( p.children[row] ) );
 }
 
-bool BSAProxyModel::filterAcceptsRow( int sourceRow, const QModelIndex & sourceParent ) const
+QModelIndex BSAModel::parent( const QModelIndex & child ) const
 {
-	if ( !filterRegularExpression().pattern().isEmpty() ) {
+	if ( !child.isValid() || !archive )
+		return QModelIndex();
 
-		QModelIndex sourceIndex0 = sourceModel()->index( sourceRow, 0, sourceParent );
-		QModelIndex sourceIndex1 = sourceModel()->index( sourceRow, 1, sourceParent );
-		if ( sourceIndex0.isValid() ) {
-			// If children match, parent matches
-			int c = sourceModel()->rowCount( sourceIndex0 );
-			for ( int i = 0; i < c; ++i ) {
-				if ( filterAcceptsRow( i, sourceIndex0 ) )
-					return true;
-			}
+	std::uint32_t	p = nodes[child.internalId()].parent;
+	if ( p == 0 )
+		return QModelIndex();
 
-			QString key0 = sourceModel()->data( sourceIndex0, filterRole() ).toString();
-			QString key1 = sourceModel()->data( sourceIndex1, filterRole() ).toString();
+	return createIndex( int( nodes[p].row ), 0, quintptr( p ) );
+}
 
-			bool typeMatch = true;
-			if ( filetypes.count() ) {
-				typeMatch = false;
-				for ( auto f : filetypes ) {
-					typeMatch |= key1.endsWith( f, Qt::CaseInsensitive );
-				}
-			}
+int BSAModel::rowCount( const QModelIndex & parent ) const
+{
+	if ( !archive || parent.column() > 0 )
+		return 0;
 
-			bool stringMatch = (filterByNameOnly) ? key0.contains( filterRegularExpression() ) : key1.contains( filterRegularExpression() );
+	return int( populate( parent.isValid() ? std::uint32_t( parent.internalId() ) : 0 ).children.size() );
+}
+
+int BSAModel::columnCount( const QModelIndex & parent ) const
+{
+	Q_UNUSED( parent );
+	return 3;
+}
 
-			return typeMatch && stringMatch;
+bool BSAModel::hasChildren( const QModelIndex & parent ) const
+{
+	if ( !archive || parent.column() > 0 )
+		return false;
+	if ( !parent.isValid() )
+		return rowCount() > 0;
+
+	// Folders are only listed if they contain matching files
+	return !nodes[parent.internalId()].isFile;
+}
+
+QVariant BSAModel::data( const QModelIndex & index, int role ) const
+{
+	if ( !index.isValid() || !archive || !( role == Qt::DisplayRole || role == Qt::EditRole ) )
+		return QVariant();
+
+	const TreeNode &	n = nodes[index.internalId()];
+	switch ( index.column() ) {
+	case 0:
+	{
+		std::string_view	s = archive->name( n.isFile ? archive->files[n.item].name : archive->folders[n.item].name );
+		return QString::fromLatin1( s.data(), qsizetype( s.length() ) );
+	}
+	case 1:
+		if ( n.isFile )
+			return archive->filePath( n.item );
+		break;
+	case 2:
+		if ( n.isFile ) {
+			qsizetype	bytes = qsizetype( archive->files[n.item].size );
+			return ( bytes > 1024 ) ? QString::number( bytes / 1024 ) + "KB" : QString::number( bytes ) + "B";
 		}
+		break;
 	}
 
-	return QSortFilterProxyModel::filterAcceptsRow( sourceRow, sourceParent );
+	return QString();
 }
 
-bool BSAProxyModel::lessThan( const QModelIndex & left, const QModelIndex & right ) const
+QVariant BSAModel::headerData( int section, Qt::Orientation orientation, int role ) const
 {
-	QString leftString = sourceModel()->data( left ).toString();
-	QString rightString = sourceModel()->data( right ).toString();
-
-	QModelIndex leftChild = QModelIndex_child( left );
-	QModelIndex rightChild = QModelIndex_child( right );
+	if ( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+		return QVariant();
+
+	switch ( section ) {
+	case 0:
+		return QString( "File" );
+	case 1:
+		return QString( "Path" );
+	case 2:
+		return QString( "Size" );
+	}
 
-	if ( !leftChild.isValid() && rightChild.isValid() )
-		return false;
+	return QVariant();
+}
 
-	if ( leftChild.isValid() && !rightChild.isValid() )
-		return true;
+Qt::ItemFlags BSAModel::flags( const QModelIndex & index ) const
+{
+	if ( !index.isValid() || !archive )
+		return Qt::NoItemFlags;
 
-	return leftString < rightString;
+	Qt::ItemFlags	f = Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+	if ( nodes[index.internalId()].isFile )
+		f |= Qt::ItemNeverHasChildren;
+	return f;
 }
@@ -35,54 +35,112 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "libfo76utils/src/ba2file.hpp"
 
-#include <QStandardItemModel>
-#include <QSortFilterProxyModel>
-#include <QHash>
-
-class BSAModel : public QStandardItemModel
+#include <QAbstractItemModel>
+#include <QString>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class QThread;
+
+
+//! \file bsamodel.h BSAModel
+
+/*! Model of the archive browser
+ *
+ * The file list is stored as a table of interned path components, with the subfolders
+ * and files of each folder sorted by name. Rows are only created when a view asks for
+ * the children of a folder, so listing a data folder with millions of files does not
+ * create an item per file.
+ *
+ * Filters are wildcard patterns matched against the full path or the file name. They are
+ * applied on a background thread, using a trigram index of the path components to find
+ * the candidate files before matching the pattern.
+ */
+class BSAModel final : public QAbstractItemModel
 {
 	Q_OBJECT
 
 public:
 	BSAModel( QObject * parent = nullptr );
+	~BSAModel();
 
-	void init();
-
-	Qt::ItemFlags flags( const QModelIndex & index ) const override;
+	//! Lists the files of \a bsa in \a folder and its subfolders, returns false if there are none
 	bool fillModel( const BA2File * bsa, const QString & folder );
-protected:
-	struct FileScanFuncData {
-		BSAModel * p;
-		const BA2File * bsa;
-		std::string path;
-		QHash< QString, QStandardItem * > folderMap;
-	};
-	static bool fileListScanFunction( void * p, const BA2File::FileInfo & fd );
-	QStandardItem * insertFolder( const QString & path, qsizetype pos1, qsizetype pos2, QHash< QString, QStandardItem * > & folderMap );
-};
-
-
-class BSAProxyModel : public QSortFilterProxyModel
-{
-	Q_OBJECT
-
-public:
-	BSAProxyModel( QObject * parent = nullptr );
-
-	void setFiletypes( QStringList types );
-
-	void resetFilter();
+	//! Removes all files
+	void clear();
+
+	//! Returns the number of files that match the current filter
+	int fileCount() const { return matchCount; }
+
+	QModelIndex index( int row, int column, const QModelIndex & parent = QModelIndex() ) const override;
+	QModelIndex parent( const QModelIndex & child ) const override;
+	int rowCount( const QModelIndex & parent = QModelIndex() ) const override;
+	int columnCount( const QModelIndex & parent = QModelIndex() ) const override;
+	bool hasChildren( const QModelIndex & parent = QModelIndex() ) const override;
+	QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const override;
+	QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const override;
+	Qt::ItemFlags flags( const QModelIndex & index ) const override;
+	//! Sorts the files of each folder by name or size, subfolders are always listed first
+	void sort( int column, Qt::SortOrder order = Qt::AscendingOrder ) override;
 
 public slots:
+	//! Shows only the files matching the wildcard pattern \a text, an empty pattern shows all files
+	void setFilter( const QString & text );
 	void setFilterByNameOnly( bool nameOnly );
 
+signals:
+	//! Emitted when a filter has been applied, with the number of matching files
+	void filterFinished( int matches );
+
 protected:
-	bool filterAcceptsRow( int sourceRow, const QModelIndex & sourceParent ) const;
-	bool lessThan( const QModelIndex & left, const QModelIndex & right ) const;
+	struct ArchiveIndex;
+	struct ArchiveScan;
+	struct FilterResult;
+
+	//! A row of the model, created when the children of its parent are first requested
+	struct TreeNode
+	{
+		std::uint32_t	parent;
+		std::uint32_t	row;
+		//! Index of the folder or file in ArchiveIndex
+		std::uint32_t	item;
+		bool	isFile;
+		bool	populated = false;
+		std::vector<std::uint32_t>	children;
+	};
 
-private:
-	QStringList filetypes;
-	bool filterByNameOnly = false;
+	static bool fileListScanFunction( void * p, const BA2File::FileInfo & fd );
+	//! Returns nullptr if \a generation no longer equals \a expected before the filter is finished
+	static std::shared_ptr<FilterResult> runFilter(
+		std::shared_ptr<const ArchiveIndex> archive, const QString & pattern, bool nameOnly,
+		const std::atomic<std::uint64_t> & generation, std::uint64_t expected );
+
+	void startFilter();
+	//! Runs the current filter on the worker thread
+	void launchFilter();
+	void applyFilter( std::shared_ptr<FilterResult> result );
+	void resetNodes();
+	const TreeNode & populate( std::uint32_t node ) const;
+	void sortChildren( std::vector<std::uint32_t> & children ) const;
+
+	std::shared_ptr<const ArchiveIndex>	archive;
+	std::shared_ptr<const FilterResult>	filter;
+	mutable std::vector<TreeNode>	nodes;
+
+	QString	filterText;
+	bool	filterByNameOnly = false;
+	//! Incremented for every filter, older filters are cancelled and their results discarded
+	std::atomic<std::uint64_t>	filterGeneration = 0;
+	//! Thread of the running filter, at most one filter runs at a time
+	QThread *	filterThread = nullptr;
+	int	matchCount = 0;
+
+	int	sortColumn = 0;
+	Qt::SortOrder	sortOrder = Qt::AscendingOrder;
 };
 
 #endif
@@ -327,6 +327,31 @@ bool GameManager::GameResources::get_file( QByteArray & data, const std::string_
 	return true;
 }
 
+bool GameManager::GameResources::extract_file(
+	QByteArray & data, const std::string_view & fullPath, QString * errorMessage )
+{
+	const BA2File::FileInfo *	fd = nullptr;
+	if ( ba2File )
+		fd = ba2File->findFile( fullPath );
+	if ( !fd ) {
+		if ( parent )
+			return parent->extract_file( data, fullPath, errorMessage );
+		if ( errorMessage )
+			*errorMessage = QString( "File '%1' not found in archives" ).arg( QLatin1String( fullPath.data(), qsizetype(fullPath.length()) ) );
+		data.resize( 0 );
+		return false;
+	}
+	try {
+		ba2File->extractFile( &data, &byteArrayAllocFunc, *fd );
+	} catch ( FO76UtilsError & e ) {
+		if ( errorMessage )
+			*errorMessage = QString( "Error loading resource file '%1': %2" ).arg( QLatin1String( fullPath.data(), qsizetype(fullPath.length()) ) ).arg( e.what() );
+		data.resize( 0 );
+		return false;
+	}
+	return true;
+}
+
 struct list_files_scan_function_data {
 	std::set< std::string_view > * fileSet;
 	bool (*filterFunc)( void * p, const std::string_view & fileName );
@@ -630,6 +655,14 @@ bool GameManager::get_file( QByteArray & data, const GameMode game, const std::s
 	return archives[game].get_file( data, fullPath );
 }
 
+bool GameManager::extract_file(
+	QByteArray & data, const GameMode game, const std::string_view & fullPath, QString * errorMessage )
+{
+	if ( !( game >= OTHER && game < NUM_GAMES ) )
+		return false;
+	return archives[game].extract_file( data, fullPath, errorMessage );
+}
+
 bool GameManager::get_file(
 	QByteArray & data, const GameMode game, const QString & path, const char * archiveFolder, const char * extension )
 {
@@ -105,6 +105,7 @@ public:
 		void close_materials();
 		QString find_file( const std::string_view & fullPath );
 		bool get_file( QByteArray & data, const std::string_view & fullPath );
+		bool extract_file( QByteArray & data, const std::string_view & fullPath, QString * errorMessage );
 		void list_files(
 			std::set< std::string_view > & fileSet,
 			bool (*fileListFilterFunc)( void * p, const std::string_view & fileName ), void * fileListFilterFuncData );
@@ -126,6 +127,10 @@ public:
 	static bool get_file(
 		QByteArray & data, const GameMode game,
 		const QString & path, const char * archiveFolder, const char * extension );
+	//! Load resource file 'fullPath' from the already opened archives and folders of 'game', without showing
+	// message boxes on errors. Unlike get_file(), this can be called from multiple threads after list_files().
+	static bool extract_file(
+		QByteArray & data, const GameMode game, const std::string_view & fullPath, QString * errorMessage = nullptr );
 	//! Return pointer to Starfield material database, loading it first if necessary.
 	// On error, nullptr is returned.
 	static CE2MaterialDB * materials( const GameMode game );
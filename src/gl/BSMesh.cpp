@@ -16,7 +16,7 @@ BSMesh::BSMesh(Scene* s, const QModelIndex& iBlock) : Shape(s, iBlock)
 {
 }
 
-void BSMesh::transformShapes()
+void BSMesh::transformShape()
 {
 	// TODO: implement this
 #if 0
@@ -23,7 +23,7 @@ public:
 
 	// Node
 
-	void transformShapes() override;
+	void transformShape() override;
 
 	void drawShapes( NodeList * secondPass = nullptr ) override;
 	void drawSelection() const override;
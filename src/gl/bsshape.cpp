@@ -179,7 +179,7 @@ QModelIndex BSShape::vertexAt( int idx ) const
 	return nif->getIndex( QModelIndex_child( nif->getIndex( blk, "Vertex Data" ), idx ), "Vertex" );
 }
 
-void BSShape::transformShapes()
+void BSShape::transformShape()
 {
 	if ( isHidden() )
 		return;
@@ -190,8 +190,6 @@ void BSShape::transformShapes()
 		return;
 	}
 
-	Node::transformShapes();
-
 	transformRigid = true;
 
 	if ( isSkinned && weights.count() && scene->hasOption(Scene::DoSkinning) ) {
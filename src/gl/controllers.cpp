@@ -38,6 +38,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "gl/glscene.h"
 #include "model/nifmodel.h"
 #include "qtcompat.h"
+#include "libfo76utils/src/fp32vec8.hpp"
+
+#include <algorithm>
+#include <cmath>
+
 
 // `NiControllerManager` blocks
 
@@ -538,21 +543,62 @@ bool UVController::update( const NifModel * nif, const QModelIndex & index )
 }
 
 
-float random( float r )
+// `NiParticleSystemController` and other blocks
+
+void ParticleController::ParticleArrays::clear()
 {
-	return r * rand() / RAND_MAX;
+	for ( int k = 0; k < 3; k++ ) {
+		position[k].clear();
+		velocity[k].clear();
+	}
+	lifetime.clear();
+	lifespan.clear();
+	lasttime.clear();
+	step.clear();
+	vertex.clear();
+	count = 0;
 }
 
-Vector3 random( Vector3 v )
+size_t ParticleController::ParticleArrays::append()
 {
-	v[0] *= random( 1.0 );
-	v[1] *= random( 1.0 );
-	v[2] *= random( 1.0 );
-	return v;
-}
+	if ( count >= padded() ) {
+		size_t n = padded() + 8;
+		for ( int k = 0; k < 3; k++ ) {
+			position[k].resize( n, 0.0f );
+			velocity[k].resize( n, 0.0f );
+		}
+		lifetime.resize( n, 0.0f );
+		lifespan.resize( n, 0.0f );
+		lasttime.resize( n, 0.0f );
+		step.resize( n, 0.0f );
+		vertex.resize( n, 0 );
+	}
 
+	size_t i = count++;
+	for ( int k = 0; k < 3; k++ ) {
+		position[k][i] = 0.0f;
+		velocity[k][i] = 0.0f;
+	}
+	lifetime[i] = 0.0f;
+	lifespan[i] = 0.0f;
+	lasttime[i] = 0.0f;
+	step[i] = 0.0f;
+	vertex[i] = 0;
+	return i;
+}
 
-// `NiParticleSystemController` and other blocks
+void ParticleController::ParticleArrays::move( size_t to, size_t from )
+{
+	for ( int k = 0; k < 3; k++ ) {
+		position[k][to] = position[k][from];
+		velocity[k][to] = velocity[k][from];
+	}
+	lifetime[to] = lifetime[from];
+	lifespan[to] = lifespan[from];
+	lasttime[to] = lasttime[from];
+	step[to] = step[from];
+	vertex[to] = vertex[from];
+}
 
 ParticleController::ParticleController( Particles * particles, const QModelIndex & index )
 	: Controller( index ), target( particles )
@@ -589,7 +635,10 @@ bool ParticleController::update( const NifModel * nif, const QModelIndex & index
 		grow = 0.0;
 		fade = 0.0;
 
-		list.clear();
+		// Restart the random sequence, so that the same particles are emitted after every reset
+		rng.seed( std::minstd_rand::result_type( 0x4E69462Bu + std::uint32_t( nif->getBlockNumber( iBlock ) ) ) );
+
+		particles.clear();
 
 		QModelIndex iParticles = nif->getIndex( iBlock, "Particles" );
 
@@ -597,21 +646,19 @@ bool ParticleController::update( const NifModel * nif, const QModelIndex & index
 			emitMax = nif->get<int>( iBlock, "Num Particles" );
 			int numValid = nif->get<int>( iBlock, "Num Valid" );
 
-			//iParticles = nif->getIndex( iParticles, "Particles" );
-			//if ( iParticles.isValid() )
-			//{
 			for ( int p = 0; p < numValid && p < nif->rowCount( iParticles ); p++ ) {
-				Particle particle;
-				particle.velocity = nif->get<Vector3>( QModelIndex_child( iParticles, p ), "Velocity" );
-				particle.lifetime = nif->get<float>( QModelIndex_child( iParticles, p ), "Age" );
-				particle.lifespan = nif->get<float>( QModelIndex_child( iParticles, p ), "Life Span" );
-				particle.lasttime = nif->get<float>( QModelIndex_child( iParticles, p ), "Last Update" );
-				particle.vertex = nif->get<int>( QModelIndex_child( iParticles, p ), "Code" );
+				QModelIndex iParticle = QModelIndex_child( iParticles, p );
+				Vector3 velocity = nif->get<Vector3>( iParticle, "Velocity" );
+
 				// Display saved particle start on initial load
-				list.append( particle );
+				size_t n = particles.append();
+				for ( int k = 0; k < 3; k++ )
+					particles.velocity[k][n] = velocity[k];
+				particles.lifetime[n] = nif->get<float>( iParticle, "Age" );
+				particles.lifespan[n] = nif->get<float>( iParticle, "Life Span" );
+				particles.lasttime[n] = nif->get<float>( iParticle, "Last Update" );
+				particles.vertex[n] = nif->get<int>( iParticle, "Code" );
 			}
-
-			//}
 		}
 
 		if ( nif->get<bool>( iBlock, "Use Birth Rate" ) == 0 ) {
@@ -621,6 +668,7 @@ bool ParticleController::update( const NifModel * nif, const QModelIndex & index
 		iExtras.clear();
 		grav.clear();
 		iColorKeys = QModelIndex();
+		iColorData = QModelIndex();
 		QModelIndex iExtra = nif->getBlockIndex( nif->getLink( iBlock, "Particle Modifier" ) );
 
 		while ( iExtra.isValid() ) {
@@ -632,7 +680,8 @@ bool ParticleController::update( const NifModel * nif, const QModelIndex & index
 				grow = nif->get<float>( iExtra, "Grow" );
 				fade = nif->get<float>( iExtra, "Fade" );
 			} else if ( name == "NiParticleColorModifier" ) {
-				iColorKeys = nif->getIndex( nif->getBlockIndex( nif->getLink( iExtra, "Color Data" ), "NiColorData" ), "Data" );
+				iColorData = nif->getBlockIndex( nif->getLink( iExtra, "Color Data" ), "NiColorData" );
+				iColorKeys = nif->getIndex( iColorData, "Data" );
 			} else if ( name == "NiGravity" ) {
 				Gravity g;
 				g.force = nif->get<float>( iExtra, "Force" );
@@ -645,42 +694,95 @@ bool ParticleController::update( const NifModel * nif, const QModelIndex & index
 			iExtra = nif->getBlockIndex( nif->getLink( iExtra, "Next Modifier" ) );
 		}
 
+		bakeColors();
+
+		return true;
+	}
+
+	if ( index.isValid() && iColorData.isValid() && nif->getBlockNumber( index ) == nif->getBlockNumber( iColorData ) ) {
+		bakeColors();
 		return true;
 	}
 
 	return false;
 }
 
-void ParticleController::updateTime( float time )
+void ParticleController::bakeColors()
 {
-	if ( !(target && active) )
+	colorCurve.clear();
+	if ( !iColorKeys.isValid() )
 		return;
 
-	localtime = ctrlTime( time );
+	colorCurve.resize( colorCurveSize + 1 );
+	int last = 0;
+	for ( int i = 0; i <= colorCurveSize; i++ ) {
+		if ( !interpolate( colorCurve[i], iColorKeys, float( i ) / float( colorCurveSize ), last ) ) {
+			colorCurve.clear();
+			return;
+		}
+	}
+}
 
-	int n = 0;
+Particles * ParticleController::particleTarget() const
+{
+	return target;
+}
 
-	while ( n < list.count() ) {
-		Particle & p = list[n];
+size_t ParticleController::particleCapacity() const
+{
+	return ( target ? size_t( target->verts.count() ) : 0 );
+}
+
+void ParticleController::updateTime( float time )
+{
+	if ( !(target && active) )
+		return;
 
-		float deltaTime = (localtime > p.lasttime ? localtime - p.lasttime : 0); //( stop - start ) - p.lasttime + localtime );
+	localtime = ctrlTime( time );
 
-		p.lifetime += deltaTime;
+	// The world transforms are calculated on demand, which is only safe on the main thread
+	emitting = ( emitNode && emitNode->isVisible() && localtime >= emitStart && localtime <= emitStop );
+	if ( emitting ) {
+		Matrix r = target->worldTrans().rotation.inverted();
+		emitOffset = r * (emitNode->worldTrans().translation - target->worldTrans().translation);
+		emitRotation = r * emitNode->worldTrans().rotation;
+	}
 
-		if ( p.lifetime < p.lifespan && p.vertex < target->verts.count() ) {
-			p.position = target->verts[p.vertex];
+	target->scene->addParticleSimulation( this );
+}
 
-			for ( int i = 0; i < 4; i++ )
-				moveParticle( p, deltaTime / 4 );
+void ParticleController::simulate()
+{
+	if ( !target )
+		return;
 
-			p.lasttime = localtime;
-			n++;
-		} else {
-			list.remove( n );
-		}
+	size_t numVerts = size_t( target->verts.count() );
+	Vector3 * verts = target->verts.data();
+
+	// Age the particles, and remove the ones that expired or have no vertex
+	size_t n = 0;
+	for ( size_t i = 0; i < particles.count; i++ ) {
+		float deltaTime = (localtime > particles.lasttime[i] ? localtime - particles.lasttime[i] : 0);
+		particles.lifetime[i] += deltaTime;
+
+		size_t v = size_t( particles.vertex[i] );
+		if ( !( particles.lifetime[i] < particles.lifespan[i] && v < numVerts ) )
+			continue;
+
+		if ( n != i )
+			particles.move( n, i );
+		for ( int k = 0; k < 3; k++ )
+			particles.position[k][n] = verts[v][k];
+		particles.step[n] = deltaTime / 4;
+		particles.lasttime[n] = localtime;
+		n++;
 	}
+	particles.count = n;
+	std::fill( particles.step.begin() + n, particles.step.end(), 0.0f );
+
+	moveParticles();
 
-	if ( emitNode && emitNode->isVisible() && localtime >= emitStart && localtime <= emitStop ) {
+	if ( emitting ) {
 		float emitDelta = (localtime > emitLast ? localtime - emitLast : 0);
 		emitLast = localtime;
 
@@ -691,90 +793,144 @@ void ParticleController::updateTime( float time )
 		if ( num > 0 ) {
 			emitAccu -= num;
 
-			while ( num-- > 0 && list.count() < target->verts.count() ) {
-				Particle p;
-				startParticle( p );
-				list.append( p );
-			}
+			while ( num-- > 0 && particles.count < numVerts )
+				startParticle( particles.append() );
 		}
 	}
 
-	n = 0;
-
-	while ( n < list.count() ) {
-		Particle & p = list[n];
-		p.vertex = n;
-		target->verts[n] = p.position;
+	n = particles.count;
+	for ( size_t i = 0; i < n; i++ ) {
+		particles.vertex[i] = int( i );
+		verts[i] = Vector3( particles.position[0][i], particles.position[1][i], particles.position[2][i] );
+	}
 
-		if ( n < target->sizes.count() )
-			sizeParticle( p, target->sizes[n] );
+	sizeParticles( target->sizes.data(), std::min( n, size_t( target->sizes.count() ) ) );
+	colorParticles( target->colors.data(), std::min( n, size_t( target->colors.count() ) ) );
 
-		if ( n < target->colors.count() )
-			colorParticle( p, target->colors[n] );
+	target->active = int( n );
+	target->size = size;
+}
 
-		n++;
-	}
+float ParticleController::random( float r )
+{
+	return r * float( rng() - std::minstd_rand::min() ) / float( std::minstd_rand::max() - std::minstd_rand::min() );
+}
 
-	target->active = list.count();
-	target->size = size;
+Vector3 ParticleController::random( Vector3 v )
+{
+	v[0] *= random( 1.0 );
+	v[1] *= random( 1.0 );
+	v[2] *= random( 1.0 );
+	return v;
 }
 
-void ParticleController::startParticle( Particle & p )
+void ParticleController::startParticle( size_t n )
 {
-	p.position = random( emitRadius * 2 ) - emitRadius;
-	p.position += target->worldTrans().rotation.inverted() * (emitNode->worldTrans().translation - target->worldTrans().translation);
+	Vector3 position = random( emitRadius * 2 ) - emitRadius;
+	position += emitOffset;
 
 	float i = inc + random( incRnd );
 	float d = dec + random( decRnd );
 
-	p.velocity = Vector3( rand() & 1 ? sin( i ) : -sin( i ), 0, cos( i ) );
+	Vector3 velocity = Vector3( rng() & 1 ? sin( i ) : -sin( i ), 0, cos( i ) );
 
-	Matrix m; m.fromEuler( 0, 0, rand() & 1 ? d : -d );
-	p.velocity = m * p.velocity;
+	Matrix m; m.fromEuler( 0, 0, rng() & 1 ? d : -d );
+	velocity = m * velocity;
 
-	p.velocity = p.velocity * (spd + random( spdRnd ));
-	p.velocity = target->worldTrans().rotation.inverted() * emitNode->worldTrans().rotation * p.velocity;
+	velocity = velocity * (spd + random( spdRnd ));
+	velocity = emitRotation * velocity;
 
-	p.lifetime = 0;
-	p.lifespan = ttl + random( ttlRnd );
-	p.lasttime = localtime;
+	for ( int k = 0; k < 3; k++ ) {
+		particles.position[k][n] = position[k];
+		particles.velocity[k][n] = velocity[k];
+	}
+	particles.lifetime[n] = 0;
+	particles.lifespan[n] = ttl + random( ttlRnd );
+	particles.lasttime[n] = localtime;
 }
 
-void ParticleController::moveParticle( Particle & p, float deltaTime )
+void ParticleController::moveParticles()
 {
-	for ( Gravity g : grav ) {
-		switch ( g.type ) {
-		case 0:
-			p.velocity += g.direction * (g.force * deltaTime);
-			break;
-		case 1:
-		{
-			Vector3 dir = (g.position - p.position);
-			dir.normalize();
-			p.velocity += dir * (g.force * deltaTime);
+	for ( size_t i = 0; i < particles.padded(); i += 8 ) {
+		FloatVector8 p[3], v[3];
+		for ( int k = 0; k < 3; k++ ) {
+			p[k] = FloatVector8( particles.position[k].data() + i );
+			v[k] = FloatVector8( particles.velocity[k].data() + i );
 		}
-		break;
+		FloatVector8 h( particles.step.data() + i );
+
+		for ( int s = 0; s < 4; s++ ) {
+			for ( const Gravity & g : grav ) {
+				FloatVector8 a = h * g.force;
+				switch ( g.type ) {
+				case 0:
+					for ( int k = 0; k < 3; k++ )
+						v[k] += a * g.direction[k];
+					break;
+				case 1:
+				{
+					float d[3][8];
+					for ( int k = 0; k < 3; k++ )
+						( FloatVector8( g.position[k] ) - p[k] ).convertToFloats( d[k] );
+					for ( int j = 0; j < 8; j++ ) {
+						float l = std::sqrt( d[0][j] * d[0][j] + d[1][j] * d[1][j] + d[2][j] * d[2][j] );
+						if ( l > 0.0f ) {
+							for ( int k = 0; k < 3; k++ )
+								d[k][j] /= l;
+						}
+					}
+					for ( int k = 0; k < 3; k++ )
+						v[k] += FloatVector8( d[k] ) * a;
+				}
+				break;
+				}
+			}
+			for ( int k = 0; k < 3; k++ )
+				p[k] += v[k] * h;
+		}
+
+		for ( int k = 0; k < 3; k++ ) {
+			p[k].convertToFloats( particles.position[k].data() + i );
+			v[k].convertToFloats( particles.velocity[k].data() + i );
 		}
 	}
-	p.position += p.velocity * deltaTime;
 }
 
-void ParticleController::sizeParticle( Particle & p, float & sz )
+void ParticleController::sizeParticles( float * sizes, size_t n ) const
 {
-	sz = 1.0;
+	const float * lifetime = particles.lifetime.data();
+	const float * lifespan = particles.lifespan.data();
+
+	for ( size_t i = 0; i < n; i++ )
+		sizes[i] = 1.0f;
 
-	if ( grow > 0 && p.lifetime < grow )
-		sz *= p.lifetime / grow;
+	if ( grow > 0 ) {
+		for ( size_t i = 0; i < n; i++ )
+			sizes[i] *= std::min( lifetime[i] / grow, 1.0f );
+	}
 
-	if ( fade > 0 && p.lifespan - p.lifetime < fade )
-		sz *= (p.lifespan - p.lifetime) / fade;
+	if ( fade > 0 ) {
+		for ( size_t i = 0; i < n; i++ )
+			sizes[i] *= std::min( (lifespan[i] - lifetime[i]) / fade, 1.0f );
+	}
 }
 
-void ParticleController::colorParticle( Particle & p, Color4 & color )
+void ParticleController::colorParticles( Color4 * colors, size_t n ) const
 {
-	if ( iColorKeys.isValid() ) {
-		int i = 0;
-		interpolate( color, iColorKeys, p.lifetime / p.lifespan, i );
+	if ( colorCurve.empty() )
+		return;
+
+	for ( size_t i = 0; i < n; i++ ) {
+		// Particles with a life span of 0 use the color at the end of the curve
+		float t = 1.0f;
+		if ( particles.lifespan[i] > 0.0f ) {
+			t = particles.lifetime[i] / particles.lifespan[i];
+			t = ( t > 0.0f ? std::min( t, 1.0f ) : 0.0f );
+		}
+		t *= float( colorCurveSize );
+		int k = std::clamp( int( t ), 0, colorCurveSize - 1 );
+		float f = std::clamp( t - float( k ), 0.0f, 1.0f );
+		colors[i] = colorCurve[k] * ( 1.0f - f ) + colorCurve[k + 1] * f;
 	}
 }
 
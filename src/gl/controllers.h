@@ -38,6 +38,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QPointer>
 
+#include <random>
+#include <vector>
+
 
 //! @file controllers.h Controller subclasses
 
@@ -179,25 +182,37 @@ protected:
 
 class Particles;
 
-//! Controller for `NiParticleSystemController` and other blocks
+/*! Controller for `NiParticleSystemController` and `NiBSPArrayController` blocks
+ *
+ * The particles are stored as separate arrays of floats, and moved 8 at a time. updateTime()
+ * only places the emitter, the simulation is run by Scene::transform() with the particles of
+ * other controllers on multiple threads. Random numbers are generated from a seed that depends
+ * only on the block number, so the same file always plays back the same way.
+ */
 class ParticleController final : public Controller
 {
-	struct Particle
+	//! Particle attributes, with room for a multiple of 8 particles
+	struct ParticleArrays
 	{
-		Vector3 position;
-		Vector3 velocity;
-		Vector3 unknown;
-		float lifetime = 0;
-		float lifespan = 0;
-		float lasttime = 0;
-		short y = 0;
-		short vertex = 0;
-
-		Particle()
-		{
-		}
-	};
-	QVector<Particle> list;
+		std::vector<float>	position[3];
+		std::vector<float>	velocity[3];
+		std::vector<float>	lifetime;
+		std::vector<float>	lifespan;
+		std::vector<float>	lasttime;
+		//! Time step of the current frame divided by the number of sub-steps, 0 for unused elements
+		std::vector<float>	step;
+		std::vector<int>	vertex;
+		size_t	count = 0;
+
+		//! Returns the size of the arrays, count rounded up to a multiple of 8
+		size_t padded() const { return lifetime.size(); }
+		void clear();
+		//! Adds a particle with all attributes set to 0, and returns its index
+		size_t append();
+		//! Copies particle \a from to \a to
+		void move( size_t to, size_t from );
+	} particles;
+
 	struct Gravity
 	{
 		float force;
@@ -213,6 +228,11 @@ class ParticleController final : public Controller
 	QPointer<Node> emitNode;
 	Vector3 emitRadius;
 
+	//! Emitter position and rotation relative to the target, set by updateTime()
+	bool emitting = false;
+	Vector3 emitOffset;
+	Matrix emitRotation;
+
 	float spd = 0, spdRnd = 0;
 	float ttl = 0, ttlRnd = 0;
 
@@ -227,6 +247,13 @@ class ParticleController final : public Controller
 
 	QList<QPersistentModelIndex> iExtras;
 	QPersistentModelIndex iColorKeys;
+	QPersistentModelIndex iColorData;
+
+	//! Colors sampled from iColorKeys at colorCurveSize + 1 evenly spaced points of the particle life
+	std::vector<Color4> colorCurve;
+	static constexpr int colorCurveSize = 256;
+
+	std::minstd_rand rng;
 
 public:
 	ParticleController( Particles * particles, const QModelIndex & index );
@@ -235,13 +262,29 @@ public:
 
 	void updateTime( float time ) override final;
 
-	void startParticle( Particle & p );
+	//! Moves, emits and removes particles for the time set by updateTime(), called by Scene::transform()
+	void simulate();
+
+	Particles * particleTarget() const;
+
+	//! Returns the largest number of particles of the target, used as the cost of simulate()
+	size_t particleCapacity() const;
+
+protected:
+	void bakeColors();
+
+	void startParticle( size_t n );
+
+	void moveParticles();
 
-	void moveParticle( Particle & p, float deltaTime );
+	void sizeParticles( float * sizes, size_t n ) const;
 
-	void sizeParticle( Particle & p, float & size );
+	void colorParticles( Color4 * colors, size_t n ) const;
 
-	void colorParticle( Particle & p, Color4 & color );
+	//! Returns a random number between 0 and \a r
+	float random( float r );
+	//! Returns a vector with each component scaled by a random number between 0 and 1
+	Vector3 random( Vector3 v );
 };
 
 
@@ -36,6 +36,13 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "model/nifmodel.h"
 #include "qtcompat.h"
 
+#include "libfo76utils/src/fp32vec8.hpp"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
 //! @file glcontroller.cpp Controllable management, Interpolation management
 
 /*
@@ -69,6 +76,12 @@ void IControllable::clear()
 	controllers.clear();
 }
 
+void IControllable::clearKeyTracks()
+{
+	for ( Controller * ctrl : controllers )
+		ctrl->clearKeyTracks( nullptr, QModelIndex() );
+}
+
 Controller * IControllable::findController( const QString & ctrltype, const QString & var1, const QString & var2 )
 {
 	Q_UNUSED( var2 ); Q_UNUSED( var1 );
@@ -217,6 +230,9 @@ void Controller::setInterpolator( const QModelIndex & index )
 
 bool Controller::update( const NifModel * nif, const QModelIndex & index )
 {
+	if ( !keyTracks.empty() )
+		clearKeyTracks( nif, index );
+
 	if ( index == iBlock && iBlock.isValid() ) {
 		start = nif->get<float>( index, "Start Time" );
 		stop  = nif->get<float>( index, "Stop Time" );
@@ -371,93 +387,300 @@ bool Controller::timeIndex( float time, const NifModel * nif, const QModelIndex
 	return false;
 }
 
-template <typename T> bool interpolate( T & value, const QModelIndex & array, float time, int & last )
+bool KeyTrackBase::timeIndex( float time, int & i, int & j, float & x ) const
 {
-	auto nif = NifModel::fromValidIndex(array);
-	if ( nif ) {
-		QModelIndex frames = nif->getIndex( array, "Keys" );
-		int next;
-		float x;
+	int count = int( times.size() );
+
+	if ( count < 1 )
+		return false;
 
-		if ( Controller::timeIndex( time, nif, frames, last, next, x ) ) {
-			T v1 = nif->get<T>( QModelIndex_child( frames, last ), "Value" );
-			T v2 = nif->get<T>( QModelIndex_child( frames, next ), "Value" );
+	x = 0.0;
 
-			switch ( nif->get<int>( array, "Interpolation" ) ) {
+	if ( time <= times.front() ) {
+		i = j = 0;
+		return true;
+	}
 
-			case 2:
-			{
-				// Quadratic
-				/*
-					In general, for keyframe values v1 = 0, v2 = 1 it appears that
-					setting v1's corresponding "Backward" value to 1 and v2's
-					corresponding "Forward" to 1 results in a linear interpolation.
-				*/
+	if ( time >= times.back() ) {
+		i = j = count - 1;
+		return true;
+	}
 
-				// Tangent 1
-				T t1 = nif->get<T>( QModelIndex_child( frames, last ), "Backward" );
-				// Tangent 2
-				T t2 = nif->get<T>( QModelIndex_child( frames, next ), "Forward" );
+	// Try the previous interval and the one after it before searching
+	if ( !( i >= 0 && i < count - 1 && times[i] <= time && time < times[i + 1] ) ) {
+		if ( i >= 0 && i < count - 2 && times[i + 1] <= time && time < times[i + 2] )
+			i++;
+		else
+			i = int( std::upper_bound( times.begin(), times.end(), time ) - times.begin() ) - 1;
 
-				float x2 = x * x;
-				float x3 = x2 * x;
+		i = std::clamp( i, 0, count - 2 );
+	}
 
-				// Cubic Hermite spline
-				//	x(t) = (2t^3 - 3t^2 + 1)P1  + (-2t^3 + 3t^2)P2 + (t^3 - 2t^2 + t)T1 + (t^3 - t^2)T2
+	j = i + 1;
 
-				value = v1 * (2.0f * x3 - 3.0f * x2 + 1.0f) + v2 * (-2.0f * x3 + 3.0f * x2) + t1 * (x3 - 2.0f * x2 + x) + t2 * (x3 - x2);
+	float d = times[j] - times[i];
+	if ( d > 0.0f )
+		x = ( time - times[i] ) / d;
 
-			}	return true;
+	return true;
+}
 
-			case 5:
-				// Constant
-				if ( x < 0.5 )
-					value = v1;
-				else
-					value = v2;
+//! Key times, values and tangents of a "Keys" array
+template <typename T> class KeyTrack final : public KeyTrackBase
+{
+public:
+	void read( const NifModel * nif, const NifItem * group );
+	bool interpolate( T & value, float time, int & last ) const;
 
-				return true;
-			default:
-				value = v1 + ( v2 - v1 ) * x;
-				return true;
-			}
+	std::vector<T>	values;
+	std::vector<T>	forward;
+	std::vector<T>	backward;
+};
+
+template <typename T> void KeyTrack<T>::read( const NifModel * nif, const NifItem * group )
+{
+	interpolation = nif->get<int>( group, "Interpolation" );
+
+	const NifItem * keys = nif->getItem( group, "Keys" );
+	int count = ( keys ? keys->childCount() : 0 );
+	bool quadratic = ( interpolation == 2 );
+
+	times.resize( count );
+	values.resize( count );
+	if ( quadratic ) {
+		forward.resize( count );
+		backward.resize( count );
+	}
+
+	for ( int n = 0; n < count; n++ ) {
+		const NifItem * key = keys->child( n );
+		times[n] = nif->get<float>( key, "Time" );
+		values[n] = nif->get<T>( key, "Value" );
+		if ( quadratic ) {
+			forward[n] = nif->get<T>( key, "Forward" );
+			backward[n] = nif->get<T>( key, "Backward" );
 		}
 	}
+}
 
-	return false;
+template <typename T> bool KeyTrack<T>::interpolate( T & value, float time, int & last ) const
+{
+	int next;
+	float x;
+
+	if ( !timeIndex( time, last, next, x ) )
+		return false;
+
+	const T & v1 = values[last];
+	const T & v2 = values[next];
+
+	switch ( interpolation ) {
+
+	case 2:
+	{
+		// Quadratic
+		/*
+			In general, for keyframe values v1 = 0, v2 = 1 it appears that
+			setting v1's corresponding "Backward" value to 1 and v2's
+			corresponding "Forward" to 1 results in a linear interpolation.
+		*/
+
+		// Tangent 1
+		const T & t1 = backward[last];
+		// Tangent 2
+		const T & t2 = forward[next];
+
+		float x2 = x * x;
+		float x3 = x2 * x;
+
+		// Cubic Hermite spline
+		//	x(t) = (2t^3 - 3t^2 + 1)P1  + (-2t^3 + 3t^2)P2 + (t^3 - 2t^2 + t)T1 + (t^3 - t^2)T2
+
+		value = v1 * (2.0f * x3 - 3.0f * x2 + 1.0f) + v2 * (-2.0f * x3 + 3.0f * x2) + t1 * (x3 - 2.0f * x2 + x) + t2 * (x3 - x2);
+
+	}	return true;
+
+	case 5:
+		// Constant
+		if ( x < 0.5 )
+			value = v1;
+		else
+			value = v2;
+
+		return true;
+	default:
+		value = v1 + ( v2 - v1 ) * x;
+		return true;
+	}
+}
+
+//! Boolean keys, stored as integers
+class BoolKeyTrack final : public KeyTrackBase
+{
+public:
+	void read( const NifModel * nif, const NifItem * group )
+	{
+		interpolation = nif->get<int>( group, "Interpolation" );
+
+		const NifItem * keys = nif->getItem( group, "Keys" );
+		int count = ( keys ? keys->childCount() : 0 );
+
+		times.resize( count );
+		values.resize( count );
+		for ( int n = 0; n < count; n++ ) {
+			const NifItem * key = keys->child( n );
+			times[n] = nif->get<float>( key, "Time" );
+			values[n] = nif->get<int>( key, "Value" );
+		}
+	}
+
+	std::vector<int>	values;
+};
+
+//! Quaternion keys, or XYZ rotations with one float track per axis if the rotation type is 4
+class RotationKeyTrack final : public KeyTrackBase
+{
+public:
+	void read( const NifModel * nif, const NifItem * data );
+	bool interpolate( Matrix & value, float time, int & last ) const;
+
+	int	rotationType = 0;
+	int	axisCount = -1;
+	std::vector<Quat>	quats;
+	KeyTrack<float>	axes[3];
+};
+
+void RotationKeyTrack::read( const NifModel * nif, const NifItem * data )
+{
+	rotationType = nif->get<int>( data, "Rotation Type" );
+
+	if ( rotationType == 4 ) {
+		const NifItem * subkeys = nif->getItem( data, "XYZ Rotations" );
+		if ( subkeys ) {
+			axisCount = std::min( subkeys->childCount(), 3 );
+			for ( int s = 0; s < axisCount; s++ )
+				axes[s].read( nif, subkeys->child( s ) );
+		}
+		return;
+	}
+
+	const NifItem * keys = nif->getItem( data, "Quaternion Keys" );
+	int count = ( keys ? keys->childCount() : 0 );
+
+	times.resize( count );
+	quats.resize( count );
+	for ( int n = 0; n < count; n++ ) {
+		const NifItem * key = keys->child( n );
+		times[n] = nif->get<float>( key, "Time" );
+		quats[n] = nif->get<Quat>( key, "Value" );
+	}
+}
+
+bool RotationKeyTrack::interpolate( Matrix & value, float time, int & last ) const
+{
+	if ( rotationType == 4 ) {
+		if ( axisCount < 0 )
+			return false;
+
+		float r[3] = {};
+
+		for ( int s = 0; s < axisCount; s++ )
+			axes[s].interpolate( r[s], time, last );
+
+		value = Matrix::euler( 0, 0, r[2] ) * Matrix::euler( 0, r[1], 0 ) * Matrix::euler( r[0], 0, 0 );
+
+		return true;
+	}
+
+	int next;
+	float x;
+
+	if ( !timeIndex( time, last, next, x ) )
+		return false;
+
+	Quat v1 = quats[last];
+	const Quat & v2 = quats[next];
+
+	if ( Quat::dotproduct( v1, v2 ) < 0 )
+		v1.negate(); // don't take the long path
+
+	value.fromQuat( Quat::slerp( x, v1, v2 ) );
+
+	return true;
+}
+
+template <typename Track> const Track * Controller::keyTrack( const NifModel * nif, const QModelIndex & array )
+{
+	std::unique_ptr<KeyTrackBase> & t = keyTracks[QPersistentModelIndex( array )];
+	const Track * track = dynamic_cast<const Track *>( t.get() );
+	if ( track )
+		return track;
+
+	auto newTrack = std::make_unique<Track>();
+	newTrack->array = array;
+	newTrack->block = nif->getBlockNumber( array );
+
+	const NifItem * item = nif->getItem( array, false );
+	if ( item )
+		newTrack->read( nif, item );
+
+	track = newTrack.get();
+	t = std::move( newTrack );
+
+	return track;
+}
+
+void Controller::clearKeyTracks( const NifModel * nif, const QModelIndex & index )
+{
+	if ( !index.isValid() ) {
+		keyTracks.clear();
+		return;
+	}
+
+	int block = nif->getBlockNumber( index );
+
+	for ( auto it = keyTracks.begin(); it != keyTracks.end(); ) {
+		if ( it->second->block == block || !it->second->array.isValid() )
+			it = keyTracks.erase( it );
+		else
+			it++;
+	}
 }
 
 template <> bool Controller::interpolate( float & value, const QModelIndex & array, float time, int & last )
 {
-	return ::interpolate( value, array, time, last );
+	auto nif = NifModel::fromValidIndex( array );
+	return nif && keyTrack<KeyTrack<float>>( nif, array )->interpolate( value, time, last );
 }
 
 template <> bool Controller::interpolate( Vector3 & value, const QModelIndex & array, float time, int & last )
 {
-	return ::interpolate( value, array, time, last );
+	auto nif = NifModel::fromValidIndex( array );
+	return nif && keyTrack<KeyTrack<Vector3>>( nif, array )->interpolate( value, time, last );
 }
 
 template <> bool Controller::interpolate( Color4 & value, const QModelIndex & array, float time, int & last )
 {
-	return ::interpolate( value, array, time, last );
+	auto nif = NifModel::fromValidIndex( array );
+	return nif && keyTrack<KeyTrack<Color4>>( nif, array )->interpolate( value, time, last );
 }
 
 template <> bool Controller::interpolate( Color3 & value, const QModelIndex & array, float time, int & last )
 {
-	return ::interpolate( value, array, time, last );
+	auto nif = NifModel::fromValidIndex( array );
+	return nif && keyTrack<KeyTrack<Color3>>( nif, array )->interpolate( value, time, last );
 }
 
 template <> bool Controller::interpolate( bool & value, const QModelIndex & array, float time, int & last )
 {
-	int next;
-	float x;
-
-	auto nif = NifModel::fromValidIndex(array);
+	auto nif = NifModel::fromValidIndex( array );
 	if ( nif ) {
-		QModelIndex frames = nif->getIndex( array, "Keys" );
+		const BoolKeyTrack * track = keyTrack<BoolKeyTrack>( nif, array );
+		int next;
+		float x;
 
-		if ( timeIndex( time, nif, frames, last, next, x ) ) {
-			value = nif->get<int>( QModelIndex_child( frames, last ), "Value" );
+		if ( track->timeIndex( time, last, next, x ) ) {
+			value = track->values[last];
 
 			return true;
 		}
@@ -468,62 +691,13 @@ template <> bool Controller::interpolate( bool & value, const QModelIndex & arra
 
 template <> bool Controller::interpolate( Matrix & value, const QModelIndex & array, float time, int & last )
 {
-	int next;
-	float x;
-
-	auto nif = NifModel::fromValidIndex(array);
-	if ( nif ) {
-		switch ( nif->get<int>( array, "Rotation Type" ) ) {
-		case 4:
-			{
-				QModelIndex subkeys = nif->getIndex( array, "XYZ Rotations" );
-
-				if ( subkeys.isValid() ) {
-					float r[3] = {};
-
-					for ( int s = 0; s < 3 && s < nif->rowCount( subkeys ); s++ ) {
-						r[s] = 0;
-						interpolate( r[s], QModelIndex_child( subkeys, s ), time, last );
-					}
-
-					value = Matrix::euler( 0, 0, r[2] ) * Matrix::euler( 0, r[1], 0 ) * Matrix::euler( r[0], 0, 0 );
+	auto nif = NifModel::fromValidIndex( array );
+	return nif && keyTrack<RotationKeyTrack>( nif, array )->interpolate( value, time, last );
+}
 
-					return true;
-				}
-			}
-			break;
-		default:
-			{
-				QModelIndex frames = nif->getIndex( array, "Quaternion Keys" );
-
-				if ( timeIndex( time, nif, frames, last, next, x ) ) {
-					Quat v1 = nif->get<Quat>( QModelIndex_child( frames, last ), "Value" );
-					Quat v2 = nif->get<Quat>( QModelIndex_child( frames, next ), "Value" );
-
-					if ( Quat::dotproduct( v1, v2 ) < 0 )
-						v1.negate(); // don't take the long path
-
-					Quat v3 = Quat::slerp( x, v1, v2 );
-					/*
-					Quat v4;
-					float a = acos( Quat::dotproduct( v1, v2 ) );
-					if ( fabs( a ) >= 0.00005 )
-					{
-					    float i = 1.0 / sin( a );
-					    v4 = v1 * sin( ( 1.0 - x ) * a ) * i + v2 * sin( x * a ) * i;
-					}
-					*/
-					value.fromQuat( v3 );
-
-					return true;
-				}
-			}
-			break;
-		}
-	}
+#ifndef QT_NO_DEBUG
 
-	return false;
-}
+// Reference implementation, used to check BSplineTransformInterpolator::evaluate() in debug builds
 
 /*********************************************************************
 Simple b-spline curve algorithm
@@ -698,6 +872,28 @@ bool bsplineinterpolate( T & value, int degree, float interval, uint nctrl, cons
 	return true;
 }
 
+#endif
+
+//! Compact B-spline control points of NiBSplineData, converted to floats in the range -1.0 to 1.0
+class BSplineControlTrack final : public KeyTrackBase
+{
+public:
+	void read( const NifModel * nif, const NifItem * item )
+	{
+		Q_UNUSED( nif );
+		QVector<short> c = item->getArray<short>();
+
+		points.resize( size_t( c.size() ) );
+		for ( qsizetype i = 0; i < c.size(); i++ )
+			points[i] = float( c[i] ) / float( SHRT_MAX );
+	}
+
+	//! Returns a decompressed value, or 0 if the offset is out of range
+	float point( size_t i ) const { return ( i < points.size() ? points[i] : 0.0f ); }
+
+	std::vector<float>	points;
+};
+
 Interpolator::Interpolator( Controller * owner ) : parent( owner )
 {
 }
@@ -737,9 +933,9 @@ bool TransformInterpolator::update( const NifModel * nif, const QModelIndex & in
 
 bool TransformInterpolator::updateTransform( Transform & tm, float time )
 {
-	Controller::interpolate( tm.rotation, iRotations, time, lRotate );
-	Controller::interpolate( tm.translation, iTranslations, time, lTrans );
-	Controller::interpolate( tm.scale, iScales, time, lScale );
+	parent->interpolate( tm.rotation, iRotations, time, lRotate );
+	parent->interpolate( tm.translation, iTranslations, time, lTrans );
+	parent->interpolate( tm.scale, iScales, time, lScale );
 
 	return true;
 }
@@ -780,22 +976,148 @@ bool BSplineTransformInterpolator::update( const NifModel * nif, const QModelInd
 		lRotateBias = nif->get<float>( index, "Rotation Offset" );
 		lScaleBias  = nif->get<float>( index, "Scale Offset" );
 
+		for ( int i = 0; i < 8; i++ ) {
+			valueMult[i] = ( i < 4 ? lRotateMult : ( i < 7 ? lTransMult : lScaleMult ) );
+			valueBias[i] = ( i < 4 ? lRotateBias : ( i < 7 ? lTransBias : lScaleBias ) );
+		}
+
+		// Knots of the clamped uniform B-spline, see compute_intervals()
+		knots.clear();
+		if ( nCtrl > uint( degree ) ) {
+			int n = int( nCtrl ) - 1;
+			int t = degree + 1;
+
+			knots.resize( size_t( n + t + 1 ) );
+			for ( int j = 0; j <= n + t; j++ )
+				knots[j] = float( std::clamp( j - degree, 0, n - degree + 1 ) );
+		}
+
+#ifndef QT_NO_DEBUG
+		verify();
+#endif
+
 		return true;
 	}
 
 	return false;
 }
 
-bool BSplineTransformInterpolator::updateTransform( Transform & transform, float time )
+bool BSplineTransformInterpolator::evaluate( float * values, float time )
 {
-	float interval = ( ( time - start ) / ( stop - start ) ) * float(nCtrl - degree);
-	Quat q = transform.rotation.toQuat();
+	constexpr int maxDegree = 7;
+
+	auto nif = NifModel::fromValidIndex( iControl );
+	if ( !nif || knots.empty() || degree > maxDegree )
+		return false;
+
+	const BSplineControlTrack * ctrl = keyTrack<BSplineControlTrack>( nif, iControl );
+
+	int numSpans = int( nCtrl ) - degree;
+	float interval = ( ( time - start ) / ( stop - start ) ) * float( numSpans );
+
+	// Non-zero basis functions at interval, and the first control point they apply to
+	float basis[maxDegree + 1] = {};
+	int first = 0;
+
+	if ( interval >= float( numSpans ) ) {
+		first = numSpans - 1;
+		basis[degree] = 1.0f;
+	} else if ( interval >= 0.0f ) {
+		// Cox-de Boor recursion, without the zero terms
+		int k = int( interval ) + degree;
+		float left[maxDegree + 1];
+		float right[maxDegree + 1];
+
+		first = k - degree;
+		basis[0] = 1.0f;
+		for ( int j = 1; j <= degree; j++ ) {
+			left[j] = interval - knots[k + 1 - j];
+			right[j] = knots[k + j] - interval;
+
+			float saved = 0.0f;
+			for ( int r = 0; r < j; r++ ) {
+				float tmp = basis[r] / ( right[r + 1] + left[j - r] );
+				basis[r] = saved + right[r + 1] * tmp;
+				saved = left[j - r] * tmp;
+			}
+			basis[j] = saved;
+		}
+	}
+	// else (time before the start, or no valid time range): all basis functions are zero,
+	// and the result is the offset, as in the original implementation
+
+	// Weighted sum of the rotation, translation and scale control points
+	size_t offsets[3] = { lRotateOff, lTransOff, lScaleOff };
+	FloatVector8 v( 0.0f );
+
+	for ( int r = 0; r <= degree; r++ ) {
+		size_t c = size_t( first + r );
+		float p[8];
+
+		for ( int i = 0; i < 4; i++ )
+			p[i] = ctrl->point( offsets[0] + c * 4 + size_t( i ) );
+		for ( int i = 0; i < 3; i++ )
+			p[i + 4] = ctrl->point( offsets[1] + c * 3 + size_t( i ) );
+		p[7] = ctrl->point( offsets[2] + c );
 
-	if ( ::bsplineinterpolate<Quat>( q, degree, interval, nCtrl, iControl, lRotateOff, lRotateMult, lRotateBias ) )
-		transform.rotation.fromQuat( q );
+		v += FloatVector8( p ) * basis[r];
+	}
+
+	v = v * FloatVector8( valueMult ) + FloatVector8( valueBias );
+	v.convertToFloats( values );
+
+	return true;
+}
+
+#ifndef QT_NO_DEBUG
+void BSplineTransformInterpolator::verify()
+{
+	if ( !iControl.isValid() || knots.empty() )
+		return;
+
+	float interval = float( nCtrl - degree );
+	float maxError = 0.0f;
+
+	for ( int i = -2; i <= 66; i++ ) {
+		float time = start + ( stop - start ) * ( float( i ) / 64.0f );
+		float values[8];
+		if ( !evaluate( values, time ) )
+			return;
+
+		float x = ( ( time - start ) / ( stop - start ) ) * interval;
+		Quat q;
+		Vector3 tr;
+		float sc = 0.0f;
+
+		if ( bsplineinterpolate<Quat>( q, degree, x, nCtrl, iControl, lRotateOff, lRotateMult, lRotateBias ) ) {
+			for ( int j = 0; j < 4; j++ )
+				maxError = std::max( maxError, std::fabs( values[j] - q[j] ) / std::max( std::fabs( q[j] ), 1.0f ) );
+		}
+		if ( bsplineinterpolate<Vector3>( tr, degree, x, nCtrl, iControl, lTransOff, lTransMult, lTransBias ) ) {
+			for ( int j = 0; j < 3; j++ )
+				maxError = std::max( maxError, std::fabs( values[j + 4] - tr[j] ) / std::max( std::fabs( tr[j] ), 1.0f ) );
+		}
+		if ( bsplineinterpolate<float>( sc, degree, x, nCtrl, iControl, lScaleOff, lScaleMult, lScaleBias ) )
+			maxError = std::max( maxError, std::fabs( values[7] - sc ) / std::max( std::fabs( sc ), 1.0f ) );
+	}
+
+	if ( maxError > 1.0e-4f )
+		qWarning() << "B-spline evaluation differs from the reference implementation by" << maxError;
+}
+#endif
+
+bool BSplineTransformInterpolator::updateTransform( Transform & transform, float time )
+{
+	float v[8];
+	if ( !evaluate( v, time ) )
+		return true;
 
-	::bsplineinterpolate<Vector3>( transform.translation, degree, interval, nCtrl, iControl, lTransOff, lTransMult, lTransBias );
-	::bsplineinterpolate<float>( transform.scale, degree, interval, nCtrl, iControl, lScaleOff, lScaleMult, lScaleBias );
+	if ( lRotateOff != USHRT_MAX )
+		transform.rotation.fromQuat( Quat( v[0], v[1], v[2], v[3] ) );
+	if ( lTransOff != USHRT_MAX )
+		transform.translation = Vector3( v[4], v[5], v[6] );
+	if ( lScaleOff != USHRT_MAX )
+		transform.scale = v[7];
 
 	return true;
 }
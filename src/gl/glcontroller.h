@@ -39,15 +39,44 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QPersistentModelIndex>
 #include <QString>
 
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
 
 //! @file glcontroller.h Controller, Interpolator, TransformInterpolator, BSplineTransformInterpolator
 
 class Transform;
 
+/*! Key times of an animation key array, decoded from the model once
+ *
+ * The derived track types in glcontroller.cpp also store the key values and tangents.
+ * Tracks are cached per Controller and dropped when the block that contains the array changes,
+ * or when the whole scene is updated.
+ */
+class KeyTrackBase
+{
+public:
+	virtual ~KeyTrackBase() {}
+
+	/*! Returns the fraction of the way between two keyframes, like Controller::timeIndex
+	 *
+	 * The interval after \a prevFrame is checked first, so a binary search is only needed
+	 * when the time jumps.
+	 */
+	bool timeIndex( float time, int & prevFrame, int & nextFrame, float & fraction ) const;
+
+	QPersistentModelIndex	array;
+	int	block = -1;
+	int	interpolation = 0;
+	std::vector<float>	times;
+};
+
 //! Something which can be attached to anything Controllable
 class Controller
 {
 	friend class Interpolator;
+	friend class IControllable;
 
 public:
 	Controller( const QModelIndex & index );
@@ -94,7 +123,7 @@ public:
 	 * @param[in]  time			The scene time
 	 * @param[out] lastIndex	The last index
 	 */
-	template <typename T> static bool interpolate( T & value, const QModelIndex & array, float time, int & lastIndex );
+	template <typename T> bool interpolate( T & value, const QModelIndex & array, float time, int & lastIndex );
 
 	/*! Interpolate given an index and the array name
 	 *
@@ -104,7 +133,7 @@ public:
 	 * @param[in]  time			The scene time
 	 * @param[out] lastIndex	The last index
 	 */
-	template <typename T> static bool interpolate( T & value, const QModelIndex & data, const QString & arrayid, float time, int & lastindex );
+	template <typename T> bool interpolate( T & value, const QModelIndex & data, const QString & arrayid, float time, int & lastindex );
 	
 	/*! Returns the fraction of the way between two keyframes based on the scene time
 	 *
@@ -118,10 +147,27 @@ public:
 	static bool timeIndex( float inTime, const NifModel * nif, const QModelIndex & keysArray, int & prevFrame, int & nextFrame, float & fraction );
 
 protected:
+	//! Returns the cached track of a key array, decoding it from the model if needed
+	template <typename Track> const Track * keyTrack( const NifModel * nif, const QModelIndex & array );
+
+	//! Drops the cached tracks of the block \a index, or all tracks if it is invalid
+	void clearKeyTracks( const NifModel * nif, const QModelIndex & index );
 
 	QPersistentModelIndex iBlock;
 	QPersistentModelIndex iInterpolator;
 	QPersistentModelIndex iData;
+
+	struct PersistentIndexHash
+	{
+		size_t operator()( const QPersistentModelIndex & index ) const { return size_t( qHash( index ) ); }
+	};
+
+	/*! Decoded key arrays
+	 *
+	 * Persistent indices are equal only if they were created for the same item, so an item that
+	 * is allocated at the address of a deleted one does not match the track of the old item.
+	 */
+	std::unordered_map<QPersistentModelIndex, std::unique_ptr<KeyTrackBase>, PersistentIndexHash> keyTracks;
 };
 
 template <typename T> bool Controller::interpolate( T & value, const QModelIndex & data, const QString & arrayid, float time, int & lastindex )
@@ -144,6 +190,12 @@ public:
 
 protected:
 	QPersistentModelIndex GetControllerData();
+	//! Returns a key array decoded and cached by the parent controller
+	template <typename Track> const Track * keyTrack( const NifModel * nif, const QModelIndex & array )
+	{
+		return parent->keyTrack<Track>( nif, array );
+	}
+
 	Controller * parent;
 };
 
@@ -169,6 +221,17 @@ public:
 	bool updateTransform( Transform & tm, float time ) override;
 
 protected:
+	/*! Evaluates the rotation, translation and scale curves together
+	 *
+	 * @param[out] values	Rotation quaternion (4), translation (3) and scale (1)
+	 * @param[in]  time		The interpolator time
+	 */
+	bool evaluate( float * values, float time );
+#ifndef QT_NO_DEBUG
+	//! Compares evaluate() with the original B-spline implementation at sampled times
+	void verify();
+#endif
+
 	float start = 0, stop = 0;
 	QPersistentModelIndex iControl, iSpline, iBasis;
 	QPersistentModelIndex lTrans, lRotate, lScale;
@@ -177,6 +240,11 @@ protected:
 	float lTransBias = 0, lRotateBias = 0, lScaleBias = 0;
 	uint nCtrl = 0;
 	int degree = 3;
+
+	//! Clamped uniform knot vector, nCtrl + degree + 1 knots
+	std::vector<float> knots;
+	//! Half range and offset of the 8 values returned by evaluate()
+	float valueMult[8] = {}, valueBias[8] = {};
 };
 
 
@@ -607,13 +607,11 @@ bool compareTriangles( const QPair<int, float> & tri1, const QPair<int, float> &
 	return ( tri1.second < tri2.second );
 }
 
-void Mesh::transformShapes()
+void Mesh::transformShape()
 {
 	if ( isHidden() )
 		return;
 
-	Node::transformShapes();
-
 	transformRigid = true;
 
 	if ( isSkinned && ( weights.count() || partitions.count() ) && scene->hasOption(Scene::DoSkinning) ) {
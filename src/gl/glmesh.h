@@ -46,7 +46,7 @@ public:
 
 	// Node
 
-	void transformShapes() override;
+	void transformShape() override;
 
 	void drawShapes( NodeList * secondPass = nullptr ) override;
 	void drawSelection() const override;
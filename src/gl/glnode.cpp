@@ -358,8 +358,8 @@ void Node::activeProperties( PropertyList & list ) const
 
 const Transform & Node::viewTrans() const
 {
-	if ( scene->viewTrans.contains( nodeId ) )
-		return scene->viewTrans[ nodeId ];
+	if ( const Transform * cached = scene->viewTrans.find( nodeId ) )
+		return *cached;
 
 	Transform t;
 
@@ -368,22 +368,20 @@ const Transform & Node::viewTrans() const
 	else
 		t = scene->view * worldTrans();
 
-	scene->viewTrans.insert( nodeId, t );
-	return scene->viewTrans[ nodeId ];
+	return scene->viewTrans.insert( nodeId, t );
 }
 
 const Transform & Node::worldTrans() const
 {
-	if ( scene->worldTrans.contains( nodeId ) )
-		return scene->worldTrans[ nodeId ];
+	if ( const Transform * cached = scene->worldTrans.find( nodeId ) )
+		return *cached;
 
 	Transform t = local;
 
 	if ( parent )
 		t = parent->worldTrans() * t;
 
-	scene->worldTrans.insert( nodeId, t );
-	return scene->worldTrans[ nodeId ];
+	return scene->worldTrans.insert( nodeId, t );
 }
 
 Transform Node::localTrans( int root ) const
@@ -493,11 +491,17 @@ void Node::transform()
 
 void Node::transformShapes()
 {
+	transformShape();
+
 	for ( Node * node : children.list() ) {
 		node->transformShapes();
 	}
 }
 
+void Node::transformShape()
+{
+}
+
 void Node::draw()
 {
 	if ( isHidden() || iBlock == scene->currentBlock )
@@ -1934,8 +1938,8 @@ BillboardNode::BillboardNode( Scene * scene, const QModelIndex & iBlock )
 
 const Transform & BillboardNode::viewTrans() const
 {
-	if ( scene->viewTrans.contains( nodeId ) )
-		return scene->viewTrans[ nodeId ];
+	if ( const Transform * cached = scene->viewTrans.find( nodeId ) )
+		return *cached;
 
 	Transform t;
 
@@ -1946,6 +1950,5 @@ const Transform & BillboardNode::viewTrans() const
 
 	t.rotation = Matrix();
 
-	scene->viewTrans.insert( nodeId, t );
-	return scene->viewTrans[ nodeId ];
+	return scene->viewTrans.insert( nodeId, t );
 }
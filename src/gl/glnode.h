@@ -82,6 +82,7 @@ class Node : public IControllable
 	friend class VisibilityController;
 	friend class NodeList;
 	friend class LODNode;
+	friend class Scene;
 
 	typedef union
 	{
@@ -107,7 +108,16 @@ public:
 
 	// end IControllable
 
-	virtual void transformShapes();
+	//! Updates the transformed vertices of the node and its children
+	void transformShapes();
+	/*! Updates the transformed vertices of the node only
+	 *
+	 * Scene::transform() may call this for multiple nodes in parallel, after the transforms
+	 * of all nodes have been calculated. It must only modify the node itself.
+	 */
+	virtual void transformShape();
+	//! Returns the estimated cost of transformShape(), in vertices
+	virtual size_t transformCost() const { return 0; }
 
 	virtual void draw();
 	virtual void drawShapes( NodeList * secondPass = nullptr );
@@ -107,10 +107,8 @@ void Particles::transform()
 	Node::transform();
 }
 
-void Particles::transformShapes()
+void Particles::transformShape()
 {
-	Node::transformShapes();
-
 	Transform vtrans = viewTrans();
 
 	transVerts.resize( verts.count() );
@@ -51,7 +51,8 @@ public:
 	void clear() override;
 	void transform() override;
 
-	void transformShapes() override;
+	void transformShape() override;
+	size_t transformCost() const override { return size_t( verts.count() ); }
 
 	void drawShapes( NodeList * secondPass = nullptr ) override;
 
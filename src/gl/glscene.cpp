@@ -35,18 +35,23 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "gl/renderer.h"
 #include "gl/gltex.h"
 #include "gl/glcontroller.h"
+#include "gl/controllers.h"
 #include "gl/glmesh.h"
 #include "gl/bsshape.h"
 #include "gl/BSMesh.h"
 #include "gl/glparticles.h"
 #include "gl/gltex.h"
 #include "model/nifmodel.h"
+#include "lib/parallel.h"
 
 #include <QAction>
+#include <QElapsedTimer>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QSettings>
 
+#include <functional>
+
 
 //! \file glscene.cpp %Scene management
 
@@ -153,6 +158,13 @@ void Scene::update( const NifModel * nif, const QModelIndex & index )
 		properties.validate();
 		nodes.validate();
 
+		// controllers are only updated with their own block, but any block may have changed
+		for ( Property * p : properties )
+			p->clearKeyTracks();
+
+		for ( Node * n : nodes.list() )
+			n->clearKeyTracks();
+
 		for ( Property * p : properties )
 			p->update( nif, p->index() );
 
@@ -313,28 +325,92 @@ void Scene::setSequence( const QString & seqname )
 
 void Scene::transform( const Transform & trans, float time )
 {
+	QElapsedTimer timer;
+	timer.start();
+
 	view = trans;
 	this->time = time;
 
-	worldTrans.clear();
-	viewTrans.clear();
+	int maxNodeId = -1;
+	for ( Node * node : nodes.list() )
+		maxNodeId = std::max( maxNodeId, node->id() );
+
+	worldTrans.clear( size_t( maxNodeId + 1 ) );
+	viewTrans.clear( size_t( maxNodeId + 1 ) );
 	bhkBodyTrans.clear();
+	particleSimulations.clear();
 
+	// Controllers and interpolators, which may also set the local transforms of other nodes
 	for ( Property * prop : properties ) {
 		prop->transform();
 	}
 	for ( Node * node : roots.list() ) {
 		node->transform();
 	}
-	for ( Node * node : roots.list() ) {
-		node->transformShapes();
+	qint64 t1 = timer.nsecsElapsed();
+
+	simulateParticles();
+	qint64 tp = timer.nsecsElapsed();
+
+	// World and view transforms, level by level so that parents are always calculated first
+	transformOrder.clear();
+	size_t transformCost = 0;
+	for ( Node * node : roots.list() )
+		transformOrder.append( node );
+	for ( qsizetype i = 0; i < transformOrder.size(); i++ ) {
+		Node * node = transformOrder.at( i );
+		node->worldTrans();
+		node->viewTrans();
+		transformCost += node->transformCost();
+
+		for ( Node * child : node->children.list() )
+			transformOrder.append( child );
 	}
+	qint64 t2 = timer.nsecsElapsed();
+
+	// Skinning and vertex transforms, only on multiple threads if there are enough vertices
+	parallelFor( size_t( transformOrder.size() ), [this]( size_t i ) {
+		transformOrder.at( qsizetype( i ) )->transformShape();
+	}, ( transformCost >= 65536 ? 0 : 1 ) );
+	qint64 t3 = timer.nsecsElapsed();
+
+	transformTimes.controllers = double( t1 ) * 1.0e-6;
+	transformTimes.particles = double( tp - t1 ) * 1.0e-6;
+	transformTimes.nodes = double( t2 - tp ) * 1.0e-6;
+	transformTimes.shapes = double( t3 - t2 ) * 1.0e-6;
 
 	sceneBoundsValid = false;
 
 	// TODO: purge unused textures
 }
 
+void Scene::simulateParticles()
+{
+	if ( particleSimulations.empty() )
+		return;
+
+	// Controllers of the same particle system are run in order on one thread
+	std::stable_sort( particleSimulations.begin(), particleSimulations.end(), []( const ParticleController * a, const ParticleController * b ) {
+		return std::less<const Particles *>()( a->particleTarget(), b->particleTarget() );
+	} );
+
+	std::vector<size_t> groups;
+	size_t particleCount = 0;
+	for ( size_t i = 0; i < particleSimulations.size(); i++ ) {
+		if ( i == 0 || particleSimulations[i]->particleTarget() != particleSimulations[i - 1]->particleTarget() )
+			groups.push_back( i );
+		particleCount += particleSimulations[i]->particleCapacity();
+	}
+	groups.push_back( particleSimulations.size() );
+
+	parallelFor( groups.size() - 1, [this, &groups]( size_t g ) {
+		for ( size_t i = groups[g]; i < groups[g + 1]; i++ )
+			particleSimulations[i]->simulate();
+	}, ( groups.size() > 2 && particleCount >= 4096 ? 0 : 1 ) );
+
+	particleSimulations.clear();
+}
+
 void Scene::draw()
 {
 	drawShapes();
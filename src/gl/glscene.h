@@ -46,16 +46,73 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QStack>
 #include <QStringList>
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 
 //! @file glscene.h Scene
 
 class NifModel;
+class ParticleController;
 class Renderer;
 class Shape;
 class QAction;
 class QOpenGLContext;
 class QOpenGLFunctions;
 
+/*! Transforms of the nodes for the current frame, indexed by node ID
+ *
+ * clear() only increments a frame counter, entries stored in an earlier frame are ignored.
+ * Storage is reserved for all node IDs when the frame starts, so looking up the
+ * transform of a node that has already been calculated is safe on multiple threads.
+ */
+class TransformCache final
+{
+public:
+	//! Invalidates all entries, and makes room for node IDs below \a size
+	void clear( size_t size = 0 )
+	{
+		if ( size > frames.size() ) {
+			frames.resize( size, 0 );
+			transforms.resize( size );
+		}
+		if ( ++frame == 0 ) {
+			std::fill( frames.begin(), frames.end(), 0 );
+			frame = 1;
+		}
+	}
+
+	//! Returns the transform of a node, or nullptr if it has not been calculated in this frame
+	const Transform * find( int id ) const
+	{
+		if ( id >= 0 && size_t( id ) < frames.size() && frames[id] == frame )
+			return &( transforms[id] );
+		return nullptr;
+	}
+
+	bool contains( int id ) const { return bool( find( id ) ); }
+
+	const Transform & insert( int id, const Transform & t )
+	{
+		if ( id < 0 ) {
+			invalid = t;
+			return invalid;
+		}
+		if ( size_t( id ) >= frames.size() )
+			clear( size_t( id ) + 1 );
+		transforms[id] = t;
+		frames[id] = frame;
+		return transforms[id];
+	}
+
+protected:
+	std::vector<Transform>	transforms;
+	std::vector<std::uint32_t>	frames;
+	std::uint32_t	frame = 1;
+	Transform	invalid;
+};
+
 class Scene final : public QObject
 {
 	Q_OBJECT
@@ -194,10 +251,23 @@ public:
 
 	NodeList roots;
 
-	mutable QHash<int, Transform> worldTrans;
-	mutable QHash<int, Transform> viewTrans;
+	mutable TransformCache worldTrans;
+	mutable TransformCache viewTrans;
 	mutable QHash<int, Transform> bhkBodyTrans;
 
+	//! Time spent in the stages of the last call to transform(), in milliseconds
+	struct TransformTimes
+	{
+		//! Properties, controllers and interpolators
+		double	controllers = 0.0;
+		//! Particle systems
+		double	particles = 0.0;
+		//! World and view transforms of the nodes
+		double	nodes = 0.0;
+		//! Skinning and transformed vertices of the shapes
+		double	shapes = 0.0;
+	} transformTimes;
+
 	Transform view;
 
 	bool animate;
@@ -219,6 +289,9 @@ public:
 
 	float timeMin() const;
 	float timeMax() const;
+
+	//! Schedules ParticleController::simulate() after the controllers of the current frame
+	void addParticleSimulation( ParticleController * ctrl ) { particleSimulations.push_back( ctrl ); }
 signals:
 	void sceneUpdated();
 	void disableSave();
@@ -235,6 +308,14 @@ protected:
 	mutable float tMin = 0, tMax = 0;
 
 	void updateTimeBounds() const;
+
+	//! Nodes in the order their transforms are calculated, level by level from the roots
+	QVector<Node *> transformOrder;
+
+	//! Particle controllers updated in the current frame
+	std::vector<ParticleController *> particleSimulations;
+
+	void simulateParticles();
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS( Scene::SceneOptions )
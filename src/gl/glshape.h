@@ -60,6 +60,8 @@ public:
 
 	// end IControllable
 
+	size_t transformCost() const override { return size_t( verts.count() ); }
+
 	virtual void drawVerts() const {};
 	virtual QModelIndex vertexAt( int ) const { return QModelIndex(); };
 
@@ -63,6 +63,9 @@ public:
 
 	void update( const NifModel * nif, const QModelIndex & index );
 
+	//! Drops the animation keys cached by all controllers
+	void clearKeyTracks();
+
 	virtual void transform();
 
 	virtual void timeBounds( float & start, float & stop );
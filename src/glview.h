@@ -210,6 +210,8 @@ protected:
 
 protected slots:
 	void saveImage();
+	//! Times Scene::transform over the animation without drawing, and reports the frame rate
+	void benchmarkAnimation();
 
 private:
 	NifModel * model;
@@ -3,9 +3,8 @@
 #include "qtcompat.h"
 
 #include <QByteArray>
-#include <QDataStream>
-#include <QBuffer>
 #include "fp32vec4.hpp"
+#include "filebuf.hpp"
 
 #if 0
 // x/32767 matches the min/max bounds in BSGeometry more accurately on average
@@ -47,168 +46,152 @@ void MeshFile::clear()
 	haveData = false;
 }
 
+//! Returns a pointer to 'n' elements of 'elementSize' bytes at the read position of 'buf', and skips them
+static const unsigned char * meshFileArray( FileBuffer & buf, size_t n, size_t elementSize )
+{
+	if ( ( std::uint64_t( buf.getPosition() ) + ( std::uint64_t( n ) * elementSize ) ) > buf.size() )
+		throw FO76UtilsError( "unexpected end of mesh data" );
+	const unsigned char *	p = buf.getReadPtr();
+	buf.setPosition( buf.getPosition() + ( n * elementSize ) );
+	return p;
+}
+
+static void meshFileTriangles( QVector<Triangle> & triangles, FileBuffer & buf )
+{
+	size_t	n = buf.readUInt32() / 3U;
+	const unsigned char *	p = meshFileArray( buf, n, 6 );
+	triangles.resize( qsizetype(n) );
+	Triangle *	t = triangles.data();
+	for ( size_t i = 0; i < n; i++, p = p + 6 )
+		t[i] = Triangle( FileBuffer::readUInt16Fast( p ), FileBuffer::readUInt16Fast( p + 2 ), FileBuffer::readUInt16Fast( p + 4 ) );
+}
+
 void MeshFile::update( const void * data, size_t size )
 {
 	clear();
 	if ( !( data && size > 0 ) )
 		return;
 
-	QBuffer	f;
-	f.setData( reinterpret_cast< const char * >( data ), qsizetype( size ) );
-	if ( !f.open(QIODevice::ReadOnly) )
-		return;
-
-	QDataStream	in;
-	in.setDevice(&f);
-	in.setByteOrder(QDataStream::LittleEndian);
-	in.setFloatingPointPrecision(QDataStream::SinglePrecision);
-
-	quint32 magic;
-	in >> magic;
-	if ( magic > 2U )
-		return;
-
-	quint32 indicesSize;
-	in >> indicesSize;
-	triangles.resize( indicesSize / 3 );
-	haveData = true;
-
-	for ( quint32 i = 0; i < indicesSize / 3; i++ ) {
-		Triangle tri;
-		in >> tri;
-		triangles[i] = tri;
-	}
-
-	float scale;
-	in >> scale;
-	if ( scale <= 0.0f ) {
-		clear();
-		return; // From RE
-	}
-
-	quint32 numWeightsPerVertex;
-	in >> numWeightsPerVertex;
-	weightsPerVertex = numWeightsPerVertex;
-
-	quint32 numPositions;
-	in >> numPositions;
-	if ( !numPositions ) {
-		clear();
-		return;
-	}
-	positions.resize( numPositions );
-
-	for ( int i = 0; i < int(numPositions); i++ ) {
-		uint32_t	xy;
-		uint16_t	z;
+	// the attributes are decoded directly from the buffer into the arrays used by the renderer
+	try {
+		FileBuffer	in( reinterpret_cast< const unsigned char * >( data ), size );
 
-		in >> xy;
-		in >> z;
-		FloatVector4	xyz(FloatVector4::convertInt16((std::uint64_t(z) << 32) | xy));
-		xyz /= 32767.0f;
-		xyz *= scale;
+		std::uint32_t	magic = in.readUInt32();
+		if ( magic > 2U )
+			return;
 
-		positions[i] = Vector3(xyz[0], xyz[1], xyz[2]);
-	}
+		meshFileTriangles( triangles, in );
+		haveData = true;
 
-	quint32 numCoord1;
-	in >> numCoord1;
-	coords.resize( numCoord1 );
-
-	for ( int i = 0; i < int(numCoord1); i++ ) {
-		uint32_t uv;
-
-		in >> uv;
-
-		coords[i] = Vector4(FloatVector4::convertFloat16(uv));
-	}
+		float	scale = in.readFloat();
+		if ( !( scale > 0.0f ) ) {
+			clear();
+			return; // From RE
+		}
 
-	quint32 numCoord2;
-	in >> numCoord2;
-	numCoord2 = std::min( numCoord2, numCoord1 );
-	haveTexCoord2 = bool( numCoord2 );
+		std::uint32_t	numWeightsPerVertex = in.readUInt32();
+		weightsPerVertex = quint8( std::min< std::uint32_t >( numWeightsPerVertex, 255U ) );
 
-	for ( quint32 i = 0; i < numCoord2; i++ ) {
-		uint32_t uv;
-
-		in >> uv;
-		FloatVector4  uv_f(FloatVector4::convertFloat16(uv));
+		size_t	numPositions = in.readUInt32();
+		if ( !numPositions ) {
+			clear();
+			return;
+		}
+		{
+			const unsigned char *	p = meshFileArray( in, numPositions, 6 );
+			positions.resize( qsizetype(numPositions) );
+			Vector3 *	v = positions.data();
+			float	s = scale / 32767.0f;
+			for ( size_t i = 0; i < numPositions; i++, p = p + 6 ) {
+				std::uint64_t	xyz = FileBuffer::readUInt32Fast( p ) | ( std::uint64_t( FileBuffer::readUInt16Fast( p + 4 ) ) << 32 );
+				v[i].fromFloatVector4( FloatVector4::convertInt16( xyz ) * s );
+			}
+		}
 
-		coords[i][2] = uv_f[0];
-		coords[i][3] = uv_f[1];
-	}
+		size_t	numCoord1 = in.readUInt32();
+		{
+			const unsigned char *	p = meshFileArray( in, numCoord1, 4 );
+			coords.resize( qsizetype(numCoord1) );
+			Vector4 *	v = coords.data();
+			for ( size_t i = 0; i < numCoord1; i++, p = p + 4 )
+				v[i] = Vector4( FloatVector4::convertFloat16( FileBuffer::readUInt32Fast( p ) ) );
+		}
 
-	quint32 numColor;
-	in >> numColor;
-	if ( numColor > 0 ) {
-		colors.resize( numColor );
-	}
-	for ( quint32 i = 0; i < numColor; i++ ) {
-		uint32_t	bgra;
-		in >> bgra;
-		colors[i] = Color4( ( FloatVector4(bgra) / 255.0f ).shuffleValues( 0xC6 ) );	// 2, 1, 0, 3
-	}
+		size_t	numCoord2 = in.readUInt32();
+		{
+			const unsigned char *	p = meshFileArray( in, numCoord2, 4 );
+			numCoord2 = std::min( numCoord2, numCoord1 );
+			haveTexCoord2 = bool( numCoord2 );
+			Vector4 *	v = coords.data();
+			for ( size_t i = 0; i < numCoord2; i++, p = p + 4 ) {
+				FloatVector4	uv( FloatVector4::convertFloat16( FileBuffer::readUInt32Fast( p ) ) );
+				v[i][2] = uv[0];
+				v[i][3] = uv[1];
+			}
+		}
 
-	quint32 numNormal;
-	in >> numNormal;
-	if ( numNormal > 0 ) {
-		normals.resize( numNormal );
-	}
-	for ( int i = 0; i < int(numNormal); i++ ) {
-		std::uint32_t	n;
-		in >> n;
-		normals[i] = Vector3( UDecVector4(n) );
-	}
+		size_t	numColor = in.readUInt32();
+		{
+			const unsigned char *	p = meshFileArray( in, numColor, 4 );
+			colors.resize( qsizetype(numColor) );
+			Color4 *	c = colors.data();
+			for ( size_t i = 0; i < numColor; i++, p = p + 4 )
+				c[i] = Color4( ( FloatVector4( FileBuffer::readUInt32Fast( p ) ) / 255.0f ).shuffleValues( 0xC6 ) );	// 2, 1, 0, 3
+		}
 
-	quint32 numTangent;
-	in >> numTangent;
-	if ( numTangent > 0 ) {
-		tangents.resize( numTangent );
-		bitangentsBasis.resize( numTangent );
-	}
-	for ( int i = 0; i < int(numTangent); i++ ) {
-		std::uint32_t	n;
-		in >> n;
-		UDecVector4	v( n );
-		tangents[i] = Vector3( v );
-		bitangentsBasis[i] = v[3];
-	}
+		size_t	numNormal = in.readUInt32();
+		{
+			const unsigned char *	p = meshFileArray( in, numNormal, 4 );
+			normals.resize( qsizetype(numNormal) );
+			Vector3 *	n = normals.data();
+			for ( size_t i = 0; i < numNormal; i++, p = p + 4 )
+				n[i].fromFloatVector4( FloatVector4::convertX10Y10Z10W2( FileBuffer::readUInt32Fast( p ) ) );
+		}
 
-	quint32 numWeights;
-	in >> numWeights;
-	if ( numWeights > 0 && numWeightsPerVertex > 0 ) {
-		weights.resize(numWeights / numWeightsPerVertex);
-	}
-	for ( int i = 0; i < weights.count(); i++ ) {
-		QVector<QPair<quint16, quint16>> weightsUNORM;
-		for ( quint32 j = 0; j < 8; j++ ) {
-			if ( j < numWeightsPerVertex ) {
-				quint16 b, w;
-				in >> b;
-				in >> w;
-				weightsUNORM.append({ b, w });
-			} else {
-				weightsUNORM.append({0, 0});
+		size_t	numTangent = in.readUInt32();
+		{
+			const unsigned char *	p = meshFileArray( in, numTangent, 4 );
+			tangents.resize( qsizetype(numTangent) );
+			bitangentsBasis.resize( qsizetype(numTangent) );
+			Vector3 *	t = tangents.data();
+			float *	b = bitangentsBasis.data();
+			for ( size_t i = 0; i < numTangent; i++, p = p + 4 ) {
+				FloatVector4	v( FloatVector4::convertX10Y10Z10W2( FileBuffer::readUInt32Fast( p ) ) );
+				t[i].fromFloatVector4( v );
+				b[i] = v[3];
 			}
 		}
-		weights[i] = BoneWeightsUNorm(weightsUNORM, i);
-	}
 
-	if ( magic ) {
-		quint32 numLODs;
-		in >> numLODs;
-		lods.resize(numLODs);
-		for ( quint32 i = 0; i < numLODs; i++ ) {
-			quint32 indicesSize2;
-			in >> indicesSize2;
-			lods[i].resize(indicesSize2 / 3);
-
-			for ( quint32 j = 0; j < indicesSize2 / 3; j++ ) {
-				Triangle tri;
-				in >> tri;
-				lods[i][j] = tri;
+		size_t	numWeights = in.readUInt32();
+		if ( numWeights > 0 && numWeightsPerVertex > 0 ) {
+			size_t	numVerts = numWeights / numWeightsPerVertex;
+			const unsigned char *	p = meshFileArray( in, numWeights, 4 );
+			weights.resize( qsizetype(numVerts) );
+			BoneWeightsUNorm *	w = weights.data();
+			size_t	n = std::min< size_t >( numWeightsPerVertex, 8 );
+			for ( size_t i = 0; i < numVerts; i++, p = p + ( size_t(numWeightsPerVertex) * 4 ) ) {
+				w[i].weightsUNORM.resize( 8 );
+				BoneWeightUNORM16 *	bw = w[i].weightsUNORM.data();
+				for ( size_t j = 0; j < n; j++ ) {
+					bw[j].bone = FileBuffer::readUInt16Fast( p + ( j * 4 ) );
+					bw[j].weight = float( FileBuffer::readUInt16Fast( p + ( j * 4 + 2 ) ) ) / 65535.0f;
+				}
 			}
+		} else {
+			(void) meshFileArray( in, numWeights, 4 );
+		}
+
+		if ( magic ) {
+			size_t	numLODs = in.readUInt32();
+			// each LOD has at least a 4 byte index count
+			if ( ( std::uint64_t( numLODs ) * 4 ) > std::uint64_t( in.size() - in.getPosition() ) )
+				throw FO76UtilsError( "unexpected end of mesh data" );
+			lods.resize( qsizetype(numLODs) );
+			for ( size_t i = 0; i < numLODs; i++ )
+				meshFileTriangles( lods[qsizetype(i)], in );
 		}
+	} catch ( FO76UtilsError & ) {
+		clear();
 	}
 }
 
@@ -612,32 +612,44 @@ void NifOStream::init()
 	stringAdjust = (model->inherits( "NifModel" ) && model->getVersionNumber() >= 0x14010003);
 }
 
+bool NifOStream::flush()
+{
+	if ( !buffer.empty() ) {
+		qint64 n = qint64( buffer.size() );
+		if ( ok )
+			ok = ( device->write( buffer.data(), n ) == n );
+		buffer.clear();
+	}
+
+	return ok;
+}
+
 bool NifOStream::write( const NifValue & val )
 {
 	switch ( val.type() ) {
 	case NifValue::tBool:
 
 		if ( bool32bit )
-			return device->write( (char *)&val.val.u32, 4 ) == 4;
+			return writeData( (char *)&val.val.u32, 4 );
 		else
-			return device->write( (char *)&val.val.u08, 1 ) == 1;
+			return writeData( (char *)&val.val.u08, 1 );
 
 	case NifValue::tByte:
-		return device->write( (char *)&val.val.u08, 1 ) == 1;
+		return writeData( (char *)&val.val.u08, 1 );
 	case NifValue::tWord:
 	case NifValue::tShort:
 	case NifValue::tFlags:
 	case NifValue::tBlockTypeIndex:
-		return device->write( (char *)&val.val.u16, 2 ) == 2;
+		return writeData( (char *)&val.val.u16, 2 );
 	case NifValue::tStringOffset:
 	case NifValue::tInt:
 	case NifValue::tUInt:
 	case NifValue::tULittle32:
 	case NifValue::tStringIndex:
-		return device->write( (char *)&val.val.u32, 4 ) == 4;
+		return writeData( (char *)&val.val.u32, 4 );
 	case NifValue::tInt64:
 	case NifValue::tUInt64:
-		return device->write( (char *)&val.val.u64, 8 ) == 8;
+		return writeData( (char *)&val.val.u64, 8 );
 	case NifValue::tFileVersion:
 		{
 			if ( NifModel * mdl = static_cast<NifModel *>(const_cast<BaseModel *>(model)) ) {
@@ -651,23 +663,23 @@ bool NifOStream::write( const NifValue & val )
 					version = val.val.u32;
 				}
 
-				return device->write( (char *)&version, 4 ) == 4;
+				return writeData( (char *)&version, 4 );
 			} else {
-				return device->write( (char *)&val.val.u32, 4 ) == 4;
+				return writeData( (char *)&val.val.u32, 4 );
 			}
 		}
 	case NifValue::tLink:
 	case NifValue::tUpLink:
 
 		if ( !linkAdjust ) {
-			return device->write( (char *)&val.val.i32, 4 ) == 4;
+			return writeData( (char *)&val.val.i32, 4 );
 		} else {
 			qint32 l = val.val.i32 + 1;
-			return device->write( (char *)&l, 4 ) == 4;
+			return writeData( (char *)&l, 4 );
 		}
 
 	case NifValue::tFloat:
-		return device->write( (char *)&val.val.f32, 4 ) == 4;
+		return writeData( (char *)&val.val.f32, 4 );
 	case NifValue::tHfloat:
 		{
 #if ENABLE_X86_64_SIMD >= 3
@@ -675,13 +687,13 @@ bool NifOStream::write( const NifValue & val )
 #else
 			uint16_t	half = half_from_float( val.val.u32 );
 #endif
-			return device->write( (char *)&half, 2 ) == 2;
+			return writeData( (char *)&half, 2 );
 		}
 	case NifValue::tNormbyte:
 		{
 			uint8_t v = round( ((val.val.f32 + 1.0) / 2.0) * 255.0 );
 
-			return device->write( (char*)&v, 1 ) == 1;
+			return writeData( (char*)&v, 1 );
 		}
 	case NifValue::tByteVector3:
 		{
@@ -694,7 +706,7 @@ bool NifOStream::write( const NifValue & val )
 			v[1] = round( ((vec->xyz[1] + 1.0) / 2.0) * 255.0 );
 			v[2] = round( ((vec->xyz[2] + 1.0) / 2.0) * 255.0 );
 
-			return device->write( (char*)v, 3 ) == 3;
+			return writeData( (char*)v, 3 );
 		}
 	case NifValue::tShortVector3:
 		{
@@ -710,7 +722,7 @@ bool NifOStream::write( const NifValue & val )
 			FileBuffer::writeUInt16Fast( &(v[2]), std::uint16_t( std::int16_t(xyz[1]) ) );
 			FileBuffer::writeUInt16Fast( &(v[4]), std::uint16_t( std::int16_t(xyz[2]) ) );
 
-			return device->write( v, 6 ) == 6;
+			return writeData( v, 6 );
 		}
 	case NifValue::tUshortVector3:
 		{
@@ -723,7 +735,7 @@ bool NifOStream::write( const NifValue & val )
 			v[1] = (uint16_t) round(vec->xyz[1]);
 			v[2] = (uint16_t) round(vec->xyz[2]);
 
-			return device->write( (char*)v, 6 ) == 6;
+			return writeData( (char*)v, 6 );
 		}
 	case NifValue::tHalfVector3:
 		{
@@ -733,7 +745,7 @@ bool NifOStream::write( const NifValue & val )
 
 #if ENABLE_X86_64_SIMD >= 3
 			uint64_t	xyz = FloatVector4( vec->xyz[0], vec->xyz[1], vec->xyz[2], 0.0f ).convertToFloat16();
-			return device->write( (char*) &xyz, 6 ) == 6;
+			return writeData( (char*) &xyz, 6 );
 #else
 			uint16_t	v[3];
 			union { float f; uint32_t i; } xu, yu, zu;
@@ -745,7 +757,7 @@ bool NifOStream::write( const NifValue & val )
 			v[0] = half_from_float( xu.i );
 			v[1] = half_from_float( yu.i );
 			v[2] = half_from_float( zu.i );
-			return device->write( (char*)v, 6 ) == 6;
+			return writeData( (char*)v, 6 );
 #endif
 		}
 	case NifValue::tHalfVector2:
@@ -756,7 +768,7 @@ bool NifOStream::write( const NifValue & val )
 
 #if ENABLE_X86_64_SIMD >= 3
 			uint64_t	xy = FloatVector4( vec->xy[0], vec->xy[1], 0.0f, 0.0f ).convertToFloat16();
-			return device->write( (char*) &xy, 4 ) == 4;
+			return writeData( (char*) &xy, 4 );
 #else
 			uint16_t	v[2];
 			union { float f; uint32_t i; } xu, yu;
@@ -766,13 +778,13 @@ bool NifOStream::write( const NifValue & val )
 
 			v[0] = half_from_float( xu.i );
 			v[1] = half_from_float( yu.i );
-			return device->write( (char*)v, 4 ) == 4;
+			return writeData( (char*)v, 4 );
 #endif
 		}
 	case NifValue::tVector3:
-		return device->write( (char *)static_cast<Vector3 *>(val.val.data)->xyz, 12 ) == 12;
+		return writeData( (char *)static_cast<Vector3 *>(val.val.data)->xyz, 12 );
 	case NifValue::tVector4:
-		return device->write( (char *)static_cast<Vector4 *>(val.val.data)->xyzw, 16 ) == 16;
+		return writeData( (char *)static_cast<Vector4 *>(val.val.data)->xyzw, 16 );
 	case NifValue::tByteVector4:
 		{
 			ByteVector4 * vec = static_cast<ByteVector4 *>(val.val.data);
@@ -780,7 +792,7 @@ bool NifOStream::write( const NifValue & val )
 				return false;
 			char	v[4];
 			FileBuffer::writeUInt32Fast( v, std::uint32_t( *vec ) );
-			return device->write( v, 4 ) == 4;
+			return writeData( v, 4 );
 		}
 	case NifValue::tUDecVector4:
 		{
@@ -789,25 +801,25 @@ bool NifOStream::write( const NifValue & val )
 				return false;
 			char	v[4];
 			FileBuffer::writeUInt32Fast( v, std::uint32_t( *vec ) );
-			return device->write( v, 4 ) == 4;
+			return writeData( v, 4 );
 		}
 	case NifValue::tTriangle:
-		return device->write( (char *)static_cast<Triangle *>(val.val.data)->v, 6 ) == 6;
+		return writeData( (char *)static_cast<Triangle *>(val.val.data)->v, 6 );
 	case NifValue::tQuat:
-		return device->write( (char *)static_cast<Quat *>(val.val.data)->wxyz, 16 ) == 16;
+		return writeData( (char *)static_cast<Quat *>(val.val.data)->wxyz, 16 );
 	case NifValue::tQuatXYZW:
 		{
 			Quat * q = static_cast<Quat *>(val.val.data);
-			return device->write( (char *)&q->wxyz[1], 12 ) == 12 && device->write( (char *)q->wxyz, 4 ) == 4;
+			return writeData( (char *)&q->wxyz[1], 12 ) && writeData( (char *)q->wxyz, 4 );
 		}
 	case NifValue::tMatrix:
-		return device->write( (char *)static_cast<Matrix *>(val.val.data)->m, 36 ) == 36;
+		return writeData( (char *)static_cast<Matrix *>(val.val.data)->m, 36 );
 	case NifValue::tMatrix4:
-		return device->write( (char *)static_cast<Matrix4 *>(val.val.data)->m, 64 ) == 64;
+		return writeData( (char *)static_cast<Matrix4 *>(val.val.data)->m, 64 );
 	case NifValue::tVector2:
-		return device->write( (char *)static_cast<Vector2 *>(val.val.data)->xy, 8 ) == 8;
+		return writeData( (char *)static_cast<Vector2 *>(val.val.data)->xy, 8 );
 	case NifValue::tColor3:
-		return device->write( (char *)static_cast<Color3 *>(val.val.data)->rgb, 12 ) == 12;
+		return writeData( (char *)static_cast<Color3 *>(val.val.data)->rgb, 12 );
 	case NifValue::tByteColor4:
 		{
 			ByteColor4 * color = static_cast<ByteColor4 *>(val.val.data);
@@ -815,7 +827,7 @@ bool NifOStream::write( const NifValue & val )
 				return false;
 			char	c[4];
 			FileBuffer::writeUInt32Fast( c, std::uint32_t(*color) );
-			return device->write( c, 4 ) == 4;
+			return writeData( c, 4 );
 		}
 	case NifValue::tByteColor4BGRA:
 		{
@@ -824,10 +836,10 @@ bool NifOStream::write( const NifValue & val )
 				return false;
 			char	c[4];
 			FileBuffer::writeUInt32Fast( c, std::uint32_t(*color) );
-			return device->write( c, 4 ) == 4;
+			return writeData( c, 4 );
 		}
 	case NifValue::tColor4:
-		return device->write( (char *)static_cast<Color4 *>(val.val.data)->rgba, 16 ) == 16;
+		return writeData( (char *)static_cast<Color4 *>(val.val.data)->rgba, 16 );
 	case NifValue::tSizedString:
 	case NifValue::tSizedString16:
 		{
@@ -838,10 +850,10 @@ bool NifOStream::write( const NifValue & val )
 			FileBuffer::writeUInt32Fast( len, std::uint32_t(string.size()) );
 			int	lenSize = ( val.type() == NifValue::tSizedString16 ? 2 : 4 );
 
-			if ( device->write( len, lenSize ) != lenSize )
+			if ( !writeData( len, lenSize ) )
 				return false;
 
-			return device->write( string.constData(), string.size() ) == string.size();
+			return writeData( string.constData(), string.size() );
 		}
 	case NifValue::tShortString:
 		{
@@ -854,41 +866,41 @@ bool NifOStream::write( const NifValue & val )
 
 			unsigned char len = string.size() + 1;
 
-			if ( device->write( (char *)&len, 1 ) != 1 )
+			if ( !writeData( (char *)&len, 1 ) )
 				return false;
 
-			return device->write( string.constData(), len ) == len;
+			return writeData( string.constData(), len );
 		}
 	case NifValue::tText:
 		{
 			QByteArray string = static_cast<QString *>(val.val.data)->toLatin1();
 			int len = string.size();
 
-			if ( device->write( (char *)&len, 4 ) != 4 )
+			if ( !writeData( (char *)&len, 4 ) )
 				return false;
 
-			return device->write( (const char *)string.constData(), string.size() ) == string.size();
+			return writeData( (const char *)string.constData(), string.size() );
 		}
 	case NifValue::tHeaderString:
 	case NifValue::tLineString:
 		{
 			QByteArray string = static_cast<QString *>(val.val.data)->toLatin1();
 
-			if ( device->write( string.constData(), string.length() ) != string.length() )
+			if ( !writeData( string.constData(), string.length() ) )
 				return false;
 
-			return (device->write( "\n", 1 ) == 1);
+			return writeData( "\n", 1 );
 		}
 	case NifValue::tChar8String:
 		{
 			QByteArray string = static_cast<QString *>(val.val.data)->toLatin1();
 			quint32 n = std::min<quint32>( 8, string.length() );
 
-			if ( device->write( string.constData(), n ) != n )
+			if ( !writeData( string.constData(), n ) )
 				return false;
 
 			for ( quint32 i = n; i < 8; ++i ) {
-				if ( device->write( "\0", 1 ) != 1 )
+				if ( !writeData( "\0", 1 ) )
 					return false;
 			}
 
@@ -902,10 +914,10 @@ bool NifOStream::write( const NifValue & val )
 			char lenBuf[4];
 			FileBuffer::writeUInt32Fast( lenBuf, std::uint32_t( len ) );
 
-			if ( device->write( lenBuf, 4 ) != 4 )
+			if ( !writeData( lenBuf, 4 ) )
 				return false;
 
-			return device->write( *array ) == len;
+			return writeData( array->constData(), len );
 		}
 	case NifValue::tStringPalette:
 		{
@@ -914,39 +926,39 @@ bool NifOStream::write( const NifValue & val )
 			char lenBuf[4];
 			FileBuffer::writeUInt32Fast( lenBuf, std::uint32_t( len ) );
 
-			if ( device->write( lenBuf, 4 ) != 4 )
+			if ( !writeData( lenBuf, 4 ) )
 				return false;
 
-			if ( device->write( *array ) != len )
+			if ( !writeData( array->constData(), len ) )
 				return false;
 
-			return device->write( lenBuf, 4 ) == 4;
+			return writeData( lenBuf, 4 );
 		}
 	case NifValue::tByteMatrix:
 		{
 			ByteMatrix * array = static_cast<ByteMatrix *>(val.val.data);
 			int len = array->count( 0 );
 
-			if ( device->write( (char *)&len, 4 ) != 4 )
+			if ( !writeData( (char *)&len, 4 ) )
 				return false;
 
 			len = array->count( 1 );
 
-			if ( device->write( (char *)&len, 4 ) != 4 )
+			if ( !writeData( (char *)&len, 4 ) )
 				return false;
 
 			len = array->count();
-			return device->write( array->data(), len ) == len;
+			return writeData( array->data(), len );
 		}
 	case NifValue::tString:
 	case NifValue::tFilePath:
 		{
 			if ( stringAdjust ) {
 				if ( val.val.u32 < 0x00010000 ) {
-					return device->write( (char *)&val.val.u32, 4 ) == 4;
+					return writeData( (char *)&val.val.u32, 4 );
 				} else {
 					int value = 0;
-					return device->write( (char *)&value, 4 ) == 4;
+					return writeData( (char *)&value, 4 );
 				}
 			} else {
 				QByteArray string;
@@ -959,10 +971,10 @@ bool NifOStream::write( const NifValue & val )
 				//string.replace( "\\n", "\n" );
 				int len = string.size();
 
-				if ( device->write( (char *)&len, 4 ) != 4 )
+				if ( !writeData( (char *)&len, 4 ) )
 					return false;
 
-				return device->write( string.constData(), string.size() ) == string.size();
+				return writeData( string.constData(), string.size() );
 			}
 		}
 	case NifValue::tBSVertexDesc:
@@ -971,13 +983,13 @@ bool NifOStream::write( const NifValue & val )
 			if ( !d )
 				return false;
 
-			return device->write( (char*)&d->desc, 8 ) == 8;
+			return writeData( (char*)&d->desc, 8 );
 		}
 	case NifValue::tBlob:
 
 		if ( val.val.data ) {
 			QByteArray * array = static_cast<QByteArray *>(val.val.data);
-			return device->write( array->data(), array->size() ) == array->size();
+			return writeData( array->constData(), array->size() );
 		}
 
 		return true;
@@ -34,8 +34,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define NIFSTREAM_H
 
 #include <QCoreApplication>
+#include <QIODevice>
 
+#include <cstring>
 #include <memory>
+#include <vector>
 
 
 //! @file nifstream.h NifIStream, NifOStream, NifSStream
@@ -43,7 +46,6 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 class NifValue;
 class BaseModel;
 class QDataStream;
-class QIODevice;
 
 constexpr int NEOSTEAM_FF = 3;
 constexpr int GAMEBRYO_FF = 21;
@@ -97,16 +99,34 @@ class NifOStream final
 
 public:
 	NifOStream( const BaseModel * n, QIODevice * d ) : model( n ), device( d ) { init(); }
+	~NifOStream() { flush(); }
 
 	//! Writes a NifValue to the underlying device. Returns true if successful.
 	bool write( const NifValue & );
 
+	//! Writes raw bytes, in order with the values written by write()
+	inline bool writeData( const void * data, qint64 size );
+
+	/*! Writes the buffered data to the device. Returns false if any write failed.
+	 *
+	 * Data is collected in blocks of bufferSize bytes, the device is only written
+	 * when the buffer is full, on flush() and in the destructor.
+	 */
+	bool flush();
+
+	static constexpr qint64 bufferSize = 1 << 20;
+
 private:
 	//! The model that data is being read from.
 	const BaseModel * model;
 	//! The underlying device that data is being written to.
 	QIODevice * device;
 
+	//! Data not yet written to the device
+	std::vector<char> buffer;
+	//! False after a write to the device has failed
+	bool ok = true;
+
 	//! Initialises the stream.
 	void init();
 
@@ -121,6 +141,26 @@ private:
 };
 
 
+inline bool NifOStream::writeData( const void * data, qint64 size )
+{
+	if ( size <= 0 )
+		return ok;
+
+	if ( qint64( buffer.size() ) + size > bufferSize && !flush() )
+		return false;
+
+	if ( size >= bufferSize ) {
+		ok = ( device->write( static_cast<const char *>(data), size ) == size );
+		return ok;
+	}
+
+	size_t n = buffer.size();
+	buffer.resize( n + size_t( size ) );
+	std::memcpy( buffer.data() + n, data, size_t( size ) );
+	return ok;
+}
+
+
 //! A stream that determines the size of values in a model.
 class NifSStream final
 {
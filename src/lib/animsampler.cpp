@@ -0,0 +1,339 @@
+#include "animsampler.h"
+
+#include "gl/glcontroller.h"
+#include "lib/parallel.h"
+#include "model/nifmodel.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+
+#include <algorithm>
+#include <cmath>
+
+
+//! \file animsampler.cpp AnimationSampler
+
+//! Owner of the interpolators of a sequence, used for its key track cache
+class SequenceController final : public Controller
+{
+public:
+	SequenceController( const QModelIndex & index ) : Controller( index ) {}
+
+	void updateTime( float time ) override { Q_UNUSED( time ); }
+};
+
+//! Reads a string of a controlled block, or from the string palette if only the offset is stored
+static QString controlledBlockString( const NifModel * nif, const QModelIndex & iCB, const QString & name )
+{
+	QString s = nif->get<QString>( iCB, name );
+	if ( s.isEmpty() ) {
+		QModelIndex idx = nif->getIndex( iCB, name + " Offset" );
+		if ( idx.isValid() )
+			s = idx.sibling( idx.row(), NifModel::ValueCol ).data( NifSkopeDisplayRole ).toString();
+	}
+	return s;
+}
+
+AnimationSampler::AnimationSampler()
+{
+}
+
+AnimationSampler::~AnimationSampler()
+{
+}
+
+void AnimationSampler::loadSkeleton( const NifModel * nif )
+{
+	skeleton.clear();
+	skeletonNames.clear();
+	if ( !nif )
+		return;
+
+	// Parents are always added before their children
+	std::vector<int> blocks;
+	std::vector<bool> visited( size_t( nif->getBlockCount() ), false );
+	for ( int b : nif->getRootLinks() ) {
+		if ( b < 0 || size_t( b ) >= visited.size() || visited[b] )
+			continue;
+		if ( nif->blockInherits( nif->getBlockIndex( b ), "NiNode" ) ) {
+			visited[b] = true;
+			blocks.push_back( b );
+			skeleton.push_back( SkeletonNode() );
+		}
+	}
+
+	for ( size_t i = 0; i < blocks.size(); i++ ) {
+		QModelIndex iNode = nif->getBlockIndex( blocks[i] );
+		SkeletonNode & node = skeleton[i];
+		node.name = nif->get<QString>( iNode, "Name" );
+		node.local = Transform( nif, iNode );
+		if ( !node.name.isEmpty() && !skeletonNames.contains( node.name ) )
+			skeletonNames.insert( node.name, int( i ) );
+
+		for ( int c : nif->getChildLinks( blocks[i] ) ) {
+			if ( c < 0 || size_t( c ) >= visited.size() || visited[c] )
+				continue;
+			if ( !nif->blockInherits( nif->getBlockIndex( c ), "NiNode" ) )
+				continue;
+
+			visited[c] = true;
+			blocks.push_back( c );
+			SkeletonNode child;
+			child.parent = int( i );
+			skeleton.push_back( child );
+		}
+	}
+}
+
+bool AnimationSampler::load( const NifModel * nif, const NifModel * skeletonModel, QString * errorMessage )
+{
+	sequences.clear();
+	loadSkeleton( skeletonModel );
+
+	for ( int b = 0; b < nif->getBlockCount(); b++ ) {
+		QModelIndex iSeq = nif->getBlockIndex( b );
+		if ( !nif->blockInherits( iSeq, "NiControllerSequence" ) )
+			continue;
+
+		Sequence seq;
+		seq.name = nif->get<QString>( iSeq, "Name" );
+		seq.start = nif->get<float>( iSeq, "Start Time" );
+		seq.stop = nif->get<float>( iSeq, "Stop Time" );
+		seq.owner = std::make_unique<SequenceController>( iSeq );
+
+		QModelIndex iCtrlBlcks = nif->getIndex( iSeq, "Controlled Blocks" );
+		for ( int r = 0; r < nif->rowCount( iCtrlBlcks ); r++ ) {
+			QModelIndex iCB = QModelIndex_child( iCtrlBlcks, r );
+			QModelIndex iInterp = nif->getBlockIndex( nif->getLink( iCB, "Interpolator" ), "NiInterpolator" );
+			if ( !iInterp.isValid() )
+				continue;
+
+			Channel ch;
+			if ( nif->isNiBlock( iInterp, "NiBSplineCompTransformInterpolator" ) )
+				ch.interpolator = std::make_unique<BSplineTransformInterpolator>( seq.owner.get() );
+			else if ( nif->isNiBlock( iInterp, "NiTransformInterpolator" ) )
+				ch.interpolator = std::make_unique<TransformInterpolator>( seq.owner.get() );
+			else
+				continue;
+
+			ch.bone = controlledBlockString( nif, iCB, "Node Name" );
+			if ( ch.bone.isEmpty() )
+				ch.bone = nif->get<QString>( iCB, "Target Name" );
+			ch.node = skeletonNames.value( ch.bone, -1 );
+			if ( ch.node >= 0 )
+				ch.rest = skeleton[ch.node].local;
+
+			// Constant pose of the interpolator, components set to -FLT_MAX are not used
+			QModelIndex iTrans = nif->getIndex( iInterp, "Transform" );
+			if ( iTrans.isValid() && nif->isNiBlock( iInterp, "NiTransformInterpolator" ) ) {
+				Vector3 t = nif->get<Vector3>( iTrans, "Translation" );
+				Quat q = nif->get<Quat>( iTrans, "Rotation" );
+				float s = nif->get<float>( iTrans, "Scale" );
+				if ( t[0] > -3.4e38f )
+					ch.rest.translation = t;
+				if ( q[0] > -3.4e38f )
+					ch.rest.rotation.fromQuat( q );
+				if ( s > -3.4e38f )
+					ch.rest.scale = s;
+			}
+
+			ch.interpolator->update( nif, iInterp );
+
+			// Decode the key arrays now, sample() must not access the model
+			Transform t = ch.rest;
+			ch.interpolator->updateTransform( t, seq.start );
+
+			seq.channels.push_back( std::move( ch ) );
+		}
+
+		if ( !seq.channels.empty() )
+			sequences.push_back( std::move( seq ) );
+	}
+
+	if ( sequences.empty() ) {
+		if ( errorMessage )
+			*errorMessage = QString( "no NiControllerSequence with transform interpolators found" );
+		return false;
+	}
+
+	return true;
+}
+
+void AnimationSampler::sample( float fps, int maxThreads )
+{
+	float step = 1.0f / ( fps > 0.0f ? fps : 30.0f );
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// The interpolators only read the key tracks decoded by load()
+	parallelFor( sequences.size(), [this, step]( size_t i ) {
+		Sequence & seq = sequences[i];
+		size_t nChannels = seq.channels.size();
+		size_t nNodes = skeleton.size();
+
+		seq.frameTime = step;
+		seq.frameCount = int( std::floor( std::max( seq.stop - seq.start, 0.0f ) / step + 0.001f ) ) + 1;
+		seq.samples.resize( size_t( seq.frameCount ) * nChannels );
+
+		std::vector<Transform> local( nNodes );
+		std::vector<Transform> world( nNodes );
+
+		for ( int f = 0; f < seq.frameCount; f++ ) {
+			float time = std::min( seq.start + float( f ) * step, seq.stop );
+			Transform * out = seq.samples.data() + size_t( f ) * nChannels;
+
+			for ( size_t n = 0; n < nNodes; n++ )
+				local[n] = skeleton[n].local;
+
+			for ( size_t c = 0; c < nChannels; c++ ) {
+				Channel & ch = seq.channels[c];
+				out[c] = ch.rest;
+				ch.interpolator->updateTransform( out[c], time );
+				if ( ch.node >= 0 )
+					local[ch.node] = out[c];
+			}
+
+			for ( size_t n = 0; n < nNodes; n++ ) {
+				int p = skeleton[n].parent;
+				world[n] = ( p >= 0 ? world[p] * local[n] : local[n] );
+			}
+
+			for ( size_t c = 0; c < nChannels; c++ ) {
+				if ( seq.channels[c].node >= 0 )
+					out[c] = world[seq.channels[c].node];
+			}
+		}
+	}, maxThreads );
+
+	sampleSeconds = double( timer.nsecsElapsed() ) * 1.0e-9;
+	sampleCount = 0;
+	for ( const Sequence & seq : sequences )
+		sampleCount += seq.samples.size();
+}
+
+bool AnimationSampler::writeCSV( QIODevice & device ) const
+{
+	auto number = []( QByteArray & line, float v ) {
+		line += ',';
+		line += QByteArray::number( v, 'g', 7 );
+	};
+
+	if ( device.write( "sequence,time,bone,tx,ty,tz,qw,qx,qy,qz,scale\n" ) < 0 )
+		return false;
+
+	QByteArray line;
+	for ( const Sequence & seq : sequences ) {
+		QByteArray seqName = seq.name.toUtf8();
+		std::vector<QByteArray> boneNames;
+		for ( const Channel & ch : seq.channels )
+			boneNames.push_back( ch.bone.toUtf8() );
+
+		for ( int f = 0; f < seq.frameCount; f++ ) {
+			float time = std::min( seq.start + float( f ) * seq.frameTime, seq.stop );
+			const Transform * t = seq.samples.data() + size_t( f ) * seq.channels.size();
+
+			line.clear();
+			for ( size_t c = 0; c < seq.channels.size(); c++ ) {
+				Quat q = t[c].rotation.toQuat();
+
+				line += seqName;
+				number( line, time );
+				line += ',';
+				line += boneNames[c];
+				for ( int i = 0; i < 3; i++ )
+					number( line, t[c].translation[i] );
+				for ( int i = 0; i < 4; i++ )
+					number( line, q[i] );
+				number( line, t[c].scale );
+				line += '\n';
+			}
+			if ( device.write( line ) < 0 )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+QString AnimationSampler::statistics() const
+{
+	size_t frames = 0;
+	for ( const Sequence & seq : sequences )
+		frames += size_t( seq.frameCount );
+
+	double rate = ( sampleSeconds > 0.0 ? double( sampleCount ) / sampleSeconds : 0.0 );
+
+	return QString( "%1 sequences, %2 frames, %3 bone transforms in %4 ms (%5 transforms per second)" )
+		.arg( sequences.size() ).arg( frames ).arg( sampleCount )
+		.arg( sampleSeconds * 1000.0, 0, 'f', 2 ).arg( rate, 0, 'f', 0 );
+}
+
+int AnimationSampler::runCommandLine( const QStringList & files, const QString & outputPath, const QString & skeletonPath, float fps )
+{
+	QTextStream out( stdout );
+	QTextStream err( stderr );
+
+	if ( files.isEmpty() ) {
+		err << "--sample-animations: no input files\n";
+		return 1;
+	}
+
+	if ( !NifModel::loadXML() )
+		return 1;
+
+	std::unique_ptr<NifModel> skeletonModel;
+	if ( !skeletonPath.isEmpty() ) {
+		skeletonModel = std::make_unique<NifModel>();
+		if ( !skeletonModel->loadFromFile( skeletonPath ) ) {
+			err << "Could not load skeleton " << skeletonPath << "\n";
+			return 1;
+		}
+	}
+
+	int result = 0;
+	for ( const QString & fileName : files ) {
+		NifModel nif;
+		if ( !nif.loadFromFile( fileName ) ) {
+			err << "Could not load " << fileName << "\n";
+			result = 1;
+			continue;
+		}
+
+		AnimationSampler sampler;
+		QString msg;
+		if ( !sampler.load( &nif, ( skeletonModel ? skeletonModel.get() : &nif ), &msg ) ) {
+			err << fileName << ": " << msg << "\n";
+			result = 1;
+			continue;
+		}
+
+		sampler.sample( fps );
+
+		// The output path is a folder if there are several input files
+		QFileInfo fileInfo( fileName );
+		QString csvName = fileInfo.completeBaseName() + ".csv";
+		QString csvPath;
+		if ( outputPath.isEmpty() )
+			csvPath = fileInfo.dir().filePath( csvName );
+		else if ( files.size() > 1 || QFileInfo( outputPath ).isDir() )
+			csvPath = QDir( outputPath ).filePath( csvName );
+		else
+			csvPath = outputPath;
+
+		QSaveFile f( csvPath );
+		if ( !( f.open( QIODevice::WriteOnly ) && sampler.writeCSV( f ) && f.commit() ) ) {
+			err << "Could not write " << csvPath << "\n";
+			result = 1;
+			continue;
+		}
+
+		out << fileName << ": " << sampler.statistics() << "\n";
+		out.flush();
+	}
+
+	return result;
+}
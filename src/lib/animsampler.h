@@ -0,0 +1,105 @@
+#ifndef ANIMSAMPLER_H_INCLUDED
+#define ANIMSAMPLER_H_INCLUDED
+
+#include "data/niftypes.h"
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+#include <vector>
+
+
+//! \file animsampler.h Headless sampling of NiControllerSequence transform animations
+
+class Controller;
+class NifModel;
+class QIODevice;
+class TransformInterpolator;
+
+/*! Samples the transform interpolators of all NiControllerSequence blocks of a file
+ *
+ * The sequences are evaluated with the same Controller and Interpolator classes as the
+ * render window, but without a Scene or a GL context. World transforms are calculated
+ * from the node hierarchy of a skeleton model, which may be the file itself. Bones that
+ * are not found in the skeleton are written with their local transforms.
+ *
+ * load() decodes the key arrays of every interpolator on the calling thread, after that
+ * sample() evaluates the sequences in parallel without accessing the models.
+ */
+class AnimationSampler final
+{
+public:
+	AnimationSampler();
+	~AnimationSampler();
+
+	//! Collects the sequences of \a nif, \a skeleton may be nullptr. Returns false if there is nothing to sample
+	bool load( const NifModel * nif, const NifModel * skeleton, QString * errorMessage = nullptr );
+
+	//! Evaluates all sequences at \a fps frames per second, using up to \a maxThreads threads (0 = all)
+	void sample( float fps, int maxThreads = 0 );
+
+	/*! Writes the sampled transforms in CSV format
+	 *
+	 * Each line contains the sequence name, time, bone name, translation, rotation
+	 * as a quaternion (w, x, y, z) and scale.
+	 */
+	bool writeCSV( QIODevice & device ) const;
+
+	//! Returns a summary of the number of sequences, samples and the evaluation throughput
+	QString statistics() const;
+
+	int sequenceCount() const { return int( sequences.size() ); }
+
+	/*! Runs the --sample-animations command line tool
+	 *
+	 * Every input file is sampled into \a outputPath, or into a CSV file next to it
+	 * if \a outputPath is empty. Returns the process exit code.
+	 */
+	static int runCommandLine( const QStringList & files, const QString & outputPath, const QString & skeletonPath, float fps );
+
+protected:
+	struct SkeletonNode
+	{
+		QString	name;
+		int	parent = -1;
+		Transform	local;
+	};
+
+	struct Channel
+	{
+		QString	bone;
+		//! Index of the bone in skeleton, or -1
+		int	node = -1;
+		//! Pose of the bone where the interpolator has no keys
+		Transform	rest;
+		std::unique_ptr<TransformInterpolator>	interpolator;
+	};
+
+	struct Sequence
+	{
+		QString	name;
+		float	start = 0.0f;
+		float	stop = 0.0f;
+		//! Owns the decoded key tracks of the interpolators, declared first so that it is destroyed last
+		std::unique_ptr<Controller>	owner;
+		std::vector<Channel>	channels;
+
+		//! Sampled transforms, channels.size() per frame
+		std::vector<Transform>	samples;
+		int	frameCount = 0;
+		float	frameTime = 0.0f;
+	};
+
+	void loadSkeleton( const NifModel * nif );
+
+	std::vector<SkeletonNode>	skeleton;
+	QHash<QString, int>	skeletonNames;
+	std::vector<Sequence>	sequences;
+
+	size_t	sampleCount = 0;
+	double	sampleSeconds = 0.0;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "gl/gltools.h"
 #include "gl/BSMesh.h"
 #include "io/MeshFile.h"
+#include "lib/parallel.h"
 #include "model/nifmodel.h"
 #include "message.h"
 #include "qtcompat.h"
@@ -19,11 +20,14 @@
 #include <tiny_gltf.h>
 
 #include <cctype>
+#include <memory>
+#include <unordered_map>
 
 #include <QApplication>
 #include <QBuffer>
 #include <QVector>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QIODevice>
@@ -592,13 +596,47 @@ bool exportCreateMeshes(const NifModel* nif, const Scene* scene, tinygltf::Model
 
 class ExportGltfMaterials {
 protected:
+	//! A unique combination of source textures converted to a glTF image
+	struct TextureJob {
+		std::string	txtPath1;
+		std::string	txtPath2;
+		//! Paths found in the resources by findTextures(), or empty if the texture is missing
+		std::string	fullPath1;
+		std::string	fullPath2;
+		int	n;
+		unsigned char	texCoordMode;
+		QByteArray	imageBuf;
+		int	width = 1;
+		int	height = 1;
+		int	channels = 0;
+		int	textureID = -1;
+		// time in milliseconds spent loading the source textures, baking the image and encoding the PNG
+		qint64	loadTime = 0;
+		qint64	bakeTime = 0;
+		qint64	encodeTime = 0;
+		QString	errorMessage;
+	};
+	//! Material texture slot that uses a TextureJob
+	struct TextureRef {
+		int	material;
+		int	n;
+		int	job;
+		unsigned char	texCoordChannel;
+	};
+
 	tinygltf::Model &	model;
 	NifModel *	nif;
 	CE2MaterialDB *	materials;
 	int	mipLevel;
 	std::set< std::string >	materialSet;
 	std::map< std::string, int >	textureMap;
-	DDSTexture16 * loadTexture( const std::string_view & txtPath );
+	std::vector< TextureJob >	textureJobs;
+	std::vector< TextureRef >	textureRefs;
+	// summary and per-texture details for reportTextureTimes()
+	QString	textureSummary;
+	QString	textureTimes;
+	std::string findTexture( const std::string & txtPath ) const;
+	DDSTexture16 * loadTexture( const std::string & txtPath, const std::string & fullPath, QString & errorMessage );
 	// n = 0: albedo
 	// n = 1: normal
 	// n = 2: PBR
@@ -606,6 +644,8 @@ protected:
 	// n = 4: emissive
 	void getTexture( tinygltf::Material & mat, int n, const std::string & txtPath1, const std::string & txtPath2,
 					const CE2Material::UVStream * uvStream );
+	void bakeTexture( TextureJob & job, int maxThreads );
+	void addTexture( TextureJob & job );
 	static std::string getTexturePath( const CE2Material::TextureSet * txtSet, int n, std::uint32_t defaultColor = 0 );
 public:
 	ExportGltfMaterials( NifModel * nifModel, tinygltf::Model & gltfModel, int textureMipLevel )
@@ -613,9 +653,22 @@ public:
 	{
 	}
 	void exportMaterial( tinygltf::Material & mat, const std::string & matPath );
+	//! Converts the textures used by the exported materials on multiple threads, and adds them to the model
+	void exportTextures();
+	//! Shows the load, bake and PNG encode times of the textures converted by exportTextures() in one message
+	void reportTextureTimes() const;
 };
 
-DDSTexture16 * ExportGltfMaterials::loadTexture( const std::string_view & txtPath )
+std::string ExportGltfMaterials::findTexture( const std::string & txtPath ) const
+{
+	if ( txtPath.empty() || ( txtPath.length() == 9 && txtPath[0] == '#' ) || mipLevel < 0 )
+		return txtPath;
+	// this may open the archives, and must therefore run on the main thread
+	return nif->findResourceFile( QString::fromStdString( txtPath ), nullptr, nullptr ).toStdString();
+}
+
+DDSTexture16 * ExportGltfMaterials::loadTexture(
+	const std::string & txtPath, const std::string & fullPath, QString & errorMessage )
 {
 	if ( txtPath.length() == 9 && txtPath[0] == '#' ) {
 		std::uint32_t	c = 0;
@@ -631,13 +684,20 @@ DDSTexture16 * ExportGltfMaterials::loadTexture( const std::string_view & txtPat
 	DDSTexture16 *	t = nullptr;
 	try {
 		QByteArray	buf;
-		if ( mipLevel < 0 || !nif->getResourceFile( buf, txtPath ) )
+		if ( mipLevel < 0 )
+			return nullptr;
+		if ( fullPath.empty() ) {
+			errorMessage = QString( "'%1' not found" ).arg( QString::fromStdString( txtPath ) );
+			return nullptr;
+		}
+		if ( !nif->extractResourceFile( buf, fullPath, &errorMessage ) )
 			return nullptr;
 		t = new DDSTexture16(
 				reinterpret_cast< const unsigned char * >( buf.constData() ), size_t( buf.size() ), mipLevel, true );
-	} catch ( FO76UtilsError & ) {
+	} catch ( FO76UtilsError & e ) {
 		delete t;
 		t = nullptr;
+		errorMessage = QString( "'%1': %2" ).arg( QString::fromStdString( txtPath ) ).arg( e.what() );
 	}
 	return t;
 }
@@ -659,158 +719,250 @@ void ExportGltfMaterials::getTexture(
 		texCoordChannel = (unsigned char) ( uvStream->channel > 1 );
 	}
 
+	// the textures are only converted by exportTextures(), once per unique key
 	auto	i = textureMap.find( textureMapKey );
 	if ( i == textureMap.end() ) {
-		// load texture(s) and convert to glTF compatible PNG format
-		QByteArray	imageBuf;
-		int	width = 1;
-		int	height = 1;
-		int	channels = 0;
-		DDSTexture16 *	t1 = nullptr;
-		DDSTexture16 *	t2 = nullptr;
-		try {
-			if ( !txtPath1.empty() && ( t1 = loadTexture( txtPath1 ) ) != nullptr ) {
-				width = t1->getWidth();
-				height = t1->getHeight();
+		TextureJob &	job = textureJobs.emplace_back();
+		job.txtPath1 = txtPath1;
+		job.txtPath2 = txtPath2;
+		job.n = n;
+		job.texCoordMode = texCoordMode;
+		i = textureMap.emplace( textureMapKey, int( textureJobs.size() - 1 ) ).first;
+	}
+
+	textureRefs.push_back( { int( &mat - model.materials.data() ), n, i->second, texCoordChannel } );
+}
+
+void ExportGltfMaterials::bakeTexture( TextureJob & job, int maxThreads )
+{
+	// load texture(s) and convert to glTF compatible PNG format
+	std::unique_ptr< DDSTexture16 >	t1;
+	std::unique_ptr< DDSTexture16 >	t2;
+	int	width = 1;
+	int	height = 1;
+	QElapsedTimer	timer;
+	timer.start();
+	if ( !job.txtPath1.empty() )
+		t1.reset( loadTexture( job.txtPath1, job.fullPath1, job.errorMessage ) );
+	if ( !job.txtPath2.empty() )
+		t2.reset( loadTexture( job.txtPath2, job.fullPath2, job.errorMessage ) );
+	job.loadTime = timer.restart();
+	if ( t1 ) {
+		width = t1->getWidth();
+		height = t1->getHeight();
+	}
+	if ( t2 ) {
+		width = std::max< int >( width, t2->getWidth() );
+		height = std::max< int >( height, t2->getHeight() );
+	}
+	int	n = job.n;
+	int	channels = 0;
+	if ( t1 || t2 )
+		channels = ( n == 0 ? ( !t2 ? 3 : 4 ) : ( n == 3 ? 1 : 3 ) );
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	if ( !channels )
+		return;
+
+	QImage::Format	fmt =
+		( channels <= 1 ? QImage::Format_Grayscale8
+							: ( channels == 3 ? QImage::Format_RGB888 : QImage::Format_RGBA8888 ) );
+	QImage	img( width, height, fmt );
+	size_t	lineBytes = size_t( img.bytesPerLine() );
+	unsigned char *	imgBits = reinterpret_cast< unsigned char * >( img.bits() );
+	float	xScale = 1.0f / float( width );
+	float	xOffset = xScale * 0.5f;
+	float	yScale = 1.0f / float( height );
+	float	yOffset = yScale * 0.5f;
+	bool	f1 = ( t1 && ( t1->getWidth() != width || t1->getHeight() != height ) );
+	bool	f2 = ( t2 && ( t2->getWidth() != width || t2->getHeight() != height ) );
+	DDSTexture16 *	p1 = t1.get();
+	DDSTexture16 *	p2 = t2.get();
+
+	// rows are independent, the source textures are only read
+	parallelFor( size_t( height ), [&]( size_t row ) {
+		int	y = int( row );
+		unsigned char *	imgPtr = imgBits + ( size_t(y) * lineBytes );
+		float	yf = float( y ) * yScale + yOffset;
+		for ( int x = 0; x < width; x++, imgPtr = imgPtr + channels ) {
+			FloatVector4	a( 0.0f, 0.0f, 0.0f, 1.0f );
+			FloatVector4	b( 0.0f, 0.0f, 0.0f, 1.0f );
+			float	xf = float( x ) * xScale + xOffset;
+			if ( p1 )
+				a = ( !f1 ? FloatVector4::convertFloat16( p1->getPixelN(x, y, 0) ) : p1->getPixelB(xf, yf, 0) );
+			if ( p2 )
+				b = ( !f2 ? FloatVector4::convertFloat16( p2->getPixelN(x, y, 0) ) : p2->getPixelB(xf, yf, 0) );
+			switch ( n ) {
+			case 0:
+				// albedo: add alpha channel from opacity texture
+				a[3] = b[0];
+				break;
+			case 1:
+				// normal map: calculate Z (blue) channel and convert to unsigned format
+				a[2] = float( std::sqrt( std::max( 1.0f - a.dotProduct2(a), 0.0f ) ) );
+				a = a * FloatVector4( 0.5f, -0.5f, 0.5f, 0.5f ) + 0.5f;	// invert green channel
+				break;
+			case 2:
+				// PBR map: G = roughness, B = metalness
+				a = FloatVector4( 0.0f, a[0], b[0], 0.0f );
+				break;
 			}
-			if ( !txtPath2.empty() && ( t2 = loadTexture( txtPath2 ) ) != nullptr ) {
-				width = std::max< int >( width, t2->getWidth() );
-				height = std::max< int >( height, t2->getHeight() );
+			std::uint32_t	c = std::uint32_t( a * 255.0f );
+			if ( channels == 3 ) {
+				FileBuffer::writeUInt16Fast( imgPtr, std::uint16_t( c ) );
+				imgPtr[2] = std::uint8_t( c >> 16 );
+			} else if ( channels == 4 ) {
+				FileBuffer::writeUInt32Fast( imgPtr, c );
+			} else {
+				*imgPtr = std::uint8_t( c );
 			}
-			if ( t1 || t2 )
-				channels = ( n == 0 ? ( !t2 ? 3 : 4 ) : ( n == 3 ? 1 : 3 ) );
-			QImage::Format	fmt =
-				( channels <= 1 ? QImage::Format_Grayscale8
-									: ( channels == 3 ? QImage::Format_RGB888 : QImage::Format_RGBA8888 ) );
-			QImage	img( width, height, fmt );
-			size_t	lineBytes = size_t( img.bytesPerLine() );
-			float	xScale = 1.0f / float( width );
-			float	xOffset = xScale * 0.5f;
-			float	yScale = 1.0f / float( height );
-			float	yOffset = yScale * 0.5f;
-			bool	f1 = ( t1 && ( t1->getWidth() != width || t1->getHeight() != height ) );
-			bool	f2 = ( t2 && ( t2->getWidth() != width || t2->getHeight() != height ) );
-			for ( int y = 0; channels > 0 && y < height; y++ ) {
-				unsigned char *	imgPtr = reinterpret_cast< unsigned char * >( img.bits() ) + ( size_t(y) * lineBytes );
-				for ( int x = 0; x < width; x++, imgPtr = imgPtr + channels ) {
-					FloatVector4	a( 0.0f, 0.0f, 0.0f, 1.0f );
-					FloatVector4	b( 0.0f, 0.0f, 0.0f, 1.0f );
-					float	xf = float( x ) * xScale + xOffset;
-					float	yf = float( y ) * yScale + yOffset;
-					if ( t1 )
-						a = ( !f1 ? FloatVector4::convertFloat16( t1->getPixelN(x, y, 0) ) : t1->getPixelB(xf, yf, 0) );
-					if ( t2 )
-						b = ( !f2 ? FloatVector4::convertFloat16( t2->getPixelN(x, y, 0) ) : t2->getPixelB(xf, yf, 0) );
-					switch ( n ) {
-					case 0:
-						// albedo: add alpha channel from opacity texture
-						a[3] = b[0];
-						break;
-					case 1:
-						// normal map: calculate Z (blue) channel and convert to unsigned format
-						a[2] = float( std::sqrt( std::max( 1.0f - a.dotProduct2(a), 0.0f ) ) );
-						a = a * FloatVector4( 0.5f, -0.5f, 0.5f, 0.5f ) + 0.5f;	// invert green channel
-						break;
-					case 2:
-						// PBR map: G = roughness, B = metalness
-						a = FloatVector4( 0.0f, a[0], b[0], 0.0f );
-						break;
-					}
-					std::uint32_t	c = std::uint32_t( a * 255.0f );
-					if ( channels == 3 ) {
-						FileBuffer::writeUInt16Fast( imgPtr, std::uint16_t( c ) );
-						imgPtr[2] = std::uint8_t( c >> 16 );
-					} else if ( channels == 4 ) {
-						FileBuffer::writeUInt32Fast( imgPtr, c );
-					} else {
-						*imgPtr = std::uint8_t( c );
-					}
+		}
+	}, maxThreads );
+	t1.reset();
+	t2.reset();
+	job.bakeTime = timer.restart();
+
+	QBuffer	tmpBuf( &job.imageBuf );
+	tmpBuf.open( QIODevice::WriteOnly );
+	img.save( &tmpBuf, "PNG", 89 );
+	job.encodeTime = timer.elapsed();
+}
+
+void ExportGltfMaterials::addTexture( TextureJob & job )
+{
+	// if a valid image has been created, add it as a glTF buffer view
+	int	bufView = -1;
+	if ( !job.imageBuf.isEmpty() && !model.buffers.empty() ) {
+		bufView = int( model.bufferViews.size() );
+		tinygltf::BufferView &	v = model.bufferViews.emplace_back();
+		v.buffer = int( model.buffers.size() - 1 );
+		std::vector< unsigned char > &	buf = model.buffers.back().data;
+		v.byteOffset = buf.size();
+		v.byteLength = size_t( job.imageBuf.size() );
+		buf.resize( v.byteOffset + v.byteLength );
+		std::memcpy( buf.data() + v.byteOffset, job.imageBuf.data(), v.byteLength );
+	}
+	job.imageBuf = QByteArray();
+
+	int	textureID = -1;
+	if ( bufView >= 0 ) {
+		tinygltf::Image &	img = model.images.emplace_back();
+		img.width = job.width;
+		img.height = job.height;
+		img.component = job.channels;
+		img.bits = 8;
+		img.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+		img.bufferView = bufView;
+		img.mimeType = "image/png";
+		textureID = int( model.textures.size() );
+		model.textures.emplace_back().source = int( model.images.size() - 1 );
+		unsigned char	texCoordMode = job.texCoordMode;
+		if ( texCoordMode ) {
+			int	wrapMode = TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE;
+			if ( !( texCoordMode & 1 ) )
+				wrapMode = TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT;
+			for ( const auto & j : model.samplers ) {
+				if ( j.wrapS == wrapMode ) {
+					model.textures.back().sampler = int( &j - model.samplers.data() );
+					break;
 				}
 			}
-			delete t1;
-			t1 = nullptr;
-			delete t2;
-			t2 = nullptr;
-
-			if ( channels ) {
-				QBuffer	tmpBuf( &imageBuf );
-				tmpBuf.open( QIODevice::WriteOnly );
-				img.save( &tmpBuf, "PNG", 89 );
+			if ( model.textures.back().sampler < 0 ) {
+				model.samplers.emplace_back().wrapS = wrapMode;
+				model.samplers.back().wrapT = wrapMode;
+				model.textures.back().sampler = int( model.samplers.size() - 1 );
 			}
-		} catch ( ... ) {
-			delete t1;
-			delete t2;
-			throw;
 		}
+	}
+	job.textureID = textureID;
+}
 
-		// if a valid image has been created, add it as a glTF buffer view
-		int	bufView = -1;
-		if ( !imageBuf.isEmpty() && !model.buffers.empty() ) {
-			bufView = int( model.bufferViews.size() );
-			tinygltf::BufferView &	v = model.bufferViews.emplace_back();
-			v.buffer = int( model.buffers.size() - 1 );
-			std::vector< unsigned char > &	buf = model.buffers.back().data;
-			v.byteOffset = buf.size();
-			v.byteLength = size_t( imageBuf.size() );
-			buf.resize( v.byteOffset + v.byteLength );
-			std::memcpy( buf.data() + v.byteOffset, imageBuf.data(), v.byteLength );
+void ExportGltfMaterials::exportTextures()
+{
+	if ( textureJobs.empty() )
+		return;
+	QElapsedTimer	timer;
+	timer.start();
+
+	// textures are converted in batches of one per thread, with the remaining threads used for the rows
+	// of each image, so that only the decoded textures and PNG images of one batch are in memory at a time
+	size_t	batchSize = size_t( parallelThreadCount( textureJobs.size() ) );
+	for ( size_t i0 = 0; i0 < textureJobs.size(); i0 += batchSize ) {
+		size_t	n = std::min( batchSize, textureJobs.size() - i0 );
+		int	rowThreads = std::max< int >( parallelThreadCount() / int( n ), 1 );
+		// the worker threads only extract files that have already been found
+		for ( size_t i = 0; i < n; i++ ) {
+			TextureJob &	job = textureJobs[i0 + i];
+			job.fullPath1 = findTexture( job.txtPath1 );
+			job.fullPath2 = findTexture( job.txtPath2 );
 		}
+		parallelFor( n, [this, i0, rowThreads]( size_t i ) {
+			bakeTexture( textureJobs[i0 + i], rowThreads );
+		} );
+
+		// images are added in the order the textures were first used, so that the output does not depend on timing,
+		// addTexture() also frees the PNG buffer
+		for ( size_t i = 0; i < n; i++ )
+			addTexture( textureJobs[i0 + i] );
+	}
 
-		int	textureID = -1;
-		if ( bufView >= 0 ) {
-			tinygltf::Image &	img = model.images.emplace_back();
-			img.width = width;
-			img.height = height;
-			img.component = channels;
-			img.bits = 8;
-			img.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
-			img.bufferView = bufView;
-			img.mimeType = "image/png";
-			textureID = int( model.textures.size() );
-			model.textures.emplace_back().source = int( model.images.size() - 1 );
-			if ( texCoordMode ) {
-				int	wrapMode = TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE;
-				if ( !( texCoordMode & 1 ) )
-					wrapMode = TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT;
-				for ( const auto & j : model.samplers ) {
-					if ( j.wrapS == wrapMode ) {
-						model.textures.back().sampler = int( &j - model.samplers.data() );
-						break;
-					}
-				}
-				if ( model.textures.back().sampler < 0 ) {
-					model.samplers.emplace_back().wrapS = wrapMode;
-					model.samplers.back().wrapT = wrapMode;
-					model.textures.back().sampler = int( model.samplers.size() - 1 );
-				}
-			}
+	for ( const TextureRef & r : textureRefs ) {
+		tinygltf::Material &	mat = model.materials[r.material];
+		int	textureID = textureJobs[r.job].textureID;
+		switch ( r.n ) {
+		case 0:
+			mat.pbrMetallicRoughness.baseColorTexture.index = textureID;
+			mat.pbrMetallicRoughness.baseColorTexture.texCoord = r.texCoordChannel;
+			break;
+		case 1:
+			mat.normalTexture.index = textureID;
+			mat.normalTexture.texCoord = r.texCoordChannel;
+			break;
+		case 2:
+			mat.pbrMetallicRoughness.metallicRoughnessTexture.index = textureID;
+			mat.pbrMetallicRoughness.metallicRoughnessTexture.texCoord = r.texCoordChannel;
+			break;
+		case 3:
+			mat.occlusionTexture.index = textureID;
+			mat.occlusionTexture.texCoord = r.texCoordChannel;
+			break;
+		case 4:
+			mat.emissiveTexture.index = textureID;
+			mat.emissiveTexture.texCoord = r.texCoordChannel;
+			break;
 		}
-
-		i = textureMap.emplace( textureMapKey, textureID ).first;
 	}
 
-	switch ( n ) {
-	case 0:
-		mat.pbrMetallicRoughness.baseColorTexture.index = i->second;
-		mat.pbrMetallicRoughness.baseColorTexture.texCoord = texCoordChannel;
-		break;
-	case 1:
-		mat.normalTexture.index = i->second;
-		mat.normalTexture.texCoord = texCoordChannel;
-		break;
-	case 2:
-		mat.pbrMetallicRoughness.metallicRoughnessTexture.index = i->second;
-		mat.pbrMetallicRoughness.metallicRoughnessTexture.texCoord = texCoordChannel;
-		break;
-	case 3:
-		mat.occlusionTexture.index = i->second;
-		mat.occlusionTexture.texCoord = texCoordChannel;
-		break;
-	case 4:
-		mat.emissiveTexture.index = i->second;
-		mat.emissiveTexture.texCoord = texCoordChannel;
-		break;
+	qint64	loadTime = 0;
+	qint64	bakeTime = 0;
+	qint64	encodeTime = 0;
+	for ( const TextureJob & job : textureJobs ) {
+		loadTime += job.loadTime;
+		bakeTime += job.bakeTime;
+		encodeTime += job.encodeTime;
+		QString	name = QString::fromStdString( job.txtPath1.empty() ? job.txtPath2 : job.txtPath1 );
+		if ( !job.channels ) {
+			textureTimes += QString( "%1: not converted%2\n" )
+							.arg( name ).arg( job.errorMessage.isEmpty() ? QString() : ( ", " + job.errorMessage ) );
+			continue;
+		}
+		textureTimes += QString( "%1 (%2x%3): load %4 ms, bake %5 ms, PNG %6 ms\n" )
+						.arg( name ).arg( job.width ).arg( job.height )
+						.arg( job.loadTime ).arg( job.bakeTime ).arg( job.encodeTime );
 	}
+	textureSummary = tr( "%1 textures converted in %2 ms (load %3 ms, bake %4 ms, PNG %5 ms, summed over all threads)" )
+						.arg( textureJobs.size() ).arg( timer.elapsed() ).arg( loadTime ).arg( bakeTime ).arg( encodeTime );
+
+	textureJobs.clear();
+	textureRefs.clear();
+	textureMap.clear();
+}
+
+void ExportGltfMaterials::reportTextureTimes() const
+{
+	if ( !textureSummary.isEmpty() )
+		Message::info( nullptr, textureSummary, textureTimes );
 }
 
 std::string ExportGltfMaterials::getTexturePath(
@@ -952,8 +1104,10 @@ void exportGltf( const NifModel* nif, const Scene* scene, [[maybe_unused]] const
 
 			matExporter.exportMaterial( mat, name );
 		}
+		matExporter.exportTextures();
 
 		writer.WriteGltfSceneToFile(&model, filename.toStdString(), false, false, true, false);
+		matExporter.reportTextureTimes();
 	}
 
 	if ( gltf.errors.size() == 1 ) {
@@ -980,15 +1134,36 @@ protected:
 			}
 		}
 	};
+	// Vertex data of a primitive, converted to the formats stored in the NIF
+	struct MeshData {
+		bool	haveTriangles = false;
+		std::uint32_t	indicesSize = 0;
+		QVector< Triangle >	triangles;
+		float	scale = 1.0f;
+		QVector< ShortVector3 >	vertices;
+		QVector< HalfVector2 >	uvs[2];
+		QVector< UDecVector4 >	normals;
+		QVector< UDecVector4 >	tangents;
+		QVector< ByteColor4BGRA >	colors;
+		std::vector< BoneWeights >	boneWeights;
+		size_t	weightsPerVertex = 0;
+	};
 	const tinygltf::Model &	model;
 	NifModel *	nif;
 	bool	lodEnabled;
 	std::vector< int >	nodeStack;
+	std::vector< MeshData >	meshData;
+	std::unordered_map< const tinygltf::Primitive *, size_t >	meshDataMap;
 	bool nodeHasMeshes( const tinygltf::Node & node, int d = 0 ) const;
 	static void normalizeFloats( float * p, size_t n, int dataType );
-	template< typename T > bool loadBuffer( std::vector< T > & outBuf, int accessor, int typeRequired );
+	template< typename T > bool loadBuffer( std::vector< T > & outBuf, int accessor, int typeRequired ) const;
+	// Collects the primitives that loadNode() will import
+	void findPrimitives( std::vector< const tinygltf::Primitive * > & primitives, int nodeNum, int d = 0 ) const;
+	// Converts the accessor data of a primitive, does not access the NifModel and is safe to call on multiple threads
+	void decodeMesh( MeshData & d, const tinygltf::Primitive & p ) const;
+	const MeshData & getMeshData( const tinygltf::Primitive & p );
 	void loadSkin( const QPersistentModelIndex & index, const tinygltf::Skin & skin );
-	int loadTriangles( const QModelIndex & index, const tinygltf::Primitive & p );
+	int loadTriangles( const QModelIndex & index, const MeshData & d );
 	void loadSkinnedLODMesh( const QPersistentModelIndex & index, const tinygltf::Primitive & p, int lod );
 	// Returns true if tangent space needs to be calculated
 	bool loadMesh(
@@ -1047,7 +1222,7 @@ void ImportGltf::normalizeFloats( float * p, size_t n, int dataType )
 		*p = *p / scale;
 }
 
-template< typename T > bool ImportGltf::loadBuffer( std::vector< T > & outBuf, int accessor, int typeRequired )
+template< typename T > bool ImportGltf::loadBuffer( std::vector< T > & outBuf, int accessor, int typeRequired ) const
 {
 	if ( accessor < 0 || size_t(accessor) >= model.accessors.size() )
 		return false;
@@ -1122,6 +1297,179 @@ template< typename T > bool ImportGltf::loadBuffer( std::vector< T > & outBuf, i
 	return true;
 }
 
+void ImportGltf::findPrimitives( std::vector< const tinygltf::Primitive * > & primitives, int nodeNum, int d ) const
+{
+	if ( nodeNum < 0 || size_t(nodeNum) >= model.nodes.size() || d >= 1024 )
+		return;
+	const tinygltf::Node &	node = model.nodes[nodeNum];
+	if ( !( node.mesh >= 0 && size_t(node.mesh) < model.meshes.size() ) ) {
+		for ( int i : node.children )
+			findPrimitives( primitives, i, d + 1 );
+		return;
+	}
+	for ( const auto & p : model.meshes[node.mesh].primitives ) {
+		if ( p.mode != TINYGLTF_MODE_TRIANGLES || p.attributes.empty() )
+			continue;
+		if ( p.indices < 0 || size_t(p.indices) >= model.accessors.size() )
+			continue;
+		primitives.push_back( &p );
+	}
+}
+
+void ImportGltf::decodeMesh( MeshData & d, const tinygltf::Primitive & p ) const
+{
+	std::vector< std::uint16_t >	indices;
+	if ( loadBuffer< std::uint16_t >( indices, p.indices, TINYGLTF_TYPE_SCALAR ) ) {
+		d.haveTriangles = true;
+		d.indicesSize = std::uint32_t( indices.size() );
+		qsizetype	numTriangles = qsizetype( indices.size() / 3 );
+		d.triangles.resize( numTriangles );
+		for ( qsizetype i = 0; i < numTriangles; i++ ) {
+			d.triangles[i][0] = indices[i * 3];
+			d.triangles[i][1] = indices[i * 3 + 1];
+			d.triangles[i][2] = indices[i * 3 + 2];
+		}
+	}
+
+	for ( const auto & i : p.attributes ) {
+		if ( i.first == "POSITION" ) {
+			std::vector< float >	positions;
+			if ( !loadBuffer< float >( positions, i.second, TINYGLTF_TYPE_VEC3 ) )
+				continue;
+			qsizetype	numVerts = qsizetype( positions.size() / 3 );
+			if ( !numVerts )
+				continue;
+			float	maxPos = 0.0f;
+			for ( float x : positions )
+				maxPos = std::max( maxPos, float( std::fabs(x) ) );
+			float	scale = 1.0f / 64.0f;
+			while ( maxPos > scale && scale < 16777216.0f )
+				scale = scale + scale;
+			float	invScale = 1.0f / scale;
+			d.scale = scale;
+			d.vertices.resize( numVerts );
+			for ( qsizetype j = 0; j < numVerts; j++ ) {
+				d.vertices[j][0] = positions[j * 3] * invScale;
+				d.vertices[j][1] = positions[j * 3 + 1] * invScale;
+				d.vertices[j][2] = positions[j * 3 + 2] * invScale;
+			}
+		} else if ( i.first == "TEXCOORD_0" || i.first == "TEXCOORD_1" ) {
+			std::vector< float >	uvs;
+			if ( !loadBuffer< float >( uvs, i.second, TINYGLTF_TYPE_VEC2 ) )
+				continue;
+			qsizetype	numUVs = qsizetype( uvs.size() >> 1 );
+			QVector< HalfVector2 > &	uvsVec2 = d.uvs[i.first.c_str()[9] != '0' ? 1 : 0];
+			uvsVec2.resize( numUVs );
+			for ( qsizetype j = 0; j < numUVs; j++ ) {
+				uvsVec2[j][0] = uvs[j * 2];
+				uvsVec2[j][1] = uvs[j * 2 + 1];
+			}
+		} else if ( i.first == "NORMAL" ) {
+			std::vector< float >	normals;
+			if ( !loadBuffer< float >( normals, i.second, TINYGLTF_TYPE_VEC3 ) )
+				continue;
+			qsizetype	numNormals = qsizetype( normals.size() / 3 );
+			d.normals.resize( numNormals );
+			for ( qsizetype j = 0; j < numNormals; j++ ) {
+				auto	normal = FloatVector4::convertVector3( normals.data() + (j * 3) );
+				float	r = normal.dotProduct3( normal );
+				if ( r > 0.0f ) [[likely]] {
+					normal /= float( std::sqrt( r ) );
+					normal[3] = -1.0f / 3.0f;
+				} else {
+					normal = FloatVector4( 0.0f, 0.0f, 1.0f, -1.0f / 3.0f );
+				}
+				normal.convertToFloats( &(d.normals[j][0]) );
+			}
+		} else if ( i.first == "TANGENT" ) {
+			std::vector< float >	tangents;
+			if ( !loadBuffer< float >( tangents, i.second, TINYGLTF_TYPE_VEC4 ) )
+				continue;
+			qsizetype	numTangents = qsizetype( tangents.size() >> 2 );
+			d.tangents.resize( numTangents );
+			for ( qsizetype j = 0; j < numTangents; j++ ) {
+				FloatVector4	tangent( tangents.data() + (j * 4) );
+				float	r = tangent.dotProduct3( tangent );
+				if ( r > 0.0f ) [[likely]] {
+					tangent /= float( std::sqrt( r ) );
+					tangent[3] = ( tangent[3] < 0.0f ? 1.0f : -1.0f );
+				} else {
+					tangent = FloatVector4( 1.0f, 0.0f, 0.0f, -1.0f );
+				}
+				tangent.convertToFloats( &(d.tangents[j][0]) );
+			}
+		} else if ( i.first == "COLOR_0" ) {
+			std::vector< float >	colors;
+			bool	haveAlpha = loadBuffer< float >( colors, i.second, TINYGLTF_TYPE_VEC4 );
+			if ( !haveAlpha && !loadBuffer< float >( colors, i.second, TINYGLTF_TYPE_VEC3 ) )
+				continue;
+			size_t	componentCnt = ( !haveAlpha ? 3 : 4 );
+			qsizetype	numColors = qsizetype( colors.size() / componentCnt );
+			d.colors.resize( numColors );
+			const float *	q = colors.data();
+			for ( qsizetype j = 0; j < numColors; j++, q = q + componentCnt ) {
+				FloatVector4	color;
+				if ( !haveAlpha )
+					color = FloatVector4::convertVector3( q ).blendValues( FloatVector4(1.0f), 0x08 );
+				else
+					color = FloatVector4( q );
+				color.maxValues( FloatVector4(0.0f) ).minValues( FloatVector4(1.0f) );
+				color.convertToFloats( &(d.colors[j][0]) );
+			}
+		} else if ( i.first == "WEIGHTS_0" || i.first == "WEIGHTS_1" ) {
+			std::vector< float >	weights;
+			if ( !loadBuffer< float >( weights, i.second, TINYGLTF_TYPE_VEC4 ) )
+				continue;
+			size_t	numWeights = weights.size() >> 2;
+			if ( numWeights > d.boneWeights.size() )
+				d.boneWeights.resize( numWeights );
+			size_t	offs = ( i.first.c_str()[8] == '0' ? 0 : 4 );
+			for ( size_t j = 0; j < numWeights; j++ ) {
+				FloatVector4	w( weights.data() + (j * 4) );
+				w.maxValues( FloatVector4(0.0f) ).minValues( FloatVector4(1.0f) );
+				w *= 65535.0f;
+				w.roundValues();
+				d.boneWeights[j].weights[offs] = std::uint16_t( w[0] );
+				d.boneWeights[j].weights[offs + 1] = std::uint16_t( w[1] );
+				d.boneWeights[j].weights[offs + 2] = std::uint16_t( w[2] );
+				d.boneWeights[j].weights[offs + 3] = std::uint16_t( w[3] );
+			}
+		} else if ( i.first == "JOINTS_0" || i.first == "JOINTS_1" ) {
+			std::vector< std::uint16_t >	joints;
+			if ( !loadBuffer< std::uint16_t >( joints, i.second, TINYGLTF_TYPE_VEC4 ) )
+				continue;
+			size_t	numJoints = joints.size() >> 2;
+			if ( numJoints > d.boneWeights.size() )
+				d.boneWeights.resize( numJoints );
+			size_t	offs = ( i.first.c_str()[7] == '0' ? 0 : 4 );
+			for ( size_t j = 0; j < numJoints; j++ ) {
+				for ( size_t k = 0; k < 4; k++ )
+					d.boneWeights[j].joints[offs + k] = joints[j * 4 + k];
+			}
+		}
+	}
+
+	for ( const auto & bw : d.boneWeights ) {
+		for ( size_t i = 8; i > 0; i-- ) {
+			if ( bw.weights[i - 1] != 0 ) {
+				d.weightsPerVertex = std::max( d.weightsPerVertex, i );
+				break;
+			}
+		}
+	}
+}
+
+const ImportGltf::MeshData & ImportGltf::getMeshData( const tinygltf::Primitive & p )
+{
+	auto	i = meshDataMap.find( &p );
+	if ( i != meshDataMap.end() )
+		return meshData[i->second];
+	// not found by findPrimitives(), convert it now
+	meshDataMap.emplace( &p, meshData.size() );
+	decodeMesh( meshData.emplace_back(), p );
+	return meshData.back();
+}
+
 void ImportGltf::loadSkin( const QPersistentModelIndex & index, const tinygltf::Skin & skin )
 {
 	QPersistentModelIndex	iSkinBMP = nif->insertNiBlock( "SkinAttach" );
@@ -1214,28 +1562,19 @@ void ImportGltf::loadSkin( const QPersistentModelIndex & index, const tinygltf::
 	}
 }
 
-int ImportGltf::loadTriangles( const QModelIndex & index, const tinygltf::Primitive & p )
+int ImportGltf::loadTriangles( const QModelIndex & index, const MeshData & d )
 {
-	std::vector< std::uint16_t >	indices;
-	if ( !loadBuffer< std::uint16_t >( indices, p.indices, TINYGLTF_TYPE_SCALAR ) )
+	if ( !d.haveTriangles )
 		return -1;
 
-	int	numTriangles = int( indices.size() / 3 );
-	nif->set<quint32>( index, "Indices Size", quint32(indices.size()) );
+	nif->set<quint32>( index, "Indices Size", d.indicesSize );
 	auto	iTriangles = nif->getIndex( index, "Triangles" );
 	if ( iTriangles.isValid() ) {
 		nif->updateArraySize( iTriangles );
-		QVector< Triangle >	triangles;
-		triangles.resize( numTriangles );
-		for ( qsizetype i = 0; i < numTriangles; i++ ) {
-			triangles[i][0] = indices[i * 3];
-			triangles[i][1] = indices[i * 3 + 1];
-			triangles[i][2] = indices[i * 3 + 2];
-		}
-		nif->setArray<Triangle>( iTriangles, triangles );
+		nif->setArray<Triangle>( iTriangles, d.triangles );
 	}
 
-	return numTriangles;
+	return int( d.triangles.size() );
 }
 
 void ImportGltf::loadSkinnedLODMesh( const QPersistentModelIndex & index, const tinygltf::Primitive & p, int lod )
@@ -1252,32 +1591,12 @@ void ImportGltf::loadSkinnedLODMesh( const QPersistentModelIndex & index, const
 	if ( !iMeshData.isValid() )
 		return;
 
-	std::uint32_t	numVerts = nif->get<quint32>( iMeshData, "Num Verts" );
+	const MeshData &	d = getMeshData( p );
+	qsizetype	numVerts = qsizetype( nif->get<quint32>( iMeshData, "Num Verts" ) );
 	bool	invalidAttrSize = false;
-	for ( const auto & i : p.attributes ) {
-		std::vector< float >	attrBuf;
-		if ( i.first == "POSITION" || i.first == "NORMAL" ) {
-			if ( !loadBuffer< float >( attrBuf, i.second, TINYGLTF_TYPE_VEC3 ) )
-				continue;
-			if ( !attrBuf.empty() && attrBuf.size() != ( size_t(numVerts) * 3 ) ) {
-				invalidAttrSize = true;
-				break;
-			}
-		} else if ( i.first == "TEXCOORD_0" || i.first == "TEXCOORD_1" ) {
-			if ( !loadBuffer< float >( attrBuf, i.second, TINYGLTF_TYPE_VEC2 ) )
-				continue;
-			if ( !attrBuf.empty() && attrBuf.size() != ( size_t(numVerts) << 1 ) ) {
-				invalidAttrSize = true;
-				break;
-			}
-		} else if ( i.first == "TANGENT" || i.first == "COLOR_0" ) {
-			if ( !loadBuffer< float >( attrBuf, i.second, TINYGLTF_TYPE_VEC4 ) )
-				continue;
-			if ( !attrBuf.empty() && attrBuf.size() != ( size_t(numVerts) << 2 ) ) {
-				invalidAttrSize = true;
-				break;
-			}
-		}
+	for ( qsizetype n : { d.vertices.size(), d.normals.size(), d.uvs[0].size(), d.uvs[1].size(), d.tangents.size(), d.colors.size() } ) {
+		if ( n > 0 && n != numVerts )
+			invalidAttrSize = true;
 	}
 	if ( invalidAttrSize ) {
 		QMessageBox::warning( nullptr, "NifSkope warning", QString("LOD%1 mesh has inconsistent vertex count with LOD0").arg(lod) );
@@ -1296,7 +1615,7 @@ void ImportGltf::loadSkinnedLODMesh( const QPersistentModelIndex & index, const
 	nif->updateArraySize( iLODMesh );
 	iLODMesh = QModelIndex_child( iLODMesh, lod - 1 );
 	if ( iLODMesh.isValid() )
-		(void) loadTriangles( iLODMesh, p );
+		(void) loadTriangles( iLODMesh, d );
 }
 
 bool ImportGltf::loadMesh(
@@ -1338,7 +1657,8 @@ bool ImportGltf::loadMesh(
 	nif->set<quint32>( iMesh, "Flags", 64 );
 	nif->set<quint32>( iMeshData, "Version", 2 );
 
-	int	numTriangles = loadTriangles( iMeshData, p );
+	const MeshData &	d = getMeshData( p );
+	int	numTriangles = loadTriangles( iMeshData, d );
 	if ( numTriangles < 0 )
 		return false;
 	nif->set<quint32>( iMesh, "Indices Size", quint32(numTriangles) * 3U );
@@ -1346,195 +1666,67 @@ bool ImportGltf::loadMesh(
 	if ( skin >= 0 && size_t(skin) < model.skins.size() )
 		loadSkin( index, model.skins[skin] );
 
-	std::vector< BoneWeights >	boneWeights;
-
-	for ( const auto & i : p.attributes ) {
-		if ( i.first == "POSITION" ) {
-			std::vector< float >	positions;
-			if ( !loadBuffer< float >( positions, i.second, TINYGLTF_TYPE_VEC3 ) )
-				continue;
-			std::uint32_t	numVerts = std::uint32_t( positions.size() / 3 );
-			if ( !numVerts )
-				continue;
-			float	maxPos = 0.0f;
-			for ( float x : positions )
-				maxPos = std::max( maxPos, float( std::fabs(x) ) );
-			float	scale = 1.0f / 64.0f;
-			while ( maxPos > scale && scale < 16777216.0f )
-				scale = scale + scale;
-			float	invScale = 1.0f / scale;
-			nif->set<float>( iMeshData, "Scale", scale );
-			nif->set<quint32>( iMeshData, "Num Verts", numVerts );
-			nif->set<quint32>( iMesh, "Num Verts", numVerts );
-			auto	iVertices = nif->getIndex( iMeshData, "Vertices" );
-			if ( iVertices.isValid() ) {
-				nif->updateArraySize( iVertices );
-				QVector< ShortVector3 >	vertices;
-				vertices.resize( qsizetype(numVerts) );
-				for ( qsizetype j = 0; j < qsizetype(numVerts); j++ ) {
-					vertices[j][0] = positions[j * 3] * invScale;
-					vertices[j][1] = positions[j * 3 + 1] * invScale;
-					vertices[j][2] = positions[j * 3 + 2] * invScale;
-				}
-				nif->setArray<ShortVector3>( iVertices, vertices );
-			}
-		} else if ( i.first == "TEXCOORD_0" || i.first == "TEXCOORD_1" ) {
-			std::vector< float >	uvs;
-			if ( !loadBuffer< float >( uvs, i.second, TINYGLTF_TYPE_VEC2 ) )
-				continue;
-			std::uint32_t	numUVs = std::uint32_t( uvs.size() >> 1 );
-			if ( !numUVs )
-				continue;
-			bool	isUV2 = ( i.first.c_str()[9] != '0' );
-			nif->set<quint32>( iMeshData, ( !isUV2 ? "Num UVs" : "Num UVs 2" ), numUVs );
-			auto	iUVs = nif->getIndex( iMeshData, ( !isUV2 ? "UVs" : "UVs 2" ) );
-			if ( iUVs.isValid() ) {
-				nif->updateArraySize( iUVs );
-				QVector< HalfVector2 >	uvsVec2;
-				uvsVec2.resize( qsizetype(numUVs) );
-				for ( qsizetype j = 0; j < qsizetype(numUVs); j++ ) {
-					uvsVec2[j][0] = uvs[j * 2];
-					uvsVec2[j][1] = uvs[j * 2 + 1];
-				}
-				nif->setArray<HalfVector2>( iUVs, uvsVec2 );
-			}
-		} else if ( i.first == "NORMAL" ) {
-			std::vector< float >	normals;
-			if ( !loadBuffer< float >( normals, i.second, TINYGLTF_TYPE_VEC3 ) )
-				continue;
-			std::uint32_t	numNormals = std::uint32_t( normals.size() / 3 );
-			if ( !numNormals )
-				continue;
-			nif->set<quint32>( iMeshData, "Num Normals", numNormals );
-			auto	iNormals = nif->getIndex( iMeshData, "Normals" );
-			if ( iNormals.isValid() ) {
-				nif->updateArraySize( iNormals );
-				QVector< UDecVector4 >	normalsVec4;
-				normalsVec4.resize( qsizetype(numNormals) );
-				for ( qsizetype j = 0; j < qsizetype(numNormals); j++ ) {
-					auto	normal = FloatVector4::convertVector3( normals.data() + (j * 3) );
-					float	r = normal.dotProduct3( normal );
-					if ( r > 0.0f ) [[likely]] {
-						normal /= float( std::sqrt( r ) );
-						normal[3] = -1.0f / 3.0f;
-					} else {
-						normal = FloatVector4( 0.0f, 0.0f, 1.0f, -1.0f / 3.0f );
-					}
-					normal.convertToFloats( &(normalsVec4[j][0]) );
-				}
-				nif->setArray<UDecVector4>( iNormals, normalsVec4 );
-			}
-		} else if ( i.first == "TANGENT" ) {
-			std::vector< float >	tangents;
-			if ( !loadBuffer< float >( tangents, i.second, TINYGLTF_TYPE_VEC4 ) )
-				continue;
-			std::uint32_t	numTangents = std::uint32_t( tangents.size() >> 2 );
-			if ( !numTangents )
-				continue;
-			nif->set<quint32>( iMeshData, "Num Tangents", numTangents );
-			auto	iTangents = nif->getIndex( iMeshData, "Tangents" );
-			if ( iTangents.isValid() ) {
-				nif->updateArraySize( iTangents );
-				QVector< UDecVector4 >	tangentsVec4;
-				tangentsVec4.resize( qsizetype(numTangents) );
-				for ( qsizetype j = 0; j < qsizetype(numTangents); j++ ) {
-					FloatVector4	tangent( tangents.data() + (j * 4) );
-					float	r = tangent.dotProduct3( tangent );
-					if ( r > 0.0f ) [[likely]] {
-						tangent /= float( std::sqrt( r ) );
-						tangent[3] = ( tangent[3] < 0.0f ? 1.0f : -1.0f );
-					} else {
-						tangent = FloatVector4( 1.0f, 0.0f, 0.0f, -1.0f );
-					}
-					tangent.convertToFloats( &(tangentsVec4[j][0]) );
-				}
-				nif->setArray<UDecVector4>( iTangents, tangentsVec4 );
-			}
-		} else if ( i.first == "COLOR_0" ) {
-			std::vector< float >	colors;
-			bool	haveAlpha = loadBuffer< float >( colors, i.second, TINYGLTF_TYPE_VEC4 );
-			if ( !haveAlpha && !loadBuffer< float >( colors, i.second, TINYGLTF_TYPE_VEC3 ) )
-				continue;
-			size_t	componentCnt = ( !haveAlpha ? 3 : 4 );
-			std::uint32_t	numColors = std::uint32_t( colors.size() / componentCnt );
-			if ( !numColors )
-				continue;
-			nif->set<quint32>( iMeshData, "Num Vertex Colors", numColors );
-			auto	iColors = nif->getIndex( iMeshData, "Vertex Colors" );
-			if ( iColors.isValid() ) {
-				nif->updateArraySize( iColors );
-				QVector< ByteColor4BGRA >	colorsVec4;
-				colorsVec4.resize( qsizetype(numColors) );
-				const float *	q = colors.data();
-				for ( size_t j = 0; j < numColors; j++, q = q + componentCnt ) {
-					FloatVector4	color;
-					if ( !haveAlpha )
-						color = FloatVector4::convertVector3( q ).blendValues( FloatVector4(1.0f), 0x08 );
-					else
-						color = FloatVector4( q );
-					color.maxValues( FloatVector4(0.0f) ).minValues( FloatVector4(1.0f) );
-					color.convertToFloats( &(colorsVec4[qsizetype(j)][0]) );
-				}
-				nif->setArray<ByteColor4BGRA>( iColors, colorsVec4 );
-			}
-		} else if ( i.first == "WEIGHTS_0" || i.first == "WEIGHTS_1" ) {
-			std::vector< float >	weights;
-			if ( !loadBuffer< float >( weights, i.second, TINYGLTF_TYPE_VEC4 ) )
-				continue;
-			size_t	numWeights = weights.size() >> 2;
-			if ( numWeights > boneWeights.size() )
-				boneWeights.resize( numWeights );
-			size_t	offs = ( i.first.c_str()[8] == '0' ? 0 : 4 );
-			for ( size_t j = 0; j < numWeights; j++ ) {
-				FloatVector4	w( weights.data() + (j * 4) );
-				w.maxValues( FloatVector4(0.0f) ).minValues( FloatVector4(1.0f) );
-				w *= 65535.0f;
-				w.roundValues();
-				boneWeights[j].weights[offs] = std::uint16_t( w[0] );
-				boneWeights[j].weights[offs + 1] = std::uint16_t( w[1] );
-				boneWeights[j].weights[offs + 2] = std::uint16_t( w[2] );
-				boneWeights[j].weights[offs + 3] = std::uint16_t( w[3] );
-			}
-		} else if ( i.first == "JOINTS_0" || i.first == "JOINTS_1" ) {
-			std::vector< std::uint16_t >	joints;
-			if ( !loadBuffer< std::uint16_t >( joints, i.second, TINYGLTF_TYPE_VEC4 ) )
-				continue;
-			size_t	numJoints = joints.size() >> 2;
-			if ( numJoints > boneWeights.size() )
-				boneWeights.resize( numJoints );
-			size_t	offs = ( i.first.c_str()[7] == '0' ? 0 : 4 );
-			for ( size_t j = 0; j < numJoints; j++ ) {
-				for ( size_t k = 0; k < 4; k++ )
-					boneWeights[j].joints[offs + k] = joints[j * 4 + k];
-			}
+	if ( !d.vertices.isEmpty() ) {
+		quint32	numVerts = quint32( d.vertices.size() );
+		nif->set<float>( iMeshData, "Scale", d.scale );
+		nif->set<quint32>( iMeshData, "Num Verts", numVerts );
+		nif->set<quint32>( iMesh, "Num Verts", numVerts );
+		auto	iVertices = nif->getIndex( iMeshData, "Vertices" );
+		if ( iVertices.isValid() ) {
+			nif->updateArraySize( iVertices );
+			nif->setArray<ShortVector3>( iVertices, d.vertices );
 		}
 	}
-
-	if ( !boneWeights.empty() ) {
-		size_t	weightsPerVertex = 0;
-		for ( const auto & bw : boneWeights ) {
-			for ( size_t i = 8; i > 0; i-- ) {
-				if ( bw.weights[i - 1] != 0 ) {
-					weightsPerVertex = std::max( weightsPerVertex, i );
-					break;
-				}
-			}
+	for ( int i = 0; i < 2; i++ ) {
+		if ( d.uvs[i].isEmpty() )
+			continue;
+		nif->set<quint32>( iMeshData, ( !i ? "Num UVs" : "Num UVs 2" ), quint32( d.uvs[i].size() ) );
+		auto	iUVs = nif->getIndex( iMeshData, ( !i ? "UVs" : "UVs 2" ) );
+		if ( iUVs.isValid() ) {
+			nif->updateArraySize( iUVs );
+			nif->setArray<HalfVector2>( iUVs, d.uvs[i] );
 		}
-		if ( weightsPerVertex > 0 ) {
-			size_t	numWeights = boneWeights.size() * weightsPerVertex;
-			nif->set<quint32>( iMeshData, "Weights Per Vertex", quint32(weightsPerVertex) );
-			nif->set<quint32>( iMeshData, "Num Weights", quint32(numWeights) );
-			auto	iWeights = nif->getIndex( iMeshData, "Weights" );
-			if ( iWeights.isValid() ) {
-				nif->updateArraySize( iWeights );
-				NifItem *	weightsItem = nif->getItem( iWeights );
-				for ( size_t i = 0; weightsItem && i < boneWeights.size(); i++ ) {
-					for ( size_t j = 0; j < weightsPerVertex; j++ ) {
-						auto	weightItem = weightsItem->child( int(i * weightsPerVertex + j) );
-						if ( weightItem ) {
-							nif->set<quint16>( weightItem->child( 0 ), boneWeights[i].joints[j] );
-							nif->set<quint16>( weightItem->child( 1 ), boneWeights[i].weights[j] );
-						}
+	}
+	if ( !d.normals.isEmpty() ) {
+		nif->set<quint32>( iMeshData, "Num Normals", quint32( d.normals.size() ) );
+		auto	iNormals = nif->getIndex( iMeshData, "Normals" );
+		if ( iNormals.isValid() ) {
+			nif->updateArraySize( iNormals );
+			nif->setArray<UDecVector4>( iNormals, d.normals );
+		}
+	}
+	if ( !d.tangents.isEmpty() ) {
+		nif->set<quint32>( iMeshData, "Num Tangents", quint32( d.tangents.size() ) );
+		auto	iTangents = nif->getIndex( iMeshData, "Tangents" );
+		if ( iTangents.isValid() ) {
+			nif->updateArraySize( iTangents );
+			nif->setArray<UDecVector4>( iTangents, d.tangents );
+		}
+	}
+	if ( !d.colors.isEmpty() ) {
+		nif->set<quint32>( iMeshData, "Num Vertex Colors", quint32( d.colors.size() ) );
+		auto	iColors = nif->getIndex( iMeshData, "Vertex Colors" );
+		if ( iColors.isValid() ) {
+			nif->updateArraySize( iColors );
+			nif->setArray<ByteColor4BGRA>( iColors, d.colors );
+		}
+	}
+
+	if ( d.weightsPerVertex > 0 ) {
+		size_t	weightsPerVertex = d.weightsPerVertex;
+		size_t	numWeights = d.boneWeights.size() * weightsPerVertex;
+		nif->set<quint32>( iMeshData, "Weights Per Vertex", quint32(weightsPerVertex) );
+		nif->set<quint32>( iMeshData, "Num Weights", quint32(numWeights) );
+		auto	iWeights = nif->getIndex( iMeshData, "Weights" );
+		if ( iWeights.isValid() ) {
+			nif->updateArraySize( iWeights );
+			NifItem *	weightsItem = nif->getItem( iWeights );
+			for ( size_t i = 0; weightsItem && i < d.boneWeights.size(); i++ ) {
+				for ( size_t j = 0; j < weightsPerVertex; j++ ) {
+					auto	weightItem = weightsItem->child( int(i * weightsPerVertex + j) );
+					if ( weightItem ) {
+						nif->set<quint16>( weightItem->child( 0 ), d.boneWeights[i].joints[j] );
+						nif->set<quint16>( weightItem->child( 1 ), d.boneWeights[i].weights[j] );
 					}
 				}
 			}
@@ -1692,15 +1884,34 @@ void ImportGltf::loadNode( const QPersistentModelIndex & index, int nodeNum, boo
 
 void ImportGltf::importModel( const QPersistentModelIndex & iBlock )
 {
-	nif->setState( BaseModel::Processing );
+	std::vector< int >	rootNodes;
 	if ( model.scenes.empty() ) {
-		loadNode( iBlock, 0, true );
+		rootNodes.push_back( 0 );
 	} else {
-		for ( const auto & i : model.scenes ) {
-			for ( int j : i.nodes )
-				loadNode( iBlock, j, true );
-		}
+		for ( const auto & i : model.scenes )
+			rootNodes.insert( rootNodes.end(), i.nodes.begin(), i.nodes.end() );
 	}
+
+	// convert the vertex data of all meshes on multiple threads first, the blocks are created serially
+	std::vector< const tinygltf::Primitive * >	primitives;
+	for ( int i : rootNodes )
+		findPrimitives( primitives, i );
+	size_t	n = 0;
+	for ( const tinygltf::Primitive * p : primitives ) {
+		if ( meshDataMap.emplace( p, n ).second )
+			primitives[n++] = p;
+	}
+	primitives.resize( n );
+	meshData.resize( n );
+	parallelFor( n, [this, &primitives]( size_t i ) {
+		decodeMesh( meshData[i], *( primitives[i] ) );
+	} );
+
+	nif->setState( BaseModel::Processing );
+	bool	oldHoldUpdates = nif->holdUpdates( true );
+	for ( int i : rootNodes )
+		loadNode( iBlock, i, true );
+	nif->holdUpdates( oldHoldUpdates );
 	nif->updateHeader();
 	nif->restoreState();
 }
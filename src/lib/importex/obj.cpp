@@ -39,6 +39,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "qtcompat.h"
 
 #include "lib/nvtristripwrapper.h"
+#include "lib/parallel.h"
 
 #include <QApplication>
 #include <QDebug>
@@ -49,6 +50,13 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QSettings>
 #include <QTextStream>
 
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
 #define tr( x ) QApplication::tr( x )
 
 
@@ -61,40 +69,142 @@ QRegularExpression objCullRegExp;
  *  .OBJ EXPORT
  */
 
-static void writeData( const NifModel * nif, const QModelIndex & iData, QTextStream & obj, int ofs[1], Transform t )
+//! Formatted shapes are collected into blocks of this size before writing them to the file
+static const size_t objWriteBufferSize = 4 << 20;
+
+//! Geometry of one shape, collected from the model and formatted on a worker thread
+struct ObjExportMesh
+{
+	//! Comments, group and material lines written before the data
+	std::string	header;
+	QVector<Vector3>	verts;
+	QVector<ByteColor4>	colors;
+	QVector<Vector2>	texco;
+	QVector<Vector3>	norms;
+	QVector<Triangle>	tris;
+	Transform	t;
+	int	ofs[3];
+	//! Formatted output
+	std::string	text;
+
+	void format();
+};
+
+static inline void appendObjFloat( std::string & s, float v )
+{
+	char	buf[32];
+	s += ' ';
+	s.append( buf, std::to_chars( buf, buf + sizeof( buf ), v ).ptr );
+}
+
+static inline void appendObjInt( std::string & s, int v )
+{
+	char	buf[16];
+	s.append( buf, std::to_chars( buf, buf + sizeof( buf ), v ).ptr );
+}
+
+void ObjExportMesh::format()
+{
+	text.clear();
+	text.reserve( header.size() + size_t( verts.size() + texco.size() + norms.size() ) * 40 + size_t( tris.size() ) * 48 );
+	text += header;
+
+	for ( qsizetype i = 0; i < verts.size(); i++ ) {
+		Vector3	v = t * verts.at( i );
+		text += 'v';
+		appendObjFloat( text, v[0] );
+		appendObjFloat( text, v[1] );
+		appendObjFloat( text, v[2] );
+		if ( i < colors.size() ) {
+			const ByteColor4 &	c = colors.at( i );
+			char	buf[32];
+			for ( int j = 0; j < 3; j++ ) {
+				text += ' ';
+				text.append( buf, std::to_chars( buf, buf + sizeof( buf ), c[j], std::chars_format::general, 5 ).ptr );
+			}
+		}
+		text += "\r\n";
+	}
+
+	for ( const Vector2 & c : texco ) {
+		text += "vt";
+		appendObjFloat( text, c[0] );
+		appendObjFloat( text, 1.0f - c[1] );
+		text += "\r\n";
+	}
+
+	for ( Vector3 n : norms ) {
+		n = t.rotation * n;
+		text += "vn";
+		appendObjFloat( text, n[0] );
+		appendObjFloat( text, n[1] );
+		appendObjFloat( text, n[2] );
+		text += "\r\n";
+	}
+
+	for ( const Triangle & tri : tris ) {
+		text += 'f';
+
+		for ( int p = 0; p < 3; p++ ) {
+			text += ' ';
+			appendObjInt( text, ofs[0] + tri[p] );
+
+			if ( norms.count() ) {
+				if ( texco.count() ) {
+					text += '/';
+					appendObjInt( text, ofs[1] + tri[p] );
+				} else {
+					text += '/';
+				}
+				text += '/';
+				appendObjInt( text, ofs[2] + tri[p] );
+			} else if ( texco.count() ) {
+				text += '/';
+				appendObjInt( text, ofs[1] + tri[p] );
+			}
+		}
+
+		text += "\r\n";
+	}
+
+	// the source data is no longer needed
+	verts = QVector<Vector3>();
+	colors = QVector<ByteColor4>();
+	texco = QVector<Vector2>();
+	norms = QVector<Vector3>();
+	tris = QVector<Triangle>();
+}
+
+static ObjExportMesh & addMesh( std::vector<ObjExportMesh> & obj, const std::string & header, const int ofs[3], const Transform & t )
+{
+	ObjExportMesh &	m = obj.emplace_back();
+	m.header = header;
+	m.t = t;
+	m.ofs[0] = ofs[0];
+	m.ofs[1] = ofs[1];
+	m.ofs[2] = ofs[2];
+	return m;
+}
+
+static void writeData( const NifModel * nif, const QModelIndex & iData, std::vector<ObjExportMesh> & obj, const std::string & header, int ofs[1], Transform t )
 {
 	// copy vertices
 
 	if ( nif->getBSVersion() < 100 ) {
-		QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
-		foreach( Vector3 v, verts )
-		{
-			v = t * v;
-			obj << "v " << qSetRealNumberPrecision( 17 ) << v[0] << " " << v[1] << " " << v[2] << "\r\n";
-		}
+		ObjExportMesh &	m = addMesh( obj, header, ofs, t );
+		m.verts = nif->getArray<Vector3>( iData, "Vertices" );
 
 		// copy texcoords
 
 		QModelIndex iUV = nif->getIndex( iData, "UV Sets" );
-		QVector<Vector2> texco = nif->getArray<Vector2>( QModelIndex_child( iUV, 0, 0 ) );
-		foreach( Vector2 t, texco )
-		{
-			obj << "vt " << t[0] << " " << 1.0 - t[1] << "\r\n";
-		}
+		m.texco = nif->getArray<Vector2>( QModelIndex_child( iUV, 0, 0 ) );
 
 		// copy normals
 
-		QVector<Vector3> norms = nif->getArray<Vector3>( iData, "Normals" );
-		foreach( Vector3 n, norms )
-		{
-			n = t.rotation * n;
-			obj << "vn " << n[0] << " " << n[1] << " " << n[2] << "\r\n";
-		}
+		m.norms = nif->getArray<Vector3>( iData, "Normals" );
 
 		// get the triangles
 
-		QVector<Triangle> tris;
-
 		QModelIndex iPoints = nif->getIndex( iData, "Points" );
 
 		if ( iPoints.isValid() ) {
@@ -103,109 +213,46 @@ static void writeData( const NifModel * nif, const QModelIndex & iData, QTextStr
 			for ( int r = 0; r < nif->rowCount( iPoints ); r++ )
 				strips.append( nif->getArray<quint16>( QModelIndex_child( iPoints, r, 0 ) ) );
 
-			tris = triangulate( strips );
+			m.tris = triangulate( strips );
 		} else {
-			tris = nif->getArray<Triangle>( iData, "Triangles" );
+			m.tris = nif->getArray<Triangle>( iData, "Triangles" );
 		}
 
-		// write the triangles
-
-		foreach( Triangle t, tris )
-		{
-			obj << "f";
-
-			for ( int p = 0; p < 3; p++ ) {
-				obj << " " << ofs[0] + t[p];
-
-				if ( norms.count() )
-					if ( texco.count() )
-						obj << "/" << ofs[1] + t[p] << "/" << ofs[2] + t[p];
-					else
-						obj << "//" << ofs[2] + t[p];
-
-
-				else if ( texco.count() )
-					obj << "/" << ofs[1] + t[p];
-			}
-
-			obj << "\r\n";
-		}
-
-		ofs[0] += verts.count();
-		ofs[1] += texco.count();
-		ofs[2] += norms.count();
+		ofs[0] += m.verts.count();
+		ofs[1] += m.texco.count();
+		ofs[2] += m.norms.count();
 	} else {
 		auto iVertData = nif->getIndex( iData, "Vertex Data" );
 		if ( !iVertData.isValid() )
 			return;
 
-		QVector<Vector3> verts;
-		QVector<Vector2> coords;
-		QVector<Vector3> norms;
-		QVector<ByteColor4> colors;
+		ObjExportMesh &	m = addMesh( obj, header, ofs, t );
 
 		auto numVerts = nif->get<int>( iData, "Num Vertices" );
+		m.verts.reserve( numVerts );
+		m.texco.reserve( numVerts );
+		m.norms.reserve( numVerts );
 		for ( int i = 0; i < numVerts; i++ ) {
 			auto idx = nif->index( i, 0, iVertData );
 
-			verts += nif->get<Vector3>( idx, "Vertex" );
-			coords += nif->get<HalfVector2>( idx, "UV" );
-			norms += nif->get<ByteVector3>( idx, "Normal" );
+			m.verts += nif->get<Vector3>( idx, "Vertex" );
+			m.texco += nif->get<HalfVector2>( idx, "UV" );
+			m.norms += nif->get<ByteVector3>( idx, "Normal" );
 			QModelIndex	iColors = nif->getIndex( idx, "Vertex Colors" );
 			if ( iColors.isValid() )
-				colors += nif->get<ByteColor4>( iColors );
+				m.colors += nif->get<ByteColor4>( iColors );
 		}
 
-		for ( Vector3 & v : verts ) {
-			v = t * v;
-			obj << "v " << qSetRealNumberPrecision( 17 ) << v[0] << " " << v[1] << " " << v[2];
-			qsizetype	i = qsizetype( &v - verts.constData() );
-			if ( i < colors.size() ) {
-				ByteColor4	c = colors.at( i );
-				obj << qSetRealNumberPrecision( 5 ) << " " << c[0] << " " << c[1] << " " << c[2];
-			}
-			obj << "\r\n";
-		}
+		m.tris = nif->getArray<Triangle>( iData, "Triangles" );
 
-		for ( Vector2 & c : coords ) {
-			obj << "vt " << c[0] << " " << 1.0 - c[1] << "\r\n";
-		}
-
-		for ( Vector3 & n : norms ) {
-			n = t.rotation * n;
-			obj << "vn " << n[0] << " " << n[1] << " " << n[2] << "\r\n";
-		}
-
-		auto tris = nif->getArray<Triangle>( iData, "Triangles" );
-
-		for ( const Triangle & t : tris ) {
-			obj << "f";
-
-			for ( int p = 0; p < 3; p++ ) {
-				obj << " " << ofs[0] + t[p];
-
-				if ( norms.count() )
-					if ( coords.count() )
-						obj << "/" << ofs[1] + t[p] << "/" << ofs[2] + t[p];
-					else
-						obj << "//" << ofs[2] + t[p];
-
-
-				else if ( coords.count() )
-					obj << "/" << ofs[1] + t[p];
-			}
-
-			obj << "\r\n";
-		}
-
-		ofs[0] += verts.count();
-		ofs[1] += coords.count();
-		ofs[2] += norms.count();
+		ofs[0] += m.verts.count();
+		ofs[1] += m.texco.count();
+		ofs[2] += m.norms.count();
 	}
 
 }
 
-static void writeShape( const NifModel * nif, const QModelIndex & iShape, QTextStream & obj, QTextStream & mtl, int ofs[], Transform t )
+static void writeShape( const NifModel * nif, const QModelIndex & iShape, std::vector<ObjExportMesh> & obj, QTextStream & mtl, int ofs[], Transform t )
 {
 	QString name = nif->get<QString>( iShape, "Name" );
 	QString matn = name, map_Kd, map_Kn, map_Ks, map_Ns, map_d, disp, decal, bump;
@@ -240,8 +287,8 @@ static void writeShape( const NifModel * nif, const QModelIndex & iShape, QTextS
 			QModelIndex iSource = nif->getBlockIndex( nif->getLink( iProp, "Image" ), "NiImage" );
 			map_Kd = TexCache::find( nif->get<QString>( iSource, "File Name" ) );
 		} else if ( nif->isNiBlock( iProp, "NiSkinInstance" ) ) {
-			QMessageBox::warning(
-				0,
+			// Message::append() also works in the command line benchmark, which has no widgets
+			Message::append(
 				"OBJ Export Warning",
 				QString( "The shape " ) + name + QString( " is skinned, but the "
 					"obj format does not support skinning. This mesh will be "
@@ -313,15 +360,15 @@ static void writeShape( const NifModel * nif, const QModelIndex & iShape, QTextS
 	if ( !bump.isEmpty() )
 		mtl << "bump " << decal << "\r\n";
 
-	obj << "\r\n# " << name << "\r\n\r\ng " << name << "\r\n" << "usemtl " << matn << "\r\n\r\n";
+	std::string header = QString( "\r\n# %1\r\n\r\ng %1\r\nusemtl %2\r\n\r\n" ).arg( name, matn ).toStdString();
 
 	if ( nif->getBSVersion() < 100 )
-		writeData( nif, nif->getBlockIndex( nif->getLink( iShape, "Data" ) ), obj, ofs, t );
+		writeData( nif, nif->getBlockIndex( nif->getLink( iShape, "Data" ) ), obj, header, ofs, t );
 	else
-		writeData( nif, iShape, obj, ofs, t );
+		writeData( nif, iShape, obj, header, ofs, t );
 }
 
-static void writeParent( const NifModel * nif, const QModelIndex & iNode, QTextStream & obj, QTextStream & mtl, int ofs[], Transform t )
+static void writeParent( const NifModel * nif, const QModelIndex & iNode, std::vector<ObjExportMesh> & obj, QTextStream & mtl, int ofs[], Transform t )
 {
 	// export culling
 	if ( objCulling && !objCullRegExp.pattern().isEmpty() && nif->get<QString>( iNode, "Name" ).contains( objCullRegExp ) )
@@ -359,12 +406,11 @@ static void writeParent( const NifModel * nif, const QModelIndex & iNode, QTextS
 
 						if ( nif->isNiBlock( iData, "hkPackedNiTriStripsData" ) ) {
 							bt = t * bt;
-							obj << "\r\n# bhkPackedNiTriStripsShape\r\n\r\ng collision\r\n" << "usemtl collision\r\n\r\n";
+							ObjExportMesh &	m = addMesh( obj, "\r\n# bhkPackedNiTriStripsShape\r\n\r\ng collision\r\nusemtl collision\r\n\r\n", ofs, bt );
 							QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
-							foreach ( Vector3 v, verts ) {
+							m.verts = verts;
+							for ( Vector3 & v : verts )
 								v = bt * v;
-								obj << "v " << v[0] << " " << v[1] << " " << v[2] << "\r\n";
-							}
 
 							QModelIndex iTris = nif->getIndex( iData, "Triangles" );
 
@@ -381,11 +427,7 @@ static void writeParent( const NifModel * nif, const QModelIndex & iNode, QTextS
 
 								bool flip = Vector3::dotproduct( n, fn ) < 0;
 
-								obj << "f"
-								    << " " << tri[0] + ofs[0]
-								    << " " << tri[ flip ? 2 : 1 ] + ofs[0]
-								    << " " << tri[ flip ? 1 : 2 ] + ofs[0]
-								    << "\r\n";
+								m.tris.append( Triangle( tri[0], tri[ flip ? 2 : 1 ], tri[ flip ? 1 : 2 ] ) );
 							}
 
 							ofs[0] += verts.count();
@@ -393,17 +435,101 @@ static void writeParent( const NifModel * nif, const QModelIndex & iNode, QTextS
 					}
 				} else if ( nif->isNiBlock( iShape, "bhkNiTriStripsShape" ) ) {
 					bt.scale = 1;
-					obj << "\r\n# bhkNiTriStripsShape\r\n\r\ng collision\r\n" << "usemtl collision\r\n\r\n";
+					std::string header = "\r\n# bhkNiTriStripsShape\r\n\r\ng collision\r\nusemtl collision\r\n\r\n";
 					QModelIndex iStrips = nif->getIndex( iShape, "Strips Data" );
 
-					for ( int r = 0; r < nif->rowCount( iStrips ); r++ )
-						writeData( nif, nif->getBlockIndex( nif->getLink( QModelIndex_child( iStrips, r, 0 ) ), "NiTriStripsData" ), obj, ofs, t * bt );
+					for ( int r = 0; r < nif->rowCount( iStrips ); r++ ) {
+						size_t n = obj.size();
+						writeData( nif, nif->getBlockIndex( nif->getLink( QModelIndex_child( iStrips, r, 0 ) ), "NiTriStripsData" ), obj, header, ofs, t * bt );
+						if ( obj.size() > n )
+							header.clear();
+					}
 				}
 			}
 		}
 	}
 }
 
+//! Writes the shapes under the root blocks to 'fname'.obj and 'fname'.mtl, returns false on error
+static bool writeObjFiles( const NifModel * nif, const QList<int> & roots, QString fname )
+{
+	QFile fobj( fname + ".obj" );
+
+	if ( !fobj.open( QIODevice::WriteOnly ) ) {
+		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fobj.fileName() );
+		return false;
+	}
+
+	QFile fmtl( fname + ".mtl" );
+
+	if ( !fmtl.open( QIODevice::WriteOnly ) ) {
+		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fmtl.fileName() );
+		return false;
+	}
+
+	fname = fmtl.fileName();
+	int i = fname.lastIndexOf( "/" );
+
+	if ( i >= 0 )
+		fname = fname.remove( 0, i + 1 );
+
+	QTextStream smtl( &fmtl );
+
+	//--Translate NIF structure into file structure --//
+
+	std::vector<ObjExportMesh> meshes;
+	int ofs[3] = {
+		1, 1, 1
+	};
+	foreach ( int l, roots ) {
+		QModelIndex iBlock = nif->getBlockIndex( l );
+
+		if ( nif->blockInherits( iBlock, "NiNode" ) )
+			writeParent( nif, iBlock, meshes, smtl, ofs, Transform() );
+		else if ( nif->isNiBlock( iBlock, { "NiTriShape", "NiTriStrips" } ) )
+			writeShape( nif, iBlock, meshes, smtl, ofs, Transform() );
+	}
+
+	// Format the shapes in parallel, then write them in order
+	parallelFor( meshes.size(), [&meshes]( size_t i ) {
+		meshes[i].format();
+	} );
+
+	QByteArray header = QString( "# exported with NifSkope\r\n\r\nmtllib %1\r\n" ).arg( fname ).toUtf8();
+	bool writeOk = ( fobj.write( header ) == header.size() );
+
+	std::string buf;
+	for ( ObjExportMesh & m : meshes ) {
+		if ( buf.size() + m.text.size() > objWriteBufferSize && !buf.empty() ) {
+			writeOk = writeOk && ( fobj.write( buf.data(), qint64( buf.size() ) ) == qint64( buf.size() ) );
+			buf.clear();
+		}
+		if ( m.text.size() >= objWriteBufferSize ) {
+			writeOk = writeOk && ( fobj.write( m.text.data(), qint64( m.text.size() ) ) == qint64( m.text.size() ) );
+		} else {
+			buf += m.text;
+		}
+		m.text = std::string();
+	}
+	if ( !buf.empty() )
+		writeOk = writeOk && ( fobj.write( buf.data(), qint64( buf.size() ) ) == qint64( buf.size() ) );
+
+	if ( !writeOk )
+		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fobj.fileName() );
+
+	return writeOk;
+}
+
+//! Exports the entire scene to 'fileName' without user interaction, used by --benchmark-obj-export
+bool exportObjFile( const NifModel * nif, const QString & fileName )
+{
+	QString fname = fileName;
+	while ( fname.endsWith( ".obj", Qt::CaseInsensitive ) )
+		fname = fname.left( fname.length() - 4 );
+
+	return writeObjFiles( nif, nif->getRootLinks(), fname );
+}
+
 void exportObj( const NifModel * nif, const Scene* scene, const QModelIndex & index )
 {
 	(void) scene;
@@ -451,46 +577,10 @@ void exportObj( const NifModel * nif, const Scene* scene, const QModelIndex & in
 	while ( fname.endsWith( ".obj", Qt::CaseInsensitive ) )
 		fname = fname.left( fname.length() - 4 );
 
-	QFile fobj( fname + ".obj" );
-
-	if ( !fobj.open( QIODevice::WriteOnly ) ) {
-		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fobj.fileName() );
-		return;
-	}
-
-	QFile fmtl( fname + ".mtl" );
-
-	if ( !fmtl.open( QIODevice::WriteOnly ) ) {
-		qCCritical( nsIo ) << tr( "Failed to write %1" ).arg( fmtl.fileName() );
+	if ( !writeObjFiles( nif, roots, fname ) )
 		return;
-	}
-
-	fname = fmtl.fileName();
-	int i = fname.lastIndexOf( "/" );
 
-	if ( i >= 0 )
-		fname = fname.remove( 0, i + 1 );
-
-	QTextStream sobj( &fobj );
-	QTextStream smtl( &fmtl );
-
-	sobj << "# exported with NifSkope\r\n\r\n" << "mtllib " << fname << "\r\n";
-
-	//--Translate NIF structure into file structure --//
-
-	int ofs[3] = {
-		1, 1, 1
-	};
-	foreach ( int l, roots ) {
-		QModelIndex iBlock = nif->getBlockIndex( l );
-
-		if ( nif->blockInherits( iBlock, "NiNode" ) )
-			writeParent( nif, iBlock, sobj, smtl, ofs, Transform() );
-		else if ( nif->isNiBlock( iBlock, { "NiTriShape", "NiTriStrips" } ) )
-			writeShape( nif, iBlock, sobj, smtl, ofs, Transform() );
-	}
-
-	settings.setValue( "File Name", fobj.fileName() );
+	settings.setValue( "File Name", fname + ".obj" );
 
 	settings.endGroup(); // OBJ
 	settings.endGroup(); // Import-Export
@@ -513,11 +603,227 @@ struct ObjPoint
 	}
 };
 
+struct ObjPointHash
+{
+	size_t operator()( const ObjPoint & p ) const
+	{
+		std::uint64_t	h = std::uint32_t( p.v ) * 0x9E3779B97F4A7C15ULL;
+		h = ( h ^ ( h >> 29 ) ^ std::uint32_t( p.t ) ) * 0xBF58476D1CE4E5B9ULL;
+		h = ( h ^ ( h >> 32 ) ^ std::uint32_t( p.n ) ) * 0x94D049BB133111EBULL;
+		return size_t( h ^ ( h >> 31 ) );
+	}
+};
+
 struct ObjFace
 {
 	ObjPoint p[3];
+	//! Bit 3 * i + j is set if component j of point i is a negative index relative to the parsed chunk
+	std::uint16_t relative = 0;
+};
+
+//! Data parsed from a range of lines of an OBJ file
+struct ObjChunk
+{
+	std::vector<Vector3>	verts;
+	std::vector<ByteColor4>	colors;
+	std::vector<Vector2>	texco;
+	std::vector<Vector3>	norms;
+	std::vector<ObjFace>	faces;
+	//! usemtl statements as face index and material name, in file order
+	std::vector<std::pair<size_t, QString>>	materials;
+	std::vector<QString>	mtllibs;
+	//! Set if a face has more than 4 vertices
+	bool	untriangulated = false;
+
+	void parse( const char * p, const char * end );
+	void parseLine( const char * p, const char * end );
+};
+
+static inline const char * skipObjSpace( const char * p, const char * end )
+{
+	while ( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' ) )
+		p++;
+	return p;
+}
+
+static inline const char * objTokenEnd( const char * p, const char * end )
+{
+	while ( p < end && !( *p == ' ' || *p == '\t' || *p == '\r' ) )
+		p++;
+	return p;
+}
+
+//! Parses the next number of a line, missing or invalid numbers are read as 0 like QString::toDouble()
+static inline float parseObjFloat( const char * & p, const char * end )
+{
+	p = skipObjSpace( p, end );
+	const char *	tokenEnd = objTokenEnd( p, end );
+	const char *	q = ( p < tokenEnd && *p == '+' ? p + 1 : p );
+	float	v = 0.0f;
+	if ( std::from_chars( q, tokenEnd, v ).ec != std::errc() )
+		v = 0.0f;
+	p = tokenEnd;
+	return v;
+}
+
+static inline int parseObjInt( const char * p, const char * end )
+{
+	int	v = 0;
+	if ( std::from_chars( p, end, v ).ec != std::errc() )
+		v = 0;
+	return v;
+}
+
+void ObjChunk::parse( const char * p, const char * end )
+{
+	while ( p < end ) {
+		const char *	lineEnd = static_cast<const char *>( std::memchr( p, '\n', size_t( end - p ) ) );
+		if ( !lineEnd )
+			lineEnd = end;
+		parseLine( p, lineEnd );
+		p = lineEnd + 1;
+	}
+}
+
+void ObjChunk::parseLine( const char * p, const char * end )
+{
+	p = skipObjSpace( p, end );
+	const char *	keyEnd = objTokenEnd( p, end );
+	std::string_view	key( p, size_t( keyEnd - p ) );
+	p = keyEnd;
+
+	if ( key == "v" ) {
+		float	v[6];
+		int	n = 0;
+		for ( ; n < 6 && skipObjSpace( p, end ) < end; n++ )
+			v[n] = parseObjFloat( p, end );
+		for ( int i = n; i < 3; i++ )
+			v[i] = 0.0f;
+		verts.emplace_back( v[0], v[1], v[2] );
+		ByteColor4 &	c = colors.emplace_back();
+		if ( n == 6 && skipObjSpace( p, end ) == end ) {
+			// X, Y, Z, R, G, B format
+			c[0] = v[3];
+			c[1] = v[4];
+			c[2] = v[5];
+		}
+	} else if ( key == "vt" ) {
+		float	u = parseObjFloat( p, end );
+		float	v = parseObjFloat( p, end );
+		texco.emplace_back( u, 1.0f - v );
+	} else if ( key == "vn" ) {
+		float	x = parseObjFloat( p, end );
+		float	y = parseObjFloat( p, end );
+		float	z = parseObjFloat( p, end );
+		norms.emplace_back( x, y, z );
+	} else if ( key == "f" ) {
+		ObjPoint	points[4];
+		std::uint16_t	relative = 0;
+		int	n = 0;
+		for ( p = skipObjSpace( p, end ); p < end; p = skipObjSpace( p, end ) ) {
+			const char *	tokenEnd = objTokenEnd( p, end );
+			if ( n >= 4 ) {
+				untriangulated = true;
+				return;
+			}
+
+			// v, v/t, v//n or v/t/n, a missing index is stored as -1
+			int	idx[3] = { 0, 0, 0 };
+			for ( int j = 0; j < 3 && p <= tokenEnd; j++ ) {
+				const char *	q = static_cast<const char *>( std::memchr( p, '/', size_t( tokenEnd - p ) ) );
+				if ( !q )
+					q = tokenEnd;
+				idx[j] = parseObjInt( p, q );
+				p = q + 1;
+			}
+			p = tokenEnd;
+
+			int	counts[3] = { int( verts.size() ), int( texco.size() ), int( norms.size() ) };
+			for ( int j = 0; j < 3; j++ ) {
+				if ( idx[j] < 0 ) {
+					idx[j] += counts[j];
+					relative |= std::uint16_t( 1U << ( n * 3 + j ) );
+				} else {
+					idx[j]--;
+				}
+			}
+			points[n].v = idx[0];
+			points[n].t = idx[1];
+			points[n].n = idx[2];
+			n++;
+		}
+
+		// triangles and quads
+		for ( int j = 1; j < n - 1; j++ ) {
+			ObjFace &	face = faces.emplace_back();
+			int	src[3] = { 0, j, j + 1 };
+			for ( int i = 0; i < 3; i++ ) {
+				face.p[i] = points[src[i]];
+				face.relative |= std::uint16_t( ( ( relative >> ( src[i] * 3 ) ) & 7 ) << ( i * 3 ) );
+			}
+		}
+	} else if ( key == "usemtl" || key == "mtllib" ) {
+		p = skipObjSpace( p, end );
+		QString	name = QString::fromUtf8( p, qsizetype( objTokenEnd( p, end ) - p ) );
+		if ( key == "usemtl" )
+			materials.emplace_back( faces.size(), name );
+		else
+			mtllibs.push_back( name );
+	}
+}
+
+//! A shape to be created from the faces of one material, with at most 65535 vertices
+struct ObjShapeData
+{
+	QString	material;
+	QVector<Vector3>	verts;
+	QVector<Vector3>	norms;
+	QVector<Vector2>	texco;
+	QVector<ByteColor4>	colors;
+	QVector<Triangle>	triangles;
+	bool	haveVertexColors = false;
 };
 
+template <typename T> static inline T objValue( const std::vector<T> & v, int i )
+{
+	return ( i >= 0 && size_t( i ) < v.size() ? v[i] : T() );
+}
+
+//! Creates shapes from the faces of a material, splitting them where the 16-bit vertex index limit is reached
+static void buildObjShapes( std::vector<ObjShapeData> & shapes, const QString & material, const std::vector<ObjFace> & faces, const ObjChunk & data )
+{
+	std::unordered_map<ObjPoint, int, ObjPointHash>	points;
+	ObjShapeData *	shape = nullptr;
+
+	for ( const ObjFace & oface : faces ) {
+		if ( !shape || shape->verts.size() > 65535 - 3 ) {
+			shape = &( shapes.emplace_back() );
+			shape->material = material;
+			points.clear();
+		}
+
+		Triangle tri;
+
+		for ( int t = 0; t < 3; t++ ) {
+			const ObjPoint & p = oface.p[t];
+			auto	i = points.try_emplace( p, int( shape->verts.size() ) );
+
+			if ( i.second ) {
+				shape->verts.append( objValue( data.verts, p.v ) );
+				shape->norms.append( objValue( data.norms, p.n ) );
+				shape->texco.append( objValue( data.texco, p.t ) );
+				ByteColor4	c = objValue( data.colors, p.v );
+				shape->colors.append( c );
+				shape->haveVertexColors = shape->haveVertexColors || ( std::uint32_t( c ) != 0xFFFFFFFFU );
+			}
+
+			tri[t] = quint16( i.first->second );
+		}
+
+		shape->triangles.append( tri );
+	}
+}
+
 struct ObjMaterial
 {
 	Color3 Ka, Kd, Ks;
@@ -703,92 +1009,99 @@ void importObjMain( NifModel * nif, const QModelIndex & index, bool collision )
 		return;
 	}
 
-	QTextStream sobj( &fobj );
+	// Map the file if possible, and parse it in chunks of whole lines on multiple threads
+	QByteArray fileData;
+	const char * fileBegin = reinterpret_cast<const char *>( fobj.map( 0, fobj.size() ) );
+	if ( !fileBegin && fobj.size() > 0 ) {
+		fileData = fobj.readAll();
+		fileBegin = fileData.constData();
+	}
+	const char * fileEnd = ( fileBegin ? fileBegin + fobj.size() : nullptr );
+
+	std::vector<const char *> chunkBounds;
+	chunkBounds.push_back( fileBegin );
+	size_t chunkSize = std::max<size_t>( size_t( fileEnd - fileBegin ) / size_t( parallelThreadCount() * 4 ), 1 << 20 );
+	while ( size_t( fileEnd - chunkBounds.back() ) > chunkSize ) {
+		const char * p = chunkBounds.back() + chunkSize;
+		p = static_cast<const char *>( std::memchr( p, '\n', size_t( fileEnd - p ) ) );
+		if ( !p )
+			break;
+		chunkBounds.push_back( p + 1 );
+	}
+	chunkBounds.push_back( fileEnd );
 
-	QVector<Vector3> overts;
-	QVector<Vector3> onorms;
-	QVector<Vector2> otexco;
-	QVector<ByteColor4> ocolors;
-	QMap<QString, QVector<ObjFace> *> ofaces;
-	QMap<QString, ObjMaterial> omaterials;
+	std::vector<ObjChunk> chunks( chunkBounds.size() - 1 );
+	parallelFor( chunks.size(), [&chunks, &chunkBounds]( size_t i ) {
+		chunks[i].parse( chunkBounds[i], chunkBounds[i + 1] );
+	} );
 
-	QVector<ObjFace> * mfaces = new QVector<ObjFace>();
+	// Merge the chunks in order, resolving negative indices
+	ObjChunk odata;
+	QMap<QString, std::vector<ObjFace>> ofaces;
+	QMap<QString, ObjMaterial> omaterials;
 
 	QString usemtl = "None";
-	ofaces.insert( usemtl, mfaces );
-
-	while ( !sobj.atEnd() ) {
-		// parse each line of the file
-		QString line = sobj.readLine();
-
-		QStringList t = line.split( " ", Qt::SkipEmptyParts );
-
-		if ( t.value( 0 ) == "mtllib" ) {
-			readMtlLib( fname.left( qMax( fname.lastIndexOf( "/" ), fname.lastIndexOf( "\\" ) ) + 1 ) + t.value( 1 ), omaterials );
-		} else if ( t.value( 0 ) == "usemtl" ) {
-			usemtl = t.value( 1 );
-			//if ( usemtl.contains( "_" ) )
-			//	usemtl = usemtl.left( usemtl.indexOf( "_" ) );
+	ofaces.insert( usemtl, std::vector<ObjFace>() );
 
-			mfaces = ofaces.value( usemtl );
+	for ( ObjChunk & c : chunks ) {
+		if ( c.untriangulated ) {
+			qCCritical( nsNif ) << tr( "Please triangulate your mesh before import." );
+			return;
+		}
 
-			if ( !mfaces ) {
-				mfaces = new QVector<ObjFace>();
-				ofaces.insert( usemtl, mfaces );
-			}
-		} else if ( t.value( 0 ) == "v" ) {
-			overts.append( Vector3( t.value( 1 ).toDouble(), t.value( 2 ).toDouble(), t.value( 3 ).toDouble() ) );
-			ByteColor4 c;
-			if ( t.size() == 7 ) {
-				// X, Y, Z, R, G, B format
-				c[0] = t.value( 4 ).toFloat();
-				c[1] = t.value( 5 ).toFloat();
-				c[2] = t.value( 6 ).toFloat();
-			}
-			ocolors.append( c );
-		} else if ( t.value( 0 ) == "vt" ) {
-			otexco.append( Vector2( t.value( 1 ).toDouble(), 1.0 - t.value( 2 ).toDouble() ) );
-		} else if ( t.value( 0 ) == "vn" ) {
-			onorms.append( Vector3( t.value( 1 ).toDouble(), t.value( 2 ).toDouble(), t.value( 3 ).toDouble() ) );
-		} else if ( t.value( 0 ) == "f" ) {
-			if ( t.count() > 5 ) {
-				qCCritical( nsNif ) << tr( "Please triangulate your mesh before import." );
-				return;
+		for ( const QString & mtllib : c.mtllibs )
+			readMtlLib( fname.left( qMax( fname.lastIndexOf( "/" ), fname.lastIndexOf( "\\" ) ) + 1 ) + mtllib, omaterials );
+
+		int base[3] = { int( odata.verts.size() ), int( odata.texco.size() ), int( odata.norms.size() ) };
+		for ( ObjFace & face : c.faces ) {
+			if ( !face.relative )
+				continue;
+			for ( int i = 0; i < 3; i++ ) {
+				if ( face.relative & ( 1U << ( i * 3 ) ) )
+					face.p[i].v += base[0];
+				if ( face.relative & ( 2U << ( i * 3 ) ) )
+					face.p[i].t += base[1];
+				if ( face.relative & ( 4U << ( i * 3 ) ) )
+					face.p[i].n += base[2];
 			}
+		}
 
-			for ( int j = 1; j < t.count() - 2; j++ ) {
-				ObjFace face;
-
-				for ( int i = 0; i < 3; i++ ) {
-					QStringList lst = t.value( i == 0 ? 1 : j + i ).split( "/" );
-
-					int v = lst.value( 0 ).toInt();
-					if ( v < 0 )
-						v += overts.count();
-					else
-						v--;
-
-					int t = lst.value( 1 ).toInt();
-					if ( t < 0 )
-						v += otexco.count();
-					else
-						t--;
-
-					int n = lst.value( 2 ).toInt();
-					if ( n < 0 )
-						n += onorms.count();
-					else
-						n--;
-
-					face.p[i].v = v;
-					face.p[i].t = t;
-					face.p[i].n = n;
-				}
-
-				mfaces->append( face );
+		size_t f = 0;
+		for ( size_t m = 0; m <= c.materials.size(); m++ ) {
+			size_t faceEnd = ( m < c.materials.size() ? c.materials[m].first : c.faces.size() );
+			if ( faceEnd > f ) {
+				std::vector<ObjFace> & mfaces = ofaces[usemtl];
+				mfaces.insert( mfaces.end(), c.faces.begin() + f, c.faces.begin() + faceEnd );
+				f = faceEnd;
 			}
+			if ( m < c.materials.size() )
+				usemtl = c.materials[m].second;
 		}
+
+		odata.verts.insert( odata.verts.end(), c.verts.begin(), c.verts.end() );
+		odata.colors.insert( odata.colors.end(), c.colors.begin(), c.colors.end() );
+		odata.texco.insert( odata.texco.end(), c.texco.begin(), c.texco.end() );
+		odata.norms.insert( odata.norms.end(), c.norms.begin(), c.norms.end() );
+		c = ObjChunk();
+	}
+
+	// De-duplicate the vertices of each material in parallel
+	QList<QString> materialNames = ofaces.keys();
+	std::vector<std::vector<ObjShapeData>> materialShapes( size_t( materialNames.size() ) );
+	// the workers only read the shared map, non-const QMap access could detach it
+	const QMap<QString, std::vector<ObjFace>> & cfaces = ofaces;
+	parallelFor( materialShapes.size(), [&]( size_t i ) {
+		buildObjShapes( materialShapes[i], materialNames.at( qsizetype( i ) ), cfaces.constFind( materialNames.at( qsizetype( i ) ) ).value(), odata );
+	} );
+
+	std::vector<ObjShapeData> shapes;
+	for ( auto & m : materialShapes ) {
+		for ( auto & shape : m )
+			shapes.push_back( std::move( shape ) );
 	}
+	materialShapes.clear();
+	ofaces.clear();
+	odata = ObjChunk();
 
 	//--Translate file structures into NIF ones--//
 
@@ -800,52 +1113,15 @@ void importObjMain( NifModel * nif, const QModelIndex & index, bool collision )
 	// create a NiTriShape or BSTriShape for each material in the object
 	int shapecount = 0;
 	bool first_tri_shape = true;
-	QMapIterator<QString, QVector<ObjFace> *> it( ofaces );
-
 	nif->holdUpdates( true );
 
-	while ( it.hasNext() ) {
-		it.next();
-
-		if ( !it.value()->count() )
-			continue;
-
-		QVector<Vector3> verts;
-		QVector<Vector3> norms;
-		QVector<Vector2> texco;
-		QVector<ByteColor4> colors;
-		QVector<Triangle> triangles;
-
-		QVector<ObjPoint> points;
-		bool	haveVertexColors = false;
-
-		foreach ( ObjFace oface, *( it.value() ) ) {
-			Triangle tri;
-
-			for ( int t = 0; t < 3; t++ ) {
-				ObjPoint p = oface.p[t];
-				int ix;
-
-				for ( ix = 0; ix < points.count(); ix++ ) {
-					if ( points[ix] == p )
-						break;
-				}
-
-				if ( ix == points.count() ) {
-					points.append( p );
-					verts.append( overts.value( p.v ) );
-					norms.append( onorms.value( p.n ) );
-					texco.append( otexco.value( p.t ) );
-					ByteColor4	c = ocolors.value( p.v );
-					colors.append( c );
-					haveVertexColors = haveVertexColors || ( std::uint32_t( c ) != 0xFFFFFFFFU );
-				}
-
-				tri[t] = ix;
-			}
-
-			triangles.append( tri );
-		}
+	for ( const ObjShapeData & shape : shapes ) {
+		const QVector<Vector3> & verts = shape.verts;
+		const QVector<Vector3> & norms = shape.norms;
+		const QVector<Vector2> & texco = shape.texco;
+		const QVector<ByteColor4> & colors = shape.colors;
+		const QVector<Triangle> & triangles = shape.triangles;
+		bool	haveVertexColors = shape.haveVertexColors;
 
 		if ( !collision ) {
 			//If we are on the first shape, and one was selected in the 3D view, use the existing one
@@ -866,12 +1142,12 @@ void importObjMain( NifModel * nif, const QModelIndex & index, bool collision )
 				}
 			}
 
-			if ( !omaterials.contains( it.key() ) ) {
+			if ( !omaterials.contains( shape.material ) ) {
 				Message::append( tr( "Warnings were generated during OBJ import." ),
-					tr( "Material '%1' not found in mtllib." ).arg( it.key() ) );
+					tr( "Material '%1' not found in mtllib." ).arg( shape.material ) );
 			}
 
-			ObjMaterial mtl = omaterials.value( it.key() );
+			ObjMaterial mtl = omaterials.value( shape.material );
 
 			QModelIndex shaderProp;
 			// add material property, for non-Skyrim versions
@@ -884,7 +1160,7 @@ void importObjMain( NifModel * nif, const QModelIndex & index, bool collision )
 				}
 
 				if ( newiMaterial ) // don't affect a property  that is already there - that name is generated above on export and it has nothign to do with the stored name
-					nif->set<QString>( iMaterial, "Name", it.key() );
+					nif->set<QString>( iMaterial, "Name", shape.material );
 
 				nif->set<Color3>( iMaterial, "Ambient Color", mtl.Ka );
 				nif->set<Color3>( iMaterial, "Diffuse Color", mtl.Kd );
@@ -1061,16 +1337,30 @@ void importObjMain( NifModel * nif, const QModelIndex & index, bool collision )
 
 				QModelIndex	iVerts = nif->getIndex( iShape, "Vertex Data" );
 				nif->updateArraySize( iVerts );
-				for ( qsizetype i = 0; i < verts.size(); i++ ) {
-					QModelIndex	iVertex = QModelIndex_child( iVerts, int( i ) );
-					if ( !iVertex.isValid() )
-						continue;
-					nif->set<Vector3>( iVertex, "Vertex", verts.at( i ) );
-					nif->set<HalfVector2>( iVertex, "UV", texco.at( i ) );
-					nif->set<ByteVector3>( iVertex, "Normal", ByteVector3( norms.at( i ) ) );
-					QModelIndex	j = nif->getIndex( iVertex, "Vertex Colors" );
-					if ( j.isValid() )
-						nif->set<ByteColor4>( j, colors.at( i ) );
+				const NifItem *	vertsItem = nif->getItem( iVerts );
+				if ( vertsItem && vertsItem->childCount() > 0 ) {
+					// all vertices have the same structure, look up the rows of the fields only once
+					const NifItem *	firstVertex = vertsItem->child( 0 );
+					int	rows[4] = { -1, -1, -1, -1 };
+					const char *	names[4] = { "Vertex", "UV", "Normal", "Vertex Colors" };
+					for ( int j = 0; j < 4; j++ ) {
+						const NifItem *	field = nif->getItem( firstVertex, names[j] );
+						if ( field )
+							rows[j] = field->row();
+					}
+
+					int	n = std::min( vertsItem->childCount(), int( verts.size() ) );
+					for ( int i = 0; i < n; i++ ) {
+						const NifItem *	vertexItem = vertsItem->child( i );
+						if ( rows[0] >= 0 )
+							nif->set<Vector3>( vertexItem, rows[0], verts.at( i ) );
+						if ( rows[1] >= 0 )
+							nif->set<HalfVector2>( vertexItem, rows[1], texco.at( i ) );
+						if ( rows[2] >= 0 )
+							nif->set<ByteVector3>( vertexItem, rows[2], ByteVector3( norms.at( i ) ) );
+						if ( rows[3] >= 0 )
+							nif->set<ByteColor4>( vertexItem, rows[3], colors.at( i ) );
+					}
 				}
 
 				QModelIndex	iTriangles = nif->getIndex( iShape, "Triangles" );
@@ -1085,38 +1375,8 @@ void importObjMain( NifModel * nif, const QModelIndex & index, bool collision )
 			bounds.update( nif, iData );
 		} else if ( nif->getBSVersion() > 0 ) {
 			// create experimental havok collision mesh
-			QVector<Vector3> verts;
-			QVector<Vector3> norms;
-			QVector<Triangle> triangles;
-
-			QVector<ObjPoint> points;
-
 			shapecount++;
 
-			for ( const ObjFace & oface : *( it.value() ) ) {
-				Triangle tri;
-
-				for ( int t = 0; t < 3; t++ ) {
-					ObjPoint p = oface.p[t];
-					int ix;
-
-					for ( ix = 0; ix < points.count(); ix++ ) {
-						if ( points[ix] == p )
-							break;
-					}
-
-					if ( ix == points.count() ) {
-						points.append( p );
-						verts.append( overts.value( p.v ) );
-						norms.append( onorms.value( p.n ) );
-					}
-
-					tri[t] = ix;
-				}
-
-				triangles.append( tri );
-			}
-
 			QPersistentModelIndex iData = nif->insertNiBlock( "NiTriStripsData" );
 
 			nif->set<int>( iData, "Has Vertices", 1 );
@@ -1195,8 +1455,6 @@ void importObjMain( NifModel * nif, const QModelIndex & index, bool collision )
 	}
 	nif->holdUpdates( false );
 
-	qDeleteAll( ofaces );
-
 	settings.setValue( "File Name", fname );
 
 	settings.endGroup(); // OBJ
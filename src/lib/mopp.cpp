@@ -0,0 +1,503 @@
+#include "mopp.h"
+#include "lib/parallel.h"
+
+#include <QCoreApplication>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+
+// MOPP opcodes used by the builder and understood by the interpreter
+enum : unsigned char
+{
+	MOPP_JUMP8 = 0x05,
+	MOPP_JUMP16 = 0x06,
+	MOPP_JUMP24 = 0x07,
+	MOPP_ADD_OFFSET8 = 0x09,
+	MOPP_ADD_OFFSET16 = 0x0A,
+	MOPP_SET_OFFSET32 = 0x0B,
+	MOPP_SPLIT_X = 0x10,	// 0x10 - 0x12: a, b, 8-bit jump
+	MOPP_SPLIT16_X = 0x23,	// 0x23 - 0x25: a, b, 16-bit jump (lower), 16-bit jump (upper)
+	MOPP_BOUND_X = 0x26,	// 0x26 - 0x28: min, max
+	MOPP_TRI_SHORT = 0x30,	// 0x30 - 0x4F: key = offset + opcode - 0x30
+	MOPP_TRI8 = 0x50,
+	MOPP_TRI16 = 0x51,
+	MOPP_TRI32 = 0x53
+};
+
+// Face count below which subtrees are always encoded on the current thread
+static constexpr size_t MOPP_PARALLEL_MIN_FACES = 2048;
+// Tree depth from which ranges are split at the median instead of using the surface area heuristic
+static constexpr int MOPP_MAX_SAH_DEPTH = 48;
+
+
+MoppCodeBuilder::MoppCodeBuilder( const std::vector<Vector3> & verts, const std::vector<Face> & f, float radius )
+	: vertices( verts ), inputFaces( f ), shellRadius( std::max( radius, 0.0f ) )
+{
+}
+
+bool MoppCodeBuilder::build()
+{
+	moppCode.clear();
+	faces.clear();
+	buildFailed = false;
+	if ( vertices.empty() || inputFaces.empty() )
+		return false;
+
+	Vector3	bMin( vertices.front() );
+	Vector3	bMax( vertices.front() );
+	for ( const auto & v : vertices ) {
+		for ( int i = 0; i < 3; i++ ) {
+			bMin[i] = std::min( bMin[i], v[i] );
+			bMax[i] = std::max( bMax[i], v[i] );
+		}
+	}
+	float	size = std::max( std::max( bMax[0] - bMin[0], bMax[1] - bMin[1] ), bMax[2] - bMin[2] );
+	size = size + 2.0f * shellRadius;
+	if ( !( size > 0.0f ) )
+		size = 1.0f;
+	moppOrigin = Vector3( bMin[0] - shellRadius, bMin[1] - shellRadius, bMin[2] - shellRadius );
+	moppScale = 256.0f * 256.0f * 254.0f / size;
+
+	// Quantize the bounds of each triangle, expanded by the shell radius
+	auto	quantize = [this]( float x, int axis ) {
+		double	q = std::floor( double( x - moppOrigin[axis] ) * double( moppScale ) );
+		q = std::min( std::max( q, 0.0 ), double( 0x00FFFFFF ) );
+		return (unsigned char) ( int( q ) >> 16 );
+	};
+
+	faces.resize( inputFaces.size() );
+	for ( size_t i = 0; i < inputFaces.size(); i++ ) {
+		const Face &	f = inputFaces[i];
+		if ( f.v[0] >= vertices.size() || f.v[1] >= vertices.size() || f.v[2] >= vertices.size() )
+			return false;
+		const Vector3 &	v0 = vertices[f.v[0]];
+		const Vector3 &	v1 = vertices[f.v[1]];
+		const Vector3 &	v2 = vertices[f.v[2]];
+		FaceBounds &	b = faces[i];
+		for ( int a = 0; a < 3; a++ ) {
+			float	fMin = std::min( std::min( v0[a], v1[a] ), v2[a] );
+			float	fMax = std::max( std::max( v0[a], v1[a] ), v2[a] );
+			b.qMin[a] = quantize( fMin - shellRadius, a );
+			b.qMax[a] = quantize( fMax + shellRadius, a );
+			b.centroid[a] = ( v0[a] + v1[a] + v2[a] ) * ( 1.0f / 3.0f );
+		}
+		b.key = f.key;
+	}
+
+	// Split the top levels of the tree across threads
+	parallelDepth = 0;
+	for ( int n = parallelThreadCount(); n > 1; n = ( n + 1 ) >> 1 )
+		parallelDepth++;
+	if ( parallelDepth )
+		parallelDepth++;
+
+	const int	regionMin[3] = { 0, 0, 0 };
+	const int	regionMax[3] = { 255, 255, 255 };
+	encodeRange( moppCode, 0, faces.size(), regionMin, regionMax, 0 );
+
+	if ( buildFailed )
+		moppCode.clear();
+	return !moppCode.empty();
+}
+
+size_t MoppCodeBuilder::splitRange( size_t begin, size_t end, int & axis, bool median )
+{
+	// Select the axis with the largest centroid extent
+	float	cMin[3], cMax[3];
+	for ( int a = 0; a < 3; a++ )
+		cMin[a] = cMax[a] = faces[begin].centroid[a];
+	for ( size_t i = begin + 1; i < end; i++ ) {
+		for ( int a = 0; a < 3; a++ ) {
+			cMin[a] = std::min( cMin[a], faces[i].centroid[a] );
+			cMax[a] = std::max( cMax[a], faces[i].centroid[a] );
+		}
+	}
+	axis = 0;
+	for ( int a = 1; a < 3; a++ ) {
+		if ( ( cMax[a] - cMin[a] ) > ( cMax[axis] - cMin[axis] ) )
+			axis = a;
+	}
+
+	size_t	mid = begin + ( ( end - begin ) >> 1 );
+	float	extent = cMax[axis] - cMin[axis];
+	if ( !( extent > 0.0f ) )
+		return mid;
+	if ( median ) {
+		std::nth_element( faces.begin() + begin, faces.begin() + mid, faces.begin() + end,
+		                  [axis]( const FaceBounds & a, const FaceBounds & b ) { return a.centroid[axis] < b.centroid[axis]; } );
+		return mid;
+	}
+
+	// Binned surface area heuristic on the quantized bounds
+	constexpr int	binCnt = 16;
+	struct Bin
+	{
+		int	qMin[3] = { 255, 255, 255 };
+		int	qMax[3] = { 0, 0, 0 };
+		size_t	n = 0;
+	};
+	Bin	bins[binCnt];
+	float	binScale = float( binCnt ) / extent;
+	auto	binIndex = [&]( const FaceBounds & f ) {
+		return std::min( int( ( f.centroid[axis] - cMin[axis] ) * binScale ), binCnt - 1 );
+	};
+	for ( size_t i = begin; i < end; i++ ) {
+		Bin &	b = bins[binIndex( faces[i] )];
+		for ( int a = 0; a < 3; a++ ) {
+			b.qMin[a] = std::min< int >( b.qMin[a], faces[i].qMin[a] );
+			b.qMax[a] = std::max< int >( b.qMax[a], faces[i].qMax[a] );
+		}
+		b.n++;
+	}
+	auto	area = []( const Bin & b ) {
+		double	dx = b.qMax[0] - b.qMin[0] + 1;
+		double	dy = b.qMax[1] - b.qMin[1] + 1;
+		double	dz = b.qMax[2] - b.qMin[2] + 1;
+		return dx * dy + dy * dz + dz * dx;
+	};
+	auto	grow = []( Bin & b, const Bin & o ) {
+		for ( int a = 0; a < 3; a++ ) {
+			b.qMin[a] = std::min( b.qMin[a], o.qMin[a] );
+			b.qMax[a] = std::max( b.qMax[a], o.qMax[a] );
+		}
+		b.n += o.n;
+	};
+
+	double	rightCost[binCnt];
+	Bin	acc;
+	for ( int i = binCnt - 1; i > 0; i-- ) {
+		grow( acc, bins[i] );
+		rightCost[i] = ( acc.n ? area( acc ) * double( acc.n ) : 0.0 );
+	}
+	acc = Bin();
+	int	bestSplit = -1;
+	double	bestCost = 0.0;
+	for ( int i = 1; i < binCnt; i++ ) {
+		grow( acc, bins[i - 1] );
+		if ( !acc.n || acc.n == ( end - begin ) )
+			continue;
+		double	cost = area( acc ) * double( acc.n ) + rightCost[i];
+		if ( bestSplit < 0 || cost < bestCost ) {
+			bestSplit = i;
+			bestCost = cost;
+		}
+	}
+
+	if ( bestSplit > 0 ) {
+		auto	p = std::partition( faces.begin() + begin, faces.begin() + end,
+		                            [&]( const FaceBounds & f ) { return binIndex( f ) < bestSplit; } );
+		size_t	m = size_t( p - faces.begin() );
+		if ( m > begin && m < end )
+			return m;
+	}
+
+	std::nth_element( faces.begin() + begin, faces.begin() + mid, faces.begin() + end,
+	                  [axis]( const FaceBounds & a, const FaceBounds & b ) { return a.centroid[axis] < b.centroid[axis]; } );
+	return mid;
+}
+
+void MoppCodeBuilder::encodeLeaf( std::vector<unsigned char> & buf, const FaceBounds & f,
+                                  const int * regionMin, const int * regionMax ) const
+{
+	// Tighten the region inherited from the splits to the bounds of the triangle
+	for ( int a = 0; a < 3; a++ ) {
+		if ( f.qMin[a] > regionMin[a] || f.qMax[a] < regionMax[a] ) {
+			buf.push_back( (unsigned char) ( MOPP_BOUND_X + a ) );
+			buf.push_back( f.qMin[a] );
+			buf.push_back( f.qMax[a] );
+		}
+	}
+
+	std::uint32_t	k = f.key;
+	if ( k < 32 ) {
+		buf.push_back( (unsigned char) ( MOPP_TRI_SHORT + k ) );
+	} else if ( k < 0x0100 ) {
+		buf.push_back( MOPP_TRI8 );
+		buf.push_back( (unsigned char) k );
+	} else if ( k < 0x010000 ) {
+		buf.push_back( MOPP_TRI16 );
+		buf.push_back( (unsigned char) ( k >> 8 ) );
+		buf.push_back( (unsigned char) k );
+	} else {
+		buf.push_back( MOPP_TRI32 );
+		buf.push_back( (unsigned char) ( k >> 24 ) );
+		buf.push_back( (unsigned char) ( k >> 16 ) );
+		buf.push_back( (unsigned char) ( k >> 8 ) );
+		buf.push_back( (unsigned char) k );
+	}
+}
+
+void MoppCodeBuilder::encodeRange( std::vector<unsigned char> & buf, size_t begin, size_t end,
+                                   const int * regionMin, const int * regionMax, int depth )
+{
+	if ( ( end - begin ) == 1 ) {
+		encodeLeaf( buf, faces[begin], regionMin, regionMax );
+		return;
+	}
+
+	int	axis = 0;
+	// Fall back to median splits if the heuristic produces a very unbalanced tree
+	size_t	mid = splitRange( begin, end, axis, depth >= MOPP_MAX_SAH_DEPTH );
+
+	int	a = 0;
+	for ( size_t i = begin; i < mid; i++ )
+		a = std::max< int >( a, faces[i].qMax[axis] );
+	int	b = 255;
+	for ( size_t i = mid; i < end; i++ )
+		b = std::min< int >( b, faces[i].qMin[axis] );
+
+	int	lowerMax[3] = { regionMax[0], regionMax[1], regionMax[2] };
+	lowerMax[axis] = std::min( lowerMax[axis], a );
+	int	upperMin[3] = { regionMin[0], regionMin[1], regionMin[2] };
+	upperMin[axis] = std::max( upperMin[axis], b );
+
+	std::vector<unsigned char>	lower;
+	std::vector<unsigned char>	upper;
+	if ( depth < parallelDepth && ( end - begin ) >= MOPP_PARALLEL_MIN_FACES ) {
+		// The two ranges are disjoint, so they can be encoded concurrently
+		parallelFor( 2, [&]( size_t i ) {
+			if ( i == 0 )
+				encodeRange( lower, begin, mid, regionMin, lowerMax, depth + 1 );
+			else
+				encodeRange( upper, mid, end, upperMin, regionMax, depth + 1 );
+		} );
+	} else {
+		encodeRange( lower, begin, mid, regionMin, lowerMax, depth + 1 );
+		encodeRange( upper, mid, end, upperMin, regionMax, depth + 1 );
+	}
+
+	buf.reserve( buf.size() + lower.size() + upper.size() + 11 );
+	if ( lower.size() <= 0xFF ) {
+		// Lower half follows the split, upper half is reached with a jump over it
+		buf.push_back( (unsigned char) ( MOPP_SPLIT_X + axis ) );
+		buf.push_back( (unsigned char) a );
+		buf.push_back( (unsigned char) b );
+		buf.push_back( (unsigned char) lower.size() );
+		buf.insert( buf.end(), lower.begin(), lower.end() );
+		buf.insert( buf.end(), upper.begin(), upper.end() );
+		return;
+	}
+
+	// Both halves are reached with 16-bit jumps, store the smaller one first to keep the jump short
+	bool	lowerFirst = ( lower.size() <= upper.size() );
+	const std::vector<unsigned char> &	first = ( lowerFirst ? lower : upper );
+	const std::vector<unsigned char> &	second = ( lowerFirst ? upper : lower );
+	size_t	jumpFirst = 0;
+	size_t	jumpSecond = first.size();
+	bool	useTrampoline = ( first.size() > 0xFFFF );
+	if ( useTrampoline ) {
+		// The second half is reached through a 24-bit jump placed before the first half
+		if ( first.size() > 0x00FFFFFF ) {
+			buildFailed = true;
+			return;
+		}
+		jumpFirst = 4;
+		jumpSecond = 0;
+	}
+	size_t	jumpLower = ( lowerFirst ? jumpFirst : jumpSecond );
+	size_t	jumpUpper = ( lowerFirst ? jumpSecond : jumpFirst );
+
+	buf.push_back( (unsigned char) ( MOPP_SPLIT16_X + axis ) );
+	buf.push_back( (unsigned char) a );
+	buf.push_back( (unsigned char) b );
+	buf.push_back( (unsigned char) ( jumpLower >> 8 ) );
+	buf.push_back( (unsigned char) jumpLower );
+	buf.push_back( (unsigned char) ( jumpUpper >> 8 ) );
+	buf.push_back( (unsigned char) jumpUpper );
+	if ( useTrampoline ) {
+		buf.push_back( MOPP_JUMP24 );
+		buf.push_back( (unsigned char) ( first.size() >> 16 ) );
+		buf.push_back( (unsigned char) ( first.size() >> 8 ) );
+		buf.push_back( (unsigned char) first.size() );
+	}
+	buf.insert( buf.end(), first.begin(), first.end() );
+	buf.insert( buf.end(), second.begin(), second.end() );
+}
+
+bool MoppCodeBuilder::validate( QString * errorMessage ) const
+{
+	auto	fail = [errorMessage]( const QString & msg ) {
+		if ( errorMessage )
+			*errorMessage = msg;
+		return false;
+	};
+	if ( moppCode.empty() || inputFaces.empty() )
+		return fail( QCoreApplication::translate( "MoppCodeBuilder", "No MOPP code was generated" ) );
+
+	MoppInterpreter	mopp( moppCode.data(), moppCode.size() );
+
+	// The code must contain one triangle opcode for each input triangle
+	std::vector<std::uint32_t>	codeKeys;
+	if ( !mopp.allKeys( codeKeys ) )
+		return fail( QCoreApplication::translate( "MoppCodeBuilder", "The generated MOPP code is malformed" ) );
+	std::vector<std::uint32_t>	inputKeys;
+	inputKeys.reserve( inputFaces.size() );
+	for ( const Face & f : inputFaces )
+		inputKeys.push_back( f.key );
+	std::sort( codeKeys.begin(), codeKeys.end() );
+	std::sort( inputKeys.begin(), inputKeys.end() );
+	if ( codeKeys != inputKeys )
+		return fail( QCoreApplication::translate( "MoppCodeBuilder", "The shape keys in the generated MOPP code do not match the triangles" ) );
+
+	std::atomic< size_t >	unreachable( 0 );
+	std::atomic< bool >	malformed( false );
+
+	constexpr size_t	blockSize = 256;
+	parallelFor( ( inputFaces.size() + blockSize - 1 ) / blockSize, [&]( size_t n ) {
+		std::vector<std::uint32_t>	keys;
+		size_t	endFace = std::min( ( n + 1 ) * blockSize, inputFaces.size() );
+		for ( size_t i = n * blockSize; i < endFace; i++ ) {
+			const Face &	f = inputFaces[i];
+			int	q[3];
+			for ( int a = 0; a < 3; a++ ) {
+				float	c = ( vertices[f.v[0]][a] + vertices[f.v[1]][a] + vertices[f.v[2]][a] ) * ( 1.0f / 3.0f );
+				double	x = std::floor( double( c - moppOrigin[a] ) * double( moppScale ) );
+				q[a] = int( std::min( std::max( x, 0.0 ), double( 0x00FFFFFF ) ) ) >> 16;
+			}
+			keys.clear();
+			if ( !mopp.query( keys, q, q ) ) {
+				malformed = true;
+				return;
+			}
+			if ( std::find( keys.begin(), keys.end(), f.key ) == keys.end() )
+				unreachable++;
+		}
+	} );
+
+	if ( malformed )
+		return fail( QCoreApplication::translate( "MoppCodeBuilder", "The generated MOPP code is malformed" ) );
+	if ( unreachable )
+		return fail( QCoreApplication::translate( "MoppCodeBuilder", "%1 of %2 triangles are unreachable in the generated MOPP code" )
+		             .arg( size_t( unreachable ) ).arg( inputFaces.size() ) );
+	return true;
+}
+
+bool MoppInterpreter::query( std::vector<std::uint32_t> & keys, const int * qMin, const int * qMax ) const
+{
+	struct State
+	{
+		size_t	pos;
+		std::uint32_t	offset;
+	};
+	std::vector<State>	stack;
+	stack.push_back( State{ 0, 0 } );
+
+	while ( !stack.empty() ) {
+		State	s = stack.back();
+		stack.pop_back();
+
+		// All jumps are forward, so every path terminates
+		for ( bool done = false; !done; ) {
+			if ( s.pos >= codeSize )
+				return false;
+			const unsigned char *	p = code + s.pos;
+			size_t	avail = codeSize - s.pos;
+			unsigned char	op = p[0];
+			if ( op >= MOPP_TRI_SHORT && op < MOPP_TRI8 ) {
+				keys.push_back( s.offset + std::uint32_t( op - MOPP_TRI_SHORT ) );
+				break;
+			}
+
+			switch ( op ) {
+			case MOPP_JUMP8:
+				if ( avail < 2 )
+					return false;
+				s.pos += 2 + p[1];
+				break;
+			case MOPP_JUMP16:
+				if ( avail < 3 )
+					return false;
+				s.pos += 3 + ( size_t( p[1] ) << 8 | p[2] );
+				break;
+			case MOPP_JUMP24:
+				if ( avail < 4 )
+					return false;
+				s.pos += 4 + ( size_t( p[1] ) << 16 | size_t( p[2] ) << 8 | p[3] );
+				break;
+			case MOPP_ADD_OFFSET8:
+				if ( avail < 2 )
+					return false;
+				s.offset += p[1];
+				s.pos += 2;
+				break;
+			case MOPP_ADD_OFFSET16:
+				if ( avail < 3 )
+					return false;
+				s.offset += std::uint32_t( p[1] ) << 8 | p[2];
+				s.pos += 3;
+				break;
+			case MOPP_SET_OFFSET32:
+				if ( avail < 5 )
+					return false;
+				s.offset = std::uint32_t( p[1] ) << 24 | std::uint32_t( p[2] ) << 16 | std::uint32_t( p[3] ) << 8 | p[4];
+				s.pos += 5;
+				break;
+			case MOPP_SPLIT_X:
+			case MOPP_SPLIT_X + 1:
+			case MOPP_SPLIT_X + 2:
+				{
+					if ( avail < 4 )
+						return false;
+					int	axis = op - MOPP_SPLIT_X;
+					if ( qMax[axis] >= p[2] )
+						stack.push_back( State{ s.pos + 4 + p[3], s.offset } );
+					if ( qMin[axis] <= p[1] )
+						stack.push_back( State{ s.pos + 4, s.offset } );
+					done = true;
+				}
+				break;
+			case MOPP_SPLIT16_X:
+			case MOPP_SPLIT16_X + 1:
+			case MOPP_SPLIT16_X + 2:
+				{
+					if ( avail < 7 )
+						return false;
+					int	axis = op - MOPP_SPLIT16_X;
+					if ( qMax[axis] >= p[2] )
+						stack.push_back( State{ s.pos + 7 + ( size_t( p[5] ) << 8 | p[6] ), s.offset } );
+					if ( qMin[axis] <= p[1] )
+						stack.push_back( State{ s.pos + 7 + ( size_t( p[3] ) << 8 | p[4] ), s.offset } );
+					done = true;
+				}
+				break;
+			case MOPP_BOUND_X:
+			case MOPP_BOUND_X + 1:
+			case MOPP_BOUND_X + 2:
+				{
+					if ( avail < 3 )
+						return false;
+					int	axis = op - MOPP_BOUND_X;
+					if ( qMax[axis] < p[1] || qMin[axis] > p[2] )
+						done = true;
+					s.pos += 3;
+				}
+				break;
+			case MOPP_TRI8:
+				if ( avail < 2 )
+					return false;
+				keys.push_back( s.offset + p[1] );
+				done = true;
+				break;
+			case MOPP_TRI16:
+				if ( avail < 3 )
+					return false;
+				keys.push_back( s.offset + ( std::uint32_t( p[1] ) << 8 | p[2] ) );
+				done = true;
+				break;
+			case MOPP_TRI32:
+				if ( avail < 5 )
+					return false;
+				keys.push_back( s.offset + ( std::uint32_t( p[1] ) << 24 | std::uint32_t( p[2] ) << 16
+				                             | std::uint32_t( p[3] ) << 8 | p[4] ) );
+				done = true;
+				break;
+			default:
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
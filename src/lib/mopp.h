@@ -0,0 +1,107 @@
+#ifndef MOPP_H_INCLUDED
+#define MOPP_H_INCLUDED
+
+#include "data/niftypes.h"
+
+#include <QString>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+//! \file mopp.h Native Havok MOPP code generator and interpreter
+
+/*! Builds MOPP (Memory Optimized Partial Polytope) byte code for a triangle mesh
+ *
+ * The mesh is quantized into 24-bit integer coordinates relative to origin(), using
+ * the scale from the nif.xml documentation of hkpMoppCode (256 * 256 * 254 / (size + 2 * radius)).
+ * A bounding volume hierarchy with one triangle per leaf is then built over the triangles
+ * and encoded as a tree of axis split and bound test opcodes that terminates in
+ * triangle (shape key) opcodes.
+ *
+ * The generated code only uses the single axis split (0x10-0x12, 0x23-0x25), bound test
+ * (0x26-0x28), jump and triangle opcodes, and compares the upper 8 bits of the quantized
+ * coordinates without rescaling. This is less precise than the code generated by the Havok
+ * SDK, but is conservative: every triangle can be reached by a query that overlaps its bounds.
+ */
+class MoppCodeBuilder final
+{
+public:
+	//! A triangle of the input mesh with the shape key returned by the MOPP code
+	struct Face
+	{
+		std::uint32_t	v[3];
+		std::uint32_t	key;
+	};
+
+	MoppCodeBuilder( const std::vector<Vector3> & verts, const std::vector<Face> & faces, float radius );
+
+	//! Generates the MOPP code, returns false if the input is empty or invalid
+	bool build();
+	/*! Checks the generated code against the input mesh
+	 *
+	 * Every input triangle must be reached by a query at its centroid, which is quantized
+	 * again from the vertices, and the code must contain exactly the shape keys of the input.
+	 */
+	bool validate( QString * errorMessage = nullptr ) const;
+
+	const std::vector<unsigned char> & code() const { return moppCode; }
+	const Vector3 & origin() const { return moppOrigin; }
+	float scale() const { return moppScale; }
+
+protected:
+	struct FaceBounds
+	{
+		unsigned char	qMin[3];
+		unsigned char	qMax[3];
+		float	centroid[3];
+		std::uint32_t	key;
+	};
+
+	void encodeRange( std::vector<unsigned char> & buf, size_t begin, size_t end,
+	                  const int * regionMin, const int * regionMax, int depth );
+	void encodeLeaf( std::vector<unsigned char> & buf, const FaceBounds & f,
+	                 const int * regionMin, const int * regionMax ) const;
+	size_t splitRange( size_t begin, size_t end, int & axis, bool median );
+
+	const std::vector<Vector3> & vertices;
+	const std::vector<Face> & inputFaces;
+	float	shellRadius;
+
+	std::vector<FaceBounds>	faces;
+	std::vector<unsigned char>	moppCode;
+	Vector3	moppOrigin;
+	float	moppScale = 1.0f;
+	int	parallelDepth = 0;
+	//! Set by encodeRange() on any thread if a subtree is too large to be encoded
+	std::atomic<bool>	buildFailed = false;
+};
+
+//! Decodes MOPP byte code and runs bounding box queries on it
+class MoppInterpreter final
+{
+public:
+	MoppInterpreter( const unsigned char * data, size_t size ) : code( data ), codeSize( size ) {}
+
+	/*! Collects the shape keys of all triangles the code reaches for a query box
+	 *
+	 * \a qMin and \a qMax are the upper 8 bits of the quantized coordinates of the query box.
+	 * Returns false if the code is malformed (unknown opcode or jump out of range).
+	 */
+	bool query( std::vector<std::uint32_t> & keys, const int * qMin, const int * qMax ) const;
+
+	//! Collects the shape keys of all triangles referenced by the code
+	bool allKeys( std::vector<std::uint32_t> & keys ) const
+	{
+		static const int	qMin[3] = { 0, 0, 0 };
+		static const int	qMax[3] = { 255, 255, 255 };
+		return query( keys, qMin, qMax );
+	}
+
+private:
+	const unsigned char *	code;
+	size_t	codeSize;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//! \file parallel.h Minimal helpers for running independent work items on multiple threads
+
+//! Returns the number of worker threads to use for \a n work items
+inline int parallelThreadCount( size_t n = size_t(-1) )
+{
+	unsigned int	t = std::thread::hardware_concurrency();
+	t = std::min< unsigned int >( std::max< unsigned int >( t, 1U ), 64U );
+	return int( std::min< size_t >( t, std::max< size_t >( n, 1 ) ) );
+}
+
+/*! Calls \a fn( i ) for each i in [0, \a n) using up to parallelThreadCount() threads
+ *
+ * Work items are handed out dynamically, so they do not need to be of similar cost.
+ * The calling thread takes part in the work. If \a fn throws, the remaining items are
+ * skipped and the first exception is rethrown on the calling thread.
+ *
+ * \a fn must not access NifModel or any other QObject that is not thread safe.
+ */
+template < typename F >
+void parallelFor( size_t n, F && fn, int maxThreads = 0 )
+{
+	int	threadCnt = parallelThreadCount( n );
+	if ( maxThreads > 0 )
+		threadCnt = std::min( threadCnt, maxThreads );
+	if ( threadCnt <= 1 ) {
+		for ( size_t i = 0; i < n; i++ )
+			fn( i );
+		return;
+	}
+
+	std::atomic< size_t >	nextItem( 0 );
+	std::exception_ptr	err;
+	std::mutex	errMutex;
+	auto	worker = [&]() {
+		try {
+			for ( size_t i; ( i = nextItem.fetch_add( 1 ) ) < n; )
+				fn( i );
+		} catch ( ... ) {
+			std::lock_guard< std::mutex >	lock( errMutex );
+			if ( !err )
+				err = std::current_exception();
+			nextItem.store( n );
+		}
+	};
+
+	std::vector< std::thread >	threads;
+	threads.reserve( size_t( threadCnt - 1 ) );
+	for ( int t = 1; t < threadCnt; t++ )
+		threads.emplace_back( worker );
+	worker();
+	for ( auto & t : threads )
+		t.join();
+
+	if ( err )
+		std::rethrow_exception( err );
+}
+
+#endif
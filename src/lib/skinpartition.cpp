@@ -0,0 +1,602 @@
+#include "skinpartition.h"
+
+#include <QCoreApplication>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <numeric>
+
+
+SkinPartitioner::SkinPartitioner( size_t numVertices, size_t numBones )
+	: numVerts( numVertices ), numBones( numBones ), boneWords( std::max< size_t >( ( numBones + 63 ) >> 6, 1 ) )
+{
+}
+
+void SkinPartitioner::addInfluence( std::uint32_t vertex, std::uint32_t bone, float weight )
+{
+	if ( vertex < numVerts && bone < numBones )
+		inputInfluences.push_back( InputInfluence{ vertex, Influence{ bone, weight } } );
+}
+
+void SkinPartitioner::influenceRange( int & minInfluences, int & maxInfluences ) const
+{
+	std::vector< std::uint32_t >	counts( numVerts, 0 );
+	for ( const auto & i : inputInfluences )
+		counts[i.vertex]++;
+	minInfluences = 0;
+	maxInfluences = 0;
+	if ( numVerts > 0 ) {
+		auto	r = std::minmax_element( counts.begin(), counts.end() );
+		minInfluences = int( *r.first );
+		maxInfluences = int( *r.second );
+	}
+}
+
+bool SkinPartitioner::fail( QString * errorMessage, const QString & msg ) const
+{
+	if ( errorMessage )
+		*errorMessage = msg;
+	return false;
+}
+
+bool SkinPartitioner::build( QString * errorMessage )
+{
+	parts.clear();
+	groups.clear();
+	reducedVertices = 0;
+	removedInfluences = 0;
+
+	size_t	numTriangles = triangles.size() / 3;
+	if ( !numTriangles || !numVerts )
+		return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "No triangles" ) );
+	if ( maxBonesPerVertex < 1 || maxBonesPerPartition < maxBonesPerVertex || maxVerticesPerPartition < 3 )
+		return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Invalid partition limits" ) );
+	for ( auto v : triangles ) {
+		if ( v >= numVerts )
+			return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Invalid vertex index in triangle data" ) );
+	}
+	explicitPartitions = !trianglePartitions.empty();
+	if ( explicitPartitions && trianglePartitions.size() != numTriangles )
+		return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Partition list size does not match the number of triangles" ) );
+
+	// store the influences in a dense array
+	influenceCounts.assign( numVerts, 0 );
+	for ( const auto & i : inputInfluences )
+		influenceCounts[i.vertex]++;
+	influenceStride = 1;
+	for ( auto n : influenceCounts )
+		influenceStride = std::max( influenceStride, int( n ) );
+	influences.assign( numVerts * size_t( influenceStride ), Influence{ 0, 0.0f } );
+	std::fill( influenceCounts.begin(), influenceCounts.end(), 0 );
+	for ( const auto & i : inputInfluences ) {
+		size_t	n = size_t( i.vertex ) * size_t( influenceStride ) + influenceCounts[i.vertex];
+		influences[n] = i.influence;
+		influenceCounts[i.vertex]++;
+	}
+
+	reduceVertexInfluences();
+	if ( !reduceTriangleBones( errorMessage ) )
+		return false;
+	calculateTriangleBones();
+	if ( explicitPartitions ) {
+		for ( size_t t = 0; t < numTriangles; t++ ) {
+			size_t	g = trianglePartitions[t];
+			if ( g >= groups.size() )
+				groups.resize( g + 1 );
+			Group &	grp = groups[g];
+			if ( grp.bones.empty() )
+				grp.bones.resize( boneWords, 0 );
+			grp.triangles.push_back( std::uint32_t( t ) );
+			for ( size_t w = 0; w < boneWords; w++ )
+				grp.bones[w] |= triangleBones[t * boneWords + w];
+		}
+	} else {
+		groupTriangles();
+		mergePartitions();
+	}
+	createPartitions();
+
+	return true;
+}
+
+void SkinPartitioner::reduceVertexInfluences()
+{
+	for ( size_t v = 0; v < numVerts; v++ ) {
+		Influence *	p = influences.data() + ( v * size_t( influenceStride ) );
+		std::uint32_t &	n = influenceCounts[v];
+		std::sort( p, p + n, []( const Influence & a, const Influence & b ) {
+			return ( a.weight > b.weight || ( a.weight == b.weight && a.bone < b.bone ) );
+		} );
+		if ( n <= std::uint32_t( maxBonesPerVertex ) )
+			continue;
+
+		reducedVertices++;
+		n = std::uint32_t( maxBonesPerVertex );
+		float	totalWeight = 0.0f;
+		for ( std::uint32_t i = 0; i < n; i++ )
+			totalWeight += p[i].weight;
+		if ( totalWeight > 0.0f ) {
+			for ( std::uint32_t i = 0; i < n; i++ )
+				p[i].weight /= totalWeight;
+		}
+	}
+}
+
+int SkinPartitioner::removeInfluence( std::uint32_t vertex, std::uint32_t bone )
+{
+	Influence *	p = influences.data() + ( size_t( vertex ) * size_t( influenceStride ) );
+	std::uint32_t &	n = influenceCounts[vertex];
+	std::uint32_t	i = 0;
+	while ( i < n && p[i].bone != bone )
+		i++;
+	if ( i >= n )
+		return 0;
+	for ( n--; i < n; i++ )
+		p[i] = p[i + 1];
+
+	float	totalWeight = 0.0f;
+	for ( i = 0; i < n; i++ )
+		totalWeight += p[i].weight;
+	if ( !( totalWeight > 0.0f ) )
+		return -1;
+	for ( i = 0; i < n; i++ )
+		p[i].weight /= totalWeight;
+	return 1;
+}
+
+bool SkinPartitioner::reduceTriangleBones( QString * errorMessage )
+{
+	// vertices with the same position and influences are kept identical
+	std::vector< std::uint32_t >	matchNext( numVerts );
+	std::iota( matchNext.begin(), matchNext.end(), std::uint32_t( 0 ) );
+	bool	needMatches = true;
+
+	auto	findMatches = [&]() {
+		if ( positions.size() < ( numVerts * 3 ) )
+			return;
+		auto	equalVertices = [&]( std::uint32_t a, std::uint32_t b ) {
+			if ( std::memcmp( positions.data() + ( size_t( a ) * 3 ), positions.data() + ( size_t( b ) * 3 ), sizeof(float) * 3 ) != 0 )
+				return false;
+			if ( influenceCounts[a] != influenceCounts[b] )
+				return false;
+			for ( std::uint32_t i = 0; i < influenceCounts[a]; i++ ) {
+				const Influence &	ia = influence( a, int(i) );
+				const Influence &	ib = influence( b, int(i) );
+				if ( ia.bone != ib.bone || ia.weight != ib.weight )
+					return false;
+			}
+			return true;
+		};
+		std::vector< std::uint32_t >	order( numVerts );
+		std::iota( order.begin(), order.end(), std::uint32_t( 0 ) );
+		std::sort( order.begin(), order.end(), [&]( std::uint32_t a, std::uint32_t b ) {
+			int	c = std::memcmp( positions.data() + ( size_t( a ) * 3 ), positions.data() + ( size_t( b ) * 3 ), sizeof(float) * 3 );
+			return ( c < 0 || ( c == 0 && a < b ) );
+		} );
+		// link each run of equal vertices into a circular list
+		for ( size_t i = 0; i < numVerts; ) {
+			size_t	j = i + 1;
+			while ( j < numVerts && std::memcmp( positions.data() + ( size_t( order[i] ) * 3 ),
+			                                     positions.data() + ( size_t( order[j] ) * 3 ), sizeof(float) * 3 ) == 0 )
+				j++;
+			for ( size_t k = i; k < j; k++ ) {
+				std::uint32_t	a = order[k];
+				if ( matchNext[a] != a )
+					continue;
+				std::uint32_t	prev = a;
+				for ( size_t l = k + 1; l < j; l++ ) {
+					std::uint32_t	b = order[l];
+					if ( matchNext[b] == b && equalVertices( a, b ) ) {
+						matchNext[prev] = b;
+						prev = b;
+					}
+				}
+				matchNext[prev] = a;
+			}
+			i = j;
+		}
+	};
+
+	std::vector< std::uint32_t >	triBones;
+	std::vector< float >	boneWeights;
+	std::vector< bool >	boneFixed;
+	size_t	numTriangles = triangles.size() / 3;
+	for ( size_t t = 0; t < numTriangles; t++ ) {
+		const std::uint32_t *	tri = triangles.data() + ( t * 3 );
+		while ( true ) {
+			triBones.clear();
+			for ( int c = 0; c < 3; c++ ) {
+				for ( std::uint32_t i = 0; i < influenceCounts[tri[c]]; i++ ) {
+					std::uint32_t	b = influence( tri[c], int(i) ).bone;
+					if ( std::find( triBones.begin(), triBones.end(), b ) == triBones.end() )
+						triBones.push_back( b );
+				}
+			}
+			if ( triBones.size() <= size_t( maxBonesPerPartition ) )
+				break;
+
+			// remove the bone with the smallest total weight, bones that are the only influence of a vertex are kept
+			std::sort( triBones.begin(), triBones.end() );
+			boneWeights.assign( triBones.size(), 0.0f );
+			boneFixed.assign( triBones.size(), false );
+			for ( int c = 0; c < 3; c++ ) {
+				for ( std::uint32_t i = 0; i < influenceCounts[tri[c]]; i++ ) {
+					const Influence &	bw = influence( tri[c], int(i) );
+					size_t	n = size_t( std::lower_bound( triBones.begin(), triBones.end(), bw.bone ) - triBones.begin() );
+					boneWeights[n] += bw.weight;
+					if ( influenceCounts[tri[c]] == 1 )
+						boneFixed[n] = true;
+				}
+			}
+			size_t	minBone = triBones.size();
+			for ( size_t n = 0; n < triBones.size(); n++ ) {
+				if ( !boneFixed[n] && ( minBone >= triBones.size() || boneWeights[n] < boneWeights[minBone] ) )
+					minBone = n;
+			}
+			if ( minBone >= triBones.size() )
+				return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Cannot reduce the bones of triangle %1" ).arg( t ) );
+
+			if ( needMatches ) {
+				findMatches();
+				needMatches = false;
+			}
+			for ( int c = 0; c < 3; c++ ) {
+				bool	removed = false;
+				std::uint32_t	v = tri[c];
+				do {
+					int	r = removeInfluence( v, triBones[minBone] );
+					if ( r < 0 )
+						return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Vertex %1 has no weight left after removing bone influences" ).arg( v ) );
+					removed = removed || ( r > 0 );
+					v = matchNext[v];
+				} while ( v != tri[c] );
+				if ( removed )
+					removedInfluences++;
+			}
+		}
+	}
+
+	return true;
+}
+
+void SkinPartitioner::calculateTriangleBones()
+{
+	size_t	numTriangles = triangles.size() / 3;
+	triangleBones.assign( numTriangles * boneWords, 0 );
+	for ( size_t t = 0; t < numTriangles; t++ ) {
+		std::uint64_t *	bits = triangleBones.data() + ( t * boneWords );
+		for ( int c = 0; c < 3; c++ ) {
+			std::uint32_t	v = triangles[t * 3 + size_t(c)];
+			for ( std::uint32_t i = 0; i < influenceCounts[v]; i++ ) {
+				std::uint32_t	b = influence( v, int(i) ).bone;
+				bits[b >> 6] |= std::uint64_t( 1 ) << ( b & 63 );
+			}
+		}
+	}
+}
+
+void SkinPartitioner::groupTriangles()
+{
+	size_t	numTriangles = triangles.size() / 3;
+	const std::uint32_t	unassigned = ~std::uint32_t( 0 );
+
+	auto	boneCount = [this]( const std::uint64_t * bits ) {
+		size_t	n = 0;
+		for ( size_t w = 0; w < boneWords; w++ )
+			n += size_t( std::popcount( bits[w] ) );
+		return n;
+	};
+
+	// triangles with the most bones are used first as the seed of a new partition
+	std::vector< std::uint32_t >	order( numTriangles );
+	std::vector< std::uint32_t >	triBoneCounts( numTriangles );
+	for ( size_t t = 0; t < numTriangles; t++ ) {
+		order[t] = std::uint32_t( t );
+		triBoneCounts[t] = std::uint32_t( boneCount( triangleBones.data() + ( t * boneWords ) ) );
+	}
+	std::stable_sort( order.begin(), order.end(), [&]( std::uint32_t a, std::uint32_t b ) {
+		return ( triBoneCounts[a] > triBoneCounts[b] );
+	} );
+
+	// triangles using each bone
+	std::vector< std::uint32_t >	boneTriOffsets( numBones + 1, 0 );
+	for ( size_t t = 0; t < numTriangles; t++ ) {
+		const std::uint64_t *	bits = triangleBones.data() + ( t * boneWords );
+		for ( size_t w = 0; w < boneWords; w++ ) {
+			for ( std::uint64_t m = bits[w]; m; m = m & ( m - 1 ) )
+				boneTriOffsets[( w << 6 ) + size_t( std::countr_zero( m ) ) + 1]++;
+		}
+	}
+	for ( size_t b = 0; b < numBones; b++ )
+		boneTriOffsets[b + 1] += boneTriOffsets[b];
+	std::vector< std::uint32_t >	boneTriangles( boneTriOffsets[numBones] );
+	// end of the list of each bone, assigned triangles are removed from the lists when found
+	std::vector< std::uint32_t >	boneTriEnds( boneTriOffsets.begin() + 1, boneTriOffsets.end() );
+	{
+		std::vector< std::uint32_t >	pos( boneTriOffsets.begin(), boneTriOffsets.end() - 1 );
+		for ( size_t t = 0; t < numTriangles; t++ ) {
+			const std::uint64_t *	bits = triangleBones.data() + ( t * boneWords );
+			for ( size_t w = 0; w < boneWords; w++ ) {
+				for ( std::uint64_t m = bits[w]; m; m = m & ( m - 1 ) )
+					boneTriangles[pos[( w << 6 ) + size_t( std::countr_zero( m ) )]++] = std::uint32_t( t );
+			}
+		}
+	}
+
+	// triangles using each vertex
+	std::vector< std::uint32_t >	vertexTriOffsets( numVerts + 1, 0 );
+	for ( auto v : triangles )
+		vertexTriOffsets[size_t( v ) + 1]++;
+	for ( size_t v = 0; v < numVerts; v++ )
+		vertexTriOffsets[v + 1] += vertexTriOffsets[v];
+	std::vector< std::uint32_t >	vertexTriangles( triangles.size() );
+	{
+		std::vector< std::uint32_t >	pos( vertexTriOffsets.begin(), vertexTriOffsets.end() - 1 );
+		for ( size_t i = 0; i < triangles.size(); i++ )
+			vertexTriangles[pos[triangles[i]]++] = std::uint32_t( i / 3 );
+	}
+
+	std::vector< std::uint32_t >	triangleGroups( numTriangles, unassigned );
+	std::vector< std::uint32_t >	frontierStamp( numTriangles, unassigned );
+	std::vector< std::uint32_t >	vertexStamp( numVerts, unassigned );
+	std::vector< std::uint32_t >	frontier;
+	typedef std::pair< std::uint32_t, std::uint32_t >	QueueEntry;	// number of new bones, triangle
+	std::vector< QueueEntry >	queue;
+
+	for ( size_t seedPos = 0; true; ) {
+		while ( seedPos < numTriangles && triangleGroups[order[seedPos]] != unassigned )
+			seedPos++;
+		if ( seedPos >= numTriangles )
+			break;
+
+		std::uint32_t	g = std::uint32_t( groups.size() );
+		groups.emplace_back();
+		Group &	grp = groups.back();
+		grp.bones.assign( boneWords, 0 );
+		bool	bonesChanged = false;
+		size_t	sweepBoneCount = 0;
+		std::vector< std::uint64_t >	sweptBones( boneWords, 0 );
+
+		auto	newBones = [&]( std::uint32_t t ) {
+			const std::uint64_t *	bits = triangleBones.data() + ( size_t( t ) * boneWords );
+			std::uint32_t	n = 0;
+			for ( size_t w = 0; w < boneWords; w++ )
+				n += std::uint32_t( std::popcount( bits[w] & ~grp.bones[w] ) );
+			return n;
+		};
+		auto	newVertices = [&]( std::uint32_t t ) {
+			const std::uint32_t *	tri = triangles.data() + ( size_t( t ) * 3 );
+			size_t	n = size_t( vertexStamp[tri[0]] != g );
+			n += size_t( vertexStamp[tri[1]] != g && tri[1] != tri[0] );
+			n += size_t( vertexStamp[tri[2]] != g && tri[2] != tri[0] && tri[2] != tri[1] );
+			return n;
+		};
+		auto	addTriangle = [&]( std::uint32_t t ) {
+			triangleGroups[t] = g;
+			grp.triangles.push_back( t );
+			grp.vertexCount += newVertices( t );
+			const std::uint64_t *	bits = triangleBones.data() + ( size_t( t ) * boneWords );
+			for ( size_t w = 0; w < boneWords; w++ ) {
+				std::uint64_t	m = bits[w] & ~grp.bones[w];
+				if ( m ) {
+					grp.bones[w] |= m;
+					grp.boneCount += size_t( std::popcount( m ) );
+					bonesChanged = true;
+				}
+			}
+			// unassigned triangles sharing a vertex with the partition are the candidates for growing it
+			for ( int c = 0; c < 3; c++ ) {
+				std::uint32_t	v = triangles[size_t( t ) * 3 + size_t(c)];
+				if ( vertexStamp[v] == g )
+					continue;
+				vertexStamp[v] = g;
+				for ( std::uint32_t i = vertexTriOffsets[v]; i < vertexTriOffsets[v + 1]; i++ ) {
+					std::uint32_t	u = vertexTriangles[i];
+					if ( triangleGroups[u] == unassigned && frontierStamp[u] != g ) {
+						frontierStamp[u] = g;
+						frontier.push_back( u );
+						queue.emplace_back( newBones( u ), u );
+						std::push_heap( queue.begin(), queue.end(), std::greater< QueueEntry >() );
+					}
+				}
+			}
+		};
+
+		// adds triangles that fit in the partition from anywhere in the mesh to the candidates,
+		// only the bones added since the last search need to be checked, because adding bones
+		// that a triangle does not use cannot make it fit
+		auto	sweepTriangles = [&]() {
+			sweepBoneCount = grp.boneCount;
+			for ( size_t w = 0; w < boneWords; w++ ) {
+				std::uint64_t	added = grp.bones[w] & ~( sweptBones[w] );
+				sweptBones[w] = grp.bones[w];
+				for ( std::uint64_t m = added; m; m = m & ( m - 1 ) ) {
+					size_t	b = ( w << 6 ) + size_t( std::countr_zero( m ) );
+					for ( std::uint32_t i = boneTriOffsets[b]; i < boneTriEnds[b]; i++ ) {
+						std::uint32_t	u = boneTriangles[i];
+						if ( triangleGroups[u] != unassigned ) {
+							boneTriangles[i--] = boneTriangles[--boneTriEnds[b]];
+							continue;
+						}
+						if ( frontierStamp[u] == g || frontierStamp[u] == ( unassigned - 1 ) )
+							continue;
+						std::uint32_t	n = newBones( u );
+						if ( ( grp.boneCount + n ) <= size_t( maxBonesPerPartition ) ) {
+							frontierStamp[u] = g;
+							frontier.push_back( u );
+							queue.emplace_back( n, u );
+							std::push_heap( queue.begin(), queue.end(), std::greater< QueueEntry >() );
+						}
+					}
+				}
+			}
+		};
+
+		addTriangle( order[seedPos] );
+		while ( true ) {
+			if ( bonesChanged ) {
+				// the number of new bones decreases for some candidates whenever bones are added
+				queue.clear();
+				size_t	n = 0;
+				for ( std::uint32_t u : frontier ) {
+					if ( triangleGroups[u] != unassigned || frontierStamp[u] != g )
+						continue;
+					frontier[n++] = u;
+					queue.emplace_back( newBones( u ), u );
+				}
+				frontier.resize( n );
+				std::make_heap( queue.begin(), queue.end(), std::greater< QueueEntry >() );
+				bonesChanged = false;
+			}
+			if ( queue.empty() || ( grp.boneCount + queue.front().first ) > size_t( maxBonesPerPartition ) ) {
+				// no neighbouring triangle fits, look for one elsewhere if bones were added since the last search
+				if ( sweepBoneCount == grp.boneCount )
+					break;
+				sweepTriangles();
+				if ( queue.empty() || ( grp.boneCount + queue.front().first ) > size_t( maxBonesPerPartition ) )
+					break;
+			}
+			QueueEntry	e = queue.front();
+			std::pop_heap( queue.begin(), queue.end(), std::greater< QueueEntry >() );
+			queue.pop_back();
+			if ( triangleGroups[e.second] != unassigned )
+				continue;
+			if ( ( grp.vertexCount + newVertices( e.second ) ) > maxVerticesPerPartition ) {
+				frontierStamp[e.second] = unassigned - 1;
+				continue;
+			}
+			addTriangle( e.second );
+		}
+		frontier.clear();
+		queue.clear();
+	}
+}
+
+void SkinPartitioner::mergePartitions()
+{
+	bool	merged = true;
+	while ( merged ) {
+		merged = false;
+		for ( size_t p1 = 0; p1 < groups.size(); p1++ ) {
+			if ( groups[p1].boneCount >= size_t( maxBonesPerPartition ) )
+				continue;
+			for ( size_t p2 = p1 + 1; p2 < groups.size(); ) {
+				Group &	g1 = groups[p1];
+				Group &	g2 = groups[p2];
+				size_t	n = 0;
+				for ( size_t w = 0; w < boneWords; w++ )
+					n += size_t( std::popcount( g1.bones[w] | g2.bones[w] ) );
+				if ( n > size_t( maxBonesPerPartition ) || ( g1.vertexCount + g2.vertexCount ) > maxVerticesPerPartition ) {
+					p2++;
+					continue;
+				}
+				for ( size_t w = 0; w < boneWords; w++ )
+					g1.bones[w] |= g2.bones[w];
+				g1.boneCount = n;
+				// the sum is an upper bound of the number of vertices, shared vertices are counted twice
+				g1.vertexCount += g2.vertexCount;
+				g1.triangles.insert( g1.triangles.end(), g2.triangles.begin(), g2.triangles.end() );
+				groups.erase( groups.begin() + std::ptrdiff_t( p2 ) );
+				merged = true;
+			}
+		}
+	}
+}
+
+void SkinPartitioner::createPartitions()
+{
+	const std::uint32_t	unused = ~std::uint32_t( 0 );
+	std::vector< std::uint32_t >	localIndex( numVerts, unused );
+
+	parts.resize( groups.size() );
+	for ( size_t p = 0; p < groups.size(); p++ ) {
+		Group &	grp = groups[p];
+		Partition &	part = parts[p];
+		std::sort( grp.triangles.begin(), grp.triangles.end() );
+
+		// explicit partitions without triangles have no bone set
+		for ( size_t w = 0; w < grp.bones.size(); w++ ) {
+			for ( std::uint64_t m = grp.bones[w]; m; m = m & ( m - 1 ) )
+				part.bones.push_back( std::uint32_t( ( w << 6 ) + size_t( std::countr_zero( m ) ) ) );
+		}
+
+		part.sourceTriangles = grp.triangles;
+		part.triangles.reserve( grp.triangles.size() * 3 );
+		for ( std::uint32_t t : grp.triangles ) {
+			for ( int c = 0; c < 3; c++ ) {
+				std::uint32_t	v = triangles[size_t( t ) * 3 + size_t(c)];
+				if ( localIndex[v] == unused ) {
+					localIndex[v] = std::uint32_t( part.vertexMap.size() );
+					part.vertexMap.push_back( v );
+				}
+				part.triangles.push_back( localIndex[v] );
+			}
+		}
+		for ( std::uint32_t v : part.vertexMap )
+			localIndex[v] = unused;
+	}
+	groups.clear();
+}
+
+bool SkinPartitioner::validate( QString * errorMessage ) const
+{
+	size_t	numTriangles = triangles.size() / 3;
+	std::vector< std::uint32_t >	triangleCounts( numTriangles, 0 );
+
+	for ( size_t p = 0; p < parts.size(); p++ ) {
+		const Partition &	part = parts[p];
+		if ( !explicitPartitions && part.bones.size() > size_t( maxBonesPerPartition ) ) {
+			return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Partition %1 has %2 bones, the limit is %3" )
+			             .arg( p ).arg( part.bones.size() ).arg( maxBonesPerPartition ) );
+		}
+		// explicit partitions cannot be split, but their local vertex numbers still have to fit in 16 bits
+		if ( part.vertexMap.size() > maxVerticesPerPartition ) {
+			return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Partition %1 has %2 vertices, the limit is %3" )
+			             .arg( p ).arg( part.vertexMap.size() ).arg( maxVerticesPerPartition ) );
+		}
+		if ( !std::is_sorted( part.bones.begin(), part.bones.end() )
+		     || std::adjacent_find( part.bones.begin(), part.bones.end() ) != part.bones.end() ) {
+			return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Partition %1 has an invalid bone list" ).arg( p ) );
+		}
+		if ( part.triangles.size() != ( part.sourceTriangles.size() * 3 ) )
+			return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Partition %1 has an invalid triangle list" ).arg( p ) );
+
+		for ( size_t i = 0; i < part.sourceTriangles.size(); i++ ) {
+			std::uint32_t	t = part.sourceTriangles[i];
+			if ( t >= numTriangles )
+				return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Partition %1 has an invalid triangle list" ).arg( p ) );
+			triangleCounts[t]++;
+			for ( int c = 0; c < 3; c++ ) {
+				std::uint32_t	l = part.triangles[i * 3 + size_t(c)];
+				if ( l >= part.vertexMap.size() || part.vertexMap[l] != triangles[size_t( t ) * 3 + size_t(c)] ) {
+					return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Triangle %1 is mapped incorrectly in partition %2" )
+					             .arg( t ).arg( p ) );
+				}
+			}
+		}
+
+		for ( std::uint32_t v : part.vertexMap ) {
+			if ( influenceCounts[v] < 1 || influenceCounts[v] > std::uint32_t( maxBonesPerVertex ) ) {
+				return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Vertex %1 has %2 bone influences, the limit is %3" )
+				             .arg( v ).arg( influenceCounts[v] ).arg( maxBonesPerVertex ) );
+			}
+			for ( std::uint32_t i = 0; i < influenceCounts[v]; i++ ) {
+				if ( !std::binary_search( part.bones.begin(), part.bones.end(), influence( v, int(i) ).bone ) ) {
+					return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Vertex %1 uses a bone that is not in partition %2" )
+					             .arg( v ).arg( p ) );
+				}
+			}
+		}
+	}
+
+	for ( size_t t = 0; t < numTriangles; t++ ) {
+		if ( triangleCounts[t] != 1 ) {
+			return fail( errorMessage, QCoreApplication::translate( "SkinPartitioner", "Triangle %1 is in %2 partitions" )
+			             .arg( t ).arg( triangleCounts[t] ) );
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,131 @@
+#ifndef SKINPARTITION_H_INCLUDED
+#define SKINPARTITION_H_INCLUDED
+
+#include <QString>
+
+#include <cstdint>
+#include <vector>
+
+
+//! \file skinpartition.h Skin partitioning engine
+
+/*! Splits a skinned triangle mesh into partitions with a limited number of bones
+ *
+ * Vertex weights are stored in dense arrays with maxBonesPerVertex slots per vertex,
+ * and the bones of triangles and partitions are stored as bit sets. Vertex and triangle
+ * indices are 32-bit, partitions are limited to maxVerticesPerPartition vertices so that
+ * their local indices fit in the 16-bit fields of NiSkinPartition.
+ *
+ * Partitions are grown from the triangle with the most bones, always adding the triangle
+ * that needs the fewest new bones, and partitions that fit together are merged at the end.
+ * None of the methods use NifModel, so separate instances can run on multiple threads.
+ */
+class SkinPartitioner final
+{
+public:
+	struct Influence
+	{
+		std::uint32_t	bone;
+		float	weight;
+	};
+
+	struct Partition
+	{
+		//! Bones used by the partition, in ascending order
+		std::vector<std::uint32_t>	bones;
+		//! Maps local vertex numbers to shape vertex numbers
+		std::vector<std::uint32_t>	vertexMap;
+		//! Triangles of the partition, 3 local vertex numbers per triangle
+		std::vector<std::uint32_t>	triangles;
+		//! Index of each triangle in the input triangle list
+		std::vector<std::uint32_t>	sourceTriangles;
+	};
+
+	SkinPartitioner( size_t numVertices, size_t numBones );
+
+	//! Adds the weight of a bone for a vertex, as stored in NiSkinData
+	void addInfluence( std::uint32_t vertex, std::uint32_t bone, float weight );
+
+	//! Vertex positions (3 floats per vertex), used to keep influences of duplicate vertices consistent
+	std::vector<float>	positions;
+	//! Triangles, 3 vertex numbers per triangle
+	std::vector<std::uint32_t>	triangles;
+	/*! Optional partition number for each triangle
+	 *
+	 * If not empty, the triangles are put in the specified partitions instead of
+	 * being grouped automatically, and partitions are not merged.
+	 */
+	std::vector<std::uint32_t>	trianglePartitions;
+
+	int	maxBonesPerVertex = 4;
+	int	maxBonesPerPartition = 18;
+	size_t	maxVerticesPerPartition = 65535;
+
+	//! Returns the smallest and largest number of influences per vertex of the input
+	void influenceRange( int & minInfluences, int & maxInfluences ) const;
+
+	//! Reduces influences and builds the partitions, returns false on error
+	bool build( QString * errorMessage = nullptr );
+	/*! Checks that every triangle is in exactly one partition, and that the influence,
+	 * bone and vertex limits are respected
+	 *
+	 * The bone limit is not checked for explicit partitions, the vertex limit always is.
+	 */
+	bool validate( QString * errorMessage = nullptr ) const;
+
+	const std::vector<Partition> & partitions() const { return parts; }
+	//! Returns the number of influences of a vertex after build()
+	int influenceCount( std::uint32_t vertex ) const { return int( influenceCounts[vertex] ); }
+	//! Returns influence \a i of a vertex after build(), sorted by weight in descending order
+	const Influence & influence( std::uint32_t vertex, int i ) const
+	{
+		return influences[size_t( vertex ) * size_t( influenceStride ) + size_t( i )];
+	}
+
+	//! Number of vertices that had more than maxBonesPerVertex influences
+	size_t	reducedVertices = 0;
+	//! Number of influences removed to fit triangles into maxBonesPerPartition bones
+	size_t	removedInfluences = 0;
+
+protected:
+	bool fail( QString * errorMessage, const QString & msg ) const;
+	void reduceVertexInfluences();
+	bool reduceTriangleBones( QString * errorMessage );
+	//! Returns 1 if the influence was removed, 0 if not found, -1 if no weight is left on the vertex
+	int removeInfluence( std::uint32_t vertex, std::uint32_t bone );
+	void calculateTriangleBones();
+	void groupTriangles();
+	void mergePartitions();
+	void createPartitions();
+
+	size_t	numVerts;
+	size_t	numBones;
+	size_t	boneWords;
+	int	influenceStride = 0;
+
+	struct InputInfluence
+	{
+		std::uint32_t	vertex;
+		Influence	influence;
+	};
+	std::vector<InputInfluence>	inputInfluences;
+	std::vector<Influence>	influences;
+	std::vector<std::uint32_t>	influenceCounts;
+
+	//! Bit set of the bones of each triangle, boneWords 64-bit words per triangle
+	std::vector<std::uint64_t>	triangleBones;
+
+	//! A group of triangles that becomes a partition
+	struct Group
+	{
+		std::vector<std::uint64_t>	bones;
+		std::vector<std::uint32_t>	triangles;
+		size_t	boneCount = 0;
+		size_t	vertexCount = 0;
+	};
+	std::vector<Group>	groups;
+	std::vector<Partition>	parts;
+	bool	explicitPartitions = false;
+};
+
+#endif
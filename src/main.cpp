@@ -35,16 +35,26 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "data/nifvalue.h"
 #include "model/nifmodel.h"
 #include "model/kfmmodel.h"
+#include "lib/animsampler.h"
+#include "io/MeshFile.h"
 
 #include <QApplication>
 #include <QCommandLineParser>
 #include <QDesktopServices>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
 #include <QSettings>
 #include <QStack>
+#include <QTemporaryDir>
+#include <QTextStream>
 #include <QUdpSocket>
 #include <QUrl>
 
+#include <algorithm>
+#include <bit>
+
+bool exportObjFile( const NifModel * nif, const QString & fileName );
 
 QCoreApplication * createApplication( int &argc, char *argv[] )
 {
@@ -63,6 +73,218 @@ QCoreApplication * createApplication( int &argc, char *argv[] )
 }
 
 
+//! Loads each NIF file and reports the time and throughput of saving it to a temporary folder
+static int benchmarkSave( const QStringList & files, int repeat )
+{
+	QTextStream out( stdout );
+	QTextStream err( stderr );
+
+	if ( files.isEmpty() ) {
+		err << "--benchmark-save: no input files\n";
+		return 1;
+	}
+
+	if ( !NifModel::loadXML() )
+		return 1;
+
+	QTemporaryDir tmpDir;
+	if ( !tmpDir.isValid() ) {
+		err << "Could not create temporary folder\n";
+		return 1;
+	}
+
+	int result = 0;
+	for ( const QString & fileName : files ) {
+		NifModel nif;
+		if ( !nif.loadFromFile( fileName ) ) {
+			err << "Could not load " << fileName << "\n";
+			result = 1;
+			continue;
+		}
+
+		QString savePath = tmpDir.filePath( QFileInfo( fileName ).fileName() );
+		qint64 bestTime = -1;
+		QElapsedTimer timer;
+		for ( int i = 0; i < repeat; i++ ) {
+			timer.start();
+			if ( !nif.saveToFile( savePath ) ) {
+				bestTime = -1;
+				break;
+			}
+			qint64 t = timer.nsecsElapsed();
+			if ( bestTime < 0 || t < bestTime )
+				bestTime = t;
+		}
+
+		if ( bestTime < 0 ) {
+			err << "Could not save " << fileName << "\n";
+			result = 1;
+			continue;
+		}
+
+		double mbytes = double( QFileInfo( savePath ).size() ) / 1048576.0;
+		double seconds = std::max( double( bestTime ) * 1.0e-9, 1.0e-9 );
+		out << fileName << ": " << QString( "%1 MB saved in %2 ms (best of %3), %4 MB/s" )
+			.arg( mbytes, 0, 'f', 2 ).arg( seconds * 1000.0, 0, 'f', 2 ).arg( repeat ).arg( mbytes / seconds, 0, 'f', 1 ) << "\n";
+		out.flush();
+	}
+
+	return result;
+}
+
+
+//! Loads each NIF file and reports the time and throughput of exporting it to OBJ format in a temporary folder
+static int benchmarkObjExport( const QStringList & files, int repeat )
+{
+	QTextStream out( stdout );
+	QTextStream err( stderr );
+
+	if ( files.isEmpty() ) {
+		err << "--benchmark-obj-export: no input files\n";
+		return 1;
+	}
+
+	if ( !NifModel::loadXML() )
+		return 1;
+
+	QTemporaryDir tmpDir;
+	if ( !tmpDir.isValid() ) {
+		err << "Could not create temporary folder\n";
+		return 1;
+	}
+
+	int result = 0;
+	for ( const QString & fileName : files ) {
+		NifModel nif;
+		if ( !nif.loadFromFile( fileName ) ) {
+			err << "Could not load " << fileName << "\n";
+			result = 1;
+			continue;
+		}
+
+		QString exportPath = tmpDir.filePath( QFileInfo( fileName ).completeBaseName() + ".obj" );
+		qint64 bestTime = -1;
+		QElapsedTimer timer;
+		for ( int i = 0; i < repeat; i++ ) {
+			timer.start();
+			if ( !exportObjFile( &nif, exportPath ) ) {
+				bestTime = -1;
+				break;
+			}
+			qint64 t = timer.nsecsElapsed();
+			if ( bestTime < 0 || t < bestTime )
+				bestTime = t;
+		}
+
+		if ( bestTime < 0 ) {
+			err << "Could not export " << fileName << "\n";
+			result = 1;
+			continue;
+		}
+
+		double mbytes = double( QFileInfo( exportPath ).size() ) / 1048576.0;
+		double seconds = std::max( double( bestTime ) * 1.0e-9, 1.0e-9 );
+		out << fileName << ": " << QString( "%1 MB of OBJ data exported in %2 ms (best of %3), %4 MB/s" )
+			.arg( mbytes, 0, 'f', 2 ).arg( seconds * 1000.0, 0, 'f', 2 ).arg( repeat ).arg( mbytes / seconds, 0, 'f', 1 ) << "\n";
+		out.flush();
+	}
+
+	return result;
+}
+
+
+//! Appends a generated Starfield .mesh file with 'numVerts' vertices to 'buf'
+static void generateMeshFile( std::vector< unsigned char > & buf, std::uint32_t numVerts, std::uint32_t seed )
+{
+	auto	putU16 = [&buf]( std::uint16_t n ) {
+		buf.push_back( (unsigned char) ( n & 0xFF ) );
+		buf.push_back( (unsigned char) ( n >> 8 ) );
+	};
+	auto	putU32 = [&putU16]( std::uint32_t n ) {
+		putU16( std::uint16_t( n & 0xFFFF ) );
+		putU16( std::uint16_t( n >> 16 ) );
+	};
+	auto	random = [&seed]() {
+		seed = seed * 1664525U + 1013904223U;
+		return seed >> 8;
+	};
+
+	std::uint32_t	numTriangles = ( numVerts - 2U ) * 2U;
+	putU32( 2 );
+	putU32( numTriangles * 3U );
+	for ( std::uint32_t i = 0; i < numTriangles * 3U; i++ )
+		putU16( std::uint16_t( random() % numVerts ) );
+	putU32( std::bit_cast< std::uint32_t >( 16.0f ) );
+	putU32( 4 );	// weights per vertex
+	putU32( numVerts );
+	for ( std::uint32_t i = 0; i < numVerts * 3U; i++ )
+		putU16( std::uint16_t( random() ) );
+	for ( int uvSet = 0; uvSet < 2; uvSet++ ) {
+		putU32( numVerts );
+		for ( std::uint32_t i = 0; i < numVerts; i++ )
+			putU32( std::uint32_t( FloatVector4( float( random() & 0xFFFF ) / 65535.0f, float( random() & 0xFFFF ) / 65535.0f, 0.0f, 0.0f ).convertToFloat16() ) );
+	}
+	// colors, normals and tangents
+	for ( int i = 0; i < 3; i++ ) {
+		putU32( numVerts );
+		for ( std::uint32_t j = 0; j < numVerts; j++ )
+			putU32( random() | ( random() << 24 ) );
+	}
+	putU32( numVerts * 4U );
+	for ( std::uint32_t i = 0; i < numVerts * 4U; i++ ) {
+		putU16( std::uint16_t( random() & 0x7F ) );
+		putU16( std::uint16_t( random() ) );
+	}
+	putU32( 1 );	// LODs
+	putU32( ( numTriangles / 2U ) * 3U );
+	for ( std::uint32_t i = 0; i < ( numTriangles / 2U ) * 3U; i++ )
+		putU16( std::uint16_t( random() % numVerts ) );
+}
+
+//! Decodes a generated set of Starfield .mesh files and reports the time and throughput of MeshFile
+static int benchmarkMeshes( int count, int repeat )
+{
+	QTextStream out( stdout );
+
+	std::vector< unsigned char > buf;
+	std::vector< std::pair< size_t, size_t > > meshes;
+	std::uint64_t totalVerts = 0;
+	for ( int i = 0; i < count; i++ ) {
+		// vertex counts from 256 to 32768, similar to the range of game meshes
+		std::uint32_t numVerts = 256U << ( i % 8 );
+		size_t offs = buf.size();
+		generateMeshFile( buf, numVerts, std::uint32_t( i ) );
+		meshes.emplace_back( offs, buf.size() - offs );
+		totalVerts += numVerts;
+	}
+
+	qint64 bestTime = -1;
+	QElapsedTimer timer;
+	for ( int i = 0; i < repeat; i++ ) {
+		timer.start();
+		for ( const auto & m : meshes ) {
+			MeshFile meshFile( buf.data() + m.first, m.second );
+			if ( !meshFile.isValid() ) {
+				QTextStream( stderr ) << "Error decoding generated mesh\n";
+				return 1;
+			}
+		}
+		qint64 t = timer.nsecsElapsed();
+		if ( bestTime < 0 || t < bestTime )
+			bestTime = t;
+	}
+
+	double mbytes = double( buf.size() ) / 1048576.0;
+	double seconds = std::max( double( bestTime ) * 1.0e-9, 1.0e-9 );
+	out << QString( "%1 meshes, %2 vertices, %3 MB decoded in %4 ms (best of %5), %6 MB/s, %7 M vertices/s" )
+		.arg( meshes.size() ).arg( totalVerts ).arg( mbytes, 0, 'f', 2 ).arg( seconds * 1000.0, 0, 'f', 2 ).arg( repeat )
+		.arg( mbytes / seconds, 0, 'f', 1 ).arg( double( totalVerts ) * 1.0e-6 / seconds, 0, 'f', 2 ) << "\n";
+	out.flush();
+
+	return 0;
+}
+
+
 /*
  *  main
  */
@@ -160,7 +382,67 @@ int main( int argc, char * argv[] )
 			return 0;
 		}
 	} else {
-		// Future command line batch tools here
+		// Command line batch tools
+		QCommandLineParser parser;
+		parser.setSingleDashWordOptionMode( QCommandLineParser::ParseAsLongOptions );
+		parser.addHelpOption();
+
+		QCommandLineOption noGuiOption( "no-gui", "Run without the user interface" );
+		QCommandLineOption sampleOption( "sample-animations",
+			"Sample the transform animations of all NiControllerSequence blocks of the files and write the bone transforms in CSV format" );
+		QCommandLineOption outputOption( {"o", "output"}, "Output file, or folder if there are several input files", "path" );
+		QCommandLineOption skeletonOption( "skeleton", "Skeleton NIF used to calculate world transforms", "file" );
+		QCommandLineOption fpsOption( "fps", "Number of samples per second (default: 30)", "fps", "30" );
+		QCommandLineOption benchmarkSaveOption( "benchmark-save",
+			"Load the NIF files and measure the throughput of saving them to a temporary folder" );
+		QCommandLineOption benchmarkMeshesOption( "benchmark-meshes",
+			"Decode a generated set of Starfield .mesh files and measure the throughput of the mesh decoder" );
+		QCommandLineOption benchmarkObjExportOption( "benchmark-obj-export",
+			"Load the NIF files and measure the throughput of exporting them to OBJ format in a temporary folder" );
+		QCommandLineOption meshCountOption( "mesh-count", "Number of meshes generated for --benchmark-meshes (default: 80)", "count", "80" );
+		QCommandLineOption repeatOption( "repeat",
+			"Number of times each file is saved by --benchmark-save or exported by --benchmark-obj-export, or the meshes are decoded by --benchmark-meshes (default: 5)", "count", "5" );
+		parser.addOptions( { noGuiOption, sampleOption, outputOption, skeletonOption, fpsOption, benchmarkSaveOption,
+			benchmarkMeshesOption, benchmarkObjExportOption, meshCountOption, repeatOption } );
+		parser.addPositionalArgument( "files", "Input files" );
+
+		parser.process( *app );
+
+		if ( parser.isSet( sampleOption ) ) {
+			QStringList files;
+			for ( const QString & arg : parser.positionalArguments() )
+				files.append( QDir::current().filePath( arg ) );
+
+			QString outputPath = parser.value( outputOption );
+			QString skeletonPath = parser.value( skeletonOption );
+			if ( !outputPath.isEmpty() )
+				outputPath = QDir::current().filePath( outputPath );
+			if ( !skeletonPath.isEmpty() )
+				skeletonPath = QDir::current().filePath( skeletonPath );
+
+			return AnimationSampler::runCommandLine( files, outputPath, skeletonPath, parser.value( fpsOption ).toFloat() );
+		}
+
+		if ( parser.isSet( benchmarkSaveOption ) ) {
+			QStringList files;
+			for ( const QString & arg : parser.positionalArguments() )
+				files.append( QDir::current().filePath( arg ) );
+
+			return benchmarkSave( files, std::max( parser.value( repeatOption ).toInt(), 1 ) );
+		}
+
+		if ( parser.isSet( benchmarkObjExportOption ) ) {
+			QStringList files;
+			for ( const QString & arg : parser.positionalArguments() )
+				files.append( QDir::current().filePath( arg ) );
+
+			return benchmarkObjExport( files, std::max( parser.value( repeatOption ).toInt(), 1 ) );
+		}
+
+		if ( parser.isSet( benchmarkMeshesOption ) )
+			return benchmarkMeshes( std::max( parser.value( meshCountOption ).toInt(), 1 ), std::max( parser.value( repeatOption ).toInt(), 1 ) );
+
+		parser.showHelp( 1 );
 	}
 
 	return 0;
@@ -4,6 +4,7 @@
 #include <QAbstractButton>
 #include <QMap>
 #include <QCloseEvent>
+#include <QDebug>
 #include <QScreen>
 
 
@@ -166,6 +167,12 @@ void unregisterMessageBox( DetailsMessageBox * msgBox )
 
 void Message::append( QWidget * parent, const QString & str, const QString & err, QMessageBox::Icon icon )
 {
+	// Command line tools run without widgets
+	if ( !qobject_cast<QApplication *>( QCoreApplication::instance() ) ) {
+		qWarning().noquote() << str << err;
+		return;
+	}
+
 	if ( !parent )
 		parent = qApp->activeWindow();
 
@@ -37,9 +37,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QByteArray>
 #include <QColor>
-#include <QBuffer>
 #include <QFile>
 #include <QFileInfo>
+#include <QSaveFile>
 #include <QTime>
 
 
@@ -563,13 +563,20 @@ bool BaseModel::loadFromFile( const QString & file )
 
 bool BaseModel::saveToFile( const QString & str ) const
 {
-	QFile f( str );
-	QBuffer buf;
-	bool success = false;
-	if ( buf.open( QIODevice::WriteOnly ) && save( buf ) )
-		success = f.open( QIODevice::WriteOnly ) && f.write( buf.data() ) > 0;
+	// The data is written to a temporary file that replaces the original on commit(),
+	// an existing file is left unchanged if saving fails
+	// Direct writing is used as fallback where a temporary file cannot be created in the directory
+	QSaveFile f( str );
+	f.setDirectWriteFallback( true );
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return false;
+
+	if ( !save( f ) ) {
+		f.cancelWriting();
+		return false;
+	}
 
-	return success;
+	return f.commit();
 }
 
 void BaseModel::refreshFileInfo( const QString & f )
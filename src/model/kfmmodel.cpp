@@ -274,7 +274,7 @@ bool KfmModel::save( QIODevice & device ) const
 {
 	NifOStream stream( this, &device );
 
-	if ( !kfmroot || !save( kfmroot, stream ) ) {
+	if ( !kfmroot || !save( kfmroot, stream ) || !stream.flush() ) {
 		Message::critical( nullptr, tr( "Failed to write KFM file." ) );
 		return false;
 	}
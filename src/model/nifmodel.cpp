@@ -1828,10 +1828,11 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 {
 	QSettings settings;
 	bool ignoreSize = settings.value( "Ignore Block Size", true ).toBool();
-	bool convertSFMeshes =
-		settings.value( "Settings/Nif/Convert Starfield meshes to internal geometry on load", true ).toBool();
+	bool convertSFMeshes = convertMeshesOnLoad
+		&& settings.value( "Settings/Nif/Convert Starfield meshes to internal geometry on load", true ).toBool();
 
 	clear();
+	skippedBlocks = 0;
 
 	NifIStream stream( this, &device );
 
@@ -1874,6 +1875,7 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 
 				QString blktyp;
 				quint32 size = UINT_MAX;
+				bool skipped = false;
 				try
 				{
 					if ( version >= 0x0a000000 ) {
@@ -1908,7 +1910,7 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 						}
 
 						// for version 20.2.0.? and above the block size is stored in the header
-						if ( !ignoreSize && version >= 0x14020000 )
+						if ( ( !ignoreSize || blockFilter ) && version >= 0x14020000 )
 							size = get<quint32>( index( c, 0, getIndex( createIndex( header->row(), 0, header ), "Block Size" ) ) );
 					} else {
 						int len;
@@ -1930,7 +1932,11 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 						//qDebug() << "loading block" << c << ":" << blktyp );
 						QModelIndex newBlock = insertNiBlock( blktyp, -1 );
 
-						if ( !loadItem( root->child( c + 1 ), stream ) ) {
+						// blocks not selected by loadSelective() are skipped using the block size
+						skipped = ( blockFilter && size != UINT_MAX && !(*blockFilter)( blktyp ) );
+						if ( skipped )
+							skippedBlocks++;
+						else if ( !loadItem( root->child( c + 1 ), stream ) ) {
 							NifItem * child = root->child( c );
 							throw tr( "failed to load block number %1 (%2) previous block was %3" ).arg( c ).arg( blktyp ).arg( child ? child->name() : prevblktyp );
 						}
@@ -1960,7 +1966,9 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 
 					if ( (curpos + size) != pos ) {
 						// unable to seek to location... abort
-						if ( device.seek( curpos + size ) ) {
+						if ( !device.seek( curpos + size ) ) {
+							throw tr( "failed to reposition device at block number %1 (%2) previous block was %3" ).arg( c ).arg( blktyp ).arg( root->child( c )->name() );
+						} else if ( !skipped ) {
 							auto m = tr( "device position incorrect after block number %1 (%2) at 0x%3 ended at 0x%4 (expected 0x%5)" )
 								.arg( c )
 								.arg( blktyp )
@@ -1971,9 +1979,6 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 
 							logWarning(m);
 						}
-						else {
-							throw tr( "failed to reposition device at block number %1 (%2) previous block was %3" ).arg( c ).arg( blktyp ).arg( root->child( c )->name() );
-						}
 						curpos = device.pos();
 					} else {
 						curpos = pos;
@@ -2059,12 +2064,21 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 	//qDebug() << t.msecsTo( QTime::currentTime() );
 	reset(); // notify model views that a significant change to the data structure has occurded
 
-	if ( getBSVersion() >= 170 && convertSFMeshes )
+	if ( getBSVersion() >= 170 && convertSFMeshes && !blockFilter )
 		spMeshFileImport::processAllItems( this );
 
 	return true;
 }
 
+bool NifModel::loadSelective( QIODevice & device, const BlockFilter & filter, const char * fileName )
+{
+	blockFilter = &filter;
+	bool result = load( device, fileName );
+	blockFilter = nullptr;
+
+	return result;
+}
+
 bool NifModel::save( QIODevice & device ) const
 {
 	NifOStream stream( this, &device );
@@ -2088,25 +2102,25 @@ bool NifModel::save( QIODevice & device ) const
 			if ( version > 0x0a000000 ) {
 				if ( version < 0x0a020000 ) {
 					int null = 0;
-					device.write( (char *)&null, 4 );
+					stream.writeData( &null, 4 );
 				}
 			} else {
 				if ( version < 0x0303000d ) {
 					if ( rootLinks.contains( c - 1 ) ) {
 						QString string = "Top Level Object";
 						int len = string.length();
-						device.write( (char *)&len, 4 );
-						device.write( string.toLatin1().constData(), len );
+						stream.writeData( &len, 4 );
+						stream.writeData( string.toLatin1().constData(), len );
 					}
 				}
 
 				QString string = itemName( index( c, 0 ) );
 				int len = string.length();
-				device.write( (char *)&len, 4 );
-				device.write( string.toLatin1().constData(), len );
+				stream.writeData( &len, 4 );
+				stream.writeData( string.toLatin1().constData(), len );
 
 				if ( version < 0x0303000d ) {
-					device.write( (char *)&c, 4 );
+					stream.writeData( &c, 4 );
 				}
 			}
 		}
@@ -2121,8 +2135,14 @@ bool NifModel::save( QIODevice & device ) const
 	if ( version < 0x0303000d ) {
 		QString string = "End Of File";
 		int len = string.length();
-		device.write( (char *)&len, 4 );
-		device.write( string.toLatin1().constData(), len );
+		stream.writeData( &len, 4 );
+		stream.writeData( string.toLatin1().constData(), len );
+	}
+
+	if ( !stream.flush() ) {
+		Message::critical( nullptr, tr( "Failed to write file." ) );
+		resetState();
+		return false;
 	}
 
 	resetState();
@@ -2173,7 +2193,14 @@ bool NifModel::loadHeaderOnly( const QString & fname )
 		return false;
 	}
 
-	NifIStream stream( this, &f );
+	return loadHeaderOnly( f );
+}
+
+bool NifModel::loadHeaderOnly( QIODevice & device )
+{
+	clear();
+
+	NifIStream stream( this, &device );
 
 	// read header
 	NifItem * header = getHeaderItem();
@@ -2186,15 +2213,9 @@ bool NifModel::loadHeaderOnly( const QString & fname )
 	return true;
 }
 
-bool NifModel::earlyRejection( const QString & filepath, const QString & blockId, quint32 v )
+//! Returns true if the header of \a nif matches the version and block type of earlyRejection()
+static bool headerMatches( const NifModel & nif, const QString & blockId, quint32 v )
 {
-	NifModel nif;
-
-	if ( nif.loadHeaderOnly( filepath ) == false ) {
-		//File failed to read entierly
-		return false;
-	}
-
 	bool ver_match = false;
 
 	if ( v == 0 ) {
@@ -2210,7 +2231,7 @@ bool NifModel::earlyRejection( const QString & filepath, const QString & blockId
 	} else {
 		const auto & types = nif.getArray<QString>( nif.getHeaderItem(), "Block Types" );
 		for ( const QString& s : types ) {
-			if ( inherits( s, blockId ) ) {
+			if ( nif.inherits( s, blockId ) ) {
 				blk_match = true;
 				break;
 			}
@@ -2220,12 +2241,34 @@ bool NifModel::earlyRejection( const QString & filepath, const QString & blockId
 	return (ver_match && blk_match);
 }
 
+bool NifModel::earlyRejection( const QString & filepath, const QString & blockId, quint32 v )
+{
+	NifModel nif;
+
+	if ( nif.loadHeaderOnly( filepath ) == false ) {
+		//File failed to read entierly
+		return false;
+	}
+
+	return headerMatches( nif, blockId, v );
+}
+
+bool NifModel::earlyRejection( QIODevice & device, const QString & blockId, quint32 v )
+{
+	NifModel nif;
+
+	if ( nif.loadHeaderOnly( device ) == false )
+		return false;
+
+	return headerMatches( nif, blockId, v );
+}
+
 bool NifModel::saveIndex( QIODevice & device, const QModelIndex & index ) const
 {
 	const NifItem * item = getItem( index );
 	if ( item ) {
 		NifOStream stream( this, &device );
-		return saveItem( item, stream );
+		return saveItem( item, stream ) && stream.flush();
 	}
 	return false;
 }
@@ -41,6 +41,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QStack>
 #include <QStringList>
 
+#include <functional>
 #include <memory>
 
 class SpellBook;
@@ -105,6 +106,27 @@ public:
 
 	// end BaseModel
 
+	//! Predicate on the block type, used by loadSelective()
+	using BlockFilter = std::function<bool( const QString & blockType )>;
+	/*! Loads only the blocks for which \a filter returns true
+	 *
+	 * For files of version 20.2.0.7 and newer, the other blocks are not decoded: the device is
+	 * positioned past them using the block sizes stored in the header, and they are left as
+	 * placeholder blocks of the same type with default values, so that block numbers and types
+	 * are preserved. Older files are loaded completely. The model should not be saved after a
+	 * selective load.
+	 */
+	bool loadSelective( QIODevice & device, const BlockFilter & filter, const char * fileName = nullptr );
+	//! Returns the number of placeholder blocks of the last loadSelective()
+	int skippedBlockCount() const { return skippedBlocks; }
+	/*! Allows or disables converting Starfield meshes to internal geometry in load()
+	 *
+	 * The conversion reads the .mesh files from the game resources, which may open the archives
+	 * or show message boxes, so models loaded on worker threads should disable it. It also
+	 * depends on the "Convert Starfield meshes to internal geometry on load" setting.
+	 */
+	void setConvertMeshesOnLoad( bool enabled ) { convertMeshesOnLoad = enabled; }
+
 	//! Load from QIODevice and index
 	bool loadIndex( QIODevice & device, const QModelIndex & );
 	//! Save to QIODevice and index
@@ -121,6 +143,8 @@ public:
 	bool loadAndMapLinks( QIODevice & device, const QModelIndex &, const QMap<qint32, qint32> & map );
 	//! Loads the header from a filename
 	bool loadHeaderOnly( const QString & fname );
+	//! Loads the header from a QIODevice
+	bool loadHeaderOnly( QIODevice & device );
 
 	//! Returns the the estimated file offset of the model index
 	int fileOffset( const QModelIndex & ) const;
@@ -139,6 +163,8 @@ public:
 	 * @param version	The version to check for
 	 */
 	bool earlyRejection( const QString & filepath, const QString & blockId, quint32 version );
+	//! Checks the header of a file that is read from a QIODevice, see earlyRejection( const QString &, const QString &, quint32 )
+	bool earlyRejection( QIODevice & device, const QString & blockId, quint32 version );
 
 	const NifItem * getHeaderItem() const;
 	NifItem * getHeaderItem();
@@ -701,6 +727,12 @@ protected:
 	//! NIF file version
 	quint32 version;
 
+	//! Block filter of loadSelective(), nullptr when loading all blocks
+	const BlockFilter * blockFilter = nullptr;
+	int skippedBlocks = 0;
+	//! See setConvertMeshesOnLoad()
+	bool convertMeshesOnLoad = true;
+
 	QHash<int, QList<int> > childLinks;
 	QHash<int, QList<int> > parentLinks;
 	QList<int> rootLinks;
@@ -749,6 +781,12 @@ public:
 	}
 	bool getResourceFile(
 		QByteArray & data, const QString & path, const char * archiveFolder, const char * extension ) const;
+	//! Load resource file 'fullPath' without showing message boxes on errors. This is thread-safe
+	// if the file has already been found with findResourceFile() on the main thread.
+	inline bool extractResourceFile( QByteArray & data, const std::string_view & fullPath, QString * errorMessage = nullptr ) const
+	{
+		return gameResources->extract_file( data, fullPath, errorMessage );
+	}
 
 	//! Return pointer to Starfield material database, loading it first if necessary.
 	// On error, nullptr is returned.
@@ -37,6 +37,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QVector>
 #include <QDebug>
+#include <QSet>
+
+#include <algorithm>
 
 
 //! @file nifproxymodel.cpp NifProxyItem
@@ -44,56 +47,61 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 class NifProxyItem
 {
 public:
-	NifProxyItem( int number, NifProxyItem * parent )
+	NifProxyItem( int number, NifProxyItem * parent, QHash<int, QList<NifProxyItem *>> * index )
 	{
 		blockNumber = number;
 		parentItem  = parent;
+		blockItems  = index;
+
+		if ( blockItems && blockNumber >= 0 )
+			(*blockItems)[blockNumber].append( this );
 	}
 	~NifProxyItem()
 	{
 		qDeleteAll( childItems );
-	}
 
-	NifProxyItem * getLink( int link )
-	{
-		for ( NifProxyItem * item : childItems ) {
-			if ( item->block() == link )
-				return item;
+		if ( blockItems && blockNumber >= 0 ) {
+			auto i = blockItems->find( blockNumber );
+			if ( i != blockItems->end() ) {
+				i->removeOne( this );
+				if ( i->isEmpty() )
+					blockItems->erase( i );
+			}
 		}
-		return nullptr;
 	}
 
-	int rowLink( int link )
+	NifProxyItem * getLink( int link ) const
 	{
-		int row = 0;
-		for ( NifProxyItem * item : childItems ) {
-			if ( item->block() == link )
-				return row;
+		return links.value( link );
+	}
 
-			row++;
-		}
-		return -1;
+	int rowLink( int link ) const
+	{
+		NifProxyItem * item = getLink( link );
+		return ( item ? item->rowNumber : -1 );
 	}
 
 	NifProxyItem * addLink( int link )
 	{
 		NifProxyItem * child = getLink( link );
 
-		if ( child ) {
-			return child;
-		} else {
-			child = new NifProxyItem( link, this );
+		if ( !child ) {
+			child = new NifProxyItem( link, this, blockItems );
+			child->rowNumber = childItems.count();
 			childItems.append( child );
-			return child;
+			links.insert( link, child );
 		}
+		return child;
 	}
 
 	void delLink( int link )
 	{
-		NifProxyItem * child = getLink( link );
+		NifProxyItem * child = links.take( link );
 
 		if ( child ) {
-			childItems.removeAll( child );
+			childItems.removeAt( child->rowNumber );
+			for ( int r = child->rowNumber; r < childItems.count(); r++ )
+				childItems[r]->rowNumber = r;
 			delete child;
 		}
 	}
@@ -115,16 +123,15 @@ public:
 
 	void killChildren()
 	{
-		qDeleteAll( childItems );
+		auto items = childItems;
 		childItems.clear();
+		links.clear();
+		qDeleteAll( items );
 	}
 
 	int row() const
 	{
-		if ( parentItem )
-			return parentItem->childItems.indexOf( const_cast<NifProxyItem *>(this) );
-
-		return 0;
+		return rowNumber;
 	}
 
 	inline int block() const
@@ -132,74 +139,40 @@ public:
 		return blockNumber;
 	}
 
-	QList<int> parentBlocks() const
-	{
-		QList<int> parents;
-		NifProxyItem * parent = parentItem;
-
-		while ( parent && parent->parentItem ) {
-			parents.append( parent->blockNumber );
-			parent = parent->parentItem;
-		}
-
-		return parents;
-	}
-
-	QList<int> childBlocks() const
+	//! Returns true if a parent of the item, not counting the root, is block \a b
+	bool hasAncestor( int b ) const
 	{
-		QList<int> blocks;
-		for ( NifProxyItem * item : childItems ) {
-			blocks.append( item->block() );
-		}
-		return blocks;
-	}
-
-	NifProxyItem * findItem( int b, bool scanParents = true )
-	{
-		if ( blockNumber == b )
-			return this;
-
-		for ( NifProxyItem * child : childItems ) {
-			if ( child->blockNumber == b )
-				return child;
-		}
-
-		for ( NifProxyItem * child : childItems ) {
-			if ( NifProxyItem * x = child->findItem( b, false ) )
-				return x;
+		for ( NifProxyItem * parent = parentItem; parent && parent->parentItem; parent = parent->parentItem ) {
+			if ( parent->blockNumber == b )
+				return true;
 		}
-
-		if ( parentItem && scanParents ) {
-			NifProxyItem * root = parentItem;
-
-			while ( root && root->parentItem )
-				root = root->parentItem;
-
-			if ( NifProxyItem * x = root->findItem( b, false ) )
-				return x;
-		}
-
-		return nullptr;
+		return false;
 	}
 
-	void findAllItems( int b, QList<NifProxyItem *> & list )
+	int depth() const
 	{
-		for ( NifProxyItem * item : childItems ) {
-			item->findAllItems( b, list );
-		}
-
-		if ( blockNumber == b )
-			list.append( this );
+		int d = 0;
+		for ( NifProxyItem * parent = parentItem; parent; parent = parent->parentItem )
+			d++;
+		return d;
 	}
 
 	int blockNumber;
+	int rowNumber = 0;
+	//! The child links of the block have been added, false for up links and recursive links
+	bool expanded = false;
 	NifProxyItem * parentItem;
 	QList<NifProxyItem *> childItems;
+	//! Child items by block number
+	QHash<int, NifProxyItem *> links;
+	//! Items by block number, shared by all items of the model
+	QHash<int, QList<NifProxyItem *>> * blockItems;
 };
 
 NifProxyModel::NifProxyModel( QObject * parent ) : QAbstractItemModel( parent )
 {
-	root = new NifProxyItem( -1, 0 );
+	root = new NifProxyItem( -1, 0, &blockItems );
+	root->expanded = true;
 	nif = nullptr;
 }
 
@@ -244,9 +217,34 @@ void NifProxyModel::reset()
 	//qDebug() << "proxy reset";
 	root->killChildren();
 	updateRoot( true );
+	updateLinkCache( nullptr );
 	endResetModel();
 }
 
+void NifProxyModel::updateLinkCache( QVector<int> * changedBlocks )
+{
+	int n = ( nif ? nif->getBlockCount() : 0 );
+	QVector<QList<int>> children( n );
+	QVector<QList<int>> parents( n );
+
+	for ( int b = 0; b < n; b++ ) {
+		children[b] = nif->getChildLinks( b );
+		parents[b] = nif->getParentLinks( b );
+	}
+
+	if ( changedBlocks ) {
+		int m = std::max( n, int( childLinks.size() ) );
+		for ( int b = 0; b < m; b++ ) {
+			if ( b < n && b < childLinks.size() && children[b] == childLinks[b] && parents[b] == parentLinks[b] )
+				continue;
+			changedBlocks->append( b );
+		}
+	}
+
+	childLinks = std::move( children );
+	parentLinks = std::move( parents );
+}
+
 void NifProxyModel::updateRoot( bool fast )
 {
 	if ( !( nif && nif->getBlockCount() > 0 ) ) {
@@ -265,11 +263,14 @@ void NifProxyModel::updateRoot( bool fast )
 
 	//qDebug() << "proxy update top level";
 
+	const QList<int> rootLinks = nif->getRootLinks();
+	QSet<int> roots( rootLinks.cbegin(), rootLinks.cend() );
+
 	// Make a copy to iterate over
 	auto items = root->childItems;
 	for ( NifProxyItem * item : items ) {
-		if ( !nif->getRootLinks().contains( item->block() ) ) {
-			int at = root->rowLink( item->block() );
+		if ( !roots.contains( item->block() ) ) {
+			int at = item->row();
 
 			if ( !fast )
 				beginRemoveRows( QModelIndex(), at, at );
@@ -281,7 +282,7 @@ void NifProxyModel::updateRoot( bool fast )
 		}
 	}
 
-	for ( const auto l : nif->getRootLinks() ) {
+	for ( const auto l : rootLinks ) {
 		NifProxyItem * item = root->getLink( l );
 
 		if ( !item ) {
@@ -294,7 +295,8 @@ void NifProxyModel::updateRoot( bool fast )
 				endInsertRows();
 		}
 
-		updateItem( item, fast );
+		if ( !item->expanded )
+			updateItem( item, fast );
 	}
 }
 
@@ -302,22 +304,32 @@ void NifProxyModel::updateItem( NifProxyItem * item, bool fast )
 {
 	QModelIndex index( createIndex( item->row(), 0, item ) );
 
-	QList<int> parents( item->parentBlocks() );
+	const QList<int> children = nif->getChildLinks( item->block() );
+	const QList<int> parents = nif->getParentLinks( item->block() );
 
-	for ( const auto l : item->childBlocks() ) {
-		if ( !( nif->getChildLinks( item->block() ).contains( l ) || nif->getParentLinks( item->block() ).contains( l ) ) ) {
-			int at = item->rowLink( l );
+	item->expanded = true;
 
-			if ( !fast )
-				beginRemoveRows( index, at, at );
+	if ( item->childCount() > 0 ) {
+		QSet<int> linked( children.cbegin(), children.cend() );
+		for ( const auto l : parents )
+			linked.insert( l );
 
-			item->delLink( l );
+		auto items = item->childItems;
+		for ( NifProxyItem * child : items ) {
+			if ( !linked.contains( child->block() ) ) {
+				int at = child->row();
 
-			if ( !fast )
-				endRemoveRows();
+				if ( !fast )
+					beginRemoveRows( index, at, at );
+
+				item->delLink( child->block() );
+
+				if ( !fast )
+					endRemoveRows();
+			}
 		}
 	}
-	for ( const auto l : nif->getChildLinks( item->block() ) ) {
+	for ( const auto l : children ) {
 		NifProxyItem * child = item->getLink( l );
 
 		if ( !child ) {
@@ -332,16 +344,20 @@ void NifProxyModel::updateItem( NifProxyItem * item, bool fast )
 				endInsertRows();
 		}
 
-		if ( !parents.contains( child->block() ) ) {
-			updateItem( child, fast );
+		// Existing children are updated by xLinksChanged() if their own links change
+		if ( !item->hasAncestor( child->block() ) ) {
+			if ( !child->expanded )
+				updateItem( child, fast );
 		} else {
 			Message::append( tr( "Warnings were generated while reading NIF file." ),
 				tr( "infinite recursive link construct detected %1 -> %2" ).arg( item->block() ).arg( child->block() )
 			);
 		}
 	}
-	for ( const auto l : nif->getParentLinks( item->block() ) ) {
-		if ( !item->getLink( l ) ) {
+	for ( const auto l : parents ) {
+		NifProxyItem * child = item->getLink( l );
+
+		if ( !child ) {
 			int at = item->childCount();
 
 			if ( !fast )
@@ -351,6 +367,18 @@ void NifProxyModel::updateItem( NifProxyItem * item, bool fast )
 
 			if ( !fast )
 				endInsertRows();
+		} else if ( child->expanded && !children.contains( l ) ) {
+			// No longer a child link, only the up link is shown
+			if ( child->childCount() > 0 ) {
+				if ( !fast )
+					beginRemoveRows( createIndex( child->row(), 0, child ), 0, child->childCount() - 1 );
+
+				child->killChildren();
+
+				if ( !fast )
+					endRemoveRows();
+			}
+			child->expanded = false;
 		}
 	}
 }
@@ -436,16 +464,37 @@ QModelIndex NifProxyModel::mapFrom( const QModelIndex & idx, const QModelIndex &
 	if ( blockNumber < 0 )
 		return QModelIndex();
 
-	NifProxyItem * item = root;
+	NifProxyItem * refItem = root;
 
 	if ( ref.isValid() ) {
 		if ( ref.model() == this )
-			item = static_cast<NifProxyItem *>( ref.internalPointer() );
+			refItem = static_cast<NifProxyItem *>( ref.internalPointer() );
 		else
 			qDebug() << tr( "NifProxyModel::mapFrom() called with wrong ref model" );
 	}
 
-	item = item->findItem( blockNumber );
+	// Prefer the reference item, then the closest item below it, then the item closest to the root
+	NifProxyItem * item = nullptr;
+	bool itemInRef = false;
+	int itemDepth = 0;
+
+	for ( NifProxyItem * x : blockItems.value( blockNumber ) ) {
+		if ( x == refItem )
+			return createIndex( x->row(), 0, x );
+
+		bool inRef = false;
+		int depth = 0;
+		for ( NifProxyItem * p = x->parentItem; p; p = p->parentItem ) {
+			inRef |= ( p == refItem );
+			depth++;
+		}
+
+		if ( !item || ( inRef && !itemInRef ) || ( inRef == itemInRef && depth < itemDepth ) ) {
+			item = x;
+			itemInRef = inRef;
+			itemDepth = depth;
+		}
+	}
 
 	if ( item )
 		return createIndex( item->row(), 0, item );
@@ -473,9 +522,7 @@ QList<QModelIndex> NifProxyModel::mapFrom( const QModelIndex & idx ) const
 	if ( blockNumber < 0 )
 		return indices;
 
-	QList<NifProxyItem *> items;
-	root->findAllItems( blockNumber, items );
-	for ( NifProxyItem * item : items ) {
+	for ( NifProxyItem * item : blockItems.value( blockNumber ) ) {
 		indices.append( createIndex( item->row(), idx.column() != NifModel::NameCol ? 1 : 0, item ) );
 	}
 
@@ -565,7 +612,23 @@ void NifProxyModel::xDataChanged( const QModelIndex & begin, const QModelIndex &
 
 void NifProxyModel::xLinksChanged()
 {
+	// Only the items of blocks whose links have changed are updated
+	QVector<int> changedBlocks;
+	updateLinkCache( &changedBlocks );
+
 	updateRoot( false );
+
+	if ( !nif )
+		return;
+
+	for ( int b : changedBlocks ) {
+		const QList<NifProxyItem *> items = blockItems.value( b );
+		for ( NifProxyItem * item : items ) {
+			// Updating an item may delete other items of the same block
+			if ( blockItems.value( b ).contains( item ) && item->expanded )
+				updateItem( item, false );
+		}
+	}
 }
 
 void NifProxyModel::xRowsAboutToBeRemoved( const QModelIndex & parent, int first, int last )
@@ -573,13 +636,14 @@ void NifProxyModel::xRowsAboutToBeRemoved( const QModelIndex & parent, int first
 	if ( !parent.isValid() ) {
 		// block removed
 		for ( int c = first; c <= last; c++ ) {
-			QList<NifProxyItem *> list;
-			root->findAllItems( c - 1, list );
-			for ( NifProxyItem * item : list ) {
+			const QList<NifProxyItem *> items = blockItems.value( c - 1 );
+			for ( NifProxyItem * item : items ) {
+				if ( !blockItems.value( c - 1 ).contains( item ) )
+					continue;
+
 				QModelIndex idx = createIndex( item->row(), 0, item );
 				beginRemoveRows( idx.parent(), idx.row(), idx.row() );
-				item->parentItem->childItems.removeAll( item );
-				delete item;
+				item->parentItem->delLink( item->block() );
 				endRemoveRows();
 			}
 		}
@@ -34,9 +34,11 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define NIFPROXYMODEL_H
 
 #include <QAbstractItemModel> // Inherited
+#include <QHash>
 #include <QList>
 #include <QModelIndex>
 #include <QVariant>
+#include <QVector>
 
 
 //! @file nifproxymodel.h NifProxyModel
@@ -87,12 +89,22 @@ protected slots:
 protected:
 	QList<QModelIndex> mapFrom( const QModelIndex & index ) const;
 
+	//! Copies the links of all blocks from the model, and optionally lists the blocks whose links changed
+	void updateLinkCache( QVector<int> * changedBlocks );
+
 	void updateRoot( bool fast );
 	void updateItem( NifProxyItem * item, bool fast );
 
 	NifModel * nif;
 
 	NifProxyItem * root;
+
+	//! Items of each block, a block may be shown several times
+	QHash<int, QList<NifProxyItem *>> blockItems;
+
+	//! Child and parent links of each block as of the last update
+	QVector<QList<int>> childLinks;
+	QVector<QList<int>> parentLinks;
 };
 
 #endif
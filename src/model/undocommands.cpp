@@ -36,6 +36,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "model/nifmodel.h"
 
 #include <QCoreApplication>
+#include <QUndoStack>
+
+#include <utility>
 
 
 //! @file undocommands.cpp ChangeValueCommand, ToggleCheckBoxListCommand
@@ -46,13 +49,22 @@ size_t ChangeValueCommand::lastID = 0;
  *  ChangeValueCommand
  */
 
+//! Converts a value returned by NifModel::data() for Qt::EditRole, strings are stored as tString
+static NifValue valueFromVariant( const QVariant & v )
+{
+	if ( v.canConvert<NifValue>() )
+		return v.value<NifValue>();
+
+	NifValue s( NifValue::tString );
+	s.set<QString>( v.toString(), nullptr, nullptr );
+	return s;
+}
+
 ChangeValueCommand::ChangeValueCommand( const QModelIndex & index,
 	const QVariant & value, const QString & valueString, const QString & valueType, NifModel * model )
 	: QUndoCommand(), nif( model )
 {
-	idxs << index;
-	oldValues << index.data( Qt::EditRole );
-	newValues << value;
+	addEntry( index, valueFromVariant( index.data( Qt::EditRole ) ), valueFromVariant( value ) );
 
 	localID = lastID;
 
@@ -69,9 +81,7 @@ ChangeValueCommand::ChangeValueCommand( const QModelIndex & index, const NifValu
 										const NifValue & newVal, const QString & valueType, NifModel * model )
 	: QUndoCommand(), nif( model )
 {
-	idxs << index;
-	oldValues << oldVal.toVariant();
-	newValues << newVal.toVariant();
+	addEntry( index, oldVal, newVal );
 
 	localID = lastID;
 
@@ -84,47 +94,111 @@ ChangeValueCommand::ChangeValueCommand( const QModelIndex & index, const NifValu
 		setText( QCoreApplication::translate( "ChangeValueCommand", "Modify %1" ).arg( valueType ) );
 }
 
-void ChangeValueCommand::redo()
+void ChangeValueCommand::addEntry( const QModelIndex & index, const NifValue & oldValue, const NifValue & newValue )
 {
-	//qDebug() << "Redoing";
-	Q_ASSERT( idxs.size() == newValues.size() && newValues.size() == oldValues.size() );
-
-	if ( idxs.size() > 1 )
-		nif->setState( BaseModel::Processing );
+	if ( !index.isValid() )
+		return;
+
+	Entry e;
+	e.first = QPersistentModelIndex( index );
+	e.oldValues.push_back( oldValue );
+	e.newValues.push_back( newValue );
+	memory += entryMemory( e );
+	entries.push_back( std::move( e ) );
+}
 
-	int i = 0;
-	for ( auto idx : idxs ) {
-		if ( idx.isValid() )
-			nif->setData( idx, newValues.at( i++ ), Qt::EditRole );
+size_t ChangeValueCommand::entryMemory( const Entry & e ) const
+{
+	size_t n = sizeof( Entry );
+	n += ( e.oldValues.size() + e.newValues.size() ) * sizeof( NifValue );
+
+	for ( const auto * values : { &e.oldValues, &e.newValues } ) {
+		for ( const NifValue & v : *values ) {
+			if ( v.isString() )
+				n += size_t( v.get<QString>( nullptr, nullptr ).size() ) * sizeof( QChar );
+			else if ( v.isByteArray() )
+				n += size_t( v.get<QByteArray>( nullptr, nullptr ).size() );
+		}
 	}
 
-	if ( idxs.size() > 1 ) {
-		nif->restoreState();
-		nif->dataChanged( idxs.first(), idxs.last() );
+	return n;
+}
+
+bool ChangeValueCommand::applyValue( const QModelIndex & idx, const NifItem * item, const NifValue & v )
+{
+	// NifModel::setData() converts tString and tFilePath items to tSizedString or tStringIndex on the first edit,
+	// so string values are assigned as strings to any item that holds one
+	bool isStringItem = ( item->value().isString() || item->hasValueType( NifValue::tStringIndex )
+							|| item->hasValueType( NifValue::tFilePath ) );
+	if ( v.isString() && isStringItem ) {
+		QString str = v.get<QString>( nullptr, nullptr );
+		if ( item->hasValueType( NifValue::tString ) || item->hasValueType( NifValue::tFilePath ) )
+			return nif->setData( idx, str, Qt::EditRole );
+		if ( item->valueType() != v.type() )
+			return nif->assignString( idx, str, true );
 	}
 
-	//qDebug() << nif->data( idx ).toString();
+	if ( item->valueType() != v.type() )
+		return false;
+	return nif->setIndexValue( idx, v );
 }
 
-void ChangeValueCommand::undo()
+void ChangeValueCommand::apply( bool redoValues )
 {
-	//qDebug() << "Undoing";
+	size_t count = 0;
+	for ( const Entry & e : entries )
+		count += e.newValues.size();
 
-	if ( idxs.size() > 1 )
+	std::vector<std::pair<QModelIndex, QModelIndex>> changed;
+	if ( count > 1 )
 		nif->setState( BaseModel::Processing );
 
-	int i = 0;
-	for ( auto idx : idxs ) {
-		if ( idx.isValid() )
-			nif->setData( idx, oldValues.at( i++ ), Qt::EditRole );
+	// Undo in reverse order in case an item was changed more than once
+	for ( size_t n = 0; n < entries.size(); n++ ) {
+		const Entry & e = entries[redoValues ? n : entries.size() - 1 - n];
+		const std::vector<NifValue> & values = ( redoValues ? e.newValues : e.oldValues );
+
+		// The persistent index follows row insertions and becomes invalid if the item is removed
+		if ( !e.first.isValid() )
+			continue;
+		QModelIndex parent = e.first.parent();
+		int firstRow = e.first.row();
+		int column = e.first.column();
+
+		int rows = 0;
+		for ( size_t i = 0; i < values.size(); i++ ) {
+			QModelIndex idx = nif->index( firstRow + int( i ), column, parent );
+			const NifItem * item = nif->getItem( idx, false );
+			if ( !item )
+				break;
+
+			// The structure of the model may have changed since the command was created
+			if ( !applyValue( idx, item, values[i] ) ) {
+				nif->reportError( idx, "ChangeValueCommand",
+					QString( "the value could not be restored, the type of the item has changed to %1" ).arg( item->strType() ) );
+			}
+			rows++;
+		}
+
+		if ( count > 1 && rows > 0 )
+			changed.emplace_back( nif->index( firstRow, column, parent ), nif->index( firstRow + rows - 1, column, parent ) );
 	}
 
-	if ( idxs.size() > 1 ) {
+	if ( count > 1 ) {
 		nif->restoreState();
-		nif->dataChanged( idxs.first(), idxs.last() );
+		for ( const auto & c : changed )
+			emit nif->dataChanged( c.first, c.second );
 	}
+}
 
-	//qDebug() << nif->data( idx ).toString();
+void ChangeValueCommand::redo()
+{
+	apply( true );
+}
+
+void ChangeValueCommand::undo()
+{
+	apply( false );
 }
 
 int ChangeValueCommand::id() const
@@ -136,21 +210,90 @@ bool ChangeValueCommand::mergeWith( const QUndoCommand * other )
 {
 	const auto cv = static_cast<const ChangeValueCommand*>(other);
 
-	if ( localID != cv->localID )
+	if ( localID != cv->localID || isObsolete() || cv->isObsolete() )
 		return false;
 
-	idxs << cv->idxs;
-	newValues << cv->newValues;
-	oldValues << cv->oldValues;
+	for ( const Entry & e : cv->entries ) {
+		if ( !entries.empty() ) {
+			Entry & last = entries.back();
+			if ( last.first.isValid() && e.first.isValid() && last.first.parent() == e.first.parent()
+				&& last.first.column() == e.first.column()
+				&& last.first.row() + int( last.newValues.size() ) == e.first.row() )
+			{
+				memory -= entryMemory( last );
+				last.oldValues.insert( last.oldValues.end(), e.oldValues.begin(), e.oldValues.end() );
+				last.newValues.insert( last.newValues.end(), e.newValues.begin(), e.newValues.end() );
+				memory += entryMemory( last );
+				continue;
+			}
+		}
+
+		entries.push_back( e );
+		memory += entryMemory( e );
+	}
 
 	return true;
 }
 
+void ChangeValueCommand::discard()
+{
+	entries.clear();
+	entries.shrink_to_fit();
+	memory = 0;
+	setObsolete( true );
+}
+
 void ChangeValueCommand::createTransaction()
 {
 	lastID++;
 }
 
+//! Approximate number of bytes used by \a cmd and its children
+static size_t undoCommandMemory( const QUndoCommand * cmd )
+{
+	auto cv = dynamic_cast<const ChangeValueCommand *>( cmd );
+	size_t n = ( cv ? cv->memoryUsage() : sizeof( QUndoCommand ) + 64 );
+	n += size_t( cmd->text().size() ) * sizeof( QChar );
+	for ( int i = 0; i < cmd->childCount(); i++ )
+		n += undoCommandMemory( cmd->child( i ) );
+	return n;
+}
+
+void limitUndoMemory( QUndoStack * stack, size_t maxBytes )
+{
+	static bool busy = false;
+	if ( !stack || busy )
+		return;
+	busy = true;
+
+	if ( stack->count() >= 2 ) {
+		size_t total = 0;
+		for ( int i = 0; i < stack->count(); i++ ) {
+			if ( !stack->command( i )->isObsolete() )
+				total += undoCommandMemory( stack->command( i ) );
+		}
+
+		for ( int i = 0; i < stack->count() - 1 && total > maxBytes; i++ ) {
+			auto cmd = const_cast<QUndoCommand *>( stack->command( i ) );
+			if ( cmd->isObsolete() )
+				continue;
+			total -= undoCommandMemory( cmd );
+			auto cv = dynamic_cast<ChangeValueCommand *>( cmd );
+			if ( cv )
+				cv->discard();
+			else
+				cmd->setObsolete( true );
+		}
+	}
+
+	// Undoing an obsolete command only deletes it, this removes the discarded commands
+	// as soon as they are reached so that they do not appear as Undo steps that do nothing
+	while ( stack->index() > 0 && stack->command( stack->index() - 1 )->isObsolete() )
+		stack->undo();
+
+	busy = false;
+}
+
 
 /*
  *  ToggleCheckBoxListCommand
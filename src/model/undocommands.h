@@ -33,16 +33,28 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef UNDOCOMMANDS_H
 #define UNDOCOMMANDS_H
 
+#include "data/nifvalue.h"
+
 #include <QUndoCommand>
 #include <QModelIndex>
 #include <QVariant>
 
+#include <vector>
+
 
 //! @file undocommands.h ChangeValueCommand, ToggleCheckBoxListCommand
 
+class NifItem;
 class NifModel;
-class NifValue;
-
+class QUndoStack;
+
+/*! Changes the values of one or more items
+ *
+ * The values of consecutive rows with the same parent, like the elements of an array edited
+ * in one transaction, are merged into a single entry that stores only a persistent index of
+ * its first row. Entries whose items were removed from the model are skipped, and values that
+ * no longer match the type of their item are reported as errors.
+ */
 class ChangeValueCommand : public QUndoCommand
 {
 public:
@@ -62,10 +74,31 @@ public:
 	//! Increments the lastID
 	static void createTransaction();
 
+	//! Approximate number of bytes used by the stored values and paths
+	size_t memoryUsage() const { return memory; }
+
+	//! Frees the stored values, see limitUndoMemory()
+	void discard();
+
 private:
+	//! Values of consecutive rows of the same parent item
+	struct Entry
+	{
+		//! The first item of the entry, the others are the next rows of the same parent
+		QPersistentModelIndex first;
+		std::vector<NifValue> oldValues;
+		std::vector<NifValue> newValues;
+	};
+
+	void addEntry( const QModelIndex & index, const NifValue & oldValue, const NifValue & newValue );
+	void apply( bool redoValues );
+	//! Assigns \a v to the item, or returns false if the item can no longer hold a value of its type
+	bool applyValue( const QModelIndex & idx, const NifItem * item, const NifValue & v );
+	size_t entryMemory( const Entry & e ) const;
+
 	NifModel * nif;
-	QVector<QVariant> newValues, oldValues;
-	QVector<QPersistentModelIndex> idxs;
+	std::vector<Entry> entries;
+	size_t memory = 0;
 
 	//! The command ID for this undo command
 	size_t localID;
@@ -100,4 +133,13 @@ private:
 	QPersistentModelIndex idx;
 };
 
+/*! Discards the oldest commands of \a stack while they use more than \a maxBytes
+ *
+ * The most recent command is always kept. QUndoStack cannot remove commands from the bottom
+ * of a non-empty stack, so discarded commands are marked obsolete, and they are removed
+ * without changing the model as soon as they would become the next command to undo.
+ * This function is called whenever the index of the stack changes.
+ */
+void limitUndoMemory( QUndoStack * stack, size_t maxBytes );
+
 #endif // UNDOCOMMANDS_H
@@ -41,6 +41,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "model/kfmmodel.h"
 #include "model/nifmodel.h"
 #include "model/nifproxymodel.h"
+#include "model/undocommands.h"
 #include "ui/widgets/fileselect.h"
 #include "ui/widgets/nifview.h"
 #include "ui/widgets/refrbrowser.h"
@@ -64,12 +65,12 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QSettings>
 #include <QTimer>
 #include <QTranslator>
+#include <QUndoStack>
 #include <QUrl>
 #include <QCryptographicHash>
 
 #include <QListView>
 #include <QTreeView>
-#include <QStandardItemModel>
 
 #include "ba2file.hpp"
 #include "bsamodel.h"
@@ -226,6 +227,15 @@ NifSkope::NifSkope()
 	// Setup QUndoStack
 	nif->undoStack = new QUndoStack( this );
 
+	// Limit the memory used by the values stored in the undo history
+	{
+		QSettings settings;
+		size_t undoLimit = size_t( qMax( settings.value( "Settings/Nif/Undo Memory Limit MB", 256 ).toInt(), 1 ) ) << 20;
+		connect( nif->undoStack, &QUndoStack::indexChanged, [this, undoLimit]( int ) {
+			limitUndoMemory( nif->undoStack, undoLimit );
+		} );
+	}
+
 	indexStack = new QUndoStack( this );
 
 	// Setup Window Modified on data change
@@ -290,10 +300,28 @@ NifSkope::NifSkope()
 	connect( bsaView, &QTreeView::doubleClicked, this, &NifSkope::openArchiveFile );
 
 	bsaModel = new BSAModel( this );
-	bsaProxyModel = new BSAProxyModel( this );
-
-	// Empty Model for swapping out before model fill
-	emptyModel = new QStandardItemModel( this );
+	bsaView->setModel( bsaModel );
+	bsaView->setUniformRowHeights( true );
+	bsaView->hideColumn( 1 );
+	bsaView->setSortingEnabled( true );
+	bsaView->sortByColumn( 0, Qt::AscendingOrder );
+
+	// Archive filter, applied by the model on a background thread
+	auto bsaFilterTimer = new QTimer( this );
+	bsaFilterTimer->setSingleShot( true );
+
+	connect( ui->bsaFilter, &QLineEdit::textChanged, [bsaFilterTimer]() { bsaFilterTimer->start( 300 ); } );
+	connect( bsaFilterTimer, &QTimer::timeout, [this]() {
+		bsaModel->setFilter( ui->bsaFilter->text() );
+	} );
+	connect( ui->bsaFilenameOnly, &QCheckBox::toggled, bsaModel, &BSAModel::setFilterByNameOnly );
+	connect( bsaModel, &BSAModel::filterFinished, [this]( int matches ) {
+		// Expanding creates the rows of all matching files, only do it for short lists
+		if ( ui->bsaFilter->text().isEmpty() )
+			bsaView->collapseAll();
+		else if ( matches <= 5000 )
+			bsaView->expandAll();
+	} );
 
 	// Connect models with views
 	/* ********************** */
@@ -916,10 +944,6 @@ void NifSkope::openArchive( const QString & archive )
 {
 	// Clear memory from previously opened archives
 	bsaModel->clear();
-	bsaProxyModel->invalidate();
-	bsaProxyModel->setSourceModel( emptyModel );
-	bsaView->setModel( emptyModel );
-	bsaView->setSortingEnabled( false );
 
 	if ( currentArchive ) {
 		delete currentArchive;
@@ -950,35 +974,16 @@ void NifSkope::openArchive( const QString & archive )
 	{
 		setCurrentArchive( isArchiveFolder );
 
-		// Models
-		bsaModel->init();
-
-		// Populate model from BSA
-		bsaModel->fillModel( currentArchive, "meshes" );
-
-		if ( bsaModel->rowCount() == 0 ) {
+		// Populate model from BSA, the current filter is applied again
+		if ( !bsaModel->fillModel( currentArchive, "meshes" ) ) {
 			qCWarning( nsIo ) << "The BSA does not contain any meshes.";
 			clearCurrentArchive();
 			return;
 		}
 
-		// Set proxy and view only after filling source model
-		bsaProxyModel->setSourceModel( bsaModel );
-		bsaView->setModel( bsaProxyModel );
-		bsaView->setSortingEnabled( true );
-
-		bsaView->hideColumn( 1 );
 		bsaView->setColumnWidth( 0, 300 );
 		bsaView->setColumnWidth( 2, 50 );
 
-		// Sort proxy after model/view is populated
-		bsaProxyModel->sort( 0, Qt::AscendingOrder );
-#if 0
-		// this is not needed because archives are already filtered on load
-		bsaProxyModel->setFiletypes( { ".nif", ".bto", ".btr" } );
-#endif
-		bsaProxyModel->resetFilter();
-
 		// Set filename label
 		ui->bsaName->setText( currentArchiveNames.back() );
 
@@ -987,31 +992,6 @@ void NifSkope::openArchive( const QString & archive )
 
 		// Bring tab to front
 		dBrowser->raise();
-
-		// Filter
-		auto filterTimer = new QTimer( this );
-		filterTimer->setSingleShot( true );
-
-		connect( ui->bsaFilter, &QLineEdit::textChanged, [filterTimer]() { filterTimer->start( 300 ); } );
-		connect( filterTimer, &QTimer::timeout, [this]() {
-			auto text = ui->bsaFilter->text();
-
-			bsaProxyModel->setFilterRegularExpression(
-				QRegularExpression::fromWildcard(
-					text, Qt::CaseInsensitive, QRegularExpression::UnanchoredWildcardConversion ) );
-			bsaView->expandAll();
-
-			if ( text.isEmpty() ) {
-				bsaView->collapseAll();
-				bsaProxyModel->resetFilter();
-			}
-
-		} );
-
-		connect( ui->bsaFilenameOnly, &QCheckBox::toggled, bsaProxyModel, &BSAProxyModel::setFilterByNameOnly );
-
-		// Update filter when switching open archives
-		filterTimer->start( 0 );
 	}
 }
 
@@ -69,8 +69,6 @@ class SettingsDialog;
 class SpellBook;
 class BA2File;
 class BSAModel;
-class BSAProxyModel;
-class QStandardItemModel;
 class QAction;
 class QActionGroup;
 class QComboBox;
@@ -432,8 +430,6 @@ private:
 	//QAction * idxBackAction;
 
 	BSAModel * bsaModel;
-	BSAProxyModel * bsaProxyModel;
-	QStandardItemModel * emptyModel;
 
 	QMenu * mRecentArchiveFiles;
 };
@@ -305,6 +305,7 @@ void NifSkope::initActions()
 	connect( ui->aAboutQt, &QAction::triggered, qApp, &QApplication::aboutQt );
 
 	connect( ui->aPrintView, &QAction::triggered, ogl, &GLView::saveImage );
+	connect( ui->aBenchmarkAnimation, &QAction::triggered, ogl, &GLView::benchmarkAnimation );
 
 #ifdef QT_NO_DEBUG
 	ui->aColorKeyDebug->setDisabled( true );
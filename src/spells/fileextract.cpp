@@ -6,18 +6,26 @@
 #include <QLabel>
 #include <QProgressBar>
 #include <QPushButton>
+#include <QSet>
 #include <QSettings>
 #include <QIODevice>
 #include <QBuffer>
 #include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFileInfo>
 
 #include "libfo76utils/src/common.hpp"
 #include "libfo76utils/src/filebuf.hpp"
 #include "libfo76utils/src/material.hpp"
 #include "model/nifmodel.h"
 #include "io/nifstream.h"
+#include "lib/parallel.h"
 #include "qtcompat.h"
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+
 #ifdef Q_OS_WIN32
 #  include <direct.h>
 #else
@@ -214,7 +222,118 @@ QModelIndex spResourceFileExtract::cast( NifModel * nif, const QModelIndex & ind
 
 REGISTER_SPELL( spResourceFileExtract )
 
+//! Writes extracted files on a separate thread, so that loading and decompression can continue meanwhile
+class ResourceWriteQueue
+{
+public:
+	ResourceWriteQueue() : writerThread( &ResourceWriteQueue::writerFunction, this )
+	{
+	}
+	~ResourceWriteQueue()
+	{
+		try {
+			finish();
+		} catch ( ... ) {
+		}
+	}
+
+	//! Queue 'data' to be written to 'fileName', waiting while the queue is full. Rethrows write errors.
+	void push( std::string && fileName, QByteArray && data );
+	//! Wait until all queued files are written, and rethrow the first write error if there was one
+	void finish();
+
+	size_t	filesWritten = 0;
+	std::uint64_t	bytesWritten = 0;
+	//! Names of the files written successfully
+	std::vector< std::string >	writtenFiles;
+
+protected:
+	void writerFunction();
+	void checkError();
+
+	// limit the amount of memory used by files waiting to be written
+	static constexpr qsizetype	maxQueuedBytes = 0x08000000;
+
+	struct QueuedFile
+	{
+		std::string	fileName;
+		QByteArray	data;
+	};
+	std::deque< QueuedFile >	queue;
+	qsizetype	queuedBytes = 0;
+	bool	done = false;
+	std::exception_ptr	err;
+	std::mutex	queueMutex;
+	std::condition_variable	queueCond;
+	std::thread	writerThread;
+};
+
+void ResourceWriteQueue::checkError()
+{
+	if ( err )
+		std::rethrow_exception( err );
+}
+
+void ResourceWriteQueue::push( std::string && fileName, QByteArray && data )
+{
+	std::unique_lock< std::mutex >	lock( queueMutex );
+	queueCond.wait( lock, [this]() { return ( queuedBytes < maxQueuedBytes || queue.empty() || err ); } );
+	checkError();
+	queuedBytes += data.size();
+	queue.emplace_back( QueuedFile{ std::move( fileName ), std::move( data ) } );
+	queueCond.notify_all();
+}
+
+void ResourceWriteQueue::finish()
+{
+	{
+		std::lock_guard< std::mutex >	lock( queueMutex );
+		done = true;
+		queueCond.notify_all();
+	}
+	if ( writerThread.joinable() )
+		writerThread.join();
+	checkError();
+}
+
+void ResourceWriteQueue::writerFunction()
+{
+	std::unique_lock< std::mutex >	lock( queueMutex );
+	while ( true ) {
+		queueCond.wait( lock, [this]() { return ( !queue.empty() || done ); } );
+		if ( queue.empty() )
+			break;
+		QueuedFile	f( std::move( queue.front() ) );
+		queue.pop_front();
+		lock.unlock();
+		try {
+			spResourceFileExtract::writeFileWithPath( f.fileName, f.data.constData(), f.data.size() );
+		} catch ( ... ) {
+			lock.lock();
+			if ( !err )
+				err = std::current_exception();
+			// discard the remaining files, push() reports the error
+			queuedBytes = 0;
+			queue.clear();
+			queueCond.notify_all();
+			continue;
+		}
+		lock.lock();
+		queuedBytes -= f.data.size();
+		filesWritten++;
+		bytesWritten += std::uint64_t( f.data.size() );
+		writtenFiles.push_back( std::move( f.fileName ) );
+		queueCond.notify_all();
+	}
+}
+
 //! Extract all resource files
+/*!
+ * Archived files written by this spell are remembered for the rest of the session, so when the
+ * resources of several NIFs are extracted to the same folder, files that they share are only
+ * loaded and written once. A file is extracted again if it has been modified or deleted since,
+ * or if it was extracted from the archives of a different game.
+ */
 class spExtractAllResources final : public Spell
 {
 public:
@@ -234,8 +353,31 @@ public:
 
 	static void findPaths( std::set< std::string > & fileSet, NifModel * nif, const NifItem * item );
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
+
+protected:
+	struct ExtractedFile
+	{
+		Game::GameMode	game;
+		qint64	size;
+		qint64	modified;
+	};
+	//! Files extracted in this session by full output path
+	static std::map< std::string, ExtractedFile >	extractedFiles;
+
+	static bool isExtracted( const std::string & fullPath, Game::GameMode game );
 };
 
+std::map< std::string, spExtractAllResources::ExtractedFile >	spExtractAllResources::extractedFiles;
+
+bool spExtractAllResources::isExtracted( const std::string & fullPath, Game::GameMode game )
+{
+	auto	i = extractedFiles.find( fullPath );
+	if ( i == extractedFiles.end() || i->second.game != game )
+		return false;
+	QFileInfo	f( QString::fromStdString( fullPath ) );
+	return ( f.exists() && f.size() == i->second.size && f.lastModified().toMSecsSinceEpoch() == i->second.modified );
+}
+
 void spExtractAllResources::findPaths( std::set< std::string > & fileSet, NifModel * nif, const NifItem * item )
 {
 	if ( spResourceFileExtract::is_Applicable( nif, item ) ) {
@@ -268,36 +410,74 @@ QModelIndex spExtractAllResources::cast( NifModel * nif, const QModelIndex & ind
 	if ( dstPath.empty() )
 		return index;
 
-	std::string	matFileData;
-	std::string	fullPath;
-	QByteArray	fileData;
+	QElapsedTimer	timer;
+	timer.start();
+
+	// Starfield materials are converted to JSON and other files are located on the main thread,
+	// this also opens the archives so that the remaining files can be loaded in parallel
+	Game::GameMode	game = Game::GameManager::get_game( nif );
+	std::vector< std::string >	archivedFiles;
+	size_t	skippedFiles = 0;
+	QString	errorMessage;
+	std::mutex	errorMutex;
+	QString	resultMessage;
 	try {
-		for ( std::set< std::string >::const_iterator i = fileSet.begin(); i != fileSet.end(); i++ ) {
-			matFileData.clear();
-			if ( nif->getBSVersion() >= 170 && i->ends_with( ".mat" ) && i->starts_with( "materials/" ) ) {
+		ResourceWriteQueue	writeQueue;
+		std::string	matFileData;
+		for ( const std::string & i : fileSet ) {
+			if ( nif->getBSVersion() >= 170 && i.ends_with( ".mat" ) && i.starts_with( "materials/" ) ) {
+				matFileData.clear();
 				CE2MaterialDB *	materials = nif->getCE2Materials();
 				if ( materials ) {
-					(void) materials->loadMaterial( *i );
-					materials->getJSONMaterial( matFileData, *i );
+					(void) materials->loadMaterial( i );
+					materials->getJSONMaterial( matFileData, i );
 				}
 				if ( matFileData.empty() )
 					continue;
-			} else if ( nif->findResourceFile( QString::fromStdString( *i ), nullptr, nullptr ).isEmpty() ) {
-				continue;
+				matFileData += '\n';
+				writeQueue.push( dstPath + i, QByteArray( matFileData.c_str(), qsizetype(matFileData.length()) ) );
+			} else if ( !nif->findResourceFile( QString::fromStdString( i ), nullptr, nullptr ).isEmpty() ) {
+				if ( isExtracted( dstPath + i, game ) )
+					skippedFiles++;
+				else
+					archivedFiles.push_back( i );
 			}
+		}
 
-			fullPath = dstPath;
-			fullPath += *i;
-			if ( !matFileData.empty() ) {
-				matFileData += '\n';
-				spResourceFileExtract::writeFileWithPath( fullPath, matFileData.c_str(), qsizetype(matFileData.length()) );
-			} else if ( nif->getResourceFile( fileData, *i ) ) {
-				spResourceFileExtract::writeFileWithPath( fullPath, fileData.data(), fileData.size() );
+		parallelFor( archivedFiles.size(), [&]( size_t n ) {
+			const std::string &	filePath = archivedFiles[n];
+			QByteArray	fileData;
+			QString	err;
+			if ( !nif->extractResourceFile( fileData, filePath, &err ) ) {
+				std::lock_guard< std::mutex >	lock( errorMutex );
+				if ( errorMessage.isEmpty() )
+					errorMessage = err;
+				return;
 			}
+			writeQueue.push( dstPath + filePath, std::move( fileData ) );
+		} );
+
+		writeQueue.finish();
+
+		for ( const std::string & f : writeQueue.writtenFiles ) {
+			QFileInfo	fileInfo( QString::fromStdString( f ) );
+			extractedFiles.insert_or_assign( f, ExtractedFile{ game, fileInfo.size(), fileInfo.lastModified().toMSecsSinceEpoch() } );
 		}
+
+		double	t = double( timer.nsecsElapsed() ) * 1.0e-9;
+		resultMessage = Spell::tr( "Extracted %1 of %2 resource files (%3 MB) in %4 s, %5 MB/s" )
+			.arg( writeQueue.filesWritten ).arg( fileSet.size() )
+			.arg( double( writeQueue.bytesWritten ) / 1048576.0, 0, 'f', 2 ).arg( t, 0, 'f', 3 )
+			.arg( t > 0.0 ? double( writeQueue.bytesWritten ) / ( t * 1048576.0 ) : 0.0, 0, 'f', 2 );
+		if ( skippedFiles )
+			resultMessage += "\n" + Spell::tr( "%1 files were already extracted in this session and have been skipped" ).arg( skippedFiles );
 	} catch ( std::exception & e ) {
 		QMessageBox::critical( nullptr, "NifSkope error", QString("Error extracting file: %1" ).arg( e.what() ) );
+		return index;
 	}
+	if ( !errorMessage.isEmpty() )
+		QMessageBox::critical( nullptr, "NifSkope error", errorMessage );
+	QMessageBox::information( nullptr, Spell::tr( "Extract Resource Files" ), resultMessage );
 	return index;
 }
 
@@ -360,9 +540,15 @@ QModelIndex spExtractAllMaterials::cast( NifModel * nif, const QModelIndex & ind
 	dlg.setResult( QDialog::Accepted );
 	dlg.show();
 
+	QElapsedTimer	timer;
+	timer.start();
+
+	// the material database is not thread-safe, but writing the JSON files can overlap with loading
 	std::string	matFileData;
 	std::string	fullPath;
+	QString	resultMessage;
 	try {
+		ResourceWriteQueue	writeQueue;
 		int	n = 0;
 		for ( const auto & i : fileSet ) {
 			QCoreApplication::processEvents();
@@ -379,14 +565,23 @@ QModelIndex spExtractAllMaterials::cast( NifModel * nif, const QModelIndex & ind
 				matFileData += '\n';
 				fullPath = dstPath;
 				fullPath += i;
-				spResourceFileExtract::writeFileWithPath( fullPath, matFileData.c_str(), qsizetype(matFileData.length()) );
+				writeQueue.push( std::move( fullPath ), QByteArray( matFileData.c_str(), qsizetype(matFileData.length()) ) );
 			}
 			n++;
 			pb->setValue( n );
 		}
+		writeQueue.finish();
+
+		double	t = double( timer.nsecsElapsed() ) * 1.0e-9;
+		resultMessage = Spell::tr( "Extracted %1 materials (%2 MB) in %3 s, %4 MB/s" )
+			.arg( writeQueue.filesWritten ).arg( double( writeQueue.bytesWritten ) / 1048576.0, 0, 'f', 2 )
+			.arg( t, 0, 'f', 3 ).arg( t > 0.0 ? double( writeQueue.bytesWritten ) / ( t * 1048576.0 ) : 0.0, 0, 'f', 2 );
 	} catch ( std::exception & e ) {
 		QMessageBox::critical( nullptr, "NifSkope error", QString("Error extracting file: %1" ).arg( e.what() ) );
+		return index;
 	}
+	dlg.hide();
+	QMessageBox::information( nullptr, Spell::tr( "Extract All Materials" ), resultMessage );
 	return index;
 }
 
@@ -414,21 +609,34 @@ public:
 		return ( item->name() == "BSGeometry" && ( nif->get<quint32>(item, "Flags") & 0x0200 ) != 0 );
 	}
 
-	bool processItem( NifModel * nif, NifItem * item, const std::string & outputDirectory );
+	static bool processItems( NifModel * nif, const std::vector< NifItem * > & items, const std::string & outputDirectory );
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
 };
 
-bool spMeshFileExport::processItem( NifModel * nif, NifItem * item, const std::string & outputDirectory )
+bool spMeshFileExport::processItems( NifModel * nif, const std::vector< NifItem * > & items, const std::string & outputDirectory )
 {
-	quint32	flags;
-	if ( !( item && item->name() == "BSGeometry" && ( (flags = nif->get<quint32>(item, "Flags")) & 0x0200 ) != 0 ) )
-		return false;
+	struct MeshExport
+	{
+		NifItem *	item;
+		quint32	flags;
+		QByteArray	meshData[4];
+		QString	meshPaths[4];
+	};
+	std::vector< MeshExport >	meshes;
+
+	// serialize the mesh data on the main thread, NifModel is not thread-safe
+	for ( NifItem * item : items ) {
+		quint32	flags;
+		if ( !( item && item->name() == "BSGeometry" && ( (flags = nif->get<quint32>(item, "Flags")) & 0x0200 ) != 0 ) )
+			continue;
 
-	QString	meshPaths[4];
-	bool	haveMeshes = false;
+		MeshExport &	m = meshes.emplace_back();
+		m.item = item;
+		m.flags = flags;
 
-	auto	meshesIndex = nif->getIndex( item, "Meshes" );
-	if ( meshesIndex.isValid() ) {
+		auto	meshesIndex = nif->getIndex( item, "Meshes" );
+		if ( !meshesIndex.isValid() )
+			continue;
 		for ( int l = 0; l < 4; l++ ) {
 			auto	meshIndex = QModelIndex_child( meshesIndex, l );
 			if ( !( meshIndex.isValid() && nif->get<bool>(meshIndex, "Has Mesh") ) )
@@ -436,41 +644,73 @@ bool spMeshFileExport::processItem( NifModel * nif, NifItem * item, const std::s
 			auto	meshData = nif->getIndex( nif->getIndex( meshIndex, "Mesh" ), "Mesh Data" );
 			if ( !meshData.isValid() )
 				continue;
-			haveMeshes = true;
 
-			QBuffer	meshBuf;
+			QBuffer	meshBuf( &(m.meshData[l]) );
 			meshBuf.open( QIODevice::WriteOnly );
-			{
-				NifOStream	nifStream( nif, &meshBuf );
-				nif->saveItem( nif->getItem( meshData, false ), nifStream );
-			}
-
-			QCryptographicHash	h( QCryptographicHash::Sha1 );
-			h.addData( meshBuf.data() );
-			meshPaths[l] = h.result().toHex();
-			meshPaths[l].insert( 20, QChar('\\') );
+			NifOStream	nifStream( nif, &meshBuf );
+			nif->saveItem( nif->getItem( meshData, false ), nifStream );
+		}
+	}
 
-			std::string	fullPath( outputDirectory );
-			fullPath += Game::GameManager::get_full_path( meshPaths[l], "geometries/", ".mesh" );
-			try {
-				spResourceFileExtract::writeFileWithPath( fullPath, meshBuf.data().data(), meshBuf.data().size() );
-			} catch ( std::exception & e ) {
-				QMessageBox::critical( nullptr, "NifSkope error", QString("Error extracting file: %1" ).arg( e.what() ) );
-			}
+	// hash the mesh data of all shapes and LODs in parallel
+	parallelFor( meshes.size() * 4, [&]( size_t n ) {
+		MeshExport &	m = meshes[n >> 2];
+		const QByteArray &	meshData = m.meshData[n & 3];
+		if ( meshData.isEmpty() )
+			return;
+
+		QString &	meshPath = m.meshPaths[n & 3];
+		QCryptographicHash	h( QCryptographicHash::Sha1 );
+		h.addData( meshData );
+		meshPath = h.result().toHex();
+		meshPath.insert( 20, QChar('\\') );
+	} );
+
+	// identical meshes have the same path, each file is written only once
+	std::vector< std::pair< const QString *, const QByteArray * > >	meshFiles;
+	QSet< QString >	meshPathsFound;
+	for ( const MeshExport & m : meshes ) {
+		for ( int l = 0; l < 4; l++ ) {
+			if ( m.meshData[l].isEmpty() || meshPathsFound.contains( m.meshPaths[l] ) )
+				continue;
+			meshPathsFound.insert( m.meshPaths[l] );
+			meshFiles.emplace_back( &(m.meshPaths[l]), &(m.meshData[l]) );
 		}
 	}
 
-	item->invalidateVersionCondition();
-	item->invalidateCondition();
-	nif->set<quint32>( item, "Flags", flags & ~0x0200U );
+	QString	errorMessage;
+	std::mutex	errorMutex;
+	parallelFor( meshFiles.size(), [&]( size_t n ) {
+		std::string	fullPath( outputDirectory );
+		fullPath += Game::GameManager::get_full_path( *(meshFiles[n].first), "geometries/", ".mesh" );
+		try {
+			spResourceFileExtract::writeFileWithPath( fullPath, meshFiles[n].second->data(), meshFiles[n].second->size() );
+		} catch ( std::exception & e ) {
+			std::lock_guard< std::mutex >	lock( errorMutex );
+			if ( errorMessage.isEmpty() )
+				errorMessage = QString( "Error extracting file: %1" ).arg( e.what() );
+		}
+	} );
+	if ( !errorMessage.isEmpty() )
+		QMessageBox::critical( nullptr, "NifSkope error", errorMessage );
 
-	meshesIndex = nif->getIndex( item, "Meshes" );
-	for ( int l = 0; l < 4; l++ ) {
-		auto	meshIndex = QModelIndex_child( meshesIndex, l );
-		if ( !( meshIndex.isValid() && nif->get<bool>(meshIndex, "Has Mesh") ) )
-			continue;
-		nif->set<QString>( nif->getIndex( meshIndex, "Mesh" ), "Mesh Path", meshPaths[l] );
+	bool	haveMeshes = false;
+	bool	oldHoldUpdates = nif->holdUpdates( true );
+	for ( const MeshExport & m : meshes ) {
+		m.item->invalidateVersionCondition();
+		m.item->invalidateCondition();
+		nif->set<quint32>( m.item, "Flags", m.flags & ~0x0200U );
+
+		auto	meshesIndex = nif->getIndex( m.item, "Meshes" );
+		for ( int l = 0; l < 4; l++ ) {
+			auto	meshIndex = QModelIndex_child( meshesIndex, l );
+			if ( !( meshIndex.isValid() && nif->get<bool>(meshIndex, "Has Mesh") ) )
+				continue;
+			nif->set<QString>( nif->getIndex( meshIndex, "Mesh" ), "Mesh Path", m.meshPaths[l] );
+			haveMeshes = haveMeshes || !m.meshData[l].isEmpty();
+		}
 	}
+	nif->holdUpdates( oldHoldUpdates );
 
 	return haveMeshes;
 }
@@ -488,14 +728,14 @@ QModelIndex spMeshFileExport::cast( NifModel * nif, const QModelIndex & index )
 	if ( outputDirectory.empty() )
 		return index;
 
-	bool	meshesConverted = false;
+	std::vector< NifItem * >	items;
 	if ( item ) {
-		meshesConverted = processItem( nif, item, outputDirectory );
+		items.push_back( item );
 	} else {
 		for ( int b = 0; b < nif->getBlockCount(); b++ )
-			meshesConverted |= processItem( nif, nif->getBlockItem( qint32(b) ), outputDirectory );
+			items.push_back( nif->getBlockItem( qint32(b) ) );
 	}
-	if ( meshesConverted )
+	if ( processItems( nif, items, outputDirectory ) )
 		Game::GameManager::close_resources();
 
 	return index;
@@ -525,67 +765,106 @@ public:
 		return ( item->name() == "BSGeometry" && ( nif->get<quint32>(item, "Flags") & 0x0200 ) == 0 );
 	}
 
-	static bool processItem( NifModel * nif, NifItem * item );
+	static bool processItems( NifModel * nif, const std::vector< NifItem * > & items );
 	static bool processAllItems( NifModel * nif );
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
 };
 
-bool spMeshFileImport::processItem( NifModel * nif, NifItem * item )
+bool spMeshFileImport::processItems( NifModel * nif, const std::vector< NifItem * > & items )
 {
-	quint32	flags;
-	if ( !( item && item->name() == "BSGeometry" && ( (flags = nif->get<quint32>(item, "Flags")) & 0x0200 ) == 0 ) )
-		return false;
+	struct MeshImport
+	{
+		NifItem *	item;
+		quint32	flags;
+		QString	meshPaths[4];
+		std::string	fullPaths[4];
+		QByteArray	meshData[4];
+		//! LOD of the first mesh file that could not be loaded, or -1
+		int	failedLOD = -1;
+	};
+	std::vector< MeshImport >	meshes;
+
+	// find the mesh files on the main thread, this also opens the archives if necessary
+	for ( NifItem * item : items ) {
+		quint32	flags;
+		if ( !( item && item->name() == "BSGeometry" && ( (flags = nif->get<quint32>(item, "Flags")) & 0x0200 ) == 0 ) )
+			continue;
 
-	QByteArray	meshData[4];
+		MeshImport &	m = meshes.emplace_back();
+		m.item = item;
+		m.flags = flags;
 
-	auto	meshesIndex = nif->getIndex( item, "Meshes" );
-	if ( meshesIndex.isValid() ) {
-		for ( int l = 0; l < 4; l++ ) {
+		auto	meshesIndex = nif->getIndex( item, "Meshes" );
+		if ( !meshesIndex.isValid() )
+			continue;
+		for ( int l = 0; l < 4 && m.failedLOD < 0; l++ ) {
 			auto	meshIndex = QModelIndex_child( meshesIndex, l );
 			if ( !( meshIndex.isValid() && nif->get<bool>(meshIndex, "Has Mesh") ) )
 				continue;
-			QString	meshPath = nif->get<QString>( nif->getIndex( meshIndex, "Mesh" ), "Mesh Path" );
-			if ( meshPath.isEmpty() )
+			m.meshPaths[l] = nif->get<QString>( nif->getIndex( meshIndex, "Mesh" ), "Mesh Path" );
+			if ( m.meshPaths[l].isEmpty() )
 				continue;
-			if ( !nif->getResourceFile( meshData[l], meshPath, "geometries/", ".mesh" ) ) {
-				QMessageBox::critical( nullptr, "NifSkope error", QString("Failed to load mesh file '%1'" ).arg( meshPath ) );
-				return false;
-			}
+			m.fullPaths[l] = Game::GameManager::get_full_path( m.meshPaths[l], "geometries/", ".mesh" );
+			if ( nif->findResourceFile( m.meshPaths[l], "geometries/", ".mesh" ).isEmpty() )
+				m.failedLOD = l;
 		}
 	}
 
-	item->invalidateVersionCondition();
-	item->invalidateCondition();
-	nif->set<quint32>( item, "Flags", flags | 0x0200U );
+	// load and decompress the mesh files of all shapes and LODs in parallel
+	parallelFor( meshes.size() * 4, [&]( size_t n ) {
+		MeshImport &	m = meshes[n >> 2];
+		const std::string &	fullPath = m.fullPaths[n & 3];
+		if ( m.failedLOD < 0 && !fullPath.empty() )
+			(void) nif->extractResourceFile( m.meshData[n & 3], fullPath );
+	} );
 
-	meshesIndex = nif->getIndex( item, "Meshes" );
-	for ( int l = 0; l < 4; l++ ) {
-		auto	meshIndex = QModelIndex_child( meshesIndex, l );
-		if ( !( meshIndex.isValid() && nif->get<bool>(meshIndex, "Has Mesh") ) )
+	bool	r = false;
+	bool	oldHoldUpdates = nif->holdUpdates( true );
+	for ( MeshImport & m : meshes ) {
+		for ( int l = 0; l < 4 && m.failedLOD < 0; l++ ) {
+			if ( !m.fullPaths[l].empty() && m.meshData[l].isEmpty() )
+				m.failedLOD = l;
+		}
+		if ( m.failedLOD >= 0 ) {
+			QMessageBox::critical( nullptr, "NifSkope error", QString("Failed to load mesh file '%1'" ).arg( m.meshPaths[m.failedLOD] ) );
 			continue;
+		}
 
-		NifItem *	meshItem = nif->getItem( nif->getIndex( meshIndex, "Mesh" ), "Mesh Data" );
-		if ( !meshItem )
-			continue;
+		m.item->invalidateVersionCondition();
+		m.item->invalidateCondition();
+		nif->set<quint32>( m.item, "Flags", m.flags | 0x0200U );
 
-		QBuffer	meshBuf;
-		meshBuf.setData( meshData[l] );
-		meshBuf.open( QIODevice::ReadOnly );
-		{
-			NifIStream	nifStream( nif, &meshBuf );
-			nif->loadItem( meshItem, nifStream );
+		auto	meshesIndex = nif->getIndex( m.item, "Meshes" );
+		for ( int l = 0; l < 4; l++ ) {
+			auto	meshIndex = QModelIndex_child( meshesIndex, l );
+			if ( !( meshIndex.isValid() && nif->get<bool>(meshIndex, "Has Mesh") ) )
+				continue;
+
+			NifItem *	meshItem = nif->getItem( nif->getIndex( meshIndex, "Mesh" ), "Mesh Data" );
+			if ( !meshItem )
+				continue;
+
+			QBuffer	meshBuf;
+			meshBuf.setData( m.meshData[l] );
+			meshBuf.open( QIODevice::ReadOnly );
+			{
+				NifIStream	nifStream( nif, &meshBuf );
+				nif->loadItem( meshItem, nifStream );
+			}
 		}
+		r = true;
 	}
+	nif->holdUpdates( oldHoldUpdates );
 
-	return true;
+	return r;
 }
 
 bool spMeshFileImport::processAllItems( NifModel * nif )
 {
-	bool	r = false;
+	std::vector< NifItem * >	items;
 	for ( int b = 0; b < nif->getBlockCount(); b++ )
-		r = r | processItem( nif, nif->getBlockItem( qint32(b) ) );
-	return r;
+		items.push_back( nif->getBlockItem( qint32(b) ) );
+	return processItems( nif, items );
 }
 
 QModelIndex spMeshFileImport::cast( NifModel * nif, const QModelIndex & index )
@@ -598,7 +877,7 @@ QModelIndex spMeshFileImport::cast( NifModel * nif, const QModelIndex & index )
 		return index;
 
 	if ( item )
-		processItem( nif, item );
+		processItems( nif, std::vector< NifItem * >( 1, item ) );
 	else
 		processAllItems( nif );
 
@@ -1,11 +1,14 @@
 #include "mesh.h"
 #include "gl/gltools.h"
+#include "lib/parallel.h"
 #include "qtcompat.h"
 
 #include <QDialog>
+#include <QElapsedTimer>
 #include <QGridLayout>
 #include <QSettings>
 #include <cfloat>
+#include <chrono>
 #include <unordered_set>
 
 #include "libfo76utils/src/fp32vec4.hpp"
@@ -1461,28 +1464,27 @@ void spUpdateBounds::calculateSFBoneBounds(
 	}
 }
 
-static void updateCullData( NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile )
+//! Calculates the bounding box (center and extents) of each meshlet, meshlets use consecutive ranges of triangles
+static void calculateCullData(
+	std::vector< FloatVector4 > & cullData, const std::vector< std::uint32_t > & triangleCounts,
+	const QVector< Triangle > & triangles, const QVector< Vector3 > & positions )
 {
-	int	meshletCount = int( nif->get<quint32>( iMeshData, "Num Meshlets" ) );
-	auto	iMeshlets = nif->getIndex( iMeshData, "Meshlets" );
-	nif->set<quint32>( iMeshData, "Num Cull Data", quint32(meshletCount) );
-	auto	iCullData = nif->getIndex( iMeshData, "Cull Data" );
-	nif->updateArraySize( iCullData );
+	cullData.resize( triangleCounts.size() * 2 );
 	qsizetype	k = 0;
-	for ( int i = 0; i < meshletCount; i++ ) {
-		int	triangleCount = int( nif->get<quint32>( QModelIndex_child( iMeshlets, i ), "Triangle Count" ) );
+	for ( size_t i = 0; i < triangleCounts.size(); i++ ) {
+		int	triangleCount = int( triangleCounts[i] );
 		FloatVector4	bndMin( float(FLT_MAX) );
 		FloatVector4	bndMax( float(-FLT_MAX) );
 		bool	haveBounds = false;
 		for ( int j = 0; j < triangleCount; j++, k++ ) {
-			if ( k >= meshFile.triangles.size() ) [[unlikely]]
+			if ( k >= triangles.size() ) [[unlikely]]
 				break;
-			Triangle	t = meshFile.triangles.at( k );
+			const Triangle &	t = triangles.at( k );
 			for ( int l = 0; l < 3; l++ ) {
 				int	m = t[l];
-				if ( !( m >= 0 && m < int(meshFile.positions.size()) ) )
+				if ( !( m >= 0 && m < int(positions.size()) ) )
 					continue;
-				FloatVector4	xyz( meshFile.positions.at( m ) );
+				FloatVector4	xyz( positions.at( m ) );
 				bndMin.minValues( xyz );
 				bndMax.maxValues( xyz );
 				haveBounds = true;
@@ -1494,11 +1496,44 @@ static void updateCullData( NifModel * nif, const QPersistentModelIndex & iMeshD
 			bndCenter = ( bndMin + bndMax ) * 0.5f;
 			bndDims = ( bndMax - bndMin ) * 0.5f;
 		}
-		setBoundingBox( nif, QModelIndex_child( iCullData, i ), bndCenter, bndDims );
+		cullData[i * 2] = bndCenter;
+		cullData[i * 2 + 1] = bndDims;
+	}
+}
+
+//! Writes cull data calculated by calculateCullData() to the model
+static void writeCullData( NifModel * nif, const QModelIndex & iMeshData, const std::vector< FloatVector4 > & cullData )
+{
+	int	cullDataCount = int( cullData.size() >> 1 );
+	nif->set<quint32>( iMeshData, "Num Cull Data", quint32(cullDataCount) );
+	auto	iCullData = nif->getIndex( iMeshData, "Cull Data" );
+	nif->updateArraySize( iCullData );
+	NifItem *	cullItem = nif->getItem( iCullData );
+	if ( !cullItem )
+		return;
+	for ( int i = 0; i < cullDataCount && i < cullItem->childCount(); i++ ) {
+		NifItem *	boundsItem = nif->getItem( cullItem->child( i ), "Bounding Box" );
+		if ( boundsItem && boundsItem->childCount() >= 2 ) {
+			nif->set<Vector3>( boundsItem->child( 0 ), Vector3( cullData[size_t(i) * 2] ) );
+			nif->set<Vector3>( boundsItem->child( 1 ), Vector3( cullData[size_t(i) * 2 + 1] ) );
+		}
+	}
+}
+
+static void updateCullData( NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile )
+{
+	std::vector< std::uint32_t >	triangleCounts( nif->get<quint32>( iMeshData, "Num Meshlets" ) );
+	const NifItem *	meshletsItem = nif->getItem( nif->getIndex( iMeshData, "Meshlets" ) );
+	for ( size_t i = 0; i < triangleCounts.size(); i++ ) {
+		if ( meshletsItem && int(i) < meshletsItem->childCount() )
+			triangleCounts[i] = nif->get<quint32>( meshletsItem->child( int(i) ), "Triangle Count" );
 	}
+	std::vector< FloatVector4 >	cullData;
+	calculateCullData( cullData, triangleCounts, meshFile.triangles, meshFile.positions );
+	writeCullData( nif, iMeshData, cullData );
 }
 
-QModelIndex spUpdateBounds::cast_Starfield( NifModel * nif, const QModelIndex & index )
+QModelIndex spUpdateBounds::cast_Starfield( NifModel * nif, const QModelIndex & index, bool updateCullData )
 {
 	QModelIndex	iBlock = nif->getBlockIndex( index );
 	auto meshes = nif->getIndex( iBlock, "Meshes" );
@@ -1558,8 +1593,8 @@ QModelIndex spUpdateBounds::cast_Starfield( NifModel * nif, const QModelIndex &
 			continue;
 		auto	meshData = nif->getIndex( mesh, "Mesh Data" );
 		// update cull data for version 2 meshlets
-		if ( meshData.isValid() && nif->get<quint32>( meshData, "Version" ) >= 2U )
-			updateCullData( nif, meshData, meshFile );
+		if ( updateCullData && meshData.isValid() && nif->get<quint32>( meshData, "Version" ) >= 2U )
+			::updateCullData( nif, meshData, meshFile );
 	}
 
 	bounds.update( nif, iBlock );
@@ -1657,16 +1692,181 @@ void spGenerateMeshlets::clearMeshlets( NifModel * nif, const QModelIndex & iMes
 		nif->updateArraySize( i );
 }
 
-void spGenerateMeshlets::updateMeshlets(
-	NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile )
+//! Names of the meshlet algorithms, as in the general settings
+static const char * const meshletAlgorithmNames[5] = {
+	"meshopt_buildMeshlets", "meshopt_buildMeshlets (optimized)",
+	"meshopt_buildMeshletsScan", "meshopt_buildMeshletsScan (optimized)", "DirectXMesh"
+};
+
+static int getMeshletAlgorithm()
 {
-	int	meshletAlgorithm;
-	{
-		QSettings	settings;
-		meshletAlgorithm = settings.value( "Settings/Nif/Starfield Meshlet Algorithm", 0 ).toInt();
-		meshletAlgorithm = std::min< int >( std::max< int >( meshletAlgorithm, 0 ), 4 );
+	QSettings	settings;
+	int	meshletAlgorithm = settings.value( "Settings/Nif/Starfield Meshlet Algorithm", 0 ).toInt();
+	return std::min< int >( std::max< int >( meshletAlgorithm, 0 ), 4 );
+}
+
+//! Builds the meshlets and cull data of a Starfield mesh
+/*!
+ * The mesh data is copied from the model by the constructor, build() does not access
+ * the model and can run on a worker thread, and write() stores the results with bulk writes.
+ */
+class MeshletBuilder
+{
+public:
+	MeshletBuilder( const NifModel * nif, const QPersistentModelIndex & meshData, const MeshFile & meshFile, int meshletAlgorithm );
+
+	void build();
+	void write( NifModel * nif ) const;
+
+	QPersistentModelIndex	iMeshData;
+	int	algorithm;
+	QVector< Vector3 >	positions;
+	QVector< Triangle >	triangles;
+	//! The triangles reordered by meshlet
+	QVector< Triangle >	newTriangles;
+	std::vector< meshopt_Meshlet >	meshlets;
+	//! Center and extents of the bounding box of each meshlet
+	std::vector< FloatVector4 >	cullData;
+	QString	errorMessage;
+	//! Time taken by build() in milliseconds
+	double	buildTime = 0.0;
+
+protected:
+	void buildMeshopt();
+	void buildDirectXMesh();
+};
+
+MeshletBuilder::MeshletBuilder(
+	const NifModel * nif, const QPersistentModelIndex & meshData, const MeshFile & meshFile, int meshletAlgorithm )
+	: iMeshData( meshData ), algorithm( meshletAlgorithm ), positions( meshFile.positions ), triangles( meshFile.triangles )
+{
+	if ( positions.size() > 0 && triangles.size() > 0 ) {
+		auto	iTriangles = nif->getIndex( iMeshData, "Triangles" );
+		if ( !iTriangles.isValid() || qsizetype( nif->rowCount( iTriangles ) ) != triangles.size() )
+			errorMessage = "invalid triangle data";
 	}
+}
 
+void MeshletBuilder::build()
+{
+	auto	t0 = std::chrono::steady_clock::now();
+	meshlets.clear();
+	cullData.clear();
+	newTriangles.clear();
+	if ( errorMessage.isEmpty() && positions.size() > 0 && triangles.size() > 0 ) {
+		try {
+			if ( algorithm < 4 )
+				buildMeshopt();
+			else
+				buildDirectXMesh();
+			std::vector< std::uint32_t >	triangleCounts( meshlets.size() );
+			for ( size_t i = 0; i < meshlets.size(); i++ )
+				triangleCounts[i] = meshlets[i].triangle_count;
+			calculateCullData( cullData, triangleCounts, newTriangles, positions );
+		} catch ( std::exception & e ) {
+			meshlets.clear();
+			cullData.clear();
+			newTriangles.clear();
+			errorMessage = e.what();
+		}
+	}
+	buildTime = std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - t0 ).count();
+}
+
+void MeshletBuilder::buildMeshopt()
+{
+	size_t	vertexCnt = size_t( positions.size() );
+	size_t	triangleCnt = size_t( triangles.size() );
+	std::vector< unsigned int >	indices( triangleCnt * 3 );
+	size_t	k = 0;
+	for ( const auto & t : triangles ) {
+		if ( t[0] >= vertexCnt || t[1] >= vertexCnt || t[2] >= vertexCnt )
+			throw FO76UtilsError( "vertex number is out of range" );
+		indices[k] = t[0];
+		indices[k + 1] = t[1];
+		indices[k + 2] = t[2];
+		k = k + 3;
+	}
+	size_t	maxMeshlets = meshopt_buildMeshletsBound( triangleCnt * 3, 96, 128 );
+	meshlets.resize( maxMeshlets );
+	std::vector< unsigned int >	meshletVertices( maxMeshlets * 96 );
+	std::vector< unsigned char >	meshletTriangles( maxMeshlets * 128 * 3 );
+	size_t	meshletCnt;
+	const float *	vertexPositions = &( positions.at(0)[0] );
+	if ( algorithm & 2 ) {
+		std::vector< unsigned int >	indicesOpt( triangleCnt * 3 );
+		meshopt_spatialSortTriangles( indicesOpt.data(), indices.data(), triangleCnt * 3,
+										vertexPositions, vertexCnt, sizeof( Vector3 ) );
+		meshopt_optimizeVertexCache( indices.data(), indicesOpt.data(), triangleCnt * 3, vertexCnt );
+		meshletCnt =
+			meshopt_buildMeshletsScan( meshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+										indices.data(), triangleCnt * 3, vertexCnt, 96, 128 );
+	} else {
+		meshletCnt =
+			meshopt_buildMeshlets( meshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+									indices.data(), triangleCnt * 3, vertexPositions,
+									vertexCnt, sizeof( Vector3 ), 96, 128, 0.0625f );
+	}
+	meshlets.resize( meshletCnt );
+	if ( algorithm & 1 ) {
+		for ( const auto & m : meshlets ) {
+			meshopt_optimizeMeshlet( meshletVertices.data() + m.vertex_offset,
+									meshletTriangles.data() + m.triangle_offset,
+									m.triangle_count, m.vertex_count );
+		}
+	}
+
+	// store the triangles in meshlet order
+	k = 0;
+	newTriangles.resize( triangles.size() );
+	Triangle *	dst = newTriangles.data();
+	for ( const auto & m : meshlets ) {
+		unsigned int	n = m.triangle_count;
+		const unsigned int *	v = meshletVertices.data() + m.vertex_offset;
+		const unsigned char *	p = meshletTriangles.data() + m.triangle_offset;
+		for ( ; n; n--, k++, p = p + 3 ) {
+			if ( k >= triangleCnt )
+				throw FO76UtilsError( "triangle number is out of range" );
+			dst[k] = Triangle( quint16( v[p[0]] ), quint16( v[p[1]] ), quint16( v[p[2]] ) );
+		}
+	}
+}
+
+void MeshletBuilder::buildDirectXMesh()
+{
+	size_t	triangleCnt = size_t( triangles.size() );
+	std::vector< DirectX::Meshlet >	tmpMeshlets;
+	std::vector< std::uint16_t >	newIndices;
+	int	err = DirectX::ComputeMeshlets( triangles.constData(), triangleCnt,
+										positions.constData(), size_t( positions.size() ),
+										tmpMeshlets, newIndices, 96, 128 );
+	if ( err ) {
+		throw FO76UtilsError( err == ERANGE ? "vertex number is out of range"
+											: ( err == ENOMEM ? "std::bad_alloc" : "invalid argument" ) );
+	}
+	if ( newIndices.size() < ( triangleCnt * 3 ) )
+		throw FO76UtilsError( "triangle number is out of range" );
+	meshlets.resize( tmpMeshlets.size() );
+	std::uint32_t	vertexOffset = 0;
+	std::uint32_t	triangleOffset = 0;
+	for ( size_t i = 0; i < tmpMeshlets.size(); i++ ) {
+		const DirectX::Meshlet &	m = tmpMeshlets[i];
+		meshopt_Meshlet &	o = meshlets[i];
+		o.vertex_offset = vertexOffset;
+		o.triangle_offset = triangleOffset;
+		o.vertex_count = m.VertCount;
+		vertexOffset = vertexOffset + o.vertex_count;
+		o.triangle_count = m.PrimCount;
+		triangleOffset = ( triangleOffset + ( o.triangle_count * 3U ) + 3U ) & ~3U;
+	}
+	newTriangles.resize( triangles.size() );
+	Triangle *	dst = newTriangles.data();
+	for ( size_t i = 0; i < triangleCnt; i++ )
+		dst[i] = Triangle( newIndices[i * 3], newIndices[i * 3 + 1], newIndices[i * 3 + 2] );
+}
+
+void MeshletBuilder::write( NifModel * nif ) const
+{
 	NifItem *	item = nif->getItem( iMeshData );
 	if ( !item )
 		return;
@@ -1674,137 +1874,50 @@ void spGenerateMeshlets::updateMeshlets(
 	item->invalidateCondition();
 	nif->set<quint32>( iMeshData, "Version", 2 );
 
-	std::vector< meshopt_Meshlet >	meshletData;
-	if ( meshFile.positions.size() > 0 && meshFile.triangles.size() > 0 ) {
-		try {
-			size_t	vertexCnt = size_t( meshFile.positions.size() );
-			size_t	triangleCnt = size_t( meshFile.triangles.size() );
-			auto	iTriangles = nif->getIndex( iMeshData, "Triangles" );
-			if ( !iTriangles.isValid() || size_t( nif->rowCount( iTriangles ) ) != triangleCnt )
-				throw FO76UtilsError( "invalid triangle data" );
-			if ( meshletAlgorithm < 4 ) {
-				std::vector< unsigned int >	indices( triangleCnt * 3 );
-				size_t	k = 0;
-				for ( const auto & t : meshFile.triangles ) {
-					if ( t[0] >= vertexCnt || t[1] >= vertexCnt || t[2] >= vertexCnt )
-						throw FO76UtilsError( "vertex number is out of range" );
-					indices[k] = t[0];
-					indices[k + 1] = t[1];
-					indices[k + 2] = t[2];
-					k = k + 3;
-				}
-				size_t	maxMeshlets = meshopt_buildMeshletsBound( triangleCnt * 3, 96, 128 );
-				meshletData.resize( maxMeshlets );
-				std::vector< unsigned int >	meshletVertices( maxMeshlets * 96 );
-				std::vector< unsigned char >	meshletTriangles( maxMeshlets * 128 * 3 );
-				size_t	meshletCnt;
-				if ( meshletAlgorithm & 2 ) {
-					std::vector< unsigned int >	indicesOpt( triangleCnt * 3 );
-					meshopt_spatialSortTriangles( indicesOpt.data(), indices.data(), triangleCnt * 3,
-													&( meshFile.positions.at(0)[0] ), vertexCnt, sizeof( Vector3 ) );
-					meshopt_optimizeVertexCache( indices.data(), indicesOpt.data(), triangleCnt * 3, vertexCnt );
-					meshletCnt =
-						meshopt_buildMeshletsScan( meshletData.data(), meshletVertices.data(), meshletTriangles.data(),
-													indices.data(), triangleCnt * 3, vertexCnt, 96, 128 );
-				} else {
-					meshletCnt =
-						meshopt_buildMeshlets( meshletData.data(), meshletVertices.data(), meshletTriangles.data(),
-												indices.data(), triangleCnt * 3, &( meshFile.positions.at(0)[0] ),
-												vertexCnt, sizeof( Vector3 ), 96, 128, 0.0625f );
-				}
-				meshletData.resize( meshletCnt );
-				if ( meshletAlgorithm & 1 ) {
-					for ( const auto & m : meshletData ) {
-						meshopt_optimizeMeshlet( meshletVertices.data() + m.vertex_offset,
-												meshletTriangles.data() + m.triangle_offset,
-												m.triangle_count, m.vertex_count );
-					}
-				}
-				k = 0;
-				for ( const auto & m : meshletData ) {
-					unsigned int	n = m.triangle_count;
-					const unsigned int *	v = meshletVertices.data() + m.vertex_offset;
-					const unsigned char *	p = meshletTriangles.data() + m.triangle_offset;
-					for ( ; n; n--, k++, p = p + 3 ) {
-						auto	iTriangle = QModelIndex_child( iTriangles, int(k) );
-						if ( !iTriangle.isValid() )
-							throw FO76UtilsError( "triangle number is out of range" );
-						quint16	v0 = quint16( v[p[0]] );
-						quint16	v1 = quint16( v[p[1]] );
-						quint16	v2 = quint16( v[p[2]] );
-						Triangle	t( v0, v1, v2 );
-						nif->set<Triangle>( iTriangle, t );
-					}
-				}
-			} else {
-				std::vector< DirectX::Meshlet >	tmpMeshlets;
-				std::vector< std::uint16_t >	newIndices;
-				int	err = DirectX::ComputeMeshlets( meshFile.triangles.data(), triangleCnt,
-													meshFile.positions.data(), vertexCnt,
-													tmpMeshlets, newIndices, 96, 128 );
-				if ( err ) {
-					throw FO76UtilsError( err == ERANGE ? "vertex number is out of range"
-														: ( err == ENOMEM ? "std::bad_alloc" : "invalid argument" ) );
-				}
-				meshletData.resize( tmpMeshlets.size() );
-				std::uint32_t	vertexOffset = 0;
-				std::uint32_t	triangleOffset = 0;
-				for ( const auto & m : tmpMeshlets ) {
-					meshopt_Meshlet &	o = meshletData[&m - tmpMeshlets.data()];
-					o.vertex_offset = vertexOffset;
-					o.triangle_offset = triangleOffset;
-					o.vertex_count = m.VertCount;
-					vertexOffset = vertexOffset + o.vertex_count;
-					o.triangle_count = m.PrimCount;
-					triangleOffset = ( triangleOffset + ( o.triangle_count * 3U ) + 3U ) & ~3U;
-				}
-				for ( int i = 0; i < int(triangleCnt); i++ ) {
-					Triangle	t( newIndices[i * 3], newIndices[i * 3 + 1], newIndices[i * 3 + 2] );
-					nif->set<Triangle>( QModelIndex_child( iTriangles, i ), t );
-				}
-			}
-		} catch ( std::exception & e ) {
-			meshletData.clear();
-			QMessageBox::critical( nullptr, "NifSkope error", QString("Meshlet generation failed: %1").arg(e.what()) );
-		}
-	}
-	int	meshletCount = int( meshletData.size() );
+	if ( !meshlets.empty() )
+		nif->setArray<Triangle>( iMeshData, "Triangles", newTriangles );
 
+	int	meshletCount = int( meshlets.size() );
 	nif->set<quint32>( iMeshData, "Num Meshlets", quint32(meshletCount) );
 	auto	iMeshlets = nif->getIndex( iMeshData, "Meshlets" );
 	nif->updateArraySize( iMeshlets );
-	for ( int i = 0; i < meshletCount; i++ ) {
-		auto	iMeshlet = QModelIndex_child( iMeshlets, i );
-		if ( iMeshlet.isValid() ) {
-			nif->set<quint32>( iMeshlet, "Vertex Count", meshletData[i].vertex_count );
-			nif->set<quint32>( iMeshlet, "Vertex Offset", meshletData[i].vertex_offset );
-			nif->set<quint32>( iMeshlet, "Triangle Count", meshletData[i].triangle_count );
-			nif->set<quint32>( iMeshlet, "Triangle Offset", meshletData[i].triangle_offset );
-		}
+	const NifItem *	meshletsItem = nif->getItem( iMeshlets );
+	for ( int i = 0; meshletsItem && i < meshletCount && i < meshletsItem->childCount(); i++ ) {
+		const NifItem *	meshletItem = meshletsItem->child( i );
+		nif->set<quint32>( meshletItem, "Vertex Count", meshlets[i].vertex_count );
+		nif->set<quint32>( meshletItem, "Vertex Offset", meshlets[i].vertex_offset );
+		nif->set<quint32>( meshletItem, "Triangle Count", meshlets[i].triangle_count );
+		nif->set<quint32>( meshletItem, "Triangle Offset", meshlets[i].triangle_offset );
 	}
 
-	updateCullData( nif, iMeshData, meshFile );
+	writeCullData( nif, iMeshData, cullData );
 }
 
-QModelIndex spGenerateMeshlets::cast( NifModel * nif, const QModelIndex & index )
+void spGenerateMeshlets::updateMeshlets(
+	NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile )
 {
-	if ( !( nif && nif->getBSVersion() >= 170 ) )
-		return index;
-	if ( !index.isValid() ) {
-		// process all shapes
-		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
-			QModelIndex idx = nif->getBlockIndex( n );
-			if ( idx.isValid() )
-				cast( nif, idx );
-		}
-		return index;
-	}
+	MeshletBuilder	b( nif, iMeshData, meshFile, getMeshletAlgorithm() );
+	b.build();
+	if ( !b.errorMessage.isEmpty() )
+		QMessageBox::critical( nullptr, "NifSkope error", QString("Meshlet generation failed: %1").arg( b.errorMessage ) );
+	b.write( nif );
+}
 
-	if ( !nif->blockInherits( index, "BSGeometry" ) )
-		return index;
+void spGenerateMeshlets::updateMeshlets( NifModel * nif, const QList< QPersistentModelIndex > & shapes, bool showReport )
+{
+	int	meshletAlgorithm = getMeshletAlgorithm();
+	bool	compareAlgorithms;
+	{
+		QSettings	settings;
+		compareAlgorithms = settings.value( "Settings/Nif/Starfield Meshlet Benchmark", false ).toBool();
+	}
 
-	auto	meshes = nif->getIndex( index, "Meshes" );
-	if ( meshes.isValid() && ( nif->get<quint32>(index, "Flags") & 0x0200 ) != 0 ) {
+	// read all meshes and LODs
+	std::vector< MeshletBuilder >	builders;
+	for ( const auto & iShape : shapes ) {
+		auto	meshes = nif->getIndex( iShape, "Meshes" );
+		if ( !( meshes.isValid() && ( nif->get<quint32>(iShape, "Flags") & 0x0200 ) != 0 ) )
+			continue;
 		for ( int i = 0; i <= 3; i++ ) {
 			auto mesh = QModelIndex_child( meshes, i );
 			if ( !mesh.isValid() )
@@ -1815,14 +1928,95 @@ QModelIndex spGenerateMeshlets::cast( NifModel * nif, const QModelIndex & index
 			mesh = nif->getIndex( mesh, "Mesh" );
 			if ( !mesh.isValid() )
 				continue;
-			MeshFile	meshFile( nif, mesh );
 			auto	meshData = nif->getIndex( mesh, "Mesh Data" );
 			if ( meshData.isValid() )
-				updateMeshlets( nif, meshData, meshFile );
+				builders.emplace_back( nif, meshData, MeshFile( nif, mesh ), meshletAlgorithm );
 		}
 	}
 
-	return spUpdateBounds::cast_Starfield( nif, index );
+	// build the meshlets and cull data on multiple threads
+	QElapsedTimer	timer;
+	timer.start();
+	parallelFor( builders.size(), [&builders]( size_t i ) {
+		builders[i].build();
+	} );
+	qint64	buildTime = timer.elapsed();
+
+	timer.restart();
+	QStringList	errors;
+	size_t	meshletCnt = 0;
+	double	cpuTime = 0.0;
+	for ( const auto & b : builders ) {
+		if ( !b.errorMessage.isEmpty() )
+			errors << b.errorMessage;
+		meshletCnt += b.meshlets.size();
+		cpuTime += b.buildTime;
+		b.write( nif );
+	}
+	for ( const auto & iShape : shapes ) {
+		if ( iShape.isValid() )
+			spUpdateBounds::cast_Starfield( nif, iShape, false );
+	}
+	qint64	writeTime = timer.elapsed();
+
+	if ( !errors.isEmpty() ) {
+		errors.removeDuplicates();
+		QMessageBox::critical( nullptr, "NifSkope error", QString("Meshlet generation failed: %1").arg( errors.join( ", " ) ) );
+	}
+	if ( !showReport )
+		return;
+
+	QString	msg = Spell::tr( "Generated %1 meshlets for %2 meshes using %3\nBuild: %4 ms (%5 ms CPU time), write: %6 ms" )
+					.arg( meshletCnt ).arg( builders.size() ).arg( meshletAlgorithmNames[meshletAlgorithm] )
+					.arg( buildTime ).arg( qint64( cpuTime + 0.5 ) ).arg( writeTime );
+	QStringList	details;
+	if ( compareAlgorithms ) {
+		// build with all algorithms without writing the results, to compare their speed and meshlet counts
+		for ( int a = 0; a < 5; a++ ) {
+			for ( auto & b : builders )
+				b.algorithm = a;
+			timer.restart();
+			parallelFor( builders.size(), [&builders]( size_t i ) {
+				builders[i].build();
+			} );
+			qint64	t = timer.elapsed();
+			size_t	n = 0;
+			size_t	triangleCnt = 0;
+			double	cpu = 0.0;
+			for ( const auto & b : builders ) {
+				n += b.meshlets.size();
+				triangleCnt += size_t( b.triangles.size() );
+				cpu += b.buildTime;
+			}
+			details << Spell::tr( "%1: %2 ms (%3 ms CPU time), %4 meshlets, %5 triangles per meshlet" )
+						.arg( meshletAlgorithmNames[a] ).arg( t ).arg( qint64( cpu + 0.5 ) ).arg( n )
+						.arg( n ? double( triangleCnt ) / double( n ) : 0.0, 0, 'f', 1 );
+		}
+	}
+	Message::info( nullptr, msg, details.join( "\n" ) );
+}
+
+QModelIndex spGenerateMeshlets::cast( NifModel * nif, const QModelIndex & index )
+{
+	if ( !( nif && nif->getBSVersion() >= 170 ) )
+		return index;
+
+	QList< QPersistentModelIndex >	shapes;
+	if ( !index.isValid() ) {
+		// process all shapes
+		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
+			QModelIndex idx = nif->getBlockIndex( n );
+			if ( nif->blockInherits( idx, "BSGeometry" ) )
+				shapes.append( idx );
+		}
+	} else if ( nif->blockInherits( index, "BSGeometry" ) ) {
+		shapes.append( index );
+	}
+
+	if ( !shapes.isEmpty() )
+		updateMeshlets( nif, shapes, !index.isValid() );
+
+	return index;
 }
 
 REGISTER_SPELL( spGenerateMeshlets )
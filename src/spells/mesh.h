@@ -45,7 +45,8 @@ public:
 
 	static void calculateSFBoneBounds(
 		NifModel * nif, const QPersistentModelIndex & iBoneList, int numBones, const MeshFile & meshFile );
-	static QModelIndex cast_Starfield( NifModel * nif, const QModelIndex & index );
+	//! Updates the bounds of a BSGeometry, and the meshlet cull data if \a updateCullData is true
+	static QModelIndex cast_Starfield( NifModel * nif, const QModelIndex & index, bool updateCullData = true );
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
 };
@@ -68,6 +69,8 @@ public:
 
 	static void clearMeshlets( NifModel * nif, const QModelIndex & iMeshData );
 	static void updateMeshlets( NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile );
+	//! Generates meshlets for all meshes of a list of BSGeometry blocks in parallel, and updates their bounds
+	static void updateMeshlets( NifModel * nif, const QList< QPersistentModelIndex > & shapes, bool showReport = false );
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
 };
 
@@ -1,5 +1,9 @@
 #include "spellbook.h"
 
+#include "lib/parallel.h"
+
+#include <QCheckBox>
+#include <QCryptographicHash>
 #include <QDialog>
 #include <QLabel>
 #include <QLayout>
@@ -12,6 +16,9 @@
 #include <QFileInfo>
 #include <QTextBoundaryFinder>
 
+#include <atomic>
+#include <map>
+
 // Brief description is deliberately not autolinked to class Spell
 /*! \file meshfilecopy.cpp
  * \brief Spell to modify resource paths into user named folder (spResourceCopy)
@@ -37,7 +44,21 @@ public:
 		return ( nif && nif->getBSVersion() >= 170 && !index.isValid() );
 	}
 
-	void copyPaths(NifModel* nif, NifItem* item, const QString& author, const QString& project, const QString& nifFolder);
+	//! A mesh file to be copied, and the path item to be updated in the model
+	struct CopyJob
+	{
+		NifItem* pathItem;
+		QString newMeshPath;
+		std::string sourcePath;
+		QString oldPath;
+		QString newPath;
+		//! True if the file was found in the archives and not as a loose file
+		bool archived = false;
+		//! False if the destination is already written by an earlier job, or the source is not found
+		bool copy = true;
+	};
+
+	void copyPaths(std::vector<CopyJob>& jobs, NifModel* nif, NifItem* item, const QString& author, const QString& project, const QString& nifFolder);
 	NifItem* findChildByName(NifItem* parent, const QString& name);
 	QString sanitizeFileName(const QString& input);
 
@@ -107,7 +128,7 @@ NifItem* spResourceCopy::findChildByName(NifItem* parent, const QString& name)
 	return nullptr;
 }
 
-void spResourceCopy::copyPaths(NifModel* nif, NifItem* item, const QString& author, const QString& project, const QString& nifFolder)
+void spResourceCopy::copyPaths(std::vector<CopyJob>& jobs, NifModel* nif, NifItem* item, const QString& author, const QString& project, const QString& nifFolder)
 {
 	if (item && item->name() == "BSGeometry") {
 		if (nif->get<quint32>(item, "Flags") & 0x0200) {
@@ -124,33 +145,20 @@ void spResourceCopy::copyPaths(NifModel* nif, NifItem* item, const QString& auth
 					continue;
 				}
 				NifItem* mesh = findChildByName(meshArrayItem, "Mesh");
-				if (mesh) {
+				NifItem* pathItem = (mesh ? findChildByName(mesh, "Mesh Path") : nullptr);
+				if (pathItem) {
+					CopyJob job;
+					job.pathItem = pathItem;
 					// The nif field doesn't include the .mesh extension, and may use any type of separator
-					std::string	meshPathStr(Game::GameManager::get_full_path(nif->get<QString>(mesh, "Mesh Path"), "geometries/", ".mesh"));
-					QString	meshPath = QString::fromStdString(meshPathStr);
+					job.sourcePath = Game::GameManager::get_full_path(nif->get<QString>(mesh, "Mesh Path"), "geometries/", ".mesh");
 					// Not using QDir because file as stored uses forward slashes and no extension
-					QString newMeshPath = author + "/" + project + "/" + sanitizeFileName(objectName) + "_lod" + QString::number(i + 1);
+					job.newMeshPath = author + "/" + project + "/" + sanitizeFileName(objectName) + "_lod" + QString::number(i + 1);
 
 					// Convert paths to absolute using nifFolder as root
-					QString oldPath = QDir(nifFolder).filePath(meshPath);
-					QString newPath = QDir(nifFolder).filePath("geometries/" + newMeshPath + ".mesh");
-
-					// Create the directory for the new path if it doesn't exist
-					QDir newDir = QFileInfo(newPath).absoluteDir();
-					newDir.mkpath(newDir.absolutePath());
-
-					// Copy the file (platform-independent with the slashes)
-					if ( !QFile::copy(oldPath, newPath) ) {
-						QByteArray	meshData;
-						if ( nif->getResourceFile(meshData, meshPathStr) ) {
-							QFile	newFile( newPath );
-							if ( newFile.open(QIODevice::WriteOnly) )
-								(void) newFile.write( meshData );
-						}
-					}
+					job.oldPath = QDir(nifFolder).filePath(QString::fromStdString(job.sourcePath));
+					job.newPath = QDir(nifFolder).filePath("geometries/" + job.newMeshPath + ".mesh");
 
-					// Update the value in the nif
-					findChildByName(mesh,"Mesh Path")->setValueFromString(newMeshPath.replace(QChar('/'), QChar('\\')));
+					jobs.push_back(job);
 				}
 			}
 		}
@@ -160,7 +168,7 @@ void spResourceCopy::copyPaths(NifModel* nif, NifItem* item, const QString& auth
 		// Process children
 		for (int i = 0; i < item->childCount(); i++) {
 			if (item->child(i)) {
-				copyPaths(nif, item->child(i), author, project, nifFolder);
+				copyPaths(jobs, nif, item->child(i), author, project, nifFolder);
 			}
 		}
 	}
@@ -186,6 +194,8 @@ QModelIndex spResourceCopy::cast(NifModel* nif, const QModelIndex& index)
 	QLineEdit* le2 = new QLineEdit(&dlg);
 	le2->setFocus();
 
+	QCheckBox* cbDryRun = new QCheckBox(tr("Dry run (only report the files to be copied)"), &dlg);
+
 	QPushButton* bo = new QPushButton(tr("Ok"), &dlg);
 	QObject::connect(bo, &QPushButton::clicked, &dlg, &QDialog::accept);
 
@@ -199,8 +209,9 @@ QModelIndex spResourceCopy::cast(NifModel* nif, const QModelIndex& index)
 	grid->addWidget(le1, 2, 0, 1, 2);
 	grid->addWidget(lb2, 3, 0, 1, 2);
 	grid->addWidget(le2, 4, 0, 1, 2);
-	grid->addWidget(bo, 5, 0, 1, 1);
-	grid->addWidget(bc, 5, 1, 1, 1);
+	grid->addWidget(cbDryRun, 5, 0, 1, 2);
+	grid->addWidget(bo, 6, 0, 1, 1);
+	grid->addWidget(bc, 6, 1, 1, 1);
 
 	if (dlg.exec() != QDialog::Accepted) {
 		return index;
@@ -210,10 +221,111 @@ QModelIndex spResourceCopy::cast(NifModel* nif, const QModelIndex& index)
 	QString authorPrefix = sanitizeFileName(le1->text().trimmed().remove(QRegularExpression("^[\\\\/]+|[\\\\/]+$")));
 	QString projectName = sanitizeFileName(le2->text().trimmed().remove(QRegularExpression("^[\\\\/]+|[\\\\/]+$")));
 
+	bool dryRun = cbDryRun->isChecked();
+
+	// NifModel is not thread-safe, so the paths are collected on the main thread
+	std::vector<CopyJob> jobs;
 	for (int b = 0; b < nif->getBlockCount(); b++) {
 		NifItem* item = nif->getBlockItem(qint32(b));
 		if (item)
-			copyPaths(nif, item, authorPrefix, projectName, nif->getFolder());
+			copyPaths(jobs, nif, item, authorPrefix, projectName, nif->getFolder());
+	}
+
+	// Meshes that are used more than once are only copied by the first job, different meshes with
+	// the same destination get a numbered suffix. Finding the archived files here also opens the
+	// archives so that the files can be extracted in parallel
+	std::map<QString, std::string> destinations;
+	int filesMissing = 0;
+	int filesRenamed = 0;
+	for (CopyJob& job : jobs) {
+		QString baseMeshPath = job.newMeshPath;
+		auto d = destinations.emplace(QDir::cleanPath(job.newPath).toLower(), job.sourcePath);
+		for (int n = 2; !d.second && d.first->second != job.sourcePath; n++) {
+			job.newMeshPath = baseMeshPath + "_" + QString::number(n);
+			job.newPath = QDir(nif->getFolder()).filePath("geometries/" + job.newMeshPath + ".mesh");
+			d = destinations.emplace(QDir::cleanPath(job.newPath).toLower(), job.sourcePath);
+		}
+		filesRenamed += int(job.newMeshPath != baseMeshPath);
+		if (!d.second) {
+			job.copy = false;
+		}
+		else if (!QFileInfo::exists(job.oldPath)) {
+			job.archived = !nif->findResourceFile(QString::fromStdString(job.sourcePath), nullptr, nullptr).isEmpty();
+			job.copy = job.archived;
+			filesMissing += int(!job.archived);
+		}
+		if (job.copy && !dryRun) {
+			// Create the directory for the new path if it doesn't exist
+			QDir newDir = QFileInfo(job.newPath).absoluteDir();
+			newDir.mkpath(newDir.absolutePath());
+		}
+	}
+
+	// Read, hash and write the files in parallel, skipping destinations that are already identical
+	std::atomic<int> filesCopied(0);
+	std::atomic<int> filesSkipped(0);
+	std::atomic<int> filesFailed(filesMissing);
+	std::atomic<qint64> bytesCopied(0);
+	parallelFor(jobs.size(), [&](size_t n) {
+		const CopyJob& job = jobs[n];
+		if (!job.copy)
+			return;
+
+		QByteArray meshData;
+		if (job.archived) {
+			if (!nif->extractResourceFile(meshData, job.sourcePath)) {
+				filesFailed++;
+				return;
+			}
+		}
+		else {
+			QFile oldFile(job.oldPath);
+			if (!oldFile.open(QIODevice::ReadOnly)) {
+				filesFailed++;
+				return;
+			}
+			meshData = oldFile.readAll();
+		}
+
+		QFile newFile(job.newPath);
+		if (newFile.size() == meshData.size() && newFile.open(QIODevice::ReadOnly)) {
+			QByteArray oldHash = QCryptographicHash::hash(meshData, QCryptographicHash::Sha1);
+			if (QCryptographicHash::hash(newFile.readAll(), QCryptographicHash::Sha1) == oldHash) {
+				filesSkipped++;
+				return;
+			}
+			newFile.close();
+		}
+
+		if (!dryRun) {
+			if (!(newFile.open(QIODevice::WriteOnly) && newFile.write(meshData) == meshData.size())) {
+				filesFailed++;
+				return;
+			}
+		}
+		filesCopied++;
+		bytesCopied += meshData.size();
+	});
+
+	QString summary = (dryRun ? tr("Would copy %1 mesh files (%2 MB), %3 already up to date, %4 not found or failed")
+		: tr("Copied %1 mesh files (%2 MB), %3 already up to date, %4 not found or failed"))
+		.arg(filesCopied.load()).arg(double(bytesCopied.load()) / 1048576.0, 0, 'f', 2)
+		.arg(filesSkipped.load()).arg(filesFailed.load());
+	if (filesRenamed)
+		summary += "\n" + tr("%1 meshes with the same object name were given a numbered suffix").arg(filesRenamed);
+
+	if (dryRun) {
+		QMessageBox::information(nullptr, tr("Copy and Rename all Meshes"), summary);
+		return index;
+	}
+	if (filesFailed.load())
+		QMessageBox::warning(nullptr, tr("Copy and Rename all Meshes"), summary);
+	else if (filesRenamed)
+		QMessageBox::information(nullptr, tr("Copy and Rename all Meshes"), summary);
+
+	// Update the values in the nif
+	for (CopyJob& job : jobs) {
+		job.pathItem->setValueFromString(job.newMeshPath.replace(QChar('/'), QChar('\\')));
 	}
 
 	return index;
@@ -1,13 +1,15 @@
 #include "spellbook.h"
 #include "qtcompat.h"
+#include "lib/mopp.h"
 
 
 // Brief description is deliberately not autolinked to class Spell
 /*! \file moppcode.cpp
  * \brief Havok MOPP spells
  *
- * Note that this code only works on the Windows platform due an external
- * dependency on the Havok SDK, with which NifMopp.dll is compiled.
+ * MOPP code is generated by MoppCodeBuilder on all platforms. On Windows,
+ * NifMopp.dll (compiled with the Havok SDK) is used instead for
+ * bhkPackedNiTriStripsShape if it can be loaded.
  *
  * Most classes here inherit from the Spell class.
  */
@@ -15,7 +17,7 @@
 // Need to include headers before testing this
 #ifdef Q_OS_WIN32
 
-// This code is only intended to be run with Win32 platform.
+// NifMopp.dll is only available for the Win32 platform.
 
 extern "C" void * __stdcall SetDllDirectoryA( const char * lpPathName );
 extern "C" void * __stdcall LoadLibraryA( const char * lpModuleName );
@@ -126,100 +128,244 @@ public:
 }
 TheHavokCode;
 
-//! Update Havok MOPP for a given shape
-class spMoppCode final : public Spell
+#endif // Q_OS_WIN32
+
+//! Collision geometry of the shape below a bhkMoppBvTreeShape
+struct MoppGeometry
 {
-public:
-	QString name() const override final { return Spell::tr( "Update MOPP Code" ); }
-	QString page() const override final { return Spell::tr( "Havok" ); }
+	QVector<int> subShapeVerts;
+	std::vector<Vector3> verts;
+	std::vector<MoppCodeBuilder::Face> faces;
+	float radius = 0.0f;
+	//! Whether the geometry is from a bhkPackedNiTriStripsShape
+	bool packed = false;
+};
 
-	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
-	{
-		if ( nif->getUserVersion() != 10 && nif->getUserVersion() != 11 )
-			return false;
+//! Reads the geometry of a bhkPackedNiTriStripsShape, the shape keys are the triangle indices
+static bool loadPackedGeometry( const NifModel * nif, const QModelIndex & iShape, MoppGeometry & g )
+{
+	QModelIndex iData = nif->getBlockIndex( nif->getLink( iShape, "Data" ) );
 
-		if ( TheHavokCode.Initialize() ) {
-			//QModelIndex iData = nif->getBlockIndex( nif->getLink( index, "Data" ) );
+	if ( !nif->isNiBlock( iData, "hkPackedNiTriStripsData" ) )
+		return false;
 
-			if ( nif->isNiBlock( index, "bhkMoppBvTreeShape" ) ) {
-				return ( nif->checkVersion( 0x14000004, 0x14000005 )
-				         || nif->checkVersion( 0x14020007, 0x14020007 ) );
-			}
+	QModelIndex iSubShapes;
+
+	if ( nif->checkVersion( 0x14000004, 0x14000005 ) )
+		iSubShapes = nif->getIndex( iShape, "Sub Shapes" );
+	else if ( nif->checkVersion( 0x14020007, 0x14020007 ) )
+		iSubShapes = nif->getIndex( iData, "Sub Shapes" );
+
+	if ( iSubShapes.isValid() ) {
+		int nSubShapes = nif->rowCount( iSubShapes );
+		g.subShapeVerts.resize( nSubShapes );
+
+		for ( int t = 0; t < nSubShapes; t++ ) {
+			g.subShapeVerts[t] = nif->get<int>( QModelIndex_child( iSubShapes, t ), "Num Vertices" );
 		}
+	}
 
+	QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
+	g.verts.assign( verts.cbegin(), verts.cend() );
+
+	int nTriangles = nif->get<int>( iData, "Num Triangles" );
+	QModelIndex iTriangles = nif->getIndex( iData, "Triangles" );
+	g.faces.reserve( size_t( std::max( nTriangles, 0 ) ) );
+
+	for ( int t = 0; t < nTriangles; t++ ) {
+		Triangle tri = nif->get<Triangle>( QModelIndex_child( iTriangles, t ), "Triangle" );
+		g.faces.push_back( { { tri[0], tri[1], tri[2] }, std::uint32_t( t ) } );
+	}
+
+	g.radius = nif->get<float>( iShape, "Radius" );
+	g.packed = true;
+	return true;
+}
+
+/*! Reads the geometry of a bhkCompressedMeshShape
+ *
+ * Big triangles use their index as the shape key. Chunk triangles use
+ * ((chunk + 1) << Bits Per W Index) | (winding << Bits Per Index) | (index in chunk),
+ * where the winding bit is set for every other triangle of a strip.
+ */
+static bool loadCompressedGeometry( const NifModel * nif, const QModelIndex & iShape, MoppGeometry & g )
+{
+	QModelIndex iData = nif->getBlockIndex( nif->getLink( iShape, "Data" ) );
+
+	if ( !nif->isNiBlock( iData, "bhkCompressedMeshShapeData" ) )
 		return false;
+
+	quint32 bitsPerIndex = nif->get<quint32>( iData, "Bits Per Index" );
+	quint32 bitsPerWIndex = nif->get<quint32>( iData, "Bits Per W Index" );
+
+	if ( bitsPerIndex >= 32 || bitsPerWIndex >= 32 )
+		return false;
+
+	for ( const Vector4 & v : nif->getArray<Vector4>( iData, "Big Verts" ) )
+		g.verts.push_back( Vector3( v ) );
+
+	QModelIndex iBigTris = nif->getIndex( iData, "Big Tris" );
+	for ( int r = 0; r < nif->rowCount( iBigTris ); r++ ) {
+		Triangle tri = nif->get<Triangle>( QModelIndex_child( iBigTris, r ), "Triangle" );
+		g.faces.push_back( { { tri[0], tri[1], tri[2] }, std::uint32_t( r ) } );
 	}
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & iBlock ) override final
-	{
-		if ( !TheHavokCode.Initialize() ) {
-			Message::critical( nullptr, Spell::tr( "Unable to locate NifMopp.dll" ) );
-			return iBlock;
-		}
+	QModelIndex iChunkTrans = nif->getIndex( iData, "Chunk Transforms" );
+	QModelIndex iChunkArr = nif->getIndex( iData, "Chunks" );
+	for ( int r = 0; r < nif->rowCount( iChunkArr ); r++ ) {
+		auto iChunk = nif->index( r, 0, iChunkArr );
+		Vector4 chunkOrigin = nif->get<Vector4>( iChunk, "Translation" );
+
+		quint32 transformIndex = nif->get<quint32>( iChunk, "Transform Index" );
+		QModelIndex chunkTransform = QModelIndex_child( iChunkTrans, transformIndex );
+		Vector4 chunkTranslation = nif->get<Vector4>( QModelIndex_child( chunkTransform ) );
+		Quat chunkRotation = nif->get<Quat>( QModelIndex_child( chunkTransform, 1 ) );
+
+		Transform trans;
+		trans.rotation.fromQuat( chunkRotation );
+
+		// Same vertex transform as drawCMS()
+		std::uint32_t firstVertex = std::uint32_t( g.verts.size() );
+		for ( const UshortVector3 & o : nif->getArray<UshortVector3>( iChunk, "Vertices" ) )
+			g.verts.push_back( trans.rotation * Vector3( chunkOrigin + chunkTranslation + Vector4( o, 0.0f ) / 1000.0f ) );
+		std::uint32_t numVerts = std::uint32_t( g.verts.size() ) - firstVertex;
+
+		QVector<quint16> indices = nif->getArray<quint16>( iChunk, "Indices" );
+		QVector<quint16> strips = nif->getArray<quint16>( iChunk, "Strips" );
+
+		std::uint32_t chunkKey = std::uint32_t( r + 1 ) << bitsPerWIndex;
+		std::uint32_t t = 0;
+		auto addFace = [&]( int i, bool winding ) {
+			if ( indices[i] < numVerts && indices[i + 1] < numVerts && indices[i + 2] < numVerts ) {
+				std::uint32_t key = chunkKey | ( std::uint32_t( winding ) << bitsPerIndex ) | t;
+				g.faces.push_back( { { firstVertex + indices[i], firstVertex + indices[i + 1], firstVertex + indices[i + 2] }, key } );
+			}
+			t++;
+		};
 
-		QPersistentModelIndex ibhkMoppBvTreeShape = iBlock;
+		// Stripped tris
+		int offset = 0;
+		for ( quint16 stripLen : strips ) {
+			if ( ( offset + stripLen ) > indices.size() )
+				return false;
 
-		QModelIndex ibhkPackedNiTriStripsShape = nif->getBlockIndex( nif->getLink( ibhkMoppBvTreeShape, "Shape" ) );
+			for ( int idx = 0; idx < stripLen - 2; idx++ )
+				addFace( offset + idx, ( idx & 1 ) != 0 );
 
-		if ( !nif->isNiBlock( ibhkPackedNiTriStripsShape, "bhkPackedNiTriStripsShape" ) ) {
-			Message::warning( nullptr, Spell::tr( "Only bhkPackedNiTriStripsShape is supported at this time." ) );
-			return iBlock;
+			offset += stripLen;
 		}
 
-		QModelIndex ihkPackedNiTriStripsData = nif->getBlockIndex( nif->getLink( ibhkPackedNiTriStripsShape, "Data" ) );
+		// Non-stripped tris
+		for ( int f = offset; ( f + 2 ) < indices.size(); f += 3 )
+			addFace( f, false );
+	}
 
-		if ( !nif->isNiBlock( ihkPackedNiTriStripsData, "hkPackedNiTriStripsData" ) )
-			return iBlock;
+	g.radius = nif->get<float>( iShape, "Radius" );
+	return true;
+}
 
-		QVector<int> subshapeVerts;
+//! Generates MOPP code using NifMopp.dll if available, or MoppCodeBuilder
+static QByteArray calculateMoppCode( const MoppGeometry & g, Vector3 & origin, float & scale, QString & errorMessage )
+{
+#ifdef Q_OS_WIN32
+	if ( g.packed && TheHavokCode.Initialize() ) {
+		QVector<Vector3> verts( g.verts.cbegin(), g.verts.cend() );
+		QVector<Triangle> tris;
+		tris.reserve( qsizetype( g.faces.size() ) );
+		for ( const auto & f : g.faces )
+			tris.append( Triangle( quint16( f.v[0] ), quint16( f.v[1] ), quint16( f.v[2] ) ) );
+
+		QByteArray code = TheHavokCode.CalculateMoppCode( g.subShapeVerts, verts, tris, &origin, &scale );
+		if ( !code.isEmpty() )
+			return code;
+	}
+#endif
 
-		if ( nif->checkVersion( 0x14000004, 0x14000005 ) ) {
-			int nSubShapes = nif->get<int>( ibhkPackedNiTriStripsShape, "Num Sub Shapes" );
-			QModelIndex ihkSubShapes = nif->getIndex( ibhkPackedNiTriStripsShape, "Sub Shapes" );
-			subshapeVerts.resize( nSubShapes );
+	MoppCodeBuilder builder( g.verts, g.faces, g.radius );
 
-			for ( int t = 0; t < nSubShapes; t++ ) {
-				subshapeVerts[t] = nif->get<int>( QModelIndex_child( ihkSubShapes, t ), "Num Vertices" );
-			}
-		} else if ( nif->checkVersion( 0x14020007, 0x14020007 ) ) {
-			int nSubShapes = nif->get<int>( ihkPackedNiTriStripsData, "Num Sub Shapes" );
-			QModelIndex ihkSubShapes = nif->getIndex( ihkPackedNiTriStripsData, "Sub Shapes" );
-			subshapeVerts.resize( nSubShapes );
+	if ( !builder.build() ) {
+		errorMessage = Spell::tr( "Failed to generate MOPP code" );
+		return QByteArray();
+	}
 
-			for ( int t = 0; t < nSubShapes; t++ ) {
-				subshapeVerts[t] = nif->get<int>( QModelIndex_child( ihkSubShapes, t ), "Num Vertices" );
-			}
-		}
+	if ( !builder.validate( &errorMessage ) )
+		return QByteArray();
+
+	origin = builder.origin();
+	scale = builder.scale();
+
+	const auto & code = builder.code();
+	return QByteArray( reinterpret_cast<const char *>( code.data() ), qsizetype( code.size() ) );
+}
+
+//! Update Havok MOPP for a given shape
+class spMoppCode final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Update MOPP Code" ); }
+	QString page() const override final { return Spell::tr( "Havok" ); }
+
+	//! Oblivion, Fallout 3 and Skyrim files
+	static bool isMoppVersion( const NifModel * nif )
+	{
+		quint32 user = nif->getUserVersion();
+
+		if ( nif->checkVersion( 0x14000004, 0x14000005 ) )
+			return ( user == 10 || user == 11 );
+
+		if ( nif->checkVersion( 0x14020007, 0x14020007 ) )
+			return ( user == 10 || user == 11 || user == 12 );
+
+		return false;
+	}
 
-		QVector<Vector3> verts = nif->getArray<Vector3>( ihkPackedNiTriStripsData, "Vertices" );
-		QVector<Triangle> triangles;
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return ( isMoppVersion( nif ) && nif->isNiBlock( index, "bhkMoppBvTreeShape" ) );
+	}
 
-		int nTriangles = nif->get<int>( ihkPackedNiTriStripsData, "Num Triangles" );
-		QModelIndex iTriangles = nif->getIndex( ihkPackedNiTriStripsData, "Triangles" );
-		triangles.resize( nTriangles );
+	QModelIndex cast( NifModel * nif, const QModelIndex & iBlock ) override final
+	{
+		QPersistentModelIndex ibhkMoppBvTreeShape = iBlock;
+
+		QModelIndex iShape = nif->getBlockIndex( nif->getLink( ibhkMoppBvTreeShape, "Shape" ) );
 
-		for ( int t = 0; t < nTriangles; t++ ) {
-			triangles[t] = nif->get<Triangle>( QModelIndex_child( iTriangles, t ), "Triangle" );
+		MoppGeometry geometry;
+
+		if ( nif->isNiBlock( iShape, "bhkPackedNiTriStripsShape" ) ) {
+			if ( !loadPackedGeometry( nif, iShape, geometry ) )
+				return iBlock;
+		} else if ( nif->isNiBlock( iShape, "bhkCompressedMeshShape" ) ) {
+			if ( !loadCompressedGeometry( nif, iShape, geometry ) )
+				return iBlock;
+		} else {
+			Message::warning( nullptr, Spell::tr( "Only bhkPackedNiTriStripsShape and bhkCompressedMeshShape are supported at this time." ) );
+			return iBlock;
 		}
 
-		if ( verts.isEmpty() || triangles.isEmpty() ) {
+		if ( geometry.verts.empty() || geometry.faces.empty() ) {
 			Message::critical( nullptr, Spell::tr( "Insufficient data to calculate MOPP code" ),
-				Spell::tr("Vertices: %1, Triangles: %2").arg( !verts.isEmpty() ).arg( !triangles.isEmpty() )
+				Spell::tr("Vertices: %1, Triangles: %2").arg( !geometry.verts.empty() ).arg( !geometry.faces.empty() )
 			);
 			return iBlock;
 		}
 
 		Vector3 origin;
-		float scale;
-		QByteArray moppcode = TheHavokCode.CalculateMoppCode( subshapeVerts, verts, triangles, &origin, &scale );
+		float scale = 1.0f;
+		QString errorMessage;
+		QByteArray moppcode = calculateMoppCode( geometry, origin, scale, errorMessage );
 
 		if ( moppcode.size() == 0 ) {
-			Message::critical( nullptr, Spell::tr( "Failed to generate MOPP code" ) );
+			Message::critical( nullptr, Spell::tr( "Failed to generate MOPP code" ), errorMessage );
 		} else {
 			auto iMoppCode = nif->getIndex( ibhkMoppBvTreeShape, "MOPP Code" );
 
 			nif->set<Vector4>( nif->getIndex( iMoppCode, "Offset" ), Vector4(origin, scale) );
 
+			QModelIndex iBuildType = nif->getIndex( iMoppCode, "Build Type" );
+			if ( iBuildType.isValid() )
+				nif->set<quint8>( iBuildType, 1 );	// BUILT_WITHOUT_CHUNK_SUBDIVISION
+
 			QModelIndex iCodeSize = nif->getIndex( iMoppCode, "Data Size" );
 			QModelIndex iCode = QModelIndex_child( nif->getIndex( iMoppCode, "Data" ) );
 
@@ -245,17 +391,7 @@ public:
 
 	bool isApplicable( const NifModel * nif, const QModelIndex & idx ) override final
 	{
-		if ( nif && nif->getUserVersion() != 10 && nif->getUserVersion() != 11 )
-			return false;
-
-		if ( TheHavokCode.Initialize() ) {
-			if ( nif && !idx.isValid() ) {
-				return ( nif->checkVersion( 0x14000004, 0x14000005 )
-				         || nif->checkVersion( 0x14020007, 0x14020007 ) );
-			}
-		}
-
-		return false;
+		return ( nif && !idx.isValid() && spMoppCode::isMoppVersion( nif ) );
 	}
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & ) override final
@@ -280,6 +416,3 @@ public:
 };
 
 REGISTER_SPELL( spAllMoppCodes )
-
-#endif // Q_OS_WIN32
-
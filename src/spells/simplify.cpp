@@ -1,9 +1,18 @@
 #include "mesh.h"
 #include "gl/gltools.h"
+#include "lib/parallel.h"
 #include "qtcompat.h"
 
+#include <QElapsedTimer>
+#include <QFile>
+#include <QInputDialog>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QSettings>
 #include <cfloat>
+#include <chrono>
+#include <cstring>
 #include <unordered_set>
 
 #include "libfo76utils/src/fp32vec4.hpp"
@@ -11,50 +20,135 @@
 
 // Brief description is deliberately not autolinked to class Spell
 /*! \file simplify.cpp
- * \brief LOD generation spell
+ * \brief LOD generation spells
  *
  * All classes here inherit from the Spell class.
  */
 
-//! Simplifies Starfield meshes
-class spSimplifySFMesh final : public Spell
+//! LOD generation engine used by the LOD spells
+/*!
+ * Shapes are loaded from the model into plain arrays first, then all LOD levels
+ * of all shapes are simplified concurrently with meshoptimizer, and finally the
+ * results are written back to the model by the calling spell.
+ *
+ * The parameters of each LOD level are read from QSettings:
+ * - Settings/Nif/Sf LOD Gen Target Cnt N: target triangle count relative to LOD0
+ * - Settings/Nif/Sf LOD Gen Target Err N: maximum error relative to the model extents
+ * - Settings/Nif/Sf LOD Gen Min Tri Cnt N: minimum triangle count per shape
+ * - Settings/Nif/Sf LOD Gen Sloppy N: use meshopt_simplifySloppy (does not preserve topology)
+ * - Settings/Nif/Sf LOD Gen Normal Weight, UV Weight: attribute weights for meshopt_simplifyWithAttributes,
+ *   attributes are not used if both are 0
+ * - Settings/Nif/Sf LOD Gen Report File: optional path to save the JSON report to
+ */
+class LODGenerator
 {
 public:
-	QString name() const override final { return Spell::tr( "Generate LODs" ); }
-	QString page() const override final { return Spell::tr( "Mesh" ); }
+	static constexpr int maxLODs = 3;
+	static constexpr size_t attributeCount = 5;	// normal XYZ, UV
 
-	struct Meshes {
-		size_t	totalIndices;
-		size_t	totalVertices;
-		std::vector< unsigned int >	indices;
-		std::vector< unsigned int >	newIndices[3];
-		std::vector< float >	positions;
-		std::vector< std::uint32_t >	blockNumbers;
-		std::vector< unsigned int >	blockVertexRanges;
-		Meshes()
-			: totalIndices( 0 ), totalVertices( 0 ), blockVertexRanges( 1, 0U )
-		{
-		}
-		static void getTransform( Transform & t, const NifModel * nif, const QModelIndex & index );
-		void loadGeometryData( const NifModel * nif, const QModelIndex & index );
-		void simplifyMeshes();
-		int vertexBlockNum( unsigned int v ) const;
-		void saveGeometryData( NifModel * nif ) const;
+	struct LevelSettings
+	{
+		float	targetCnt = 0.0f;
+		float	targetErr = 0.0f;
+		int	minTriCnt = 0;
+		bool	sloppy = false;
 	};
 
-	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	struct Shape
 	{
-		if ( !( nif && nif->getBSVersion() >= 170 ) )
-			return false;
-		if ( !index.isValid() )
-			return true;
-		return ( nif->blockInherits( index, "BSGeometry" ) && ( nif->get<quint32>(index, "Flags") & 0x0200 ) != 0 );
-	}
+		std::uint32_t	blockNumber = 0;
+		QString	blockType;
+		//! Model space vertex positions for Starfield meshes, local space otherwise
+		std::vector< float >	positions;
+		//! attributeCount floats per vertex, empty if the shape has no normals or UVs
+		std::vector< float >	attributes;
+		std::vector< unsigned int >	indices;
+		//! Triangle counts of consecutive ranges that are simplified separately, empty if all triangles are one range
+		std::vector< size_t >	ranges;
+		std::vector< unsigned int >	lodIndices[maxLODs];
+		//! Simplified triangle counts of the ranges
+		std::vector< size_t >	lodRanges[maxLODs];
+		float	lodError[maxLODs] = { 0.0f, 0.0f, 0.0f };
+		double	lodTime[maxLODs] = { 0.0, 0.0, 0.0 };
+
+		size_t vertexCount() const { return positions.size() / 3; }
+		size_t triangleCount() const { return indices.size() / 3; }
+		//! Returns the triangles of LOD level l, vertex indices are those of the shape
+		QVector< Triangle > lodTriangles( int l ) const;
+	};
 
-	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
+	std::vector< Shape >	shapes;
+	LevelSettings	levels[maxLODs];
+	int	numLevels = 0;
+	float	attributeWeights[attributeCount] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	bool	useAttributes = false;
+	//! If true, errors are relative to the extents of all shapes instead of each shape
+	bool	modelRelativeError = false;
+	double	totalTime = 0.0;
+	//! The only level simplified by generate(), or -1 if all levels are
+	int	generatedLevel = -1;
+
+	LODGenerator();
+
+	//! Loads a Starfield BSGeometry with internal geometry data
+	bool addStarfieldShape( const NifModel * nif, const QModelIndex & index );
+	//! Loads a non-skinned BSTriShape, BSMeshLODTriShape, NiTriShape or BSLODTriShape
+	/*!
+	 * The LOD0, LOD1 and LOD2 triangle ranges of BSMeshLODTriShape and BSLODTriShape
+	 * are simplified separately.
+	 */
+	bool addTriShape( const NifModel * nif, const QModelIndex & index );
+
+	//! Simplifies LOD level \a level (all levels if -1) of all shapes on multiple threads
+	void generate( int level = -1 );
+
+	//! Returns the results in JSON format
+	QJsonDocument report() const;
+	//! Shows the results in a message box, and saves the JSON report if enabled
+	void showReport() const;
+
+protected:
+	static void getTransform( Transform & t, const NifModel * nif, const QModelIndex & index );
+	//! Simplifies LOD level \a l of \a s, errors are relative to \a modelScale if it is greater than 0
+	void simplifyLevel( Shape & s, int l, float modelScale ) const;
+	//! Simplifies \a indexCnt indices of \a s, appends the result to \a newIndices and returns the error
+	float simplifyRange( std::vector< unsigned int > & newIndices, const Shape & s,
+	                     const unsigned int * indices, size_t indexCnt, int l, float modelScale ) const;
 };
 
-void spSimplifySFMesh::Meshes::getTransform( Transform & t, const NifModel * nif, const QModelIndex & index )
+LODGenerator::LODGenerator()
+{
+	QSettings	settings;
+	for ( int l = 0; l < maxLODs; l++ ) {
+		float	x = 0.2f / float( 1 << l );
+		x = settings.value( QString("Settings/Nif/Sf LOD Gen Target Cnt %1").arg(l + 1), x ).toFloat();
+		float	targetCnt = std::min( std::max( x, 0.0f ), 1.0f );
+		x = 0.005f * float( 1 << l );
+		x = settings.value( QString("Settings/Nif/Sf LOD Gen Target Err %1").arg(l + 1), x ).toFloat();
+		float	targetErr = std::min( std::max( x, 0.0f ), 1.0f );
+		int	n = 200 >> l;
+		n = settings.value( QString("Settings/Nif/Sf LOD Gen Min Tri Cnt %1").arg(l + 1), n ).toInt();
+
+		if ( !( targetCnt >= 0.0005f && targetErr < 0.99995f ) )
+			break;
+
+		levels[l].targetCnt = targetCnt;
+		levels[l].targetErr = targetErr;
+		levels[l].minTriCnt = std::min< int >( std::max< int >( n, 0 ), 1000000 );
+		levels[l].sloppy = settings.value( QString("Settings/Nif/Sf LOD Gen Sloppy %1").arg(l + 1), false ).toBool();
+		numLevels = l + 1;
+	}
+
+	float	normalWeight = settings.value( "Settings/Nif/Sf LOD Gen Normal Weight", 0.0f ).toFloat();
+	float	uvWeight = settings.value( "Settings/Nif/Sf LOD Gen UV Weight", 0.0f ).toFloat();
+	normalWeight = std::min( std::max( normalWeight, 0.0f ), 1.0f );
+	uvWeight = std::min( std::max( uvWeight, 0.0f ), 1.0f );
+	attributeWeights[0] = attributeWeights[1] = attributeWeights[2] = normalWeight;
+	attributeWeights[3] = attributeWeights[4] = uvWeight;
+	useAttributes = ( normalWeight > 0.0f || uvWeight > 0.0f );
+}
+
+void LODGenerator::getTransform( Transform & t, const NifModel * nif, const QModelIndex & index )
 {
 	if ( !index.isValid() )
 		return;
@@ -70,21 +164,13 @@ void spSimplifySFMesh::Meshes::getTransform( Transform & t, const NifModel * nif
 	return getTransform( t, nif, index.parent() );
 }
 
-void spSimplifySFMesh::Meshes::loadGeometryData( const NifModel * nif, const QModelIndex & index )
+bool LODGenerator::addStarfieldShape( const NifModel * nif, const QModelIndex & index )
 {
-	if ( !index.isValid() ) {
-		for ( int b = 0; b < nif->getBlockCount(); b++ ) {
-			auto	i = nif->getBlockIndex( qint32(b) );
-			if ( i.isValid() )
-				loadGeometryData( nif, i );
-		}
-		return;
-	}
 	if ( !( nif->blockInherits( index, "BSGeometry" ) && ( nif->get<quint32>(index, "Flags") & 0x0200 ) != 0 ) )
-		return;
+		return false;
 	int	blockNum = nif->getBlockNumber( index );
 	if ( blockNum < 0 )
-		return;
+		return false;
 
 	QModelIndex	iMeshData = nif->getIndex( index, "Meshes" );
 	if ( iMeshData.isValid() )
@@ -92,16 +178,16 @@ void spSimplifySFMesh::Meshes::loadGeometryData( const NifModel * nif, const QMo
 	if ( iMeshData.isValid() && nif->get<bool>( iMeshData, "Has Mesh" ) )
 		iMeshData = nif->getIndex( iMeshData, "Mesh" );
 	else
-		return;
+		return false;
 	if ( iMeshData.isValid() )
 		iMeshData = nif->getIndex( iMeshData, "Mesh Data" );
 	if ( !iMeshData.isValid() )
-		return;
+		return false;
 
 	std::uint32_t	numVerts = nif->get<quint32>( iMeshData, "Num Verts" );
 	std::uint32_t	numTriangles = nif->get<quint32>( iMeshData, "Indices Size" ) / 3U;
 	if ( numVerts < 3 || !numTriangles )
-		return;
+		return false;
 	std::uint32_t	weightsPerVertex = nif->get<quint32>( iMeshData, "Weights Per Vertex" );
 	std::uint32_t	numUVs = nif->get<quint32>( iMeshData, "Num UVs" );
 	std::uint32_t	numUVs2 = nif->get<quint32>( iMeshData, "Num UVs 2" );
@@ -113,133 +199,397 @@ void spSimplifySFMesh::Meshes::loadGeometryData( const NifModel * nif, const QMo
 		|| ( numColors && numColors != numVerts ) || ( numNormals && numNormals != numVerts )
 		|| ( numTangents && numTangents != numVerts ) || ( numWeights != ( size_t(numVerts) * weightsPerVertex ) ) ) {
 		QMessageBox::critical( nullptr, "NifSkope error", QString("Mesh has inconsistent number of vertex attributes, cannot generate LODs") );
-		return;
+		return false;
 	}
 
+	Shape	s;
+	s.blockNumber = std::uint32_t( blockNum );
+	s.blockType = nif->itemName( index );
+
 	Transform	t;
 	getTransform( t, nif, iMeshData );
-	std::vector< float >	tmpPositions( size_t(numVerts) * 3 );
+	s.positions.resize( size_t(numVerts) * 3 );
 	for ( auto i = nif->getItem( iMeshData, "Vertices" ); i; ) {
 		for ( size_t j = 0; j < numVerts; j++ ) {
 			Vector3	tmp = t * nif->get<Vector3>( i->child( int(j) ) );
-			tmpPositions[j * 3] = tmp[0];
-			tmpPositions[j * 3 + 1] = tmp[1];
-			tmpPositions[j * 3 + 2] = tmp[2];
+			s.positions[j * 3] = tmp[0];
+			s.positions[j * 3 + 1] = tmp[1];
+			s.positions[j * 3 + 2] = tmp[2];
 		}
 		break;
 	}
 
-	size_t	indicesCnt = size_t(numTriangles) * 3;
-	std::vector< unsigned int >	tmpIndices( indicesCnt );
+	s.indices.resize( size_t(numTriangles) * 3 );
 	for ( auto i = nif->getItem( iMeshData, "Triangles" ); i; ) {
 		for ( size_t j = 0; j < numTriangles; j++ ) {
 			Triangle	tmp = nif->get<Triangle>( i->child( int(j) ) );
 			if ( tmp[0] >= numVerts || tmp[1] >= numVerts || tmp[2] >= numVerts ) {
 				QMessageBox::critical( nullptr, "NifSkope error", QString("Mesh has invalid indices, cannot generate LODs") );
-				return;
+				return false;
 			}
-			tmpIndices[j * 3] = (unsigned int) ( totalVertices + tmp[0] );
-			tmpIndices[j * 3 + 1] = (unsigned int) ( totalVertices + tmp[1] );
-			tmpIndices[j * 3 + 2] = (unsigned int) ( totalVertices + tmp[2] );
+			s.indices[j * 3] = tmp[0];
+			s.indices[j * 3 + 1] = tmp[1];
+			s.indices[j * 3 + 2] = tmp[2];
 		}
 		break;
 	}
 
-	totalIndices = totalIndices + indicesCnt;
-	totalVertices = totalVertices + numVerts;
-	indices.insert( indices.end(), tmpIndices.begin(), tmpIndices.end() );
-	positions.insert( positions.end(), tmpPositions.begin(), tmpPositions.end() );
-	blockNumbers.push_back( std::uint32_t(blockNum) );
-	blockVertexRanges.push_back( (unsigned int) totalVertices );
+	if ( useAttributes && ( numNormals || numUVs ) ) {
+		QVector< UDecVector4 >	normals;
+		if ( numNormals )
+			normals = nif->getArray<UDecVector4>( iMeshData, "Normals" );
+		QVector< HalfVector2 >	uvs;
+		if ( numUVs )
+			uvs = nif->getArray<HalfVector2>( iMeshData, "UVs" );
+		s.attributes.resize( size_t(numVerts) * attributeCount, 0.0f );
+		for ( size_t j = 0; j < numVerts; j++ ) {
+			float *	a = s.attributes.data() + ( j * attributeCount );
+			if ( qsizetype(j) < normals.size() ) {
+				a[0] = normals.at( qsizetype(j) )[0];
+				a[1] = normals.at( qsizetype(j) )[1];
+				a[2] = normals.at( qsizetype(j) )[2];
+			}
+			if ( qsizetype(j) < uvs.size() ) {
+				a[3] = uvs.at( qsizetype(j) )[0];
+				a[4] = uvs.at( qsizetype(j) )[1];
+			}
+		}
+	}
+
+	shapes.push_back( std::move( s ) );
+	modelRelativeError = true;
+	return true;
 }
 
-void spSimplifySFMesh::Meshes::simplifyMeshes()
+bool LODGenerator::addTriShape( const NifModel * nif, const QModelIndex & index )
 {
-	if ( blockNumbers.empty() || !( totalIndices >= 3 && totalVertices >= 1 ) )
-		return;
+	int	blockNum = nif->getBlockNumber( index );
+	// the skin partitions of skinned shapes would still refer to the old triangles and vertices
+	if ( blockNum < 0 || nif->getBlockIndex( nif->getLink( index, "Skin" ) ).isValid()
+		|| nif->getBlockIndex( nif->getLink( index, "Skin Instance" ) ).isValid() ) {
+		return false;
+	}
 
-	QSettings	settings;
-	Vector3	err;
-	int	numTriangles = int( totalIndices / 3 );
-	for ( int l = 0; l < 3; l++ ) {
-		float	x = 0.2f / float( 1 << l );
-		x = settings.value( QString("Settings/Nif/Sf LOD Gen Target Cnt %1").arg(l + 1), x ).toFloat();
-		float	targetCnt_f = std::min( std::max( x, 0.0f ), 1.0f );
-		x = 0.005f * float( 1 << l );
-		x = settings.value( QString("Settings/Nif/Sf LOD Gen Target Err %1").arg(l + 1), x ).toFloat();
-		float	targetErr = std::min( std::max( x, 0.0f ), 1.0f );
-		int	n = 200 >> l;
-		n = settings.value( QString("Settings/Nif/Sf LOD Gen Min Tri Cnt %1").arg(l + 1), n ).toInt();
-		size_t	minTriCnt = size_t( std::min< int >( std::max< int >( n, 0 ), 1000000 ) ) * blockNumbers.size();
-		minTriCnt = std::min< size_t >( minTriCnt, 1000000000 );
+	Shape	s;
+	s.blockNumber = std::uint32_t( blockNum );
+	s.blockType = nif->itemName( index );
 
-		if ( !( targetCnt_f >= 0.0005f && targetErr < 0.99995f ) )
-			break;
+	QVector< Vector3 >	verts;
+	QVector< Vector3 >	norms;
+	QVector< Vector2 >	uvs;
+	QVector< Triangle >	tris;
+
+	if ( nif->isNiBlock( index, { "BSTriShape", "BSMeshLODTriShape" } ) ) {
+		QModelIndex	iVertData = nif->getIndex( index, "Vertex Data" );
+		if ( !iVertData.isValid() )
+			return false;
+		auto	vf = nif->get<BSVertexDesc>( index, "Vertex Desc" );
+		if ( vf & VertexFlags::VF_SKINNED )
+			return false;
+		int	numVerts = nif->rowCount( iVertData );
+		verts.reserve( numVerts );
+		for ( int i = 0; i < numVerts; i++ ) {
+			auto	idx = nif->index( i, 0, iVertData );
+			verts += nif->get<Vector3>( idx, "Vertex" );
+			if ( useAttributes && ( vf & VertexFlags::VF_NORMAL ) )
+				norms += nif->get<ByteVector3>( idx, "Normal" );
+			if ( useAttributes && ( vf & VertexFlags::VF_UV ) )
+				uvs += nif->get<HalfVector2>( idx, "UV" );
+		}
+		tris = nif->getArray<Triangle>( index, "Triangles" );
+	} else if ( nif->isNiBlock( index, { "NiTriShape", "BSLODTriShape" } ) ) {
+		QModelIndex	iData = nif->getBlockIndex( nif->getLink( index, "Data" ), "NiTriShapeData" );
+		if ( !iData.isValid() )
+			return false;
+		verts = nif->getArray<Vector3>( iData, "Vertices" );
+		if ( useAttributes ) {
+			norms = nif->getArray<Vector3>( iData, "Normals" );
+			QModelIndex	iUVSets = nif->getIndex( iData, "UV Sets" );
+			if ( nif->rowCount( iUVSets ) > 0 )
+				uvs = nif->getArray<Vector2>( QModelIndex_child( iUVSets, 0 ) );
+		}
+		tris = nif->getArray<Triangle>( iData, "Triangles" );
+	} else {
+		return false;
+	}
 
-		newIndices[l].resize( totalIndices );
-		size_t	newIndicesCnt = 0;
-		int	targetCnt = std::max< int >( roundFloat( float( numTriangles ) * targetCnt_f ), int( minTriCnt ) );
-		if ( targetCnt >= numTriangles ) {
-			newIndicesCnt = totalIndices;
-			std::memcpy( newIndices[l].data(), indices.data(), newIndicesCnt * sizeof(unsigned int) );
+	size_t	numVerts = size_t( verts.size() );
+	if ( numVerts < 3 || tris.isEmpty() )
+		return false;
+
+	s.positions.resize( numVerts * 3 );
+	for ( size_t j = 0; j < numVerts; j++ ) {
+		s.positions[j * 3] = verts.at( qsizetype(j) )[0];
+		s.positions[j * 3 + 1] = verts.at( qsizetype(j) )[1];
+		s.positions[j * 3 + 2] = verts.at( qsizetype(j) )[2];
+	}
+	s.indices.reserve( size_t( tris.size() ) * 3 );
+	for ( const Triangle & t : tris ) {
+		if ( t[0] >= numVerts || t[1] >= numVerts || t[2] >= numVerts )
+			return false;
+		s.indices.push_back( t[0] );
+		s.indices.push_back( t[1] );
+		s.indices.push_back( t[2] );
+	}
+
+	if ( nif->isNiBlock( index, { "BSLODTriShape", "BSMeshLODTriShape" } ) ) {
+		// LOD2 also contains any triangles that are not in the LOD0 and LOD1 ranges
+		size_t	numTriangles = s.triangleCount();
+		size_t	lod0Size = std::min< size_t >( nif->get<quint32>( index, "LOD0 Size" ), numTriangles );
+		size_t	lod1Size = std::min< size_t >( nif->get<quint32>( index, "LOD1 Size" ), numTriangles - lod0Size );
+		s.ranges = { lod0Size, lod1Size, numTriangles - ( lod0Size + lod1Size ) };
+	}
+
+	if ( useAttributes && ( size_t( norms.size() ) == numVerts || size_t( uvs.size() ) == numVerts ) ) {
+		s.attributes.resize( numVerts * attributeCount, 0.0f );
+		for ( size_t j = 0; j < numVerts; j++ ) {
+			float *	a = s.attributes.data() + ( j * attributeCount );
+			if ( size_t( norms.size() ) == numVerts ) {
+				a[0] = norms.at( qsizetype(j) )[0];
+				a[1] = norms.at( qsizetype(j) )[1];
+				a[2] = norms.at( qsizetype(j) )[2];
+			}
+			if ( size_t( uvs.size() ) == numVerts ) {
+				a[3] = uvs.at( qsizetype(j) )[0];
+				a[4] = uvs.at( qsizetype(j) )[1];
+			}
+		}
+	}
+
+	shapes.push_back( std::move( s ) );
+	return true;
+}
+
+float LODGenerator::simplifyRange( std::vector< unsigned int > & newIndices, const Shape & s,
+                                   const unsigned int * indices, size_t indexCnt, int l, float modelScale ) const
+{
+	const LevelSettings &	p = levels[l];
+	size_t	numTriangles = indexCnt / 3;
+	size_t	targetCnt = std::max< size_t >( size_t( roundFloat( float( numTriangles ) * p.targetCnt ) ), size_t( p.minTriCnt ) );
+	float	err = 0.0f;
+
+	size_t	offs = newIndices.size();
+	newIndices.resize( offs + indexCnt );
+	unsigned int *	dst = newIndices.data() + offs;
+	size_t	newIndicesCnt = 0;
+	if ( targetCnt >= numTriangles ) {
+		newIndicesCnt = indexCnt;
+		if ( indexCnt )
+			std::memcpy( dst, indices, newIndicesCnt * sizeof(unsigned int) );
+	} else if ( p.sloppy ) {
+		// meshopt_simplifySloppy does not support absolute errors, convert to and from the extents of the shape
+		float	errorScale = 1.0f;
+		if ( modelScale > 0.0f ) {
+			float	shapeScale = meshopt_simplifyScale( s.positions.data(), s.vertexCount(), sizeof(float) * 3 );
+			if ( shapeScale > 0.0f )
+				errorScale = modelScale / shapeScale;
+		}
+		newIndicesCnt = meshopt_simplifySloppy(
+							dst, indices, indexCnt,
+							s.positions.data(), s.vertexCount(), sizeof(float) * 3,
+							targetCnt * 3, p.targetErr * errorScale, &err );
+		err = err / errorScale;
+	} else {
+		unsigned int	options = meshopt_SimplifyLockBorder;
+		float	targetErr = p.targetErr;
+		if ( modelScale > 0.0f ) {
+			options = options | meshopt_SimplifyErrorAbsolute;
+			targetErr = targetErr * modelScale;
+		}
+		if ( !s.attributes.empty() ) {
+			newIndicesCnt = meshopt_simplifyWithAttributes(
+								dst, indices, indexCnt,
+								s.positions.data(), s.vertexCount(), sizeof(float) * 3,
+								s.attributes.data(), sizeof(float) * attributeCount, attributeWeights, attributeCount,
+								nullptr, targetCnt * 3, targetErr, options, &err );
 		} else {
 			newIndicesCnt = meshopt_simplify(
-								newIndices[l].data(), indices.data(), totalIndices,
-								positions.data(), totalVertices, sizeof(float) * 3,
-								size_t(targetCnt) * 3, targetErr, meshopt_SimplifyLockBorder, &(err[l]) );
+								dst, indices, indexCnt,
+								s.positions.data(), s.vertexCount(), sizeof(float) * 3,
+								targetCnt * 3, targetErr, options, &err );
 		}
-		newIndices[l].resize( newIndicesCnt );
+		if ( modelScale > 0.0f )
+			err = err / modelScale;
 	}
+	newIndices.resize( offs + newIndicesCnt );
 
-	QString	msg = QString( "LOD0: %1 triangles" ).arg( numTriangles );
-	for ( int l = 0; l < 3; l++ )
-		msg.append( QString("\nLOD%1: %2 triangles, error = %3").arg(l + 1).arg(newIndices[l].size() / 3).arg(err[l]) );
-	QMessageBox::information( nullptr, "LOD generation results", msg );
+	return err;
 }
 
-int spSimplifySFMesh::Meshes::vertexBlockNum( unsigned int v ) const
+void LODGenerator::simplifyLevel( Shape & s, int l, float modelScale ) const
 {
-	if ( blockVertexRanges.empty() || v >= blockVertexRanges.back() )
-		return -1;
-	size_t	n0 = 0;
-	size_t	n2 = blockVertexRanges.size() - 1;
-	while ( ( n0 + 1 ) < n2 ) {
-		size_t	n1 = ( n0 + n2 ) >> 1;
-		( v < blockVertexRanges[n1] ? n2 : n0 ) = n1;
+	auto	t0 = std::chrono::steady_clock::now();
+
+	std::vector< unsigned int > &	newIndices = s.lodIndices[l];
+	newIndices.clear();
+	newIndices.reserve( s.indices.size() );
+	s.lodRanges[l].clear();
+	float	err = 0.0f;
+	if ( s.ranges.empty() ) {
+		err = simplifyRange( newIndices, s, s.indices.data(), s.indices.size(), l, modelScale );
+	} else {
+		size_t	offs = 0;
+		for ( size_t n : s.ranges ) {
+			size_t	prvCnt = newIndices.size();
+			err = std::max( err, simplifyRange( newIndices, s, s.indices.data() + offs, n * 3, l, modelScale ) );
+			s.lodRanges[l].push_back( ( newIndices.size() - prvCnt ) / 3 );
+			offs = offs + ( n * 3 );
+		}
 	}
-	return int( n0 );
+	s.lodError[l] = err;
+
+	s.lodTime[l] = std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - t0 ).count();
 }
 
-void spSimplifySFMesh::Meshes::saveGeometryData( NifModel * nif ) const
+void LODGenerator::generate( int level )
 {
-	if ( blockNumbers.empty() || !( totalIndices >= 3 && totalVertices >= 1 ) )
-		return;
+	QElapsedTimer	timer;
+	timer.start();
+
+	// With model relative errors, the target and result errors are converted using the extents of all shapes
+	float	modelScale = 0.0f;
+	if ( modelRelativeError && shapes.size() > 1 ) {
+		std::vector< float >	allPositions;
+		for ( const auto & s : shapes )
+			allPositions.insert( allPositions.end(), s.positions.begin(), s.positions.end() );
+		modelScale = meshopt_simplifyScale( allPositions.data(), allPositions.size() / 3, sizeof(float) * 3 );
+		if ( !( modelScale > 0.0f ) )
+			modelScale = 0.0f;
+	}
 
-	QVector< QVector< QVector< Triangle > > >	blockTriangles;
-	blockTriangles.resize( qsizetype(blockNumbers.size()) );
-	for ( auto & b : blockTriangles )
-		b.resize( 3 );
-	for ( int l = 0; l < 3; l++ ) {
-		for ( size_t i = 0; ( i + 3 ) <= newIndices[l].size(); i = i + 3 ) {
-			unsigned int	v0 = newIndices[l][i];
-			unsigned int	v1 = newIndices[l][i + 1];
-			unsigned int	v2 = newIndices[l][i + 2];
-			int	b0 = vertexBlockNum( v0 );
-			int	b1 = vertexBlockNum( v1 );
-			int	b2 = vertexBlockNum( v2 );
-			if ( ( b0 | b1 | b2 ) < 0 || b0 != b1 || b0 != b2 ) {
-				QMessageBox::critical( nullptr, "NifSkope error", QString("spSimplifySFMesh: internal error: invalid index in simplified mesh data") );
-				return;
-			}
-			v0 -= blockVertexRanges[b0];
-			v1 -= blockVertexRanges[b0];
-			v2 -= blockVertexRanges[b0];
-			blockTriangles[b0][l].append( Triangle( quint16(v0), quint16(v1), quint16(v2) ) );
+	generatedLevel = ( level >= 0 && level < numLevels ? level : -1 );
+	size_t	levelCnt = size_t( generatedLevel < 0 ? numLevels : 1 );
+	parallelFor( shapes.size() * levelCnt, [&]( size_t n ) {
+		int	l = ( generatedLevel < 0 ? int( n % levelCnt ) : generatedLevel );
+		simplifyLevel( shapes[n / levelCnt], l, modelScale );
+	} );
+
+	totalTime = double( timer.nsecsElapsed() ) / 1000000.0;
+}
+
+QVector< Triangle > LODGenerator::Shape::lodTriangles( int l ) const
+{
+	QVector< Triangle >	tris;
+	const std::vector< unsigned int > &	newIndices = lodIndices[l];
+	tris.reserve( qsizetype( newIndices.size() / 3 ) );
+	for ( size_t i = 0; ( i + 3 ) <= newIndices.size(); i = i + 3 )
+		tris.append( Triangle( quint16(newIndices[i]), quint16(newIndices[i + 1]), quint16(newIndices[i + 2]) ) );
+	return tris;
+}
+
+QJsonDocument LODGenerator::report() const
+{
+	QJsonObject	root;
+	QJsonArray	levelArray;
+	for ( int l = 0; l < numLevels; l++ ) {
+		if ( generatedLevel >= 0 && l != generatedLevel )
+			continue;
+		size_t	triCnt = 0;
+		float	maxErr = 0.0f;
+		double	time = 0.0;
+		for ( const auto & s : shapes ) {
+			triCnt += s.lodIndices[l].size() / 3;
+			maxErr = std::max( maxErr, s.lodError[l] );
+			time += s.lodTime[l];
 		}
+		QJsonObject	o;
+		o["lod"] = l + 1;
+		o["targetCount"] = levels[l].targetCnt;
+		o["targetError"] = levels[l].targetErr;
+		o["sloppy"] = levels[l].sloppy;
+		o["triangles"] = qint64( triCnt );
+		o["maxError"] = maxErr;
+		o["timeMs"] = time;
+		levelArray.append( o );
+	}
+
+	QJsonArray	shapeArray;
+	for ( const auto & s : shapes ) {
+		QJsonObject	o;
+		o["block"] = qint64( s.blockNumber );
+		o["type"] = s.blockType;
+		o["vertices"] = qint64( s.vertexCount() );
+		o["triangles"] = qint64( s.triangleCount() );
+		o["attributes"] = !s.attributes.empty();
+		QJsonArray	lods;
+		for ( int l = 0; l < numLevels; l++ ) {
+			if ( generatedLevel >= 0 && l != generatedLevel )
+				continue;
+			QJsonObject	lod;
+			lod["triangles"] = qint64( s.lodIndices[l].size() / 3 );
+			lod["error"] = s.lodError[l];
+			lod["timeMs"] = s.lodTime[l];
+			lods.append( lod );
+		}
+		o["lods"] = lods;
+		shapeArray.append( o );
+	}
+
+	size_t	triCnt = 0;
+	for ( const auto & s : shapes )
+		triCnt += s.triangleCount();
+	root["triangles"] = qint64( triCnt );
+	root["threads"] = parallelThreadCount( shapes.size() * size_t( generatedLevel < 0 ? numLevels : 1 ) );
+	root["totalTimeMs"] = totalTime;
+	root["levels"] = levelArray;
+	root["shapes"] = shapeArray;
+	return QJsonDocument( root );
+}
+
+void LODGenerator::showReport() const
+{
+	QJsonDocument	doc = report();
+	QJsonObject	root = doc.object();
+
+	QString	msg = QString( "LOD0: %1 triangles" ).arg( root["triangles"].toInteger() );
+	for ( const auto & v : root["levels"].toArray() ) {
+		QJsonObject	o = v.toObject();
+		msg.append( QString("\nLOD%1: %2 triangles, error = %3")
+		            .arg( o["lod"].toInt() ).arg( o["triangles"].toInteger() ).arg( o["maxError"].toDouble() ) );
+	}
+	msg.append( QString("\n\n%1 shapes processed in %2 ms").arg( shapes.size() ).arg( totalTime, 0, 'f', 1 ) );
+
+	QString	json = QString::fromUtf8( doc.toJson( QJsonDocument::Indented ) );
+
+	QSettings	settings;
+	QString	reportPath = settings.value( "Settings/Nif/Sf LOD Gen Report File", QString() ).toString();
+	if ( !reportPath.isEmpty() ) {
+		QFile	f( reportPath );
+		if ( f.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+			f.write( doc.toJson( QJsonDocument::Indented ) );
+		else
+			msg.append( QString("\nFailed to write report to %1").arg( reportPath ) );
 	}
 
-	for ( int b = 0; b < int( blockNumbers.size() ); b++ ) {
-		QModelIndex	index = nif->getBlockIndex( qint32(blockNumbers[b]) );
+	Message::info( nullptr, msg, json );
+}
+
+
+//! Simplifies Starfield meshes
+class spSimplifySFMesh final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Generate LODs" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		if ( !( nif && nif->getBSVersion() >= 170 ) )
+			return false;
+		if ( !index.isValid() )
+			return true;
+		return ( nif->blockInherits( index, "BSGeometry" ) && ( nif->get<quint32>(index, "Flags") & 0x0200 ) != 0 );
+	}
+
+	static void saveGeometryData( NifModel * nif, const LODGenerator & g );
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
+};
+
+void spSimplifySFMesh::saveGeometryData( NifModel * nif, const LODGenerator & g )
+{
+	for ( const auto & s : g.shapes ) {
+		QModelIndex	index = nif->getBlockIndex( qint32(s.blockNumber) );
 		if ( !( index.isValid() && nif->blockInherits( index, "BSGeometry" ) ) ) {
 			QMessageBox::critical( nullptr, "NifSkope error", QString("spSimplifySFMesh: internal error: block not found") );
 			continue;
@@ -272,8 +622,8 @@ void spSimplifySFMesh::Meshes::saveGeometryData( NifModel * nif ) const
 			nif->updateArraySize( i );
 			break;
 		}
-		for ( int l = 0; l < 3; l++ ) {
-			const QVector< Triangle > &	newTriangles = blockTriangles.at( b ).at( l );
+		for ( int l = 0; l < LODGenerator::maxLODs; l++ ) {
+			const QVector< Triangle >	newTriangles = ( l < g.numLevels ? s.lodTriangles( l ) : QVector< Triangle >() );
 			size_t	newIndicesCnt = size_t( newTriangles.size() ) * 3;
 
 			QModelIndex	iMesh = nif->getIndex( index, "Meshes" );
@@ -370,11 +720,23 @@ QModelIndex spSimplifySFMesh::cast( NifModel * nif, const QModelIndex & index )
 	if ( !( nif && nif->getBSVersion() >= 170 ) )
 		return index;
 
-	Meshes	m;
+	LODGenerator	g;
+	if ( !index.isValid() ) {
+		for ( int b = 0; b < nif->getBlockCount(); b++ ) {
+			auto	i = nif->getBlockIndex( qint32(b) );
+			if ( i.isValid() )
+				g.addStarfieldShape( nif, i );
+		}
+	} else {
+		g.addStarfieldShape( nif, index );
+	}
+	if ( g.shapes.empty() || !g.numLevels )
+		return index;
+
 	nif->setState( BaseModel::Processing );
-	m.loadGeometryData( nif, index );
-	m.simplifyMeshes();
-	m.saveGeometryData( nif );
+	g.generate();
+	g.showReport();
+	saveGeometryData( nif, g );
 	nif->restoreState();
 
 	return index;
@@ -382,3 +744,107 @@ QModelIndex spSimplifySFMesh::cast( NifModel * nif, const QModelIndex & index )
 
 REGISTER_SPELL( spSimplifySFMesh )
 
+//! Replaces the triangles of Skyrim and Fallout 4 shapes with a simplified LOD
+class spSimplifyMesh final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Simplify to LOD" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+
+	static bool isSimplifiable( const NifModel * nif, const QModelIndex & index )
+	{
+		// BSSubIndexTriShape is not supported, its segments would need to be remapped to the new triangles
+		if ( nif->isNiBlock( index, { "BSTriShape", "BSMeshLODTriShape" } ) )
+			return ( nif->getIndex( index, "Vertex Data" ).isValid()
+			         && !( nif->get<BSVertexDesc>( index, "Vertex Desc" ) & VertexFlags::VF_SKINNED ) );
+		// skinned shapes are not supported, the skin partition is not rebuilt
+		if ( nif->isNiBlock( index, { "NiTriShape", "BSLODTriShape" } ) )
+			return ( nif->getBlockIndex( nif->getLink( index, "Data" ), "NiTriShapeData" ).isValid()
+			         && !nif->getBlockIndex( nif->getLink( index, "Skin Instance" ) ).isValid() );
+		return false;
+	}
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		if ( !( nif && nif->getBSVersion() >= 83 && nif->getBSVersion() < 170 ) )
+			return false;
+		if ( !index.isValid() )
+			return true;
+		return isSimplifiable( nif, index );
+	}
+
+	static void saveGeometryData( NifModel * nif, const LODGenerator & g, int l );
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
+};
+
+void spSimplifyMesh::saveGeometryData( NifModel * nif, const LODGenerator & g, int l )
+{
+	for ( const auto & s : g.shapes ) {
+		QModelIndex	index = nif->getBlockIndex( qint32(s.blockNumber) );
+		if ( !index.isValid() )
+			continue;
+
+		QVector< Triangle >	newTriangles = s.lodTriangles( l );
+		quint32	numTriangles = quint32( newTriangles.size() );
+
+		if ( nif->blockInherits( index, "BSTriShape" ) ) {
+			nif->set<quint32>( index, "Num Triangles", numTriangles );
+			QModelIndex	iTriangles = nif->getIndex( index, "Triangles" );
+			if ( iTriangles.isValid() ) {
+				nif->updateArraySize( iTriangles );
+				nif->setArray<Triangle>( iTriangles, newTriangles );
+			}
+		} else {
+			QModelIndex	iData = nif->getBlockIndex( nif->getLink( index, "Data" ), "NiTriShapeData" );
+			if ( !iData.isValid() )
+				continue;
+			nif->set<int>( iData, "Num Triangles", int( numTriangles ) );
+			nif->set<int>( iData, "Num Triangle Points", int( numTriangles * 3 ) );
+			QModelIndex	iTriangles = nif->getIndex( iData, "Triangles" );
+			if ( iTriangles.isValid() ) {
+				nif->updateArraySize( iTriangles );
+				nif->setArray<Triangle>( iTriangles, newTriangles );
+			}
+		}
+
+		// The LOD ranges of BSLODTriShape and BSMeshLODTriShape were simplified separately
+		if ( s.lodRanges[l].size() == 3 ) {
+			nif->set<quint32>( index, "LOD0 Size", quint32( s.lodRanges[l][0] ) );
+			nif->set<quint32>( index, "LOD1 Size", quint32( s.lodRanges[l][1] ) );
+			nif->set<quint32>( index, "LOD2 Size", quint32( s.lodRanges[l][2] ) );
+		}
+	}
+}
+
+QModelIndex spSimplifyMesh::cast( NifModel * nif, const QModelIndex & index )
+{
+	LODGenerator	g;
+	if ( !index.isValid() ) {
+		for ( int b = 0; b < nif->getBlockCount(); b++ ) {
+			auto	i = nif->getBlockIndex( qint32(b) );
+			if ( i.isValid() && isSimplifiable( nif, i ) )
+				g.addTriShape( nif, i );
+		}
+	} else {
+		g.addTriShape( nif, index );
+	}
+	if ( g.shapes.empty() || !g.numLevels )
+		return index;
+
+	bool	ok = false;
+	int	l = QInputDialog::getInt( nullptr, Spell::tr( "Simplify to LOD" ),
+	                              Spell::tr( "LOD level to replace the triangles with:" ), 1, 1, g.numLevels, 1, &ok );
+	if ( !ok )
+		return index;
+
+	nif->setState( BaseModel::Processing );
+	g.generate( l - 1 );
+	g.showReport();
+	saveGeometryData( nif, g, l - 1 );
+	nif->restoreState();
+
+	return index;
+}
+
+REGISTER_SPELL( spSimplifyMesh )
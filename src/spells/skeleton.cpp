@@ -5,6 +5,8 @@
 #include "qtcompat.h"
 
 #include "lib/nvtristripwrapper.h"
+#include "lib/parallel.h"
+#include "lib/skinpartition.h"
 
 #include <QCheckBox>
 #include <QFile>
@@ -15,6 +17,8 @@
 #include <QSpinBox>
 
 #include <algorithm> // std::sort
+#include <memory>
+#include <unordered_map>
 
 #define SKEL_DAT ":/res/skel.dat"
 
@@ -246,6 +250,10 @@ inline void qRotate( Triangle & t )
 }
 
 //! Make skin partition
+/*!
+ * The weights and triangles of the shapes are read from the model first, the partitions are
+ * then calculated by SkinPartitioner on multiple threads, and finally written to NiSkinPartition.
+ */
 class spSkinPartition final : public Spell
 {
 public:
@@ -266,725 +274,450 @@ public:
 		return false;
 	}
 
-	typedef QPair<int, float> boneweight;
-
-	//! Helper for sorting a boneweight list
-	struct boneweight_equivalence
+	//! Partitioning options, shared by all shapes of a batch
+	struct Settings
 	{
-		bool operator()( const boneweight & lhs, const boneweight & rhs )
-		{
-			if ( lhs.second == 0.0 ) {
-				if ( rhs.second == 0.0 ) {
-					return rhs.first < lhs.first;
-				} else {
-					return true;
-				}
-
-				return false;
-			} else if ( rhs.second == lhs.second ) {
-				return lhs.first < rhs.first;
-			} else {
-				return rhs.second < lhs.second;
-			}
-		}
+		int maxBonesPerPartition = 0;
+		int maxBonesPerVertex = 0;
+		bool makeStrips = false;
+		bool pad = false;
 	};
 
-	//! A bone and Triangle set
-	typedef struct
+	//! A shape to be partitioned
+	struct Job
 	{
-		QList<int> bones;
-		QVector<Triangle> triangles;
-	} Partition;
+		QPersistentModelIndex iShape;
+		QPersistentModelIndex iData;
+		QPersistentModelIndex iSkinInst;
+		QPersistentModelIndex iSkinData;
+		QPersistentModelIndex iSkinPart;
+		std::unique_ptr<SkinPartitioner> partitioner;
+		//! Maximum number of bones per vertex in NiSkinData
+		int maxInfluences = 0;
+		QString error;
+	};
 
 	QModelIndex cast( NifModel * nif, const QModelIndex & iBlock ) override final
 	{
-		int mbpp = 0, mbpv = 0;
-		bool make_strips = false;
-		return cast( nif, iBlock, mbpp, mbpv, make_strips );
+		Settings settings;
+		castShapes( nif, { QPersistentModelIndex( iBlock ) }, settings );
+		return iBlock;
 	}
 
-	//! Cast with extra parameters
-	QModelIndex cast( NifModel * nif, const QModelIndex & iBlock, int & maxBonesPerPartition, int & maxBonesPerVertex, bool make_strips, bool pad = false )
+	//! Partitions a list of shapes, the settings dialog is shown if \a settings has no limits yet
+	int castShapes( NifModel * nif, const QList<QPersistentModelIndex> & shapes, Settings & settings )
 	{
-		QPersistentModelIndex iShape = iBlock;
-		QString iShapeType = "";
-
-		if ( nif->isNiBlock( iShape, "NiTriShape" ) ) {
-			iShapeType = "NiTriShape";
-		} else if ( nif->isNiBlock( iShape, "NiTriStrips" ) ) {
-			iShapeType = "NiTriStrips";
-		}
-
-		try
-		{
-			QPersistentModelIndex iData;
-
-			if ( iShapeType == "NiTriShape" ) {
-				iData = nif->getBlockIndex( nif->getLink( iShape, "Data" ), "NiTriShapeData" );
-			} else if ( iShapeType == "NiTriStrips" ) {
-				iData = nif->getBlockIndex( nif->getLink( iShape, "Data" ), "NiTriStripsData" );
-			}
-
-			QPersistentModelIndex iSkinInst = nif->getBlockIndex( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
-			QPersistentModelIndex iSkinData = nif->getBlockIndex( nif->getLink( iSkinInst, "Data" ), "NiSkinData" );
-			QModelIndex iSkinPart = nif->getBlockIndex( nif->getLink( iSkinInst, "Skin Partition" ), "NiSkinPartition" );
-
-			if ( !iSkinPart.isValid() )
-				iSkinPart = nif->getBlockIndex( nif->getLink( iSkinData, "Skin Partition" ), "NiSkinPartition" );
+		std::vector<Job> jobs;
+		QStringList errors;
+		int maxInfluences = 0;
 
-			// read in the weights from NiSkinData
+		for ( const QPersistentModelIndex & iShape : shapes ) {
+			Job job;
+			job.iShape = iShape;
 
-			int numVerts = nif->get<int>( iData, "Num Vertices" );
-			QVector<QList<boneweight> > weights( numVerts );
-
-			QModelIndex iBoneList = nif->getIndex( iSkinData, "Bone List" );
-			int numBones = nif->rowCount( iBoneList );
-
-			for ( int bone = 0; bone < numBones; bone++ ) {
-				QModelIndex iVertexWeights = nif->getIndex( QModelIndex_child( iBoneList, bone ), "Vertex Weights" );
-
-				for ( int r = 0; r < nif->rowCount( iVertexWeights ); r++ ) {
-					int vertex = nif->get<int>( QModelIndex_child( iVertexWeights, r ), "Index" );
-					float weight = nif->get<float>( QModelIndex_child( iVertexWeights, r ), "Weight" );
-
-					if ( vertex >= weights.count() )
-						throw QString( Spell::tr( "bad NiSkinData - vertex count does not match" ) );
-
-					weights[vertex].append( boneweight( bone, weight ) );
-				}
+			try
+			{
+				readShape( nif, job );
 			}
-
-			// count min and max bones per vertex
-
-			int minBones, maxBones;
-			minBones = maxBones = weights.value( 0 ).count();
-			for ( const QList<boneweight> & list : weights ) {
-				if ( list.count() < minBones )
-					minBones = list.count();
-
-				if ( list.count() > maxBones )
-					maxBones = list.count();
+			catch ( QString & err )
+			{
+				errors << shapeError( nif, job, err );
+				continue;
 			}
 
-			if ( minBones <= 0 )
-				throw QString( Spell::tr( "bad NiSkinData - some vertices have no weights at all" ) );
+			maxInfluences = std::max( maxInfluences, job.maxInfluences );
+			jobs.push_back( std::move( job ) );
+		}
 
-			// query max bones per vertex/partition
+		if ( !jobs.empty() && ( settings.maxBonesPerPartition <= 0 || settings.maxBonesPerVertex <= 0 ) ) {
+			SkinPartitionDialog dlg( maxInfluences );
 
-			if ( maxBonesPerPartition <= 0 || maxBonesPerVertex <= 0 ) {
-				SkinPartitionDialog dlg( maxBones );
+			if ( dlg.exec() != QDialog::Accepted )
+				return 0;
 
-				if ( dlg.exec() != QDialog::Accepted )
-					return iBlock;
+			settings.maxBonesPerPartition = dlg.maxBonesPerPartition();
+			settings.maxBonesPerVertex = dlg.maxBonesPerVertex();
+			settings.makeStrips = dlg.makeStrips();
+			settings.pad = dlg.padPartitions();
+		}
 
-				maxBonesPerPartition = dlg.maxBonesPerPartition();
-				maxBonesPerVertex = dlg.maxBonesPerVertex();
-				make_strips = dlg.makeStrips();
-				pad = dlg.padPartitions();
+		// the partitioner does not access the model, so the shapes can be processed in parallel
+		parallelFor( jobs.size(), [&jobs, &settings]( size_t i ) {
+			Job & job = jobs[i];
+			SkinPartitioner & p = *( job.partitioner );
+			p.maxBonesPerPartition = settings.maxBonesPerPartition;
+			p.maxBonesPerVertex = settings.maxBonesPerVertex;
+			if ( p.build( &job.error ) )
+				p.validate( &job.error );
+		} );
+
+		int cnt = 0;
+
+		for ( Job & job : jobs ) {
+			if ( !job.error.isEmpty() ) {
+				errors << shapeError( nif, job, job.error );
+				continue;
 			}
 
-			// reduce vertex influences if necessary
-
-			if ( maxBones > maxBonesPerVertex ) {
-				QMutableVectorIterator<QList<boneweight> > it( weights );
-				int c = 0;
-
-				while ( it.hasNext() ) {
-					QList<boneweight> & lst = it.next();
-					std::sort( lst.begin(), lst.end(), boneweight_equivalence() );
-
-					if ( lst.count() > maxBonesPerVertex )
-						c++;
-
-					while ( lst.count() > maxBonesPerVertex ) {
-						lst.removeLast();
-					}
-
-					float totalWeight = 0;
-					for ( const auto & bw : lst ) {
-						totalWeight += bw.second;
-					}
-
-					for ( int b = 0; b < lst.count(); b++ ) {
-						// normalize
-						lst[b].second /= totalWeight;
-					}
-				}
+			const SkinPartitioner & p = *( job.partitioner );
 
+			if ( p.reducedVertices > 0 ) {
 				qCWarning( nsSpell ) << Spell::tr( "Reduced %1 vertices to %2 bone influences (maximum number of bones per vertex was %3)" )
-					.arg( c )
-					.arg( maxBonesPerVertex )
-					.arg( maxBones );
+					.arg( p.reducedVertices )
+					.arg( settings.maxBonesPerVertex )
+					.arg( job.maxInfluences );
 			}
 
-			maxBones = maxBonesPerVertex;
-
-			// reduces bone weights so that the triangles fit into the partitions
-
-			QList<Triangle> triangles;
-
-			if ( iShapeType == "NiTriShape" ) {
-				triangles = nif->getArray<Triangle>( iData, "Triangles" ).toList();
-			} else if ( iShapeType == "NiTriStrips" ) {
-				// triangulate first (code copied from strippify.cpp)
-				QVector<QVector<quint16> > strips;
-				QModelIndex iPoints = nif->getIndex( iData, "Points" );
+			if ( p.removedInfluences > 0 )
+				qCWarning( nsSpell ) << Spell::tr( "Removed %1 bone influences" ).arg( p.removedInfluences );
 
-				for ( int s = 0; s < nif->rowCount( iPoints ); s++ ) {
-					QVector<quint16> strip;
-					QModelIndex iStrip = QModelIndex_child( iPoints, s );
+			writeShape( nif, job, settings );
+			job.partitioner.reset();
+			cnt++;
+		}
 
-					for ( int p = 0; p < nif->rowCount( iStrip ); p++ ) {
-						strip.append( nif->get<int>( QModelIndex_child( iStrip, p ) ) );
-					}
+		if ( !errors.isEmpty() )
+			QMessageBox::warning( nullptr, "NifSkope", errors.join( "\n" ) );
 
-					strips.append( strip );
-				}
+		return cnt;
+	}
 
-				triangles = triangulate( strips ).toList();
-			}
+protected:
+	QString shapeError( const NifModel * nif, const Job & job, const QString & err ) const
+	{
+		if ( err.isEmpty() )
+			return err;
 
-			QMap<Triangle, quint32> trimap;
-			quint32 defaultPart = 0;
+		return QString( "%1: %2" ).arg( nif->get<QString>( job.iShape, "Name" ), err );
+	}
 
-			if ( nif->blockInherits( iSkinInst, "BSDismemberSkinInstance" ) ) {
-				// First find a partition to dump dangling faces.  Torso is prefered if available.
-				quint32 nparts = nif->get<uint>( iSkinInst, "Num Partitions" );
-				QModelIndex iPartData = nif->getIndex( iSkinInst, "Partitions" );
+	//! Reads the strips of a NiTriStripsData or SkinPartition
+	static QVector<QVector<quint16> > readStrips( const NifModel * nif, const QModelIndex & iParent, const QString & name )
+	{
+		QVector<QVector<quint16> > strips;
+		QModelIndex iPoints = nif->getIndex( iParent, name );
 
-				for ( quint32 i = 0; i < nparts; ++i ) {
-					QModelIndex iPart = QModelIndex_child( iPartData, i );
+		for ( int s = 0; s < nif->rowCount( iPoints ); s++ )
+			strips.append( nif->getArray<quint16>( QModelIndex_child( iPoints, s ) ) );
 
-					if ( !iPart.isValid() )
-						continue;
+		return strips;
+	}
 
-					if ( nif->get<uint>( iPart, "Body Part" ) == 0 /* Torso */ ) {
-						defaultPart = i;
-						break;
-					}
-				}
+	//! Packs a rotated triangle into an integer key
+	static quint64 triangleKey( Triangle t )
+	{
+		qRotate( t );
+		return ( quint64( t[0] ) << 32 ) | ( quint64( t[1] ) << 16 ) | quint64( t[2] );
+	}
 
-				defaultPart = qMin( nparts - 1, defaultPart );
+	//! Reads the weights, vertices and triangles of a shape, throws a QString on error
+	void readShape( const NifModel * nif, Job & job )
+	{
+		bool isTriShape = nif->isNiBlock( job.iShape, "NiTriShape" );
 
-				// enumerate existing partitions and select faces into same partition
-				quint32 nskinparts = nif->get<int>( iSkinPart, "Num Partitions" );
-				iPartData = nif->getIndex( iSkinPart, "Partitions" );
+		job.iData = nif->getBlockIndex( nif->getLink( job.iShape, "Data" ), isTriShape ? "NiTriShapeData" : "NiTriStripsData" );
+		job.iSkinInst = nif->getBlockIndex( nif->getLink( job.iShape, "Skin Instance" ), "NiSkinInstance" );
+		job.iSkinData = nif->getBlockIndex( nif->getLink( job.iSkinInst, "Data" ), "NiSkinData" );
+		job.iSkinPart = nif->getBlockIndex( nif->getLink( job.iSkinInst, "Skin Partition" ), "NiSkinPartition" );
 
-				for ( quint32 i = 0; i < nskinparts; ++i ) {
-					QModelIndex iPart = QModelIndex_child( iPartData, i );
+		if ( !job.iSkinPart.isValid() )
+			job.iSkinPart = nif->getBlockIndex( nif->getLink( job.iSkinData, "Skin Partition" ), "NiSkinPartition" );
 
-					if ( !iPart.isValid() )
-						continue;
+		if ( !job.iData.isValid() || !job.iSkinData.isValid() )
+			throw QString( Spell::tr( "shape data not found" ) );
 
-					quint32 finalPart = qMin( nparts - 1, i );
+		// read in the weights from NiSkinData
 
-					QVector<int> vertmap = nif->getArray<int>( iPart, "Vertex Map" );
+		int numVerts = nif->get<int>( job.iData, "Num Vertices" );
+		QModelIndex iBoneList = nif->getIndex( job.iSkinData, "Bone List" );
+		int numBones = nif->rowCount( iBoneList );
 
-					quint8 hasFaces  = nif->get<quint8>( iPart, "Has Faces" );
-					quint8 numStrips = nif->get<quint8>( iPart, "Num Strips" );
-					QVector<Triangle> partTriangles;
+		job.partitioner = std::make_unique<SkinPartitioner>( size_t( std::max( numVerts, 0 ) ), size_t( std::max( numBones, 0 ) ) );
+		SkinPartitioner & p = *( job.partitioner );
 
-					if ( hasFaces && numStrips == 0 ) {
-						partTriangles = nif->getArray<Triangle>( iPart, "Triangles" );
-					} else if ( numStrips != 0 ) {
-						// triangulate first (code copied from strippify.cpp)
-						QVector<QVector<quint16> > strips;
-						QModelIndex iPoints = nif->getIndex( iPart, "Strips" );
+		for ( int bone = 0; bone < numBones; bone++ ) {
+			QModelIndex iVertexWeights = nif->getIndex( QModelIndex_child( iBoneList, bone ), "Vertex Weights" );
 
-						for ( int s = 0; s < nif->rowCount( iPoints ); s++ ) {
-							QVector<quint16> strip;
-							QModelIndex iStrip = QModelIndex_child( iPoints, s );
+			for ( int r = 0; r < nif->rowCount( iVertexWeights ); r++ ) {
+				QModelIndex iWeight = QModelIndex_child( iVertexWeights, r );
+				int vertex = nif->get<int>( iWeight, "Index" );
 
-							for ( int p = 0; p < nif->rowCount( iStrip ); p++ ) {
-								strip.append( nif->get<int>( QModelIndex_child( iStrip, p ) ) );
-							}
+				if ( vertex < 0 || vertex >= numVerts )
+					throw QString( Spell::tr( "bad NiSkinData - vertex count does not match" ) );
 
-							strips.append( strip );
-						}
+				p.addInfluence( quint32( vertex ), quint32( bone ), nif->get<float>( iWeight, "Weight" ) );
+			}
+		}
 
-						partTriangles = triangulate( strips );
-					}
+		int minBones = 0;
+		p.influenceRange( minBones, job.maxInfluences );
 
-					for ( int j = 0; j < partTriangles.count(); ++j ) {
-						Triangle t = partTriangles[j];
-						Triangle tri = t;
+		if ( minBones <= 0 )
+			throw QString( Spell::tr( "bad NiSkinData - some vertices have no weights at all" ) );
 
-						if ( !vertmap.isEmpty() ) {
-							tri[0] = vertmap[tri[0]];
-							tri[1] = vertmap[tri[1]];
-							tri[2] = vertmap[tri[2]];
-						}
+		// vertices with the same position and weights are kept consistent when influences are removed
 
-						qRotate( tri );
-						trimap.insert( tri, finalPart );
-					}
-				}
+		QVector<Vector3> verts = nif->getArray<Vector3>( job.iData, "Vertices" );
+		if ( verts.count() == numVerts ) {
+			p.positions.resize( size_t( numVerts ) * 3 );
+			for ( int v = 0; v < numVerts; v++ ) {
+				for ( int c = 0; c < 3; c++ )
+					p.positions[size_t( v ) * 3 + size_t( c )] = verts[v][c];
 			}
+		}
 
-			QMultiMap<int, int> match;
-			bool doMatch = true;
+		QVector<Triangle> triangles;
 
-			QList<int> tribones;
+		if ( isTriShape )
+			triangles = nif->getArray<Triangle>( job.iData, "Triangles" );
+		else
+			triangles = triangulate( readStrips( nif, job.iData, "Points" ) );
 
-			int cnt = 0;
+		p.triangles.reserve( size_t( triangles.count() ) * 3 );
+		for ( const Triangle & tri : triangles ) {
+			for ( int c = 0; c < 3; c++ )
+				p.triangles.push_back( tri[c] );
+		}
 
-			for ( const Triangle& tri : triangles )
-			{
-				do {
-					tribones.clear();
-
-					for ( int c = 0; c < 3; c++ ) {
-						for ( const auto & bw : weights[tri[c]] ) {
-							if ( !tribones.contains( bw.first ) )
-								tribones.append( bw.first );
-						}
-					}
+		if ( !nif->blockInherits( job.iSkinInst, "BSDismemberSkinInstance" ) )
+			return;
 
-					if ( tribones.count() > maxBonesPerPartition ) {
-						// sum up the weights for each bone
-						// bones with weight == 1 can't be removed
-
-						QMap<int, float> sum;
-						QList<int> nono;
-
-						for ( int t = 0; t < 3; t++ ) {
-							if ( weights[tri[t]].count() == 1 )
-								nono.append( weights[tri[t]].first().first );
-
-							for ( const auto & bw : weights[tri[t]] ) {
-								sum[ bw.first ] += bw.second;
-							}
-						}
-
-						// select the bone to remove
-
-						float minWeight = 5.0;
-						int minBone = -1;
-
-						for ( const auto b : sum.keys() ) {
-							if ( !nono.contains( b ) && sum[b] < minWeight ) {
-								minWeight = sum[b];
-								minBone = b;
-							}
-						}
-
-						if ( minBone < 0 )  // this shouldn't never happen
-							throw QString( "internal error 0x01" );
-
-						// do a vertex match detect
-
-						if ( doMatch ) {
-							QVector<Vector3> verts = nif->getArray<Vector3>( iData, "Vertices" );
-
-							for ( int a = 0; a < verts.count(); a++ ) {
-								match.insert( a, a );
-
-								for ( int b = a + 1; b < verts.count(); b++ ) {
-									if ( verts[a] == verts[b] && weights[a] == weights[b] ) {
-										match.insert( a, b );
-										match.insert( b, a );
-									}
-								}
-							}
-						}
-
-						// now remove that bone from all vertices of this triangle and from all matching vertices too
-
-						for ( int t = 0; t < 3; t++ ) {
-							bool rem = false;
-							for ( const auto v : match.values( tri[t] ) )
-							{
-								QList<boneweight> & bws = weights[ v ];
-								QMutableListIterator<boneweight> it( bws );
-
-								while ( it.hasNext() ) {
-									boneweight & bw = it.next();
-
-									if ( bw.first == minBone ) {
-										it.remove();
-										rem = true;
-									}
-								}
-
-								float totalWeight = 0;
-								for ( const auto & bw : bws ) {
-									totalWeight += bw.second;
-								}
-
-								if ( totalWeight == 0 )
-									throw QString( "internal error 0x02" );
-
-								for ( int b = 0; b < bws.count(); b++ ) {
-									// normalize
-									bws[b].second /= totalWeight;
-								}
-							}
-
-							if ( rem )
-								cnt++;
-						}
-					}
-				} while ( tribones.count() > maxBonesPerPartition );
-			}
+		// First find a partition to dump dangling faces.  Torso is prefered if available.
+		quint32 defaultPart = 0;
+		quint32 nparts = nif->get<uint>( job.iSkinInst, "Num Partitions" );
+		QModelIndex iPartData = nif->getIndex( job.iSkinInst, "Partitions" );
 
-			if ( cnt > 0 )
-				qCWarning( nsSpell ) << Spell::tr( "Removed %1 bone influences" ).arg( cnt );
+		if ( nparts == 0 )
+			return;
 
-			// split the triangles into partitions
+		for ( quint32 i = 0; i < nparts; ++i ) {
+			QModelIndex iPart = QModelIndex_child( iPartData, i );
 
-			bool merged = true;
+			if ( iPart.isValid() && nif->get<uint>( iPart, "Body Part" ) == 0 /* Torso */ ) {
+				defaultPart = i;
+				break;
+			}
+		}
 
-			QList<Partition> parts;
+		defaultPart = qMin( nparts - 1, defaultPart );
 
-			if ( !trimap.isEmpty() ) {
-				QMutableListIterator<Triangle> it( triangles );
+		// enumerate existing partitions and select faces into same partition
+		std::unordered_map<quint64, quint32> trimap;
+		quint32 nskinparts = nif->get<int>( job.iSkinPart, "Num Partitions" );
+		iPartData = nif->getIndex( job.iSkinPart, "Partitions" );
 
-				while ( it.hasNext() ) {
-					Triangle tri = it.next();
-					qRotate( tri );
-					QMap<Triangle, quint32>::iterator partItr = trimap.find( tri );
-					int partIdx = ( partItr != trimap.end() ) ? partItr.value() : defaultPart;
+		for ( quint32 i = 0; i < nskinparts; ++i ) {
+			QModelIndex iPart = QModelIndex_child( iPartData, i );
 
-					if ( partIdx >= 0 ) {
-						//Triangle & tri = *it;
+			if ( !iPart.isValid() )
+				continue;
 
-						// Ensure enough partitions
-						while ( partIdx >= int( parts.size() ) )
-							parts.push_back( Partition() );
+			quint32 finalPart = qMin( nparts - 1, i );
 
-						Partition & part = parts[partIdx];
+			QVector<int> vertmap = nif->getArray<int>( iPart, "Vertex Map" );
 
-						QList<int> tribones;
+			quint8 hasFaces  = nif->get<quint8>( iPart, "Has Faces" );
+			quint8 numStrips = nif->get<quint8>( iPart, "Num Strips" );
+			QVector<Triangle> partTriangles;
 
-						for ( int c = 0; c < 3; c++ ) {
-							for ( const auto & bw : weights[tri[c]] ) {
-								if ( !tribones.contains( bw.first ) )
-									tribones.append( bw.first );
-							}
-						}
+			if ( hasFaces && numStrips == 0 )
+				partTriangles = nif->getArray<Triangle>( iPart, "Triangles" );
+			else if ( numStrips != 0 )
+				partTriangles = triangulate( readStrips( nif, iPart, "Strips" ) );
 
-						part.bones = mergeBones( part.bones, tribones );
-						part.triangles.append( tri );
-						it.remove();
-					}
+			for ( Triangle tri : partTriangles ) {
+				if ( !vertmap.isEmpty() ) {
+					for ( int c = 0; c < 3; c++ )
+						tri[c] = vertmap.value( tri[c] );
 				}
 
-				merged = false; // when explicit mapping enabled, no merging is allowed
+				trimap.emplace( triangleKey( tri ), finalPart );
 			}
+		}
 
-			while ( !triangles.isEmpty() ) {
-				Partition part;
+		if ( trimap.empty() )
+			return;
 
-				QHash<int, bool> usedVerts;
+		p.trianglePartitions.reserve( size_t( triangles.count() ) );
+		for ( const Triangle & tri : triangles ) {
+			auto it = trimap.find( triangleKey( tri ) );
+			p.trianglePartitions.push_back( it != trimap.end() ? it->second : defaultPart );
+		}
+	}
 
-				bool addtriangles;
+	//! Writes the partitions calculated for a shape to its NiSkinPartition
+	void writeShape( NifModel * nif, Job & job, const Settings & settings )
+	{
+		const SkinPartitioner & p = *( job.partitioner );
+		const std::vector<SkinPartitioner::Partition> & parts = p.partitions();
+		int maxBones = settings.maxBonesPerVertex;
 
-				do {
-					QMutableListIterator<Triangle> it( triangles );
+		// create the NiSkinPartition if it doesn't exist yet
 
-					while ( it.hasNext() ) {
-						Triangle & tri = it.next();
+		if ( !job.iSkinPart.isValid() ) {
+			job.iSkinPart = nif->insertNiBlock( "NiSkinPartition", nif->getBlockNumber( job.iSkinData ) + 1 );
+			nif->setLink( job.iSkinInst, "Skin Partition", nif->getBlockNumber( job.iSkinPart ) );
+			nif->setLink( job.iSkinData, "Skin Partition", nif->getBlockNumber( job.iSkinPart ) );
+		}
 
-						QList<int> tribones;
+		// start writing NiSkinPartition
 
-						for ( int c = 0; c < 3; c++ ) {
-							for ( const auto & bw : weights[tri[c]] ) {
-								if ( !tribones.contains( bw.first ) )
-									tribones.append( bw.first );
-							}
-						}
+		int numParts = int( parts.size() );
+		nif->set<int>( job.iSkinPart, "Num Partitions", numParts );
+		nif->updateArraySize( job.iSkinPart, "Partitions" );
 
-						if ( part.bones.isEmpty() || containsBones( part.bones, tribones ) ) {
-							part.bones = mergeBones( part.bones, tribones );
-							part.triangles.append( tri );
-							usedVerts[ tri[0] ] = true;
-							usedVerts[ tri[1] ] = true;
-							usedVerts[ tri[2] ] = true;
-							it.remove();
-						}
-					}
+		QModelIndex iBSSkinInstPartData;
 
-					addtriangles = false;
-
-					if ( part.bones.count() < maxBonesPerPartition ) {
-						// if we have room left in the partition then add an adjacent triangle
-						it.toFront();
-
-						while ( it.hasNext() ) {
-							Triangle & tri = it.next();
-
-							if ( usedVerts.contains( tri[0] ) || usedVerts.contains( tri[1] ) || usedVerts.contains( tri[2] ) ) {
-								QList<int> tribones;
-
-								for ( int c = 0; c < 3; c++ ) {
-									for ( const auto & bw : weights[tri[c]] ) {
-										if ( !tribones.contains( bw.first ) )
-											tribones.append( bw.first );
-									}
-								}
-
-								tribones = mergeBones( part.bones, tribones );
-
-								if ( tribones.count() <= maxBonesPerPartition ) {
-									part.bones = tribones;
-									part.triangles.append( tri );
-									usedVerts[ tri[0] ] = true;
-									usedVerts[ tri[1] ] = true;
-									usedVerts[ tri[2] ] = true;
-									it.remove();
-									addtriangles = true;
-									//break;
-								}
-							}
-						}
-					}
-				} while ( addtriangles );
+		if ( nif->blockInherits( job.iSkinInst, "BSDismemberSkinInstance" ) ) {
+			int nparts = nif->get<int>( job.iSkinInst, "Num Partitions" );
+			iBSSkinInstPartData = nif->getIndex( job.iSkinInst, "Partitions" );
 
-				parts.append( part );
+			if ( nparts != numParts ) {
+				qCWarning( nsSpell ) << "BSDismemberSkinInstance partition count does not match Skin Partition count.  Adjusting to fit.";
+				nif->set<int>( job.iSkinInst, "Num Partitions", numParts );
+				nif->updateArraySize( job.iSkinInst, "Partitions" );
 			}
+		}
 
-			//qDebug() << parts.count() << "small partitions";
-
-			// merge partitions
-
-			while ( merged ) {
-				merged = false;
+		QModelIndex iParts = nif->getIndex( job.iSkinPart, "Partitions" );
+		const std::vector<quint32> * prevPartBones = nullptr;
 
-				for ( int p1 = 0; p1 < parts.count() && !merged; p1++ ) {
-					if ( parts[p1].bones.count() < maxBonesPerPartition ) {
-						for ( int p2 = p1 + 1; p2 < parts.count() && !merged; p2++ ) {
-							QList<int> mergedBones = mergeBones( parts[p1].bones, parts[p2].bones );
+		for ( int n = 0; n < numParts; n++ ) {
+			const SkinPartitioner::Partition & part = parts[n];
+			QModelIndex iPart = QModelIndex_child( iParts, n );
 
-							if ( mergedBones.count() <= maxBonesPerPartition ) {
-								parts[p1].bones = mergedBones;
-								parts[p1].triangles << parts[p2].triangles;
-								parts.removeAt( p2 );
-								merged = true;
-							}
-						}
-					}
+			// set partition flags for bs skin instance if present
+			if ( iBSSkinInstPartData.isValid() ) {
+				if ( !prevPartBones || part.bones != *prevPartBones ) {
+					prevPartBones = &part.bones;
+					nif->set<uint>( QModelIndex_child( iBSSkinInstPartData, n ), "Part Flag", 257 );
 				}
 			}
 
-			//qDebug() << parts.count() << "partitions";
+			QVector<int> bones( int( part.bones.size() ) );
+			std::copy( part.bones.begin(), part.bones.end(), bones.begin() );
 
-			// create the NiSkinPartition if it doesn't exist yet
+			QVector<int> vertices( int( part.vertexMap.size() ) );
+			std::copy( part.vertexMap.begin(), part.vertexMap.end(), vertices.begin() );
 
-			if ( !iSkinPart.isValid() ) {
-				iSkinPart = nif->insertNiBlock( "NiSkinPartition", nif->getBlockNumber( iSkinData ) + 1 );
-				nif->setLink( iSkinInst, "Skin Partition", nif->getBlockNumber( iSkinPart ) );
-				nif->setLink( iSkinData, "Skin Partition", nif->getBlockNumber( iSkinPart ) );
+			// validate() has limited the partitions to 65535 vertices, so the local vertex numbers fit in 16 bits
+			QVector<Triangle> triangles;
+			triangles.reserve( int( part.sourceTriangles.size() ) );
+			for ( size_t t = 0; t < part.sourceTriangles.size(); t++ ) {
+				const quint32 * tri = part.triangles.data() + t * 3;
+				triangles.append( Triangle( quint16( tri[0] ), quint16( tri[1] ), quint16( tri[2] ) ) );
 			}
 
-			// start writing NiSkinPartition
-
-			nif->set<int>( iSkinPart, "Num Partitions", parts.count() );
-			nif->updateArraySize( iSkinPart, "Partitions" );
+			// stripify the triangles
+			QVector<QVector<quint16> > strips;
+			int numTriangles = 0;
 
-			QModelIndex iBSSkinInstPartData;
+			if ( settings.makeStrips ) {
+				strips = stripify( triangles );
 
-			if ( nif->blockInherits( iSkinInst, "BSDismemberSkinInstance" ) ) {
-				quint32 nparts = nif->get<uint>( iSkinInst, "Num Partitions" );
-				iBSSkinInstPartData = nif->getIndex( iSkinInst, "Partitions" );
-
-				// why is QList.count() signed? cast to squash warning
-				if ( nparts != (quint32)parts.count() ) {
-					qCWarning( nsSpell ) << "BSDismemberSkinInstance partition count does not match Skin Partition count.  Adjusting to fit.";
-					nif->set<uint>( iSkinInst, "Num Partitions", parts.count() );
-					nif->updateArraySize( iSkinInst, "Partitions" );
+				for ( const QVector<quint16>& strip : strips ) {
+					numTriangles += strip.count() - 2;
 				}
+			} else {
+				numTriangles = triangles.count();
 			}
 
-			QList<int> prevPartBones;
-
-			for ( int p = 0; p < parts.count(); p++ ) {
-				QModelIndex iPart = QModelIndex_child( nif->getIndex( iSkinPart, "Partitions" ), p );
-
-				QList<int> bones = parts[p].bones;
-				std::sort( bones.begin(), bones.end() /*, std::less<int>()*/ );
-
-				// set partition flags for bs skin instance if present
-				if ( iBSSkinInstPartData.isValid() ) {
-					if ( bones != prevPartBones ) {
-						prevPartBones = bones;
-						nif->set<uint>( QModelIndex_child( iBSSkinInstPartData, p ), "Part Flag", 257 );
-					}
+			// fill in counts
+			if ( settings.pad ) {
+				while ( bones.size() < settings.maxBonesPerPartition ) {
+					bones.append( 0 );
 				}
+			}
 
-				QVector<Triangle> triangles = parts[p].triangles;
+			nif->set<int>( iPart, "Num Vertices", vertices.count() );
+			nif->set<int>( iPart, "Num Triangles", numTriangles );
+			nif->set<int>( iPart, "Num Bones", bones.count() );
+			nif->set<int>( iPart, "Num Strips", strips.count() );
+			nif->set<int>( iPart, "Num Weights Per Vertex", maxBones );
 
-				// Create the vertex map
+			// fill in bone map
 
-				int idx = 0;
-				QVector<int> vidx( numVerts, -1 );
-				for ( const Triangle& tri : triangles ) {
-					for ( int t = 0; t < 3; t++ ) {
-						int v = tri[t];
+			QModelIndex iBoneMap = nif->getIndex( iPart, "Bones" );
+			nif->updateArraySize( iBoneMap );
+			nif->setArray<int>( iBoneMap, bones );
 
-						if ( vidx[v] < 0 )
-							vidx[v] = idx++;
-					}
-				}
-				QVector<int> vertices( idx, -1 );
+			// fill in vertex map
 
-				for ( int i = 0; i < numVerts; ++i ) {
-					int v = vidx[i];
+			nif->set<int>( iPart, "Has Vertex Map", 1 );
+			QModelIndex iVertexMap = nif->getIndex( iPart, "Vertex Map" );
+			nif->updateArraySize( iVertexMap );
+			nif->setArray<int>( iVertexMap, vertices );
 
-					if ( v >= 0 ) {
-						vertices[v] = i;
-					}
-				}
+			// fill in vertex weights and bones, influences are sorted by weight
 
-				// map the vertices
+			nif->set<int>( iPart, "Has Vertex Weights", 1 );
+			QModelIndex iVWeights = nif->getIndex( iPart, "Vertex Weights" );
+			nif->updateArraySize( iVWeights );
 
-				for ( int tri = 0; tri < triangles.count(); tri++ ) {
-					for ( int t = 0; t < 3; t++ ) {
-						triangles[tri][t] = vertices.indexOf( triangles[tri][t] );
-					}
-				}
+			nif->set<int>( iPart, "Has Bone Indices", 1 );
+			QModelIndex iVBones = nif->getIndex( iPart, "Bone Indices" );
+			nif->updateArraySize( iVBones );
 
-				// stripify the triangles
-				QVector<QVector<quint16> > strips;
-				int numTriangles = 0;
+			QVector<float> vertexWeights( maxBones );
+			QVector<int> vertexBones( maxBones );
 
-				if ( make_strips == true ) {
-					strips = stripify( triangles );
+			for ( int v = 0; v < vertices.count(); v++ ) {
+				quint32 vertex = part.vertexMap[v];
+				int numInfluences = p.influenceCount( vertex );
 
-					for ( const QVector<quint16>& strip : strips ) {
-						numTriangles += strip.count() - 2;
-					}
-				} else {
-					numTriangles = triangles.count();
-				}
+				for ( int b = 0; b < maxBones; b++ ) {
+					vertexWeights[b] = 0.0f;
+					vertexBones[b] = 0;
 
-				// fill in counts
-				if ( pad ) {
-					while ( bones.size() < maxBonesPerPartition ) {
-						bones.append( 0 );
+					if ( b < numInfluences ) {
+						const SkinPartitioner::Influence & i = p.influence( vertex, b );
+						vertexWeights[b] = i.weight;
+						vertexBones[b] = int( std::lower_bound( part.bones.begin(), part.bones.end(), i.bone ) - part.bones.begin() );
 					}
 				}
 
-				// resort the bone weights in bone order
-				QMutableVectorIterator<QList<boneweight> > it( weights );
-
-				while ( it.hasNext() ) {
-					QList<boneweight> & bw = it.next();
-					std::sort( bw.begin(), bw.end(), boneweight_equivalence() );
-				}
-
-				nif->set<int>( iPart, "Num Vertices", vertices.count() );
-				nif->set<int>( iPart, "Num Triangles", numTriangles );
-				nif->set<int>( iPart, "Num Bones", bones.count() );
-				nif->set<int>( iPart, "Num Strips", strips.count() );
-				nif->set<int>( iPart, "Num Weights Per Vertex", maxBones );
-
-				// fill in bone map
-
-				QModelIndex iBoneMap = nif->getIndex( iPart, "Bones" );
-				nif->updateArraySize( iBoneMap );
-				nif->setArray<int>( iBoneMap, bones.toVector() );
-
-				// fill in vertex map
-
-				nif->set<int>( iPart, "Has Vertex Map", 1 );
-				QModelIndex iVertexMap = nif->getIndex( iPart, "Vertex Map" );
-				nif->updateArraySize( iVertexMap );
-				nif->setArray<int>( iVertexMap, vertices );
-
-				// fill in vertex weights
-
-				nif->set<int>( iPart, "Has Vertex Weights", 1 );
-				QModelIndex iVWeights = nif->getIndex( iPart, "Vertex Weights" );
-				nif->updateArraySize( iVWeights );
-
-				for ( int v = 0; v < nif->rowCount( iVWeights ); v++ ) {
-					QModelIndex iVertex = QModelIndex_child( iVWeights, v );
-					nif->updateArraySize( iVertex );
-					QList<boneweight> list = weights.value( vertices[v] );
-
-					for ( int b = 0; b < maxBones; b++ )
-						nif->set<float>( QModelIndex_child( iVertex, b ), list.count() > b ? list[ b ].second : 0.0 );
-				}
-
-				nif->set<int>( iPart, "Has Faces", 1 );
-
-				if ( make_strips == true ) {
-					//Clear out any existing triangle data that might be left over from an existing Skin Partition
-					QModelIndex iTriangles = nif->getIndex( iPart, "Triangles" );
-					nif->updateArraySize( iTriangles );
-
-					// write the strips
-					QModelIndex iStripLengths = nif->getIndex( iPart, "Strip Lengths" );
-					nif->updateArraySize( iStripLengths );
+				QModelIndex iVertex = QModelIndex_child( iVWeights, v );
+				nif->updateArraySize( iVertex );
+				nif->setArray<float>( iVertex, vertexWeights );
 
-					for ( int s = 0; s < nif->rowCount( iStripLengths ); s++ )
-						nif->set<int>( QModelIndex_child( iStripLengths, s ), strips.value( s ).count() );
+				iVertex = QModelIndex_child( iVBones, v );
+				nif->updateArraySize( iVertex );
+				nif->setArray<int>( iVertex, vertexBones );
+			}
 
-					QModelIndex iStrips = nif->getIndex( iPart, "Strips" );
-					nif->updateArraySize( iStrips );
+			nif->set<int>( iPart, "Has Faces", 1 );
 
-					for ( int s = 0; s < nif->rowCount( iStrips ); s++ ) {
-						nif->updateArraySize( QModelIndex_child( iStrips, s ) );
-						nif->setArray<quint16>( QModelIndex_child( iStrips, s ), strips.value( s ) );
-					}
-				} else {
-					//Clear out any existing strip data that might be left over from an existing Skin Partition
-					QModelIndex iStripLengths = nif->getIndex( iPart, "Strip Lengths" );
-					nif->updateArraySize( iStripLengths );
-					QModelIndex iStrips = nif->getIndex( iPart, "Strips" );
-					nif->updateArraySize( iStrips );
-
-					QModelIndex iTriangles = nif->getIndex( iPart, "Triangles" );
-					nif->updateArraySize( iTriangles );
-					nif->setArray<Triangle>( iTriangles, triangles );
-				}
+			if ( settings.makeStrips ) {
+				//Clear out any existing triangle data that might be left over from an existing Skin Partition
+				QModelIndex iTriangles = nif->getIndex( iPart, "Triangles" );
+				nif->updateArraySize( iTriangles );
 
-				// fill in vertex bones
+				// write the strips
+				QModelIndex iStripLengths = nif->getIndex( iPart, "Strip Lengths" );
+				nif->updateArraySize( iStripLengths );
 
-				nif->set<int>( iPart, "Has Bone Indices", 1 );
-				QModelIndex iVBones = nif->getIndex( iPart, "Bone Indices" );
-				nif->updateArraySize( iVBones );
+				for ( int s = 0; s < nif->rowCount( iStripLengths ); s++ )
+					nif->set<int>( QModelIndex_child( iStripLengths, s ), strips.value( s ).count() );
 
-				for ( int v = 0; v < nif->rowCount( iVBones ); v++ ) {
-					QModelIndex iVertex = QModelIndex_child( iVBones, v );
-					nif->updateArraySize( iVertex );
-					QList<boneweight> list = weights.value( vertices[v] );
+				QModelIndex iStrips = nif->getIndex( iPart, "Strips" );
+				nif->updateArraySize( iStrips );
 
-					for ( int b = 0; b < maxBones; b++ )
-						nif->set<int>( QModelIndex_child( iVertex, b ), list.count() > b ? bones.indexOf( list[ b ].first ) : 0 );
+				for ( int s = 0; s < nif->rowCount( iStrips ); s++ ) {
+					nif->updateArraySize( QModelIndex_child( iStrips, s ) );
+					nif->setArray<quint16>( QModelIndex_child( iStrips, s ), strips.value( s ) );
 				}
+			} else {
+				//Clear out any existing strip data that might be left over from an existing Skin Partition
+				QModelIndex iStripLengths = nif->getIndex( iPart, "Strip Lengths" );
+				nif->updateArraySize( iStripLengths );
+				QModelIndex iStrips = nif->getIndex( iPart, "Strips" );
+				nif->updateArraySize( iStrips );
+
+				QModelIndex iTriangles = nif->getIndex( iPart, "Triangles" );
+				nif->updateArraySize( iTriangles );
+				nif->setArray<Triangle>( iTriangles, triangles );
 			}
-
-			// done
-
-			return iShape;
-		}
-		catch ( QString & err )
-		{
-			if ( !err.isEmpty() )
-				QMessageBox::warning( nullptr, "NifSkope", err );
-
-			return iShape;
-		}
-	}
-
-	static QList<int> mergeBones( QList<int> a, QList<int> b )
-	{
-		for ( const auto c : b ) {
-			if ( !a.contains( c ) ) {
-				a.append( c );
-			}
-		}
-		return a;
-	}
-
-	static bool containsBones( QList<int> a, QList<int> b )
-	{
-		for ( const auto c : b ) {
-			if ( !a.contains( c ) )
-				return false;
 		}
-		return true;
 	}
 };
 
@@ -1016,14 +749,11 @@ public:
 				indices.append( idx );
 		}
 
-		int mbpp = 0, mbpv = 0;
-		bool make_strips = false;
-
-		for ( const QPersistentModelIndex& idx : indices ) {
-			Partitioner.cast( nif, idx, mbpp, mbpv, make_strips );
-		}
+		// the settings dialog is shown once, and the shapes are partitioned in parallel
+		spSkinPartition::Settings settings;
+		int cnt = Partitioner.castShapes( nif, indices, settings );
 
-		qCWarning( nsSpell ) << Spell::tr( "did %1 partitions" ).arg( indices.count() );
+		qCWarning( nsSpell ) << Spell::tr( "did %1 partitions" ).arg( cnt );
 
 		return QModelIndex();
 	}
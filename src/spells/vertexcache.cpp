@@ -0,0 +1,779 @@
+#include "mesh.h"
+#include "qtcompat.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "io/MeshFile.h"
+#include "meshoptimizer/meshoptimizer.h"
+
+// Brief description is deliberately not autolinked to class Spell
+/*! \file vertexcache.cpp
+ * \brief Vertex cache optimization spells
+ *
+ * Triangles are reordered for the post-transform vertex cache and for overdraw,
+ * then vertices are reordered in the order of first use for better fetch locality.
+ * Triangle ranges that the game depends on (LOD and sub-index segments, skin
+ * partitions) are optimized separately and keep their position in the list.
+ *
+ * All classes here inherit from the Spell class.
+ */
+
+//! Vertex cache size used for the ACMR and ATVR statistics
+static constexpr unsigned int vertexCacheSize = 16;
+
+//! Post-transform vertex cache statistics of one or more triangle lists
+struct VertexCacheStats
+{
+	size_t	triangles = 0;
+	size_t	vertices = 0;
+	size_t	transformedBefore = 0;
+	size_t	transformedAfter = 0;
+
+	void analyze( const std::vector< unsigned int > & indices, size_t vertexCount, bool after )
+	{
+		if ( indices.empty() )
+			return;
+		meshopt_VertexCacheStatistics	s =
+			meshopt_analyzeVertexCache( indices.data(), indices.size(), vertexCount, vertexCacheSize, 0, 0 );
+		if ( after ) {
+			transformedAfter += s.vertices_transformed;
+		} else {
+			transformedBefore += s.vertices_transformed;
+			triangles += indices.size() / 3;
+			vertices += vertexCount;
+		}
+	}
+
+	void add( const VertexCacheStats & s )
+	{
+		triangles += s.triangles;
+		vertices += s.vertices;
+		transformedBefore += s.transformedBefore;
+		transformedAfter += s.transformedAfter;
+	}
+
+	QString toString() const
+	{
+		double	t = double( std::max< size_t >( triangles, 1 ) );
+		double	v = double( std::max< size_t >( vertices, 1 ) );
+		return Spell::tr( "ACMR: %1 -> %2, ATVR: %3 -> %4" )
+		       .arg( double( transformedBefore ) / t, 0, 'f', 3 ).arg( double( transformedAfter ) / t, 0, 'f', 3 )
+		       .arg( double( transformedBefore ) / v, 0, 'f', 3 ).arg( double( transformedAfter ) / v, 0, 'f', 3 );
+	}
+};
+
+//! Optimizes the order of triangles [first, end) for the vertex cache, and for overdraw if positions are available
+static void optimizeTriangleRange(
+	std::vector< unsigned int > & indices, size_t first, size_t end,
+	const std::vector< float > & positions, size_t vertexCount )
+{
+	size_t	n = ( end - first ) * 3;
+	if ( n < 6 )
+		return;
+	unsigned int *	p = indices.data() + ( first * 3 );
+	std::vector< unsigned int >	tmp( n );
+	meshopt_optimizeVertexCache( tmp.data(), p, n, vertexCount );
+	if ( positions.size() >= ( vertexCount * 3 ) )
+		meshopt_optimizeOverdraw( p, tmp.data(), n, positions.data(), vertexCount, sizeof(float) * 3, 1.05f );
+	else
+		std::memcpy( p, tmp.data(), n * sizeof(unsigned int) );
+}
+
+//! Optimizes a triangle list, splitting it at the triangle numbers in \a boundaries
+static void optimizeTriangles(
+	std::vector< unsigned int > & indices, std::vector< size_t > boundaries,
+	const std::vector< float > & positions, size_t vertexCount )
+{
+	size_t	triangleCnt = indices.size() / 3;
+	boundaries.push_back( 0 );
+	boundaries.push_back( triangleCnt );
+	for ( auto & b : boundaries )
+		b = std::min( b, triangleCnt );
+	std::sort( boundaries.begin(), boundaries.end() );
+	boundaries.erase( std::unique( boundaries.begin(), boundaries.end() ), boundaries.end() );
+	for ( size_t i = 1; i < boundaries.size(); i++ )
+		optimizeTriangleRange( indices, boundaries[i - 1], boundaries[i], positions, vertexCount );
+}
+
+//! Returns the vertex order (old index to new index) for fetch locality, unused vertices are moved to the end
+static std::vector< unsigned int > vertexFetchRemap( const std::vector< unsigned int > & indices, size_t vertexCount )
+{
+	std::vector< unsigned int >	remap( vertexCount );
+	size_t	n = meshopt_optimizeVertexFetchRemap( remap.data(), indices.data(), indices.size(), vertexCount );
+	for ( auto & v : remap ) {
+		if ( v == ~0U )
+			v = (unsigned int) ( n++ );
+	}
+	return remap;
+}
+
+//! Inverts a vertex remap table, returns an empty vector if the remap does not change the order
+static std::vector< unsigned int > invertRemap( const std::vector< unsigned int > & oldToNew )
+{
+	std::vector< unsigned int >	newToOld( oldToNew.size() );
+	bool	isIdentity = true;
+	for ( size_t i = 0; i < oldToNew.size(); i++ ) {
+		newToOld[oldToNew[i]] = (unsigned int) i;
+		isIdentity = isIdentity && ( oldToNew[i] == i );
+	}
+	if ( isIdentity )
+		newToOld.clear();
+	return newToOld;
+}
+
+static void getIndices( std::vector< unsigned int > & indices, const QVector< Triangle > & tris, size_t vertexCount )
+{
+	indices.clear();
+	indices.reserve( size_t( tris.size() ) * 3 );
+	for ( const Triangle & t : tris ) {
+		if ( t[0] >= vertexCount || t[1] >= vertexCount || t[2] >= vertexCount )
+			throw QString( Spell::tr( "Invalid vertex index in triangle data" ) );
+		indices.push_back( t[0] );
+		indices.push_back( t[1] );
+		indices.push_back( t[2] );
+	}
+}
+
+static QVector< Triangle > getTriangles( const std::vector< unsigned int > & indices, size_t first = 0, size_t end = size_t(-1) )
+{
+	end = std::min( end, indices.size() / 3 );
+	QVector< Triangle >	tris;
+	tris.reserve( qsizetype( end - std::min( first, end ) ) );
+	for ( size_t i = first; i < end; i++ )
+		tris.append( Triangle( quint16(indices[i * 3]), quint16(indices[i * 3 + 1]), quint16(indices[i * 3 + 2]) ) );
+	return tris;
+}
+
+static void collectLeafItems( std::vector< NifItem * > & leaves, NifItem * item )
+{
+	if ( !item->childCount() ) {
+		leaves.push_back( item );
+		return;
+	}
+	for ( int i = 0; i < item->childCount(); i++ )
+		collectLeafItems( leaves, item->child( i ) );
+}
+
+static size_t countLeafItems( const NifItem * item )
+{
+	if ( !item->childCount() )
+		return 1;
+	size_t	n = 0;
+	for ( int i = 0; i < item->childCount(); i++ )
+		n += countLeafItems( item->child( i ) );
+	return n;
+}
+
+//! Returns true if reorderRows() can reorder an array of \a vertexCount * \a rowsPerVertex rows with the same structure
+/*!
+ * This is used to check the vertex data before any other part of the shape is modified.
+ */
+static bool canReorderRows( const NifModel * nif, const QModelIndex & iArray, size_t vertexCount, size_t rowsPerVertex = 1 )
+{
+	const NifItem *	arrayItem = nif->getItem( iArray, false );
+	if ( !arrayItem || size_t( arrayItem->childCount() ) != ( vertexCount * rowsPerVertex ) )
+		return false;
+	size_t	leafCnt = 0;
+	for ( int i = 0; i < arrayItem->childCount(); i++ ) {
+		size_t	n = countLeafItems( arrayItem->child( i ) );
+		if ( i > 0 && n != leafCnt )
+			return false;
+		leafCnt = n;
+	}
+	return true;
+}
+
+//! Reorders the rows of an array of any type, row i of the result is row newToOld[i] of the original
+/*!
+ * If \a rowsPerVertex is greater than 1, each vertex has that many consecutive rows in the array.
+ */
+static bool reorderRows( NifModel * nif, const QModelIndex & iArray, const std::vector< unsigned int > & newToOld, size_t rowsPerVertex = 1 )
+{
+	if ( newToOld.empty() )
+		return true;
+	NifItem *	arrayItem = nif->getItem( iArray );
+	if ( !arrayItem || size_t( arrayItem->childCount() ) != ( newToOld.size() * rowsPerVertex ) )
+		return false;
+
+	std::vector< std::vector< NifItem * > >	leaves( size_t( arrayItem->childCount() ) );
+	for ( size_t i = 0; i < leaves.size(); i++ ) {
+		collectLeafItems( leaves[i], arrayItem->child( int(i) ) );
+		if ( leaves[i].size() != leaves[0].size() )
+			return false;
+	}
+	std::vector< NifValue >	values;
+	values.reserve( leaves.size() * leaves[0].size() );
+	for ( const auto & row : leaves ) {
+		for ( const NifItem * i : row )
+			values.push_back( i->value() );
+	}
+
+	size_t	leafCnt = leaves[0].size();
+	for ( size_t v = 0; v < newToOld.size(); v++ ) {
+		if ( newToOld[v] == v )
+			continue;
+		for ( size_t r = 0; r < rowsPerVertex; r++ ) {
+			const std::vector< NifItem * > &	dst = leaves[v * rowsPerVertex + r];
+			const NifValue *	src = values.data() + ( ( size_t( newToOld[v] ) * rowsPerVertex + r ) * leafCnt );
+			for ( size_t j = 0; j < leafCnt; j++ ) {
+				if ( !( dst[j]->value() == src[j] ) )
+					nif->setIndexValue( nif->itemToIndex( dst[j] ), src[j] );
+			}
+		}
+	}
+	return true;
+}
+
+//! Reorders a typed array, element i of the result is element newToOld[i] of the original
+template <typename T> static void reorderArray( NifModel * nif, const QModelIndex & iArray, const std::vector< unsigned int > & newToOld )
+{
+	if ( !iArray.isValid() )
+		return;
+	QVector< T >	a = nif->getArray< T >( iArray );
+	if ( size_t( a.size() ) != newToOld.size() )
+		return;
+	QVector< T >	b;
+	b.reserve( a.size() );
+	for ( unsigned int i : newToOld )
+		b.append( a.at( qsizetype(i) ) );
+	nif->setArray< T >( iArray, b );
+}
+
+//! Updates the vertex indices of the bone weights in NiSkinData
+static void remapSkinData( NifModel * nif, const QModelIndex & iSkinData, const std::vector< unsigned int > & oldToNew )
+{
+	QModelIndex	iBones = nif->getIndex( iSkinData, "Bone List" );
+	for ( int b = 0; b < nif->rowCount( iBones ); b++ ) {
+		QModelIndex	iWeights = nif->getIndex( QModelIndex_child( iBones, b ), "Vertex Weights" );
+		for ( int w = 0; w < nif->rowCount( iWeights ); w++ ) {
+			QModelIndex	iWeight = QModelIndex_child( iWeights, w );
+			int	v = nif->get<int>( iWeight, "Index" );
+			if ( v >= 0 && size_t( v ) < oldToNew.size() && oldToNew[v] != (unsigned int) v )
+				nif->set<int>( iWeight, "Index", int( oldToNew[v] ) );
+		}
+	}
+}
+
+static std::vector< float > getPositions( const QVector< Vector3 > & verts )
+{
+	std::vector< float >	positions( size_t( verts.size() ) * 3 );
+	for ( qsizetype i = 0; i < verts.size(); i++ ) {
+		positions[size_t(i) * 3] = verts.at( i )[0];
+		positions[size_t(i) * 3 + 1] = verts.at( i )[1];
+		positions[size_t(i) * 3 + 2] = verts.at( i )[2];
+	}
+	return positions;
+}
+
+//! Reorders triangles and vertices of a shape for the post-transform vertex cache and fetch locality
+class spOptimizeVertexCache final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Optimize Vertex Cache" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+
+	static bool isOptimizable( const NifModel * nif, const QModelIndex & index )
+	{
+		if ( nif->getBSVersion() >= 170 && nif->blockInherits( index, "BSGeometry" ) )
+			return ( ( nif->get<quint32>(index, "Flags") & 0x0200 ) != 0 );
+		if ( nif->isNiBlock( index, { "NiTriShape", "BSLODTriShape" } ) )
+			return nif->getBlockIndex( nif->getLink( index, "Data" ), "NiTriShapeData" ).isValid();
+		return nif->isNiBlock( index, { "BSTriShape", "BSMeshLODTriShape", "BSSubIndexTriShape", "BSDynamicTriShape" } );
+	}
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && index.isValid() && isOptimizable( nif, index );
+	}
+
+	static void optimizeTriShape( NifModel * nif, const QModelIndex & iShape, VertexCacheStats & stats );
+	static void optimizeBSTriShape( NifModel * nif, const QModelIndex & iShape, VertexCacheStats & stats );
+	static void optimizeSSESkinPartition( NifModel * nif, const QModelIndex & iShape, VertexCacheStats & stats );
+	static void optimizeSFMesh( NifModel * nif, const QModelIndex & iMesh, VertexCacheStats & stats );
+	//! Optimizes a single shape, throws QString on error
+	static void optimizeShape( NifModel * nif, const QModelIndex & index, VertexCacheStats & stats );
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		VertexCacheStats	stats;
+		nif->setState( BaseModel::Processing );
+		try {
+			optimizeShape( nif, index, stats );
+		} catch ( QString & e ) {
+			nif->restoreState();
+			Message::warning( nullptr, Spell::tr( "There were errors during the operation" ), e );
+			return index;
+		}
+		nif->restoreState();
+		Message::info( nullptr, stats.toString() );
+		return index;
+	}
+};
+
+void spOptimizeVertexCache::optimizeTriShape( NifModel * nif, const QModelIndex & iShape, VertexCacheStats & stats )
+{
+	QModelIndex	iData = nif->getBlockIndex( nif->getLink( iShape, "Data" ), "NiTriShapeData" );
+	if ( !iData.isValid() )
+		return;
+
+	// all new data is calculated first, the model is only modified after no more errors can occur
+	QVector< Vector3 >	verts = nif->getArray<Vector3>( iData, "Vertices" );
+	size_t	numVerts = size_t( verts.size() );
+	std::vector< unsigned int >	indices;
+	getIndices( indices, nif->getArray<Triangle>( iData, "Triangles" ), numVerts );
+	if ( indices.empty() )
+		return;
+	std::vector< float >	positions = getPositions( verts );
+	VertexCacheStats	s;
+	s.analyze( indices, numVerts, false );
+
+	std::vector< size_t >	boundaries;
+	if ( nif->isNiBlock( iShape, "BSLODTriShape" ) ) {
+		boundaries.push_back( nif->get<quint32>( iShape, "LOD0 Size" ) );
+		boundaries.push_back( boundaries.back() + nif->get<quint32>( iShape, "LOD1 Size" ) );
+	}
+	optimizeTriangles( indices, boundaries, positions, numVerts );
+
+	QModelIndex	iSkinInst = nif->getBlockIndex( nif->getLink( iShape, "Skin Instance" ), "NiSkinInstance" );
+	QModelIndex	iSkinData = nif->getBlockIndex( nif->getLink( iSkinInst, "Data" ), "NiSkinData" );
+	QModelIndex	iSkinPart = nif->getBlockIndex( nif->getLink( iSkinInst, "Skin Partition" ), "NiSkinPartition" );
+	if ( !iSkinPart.isValid() )
+		iSkinPart = nif->getBlockIndex( nif->getLink( iSkinData, "Skin Partition" ), "NiSkinPartition" );
+	QModelIndex	iPartitions = nif->getIndex( iSkinPart, "Partitions" );
+
+	// partitions without a vertex map depend on the original vertex order
+	bool	reorderVertices = true;
+	for ( int p = 0; p < nif->rowCount( iPartitions ); p++ ) {
+		if ( nif->getArray<int>( QModelIndex_child( iPartitions, p ), "Vertex Map" ).isEmpty() )
+			reorderVertices = false;
+	}
+
+	// tangent space stored as extra data (Oblivion), the tangents of all vertices followed by the bitangents
+	QModelIndex	iTSpace;
+	QByteArray	tangentSpace;
+	QModelIndex	iExtraData = nif->getIndex( iShape, "Extra Data List" );
+	for ( int e = 0; e < nif->rowCount( iExtraData ); e++ ) {
+		QModelIndex	iExtra = nif->getBlockIndex( nif->getLink( QModelIndex_child( iExtraData, e ) ), "NiBinaryExtraData" );
+		if ( iExtra.isValid() && nif->get<QString>( iExtra, "Name" ) == "Tangent space (binormal & tangent vectors)" ) {
+			iTSpace = iExtra;
+			tangentSpace = nif->get<QByteArray>( iExtra, "Binary Data" );
+			if ( size_t( tangentSpace.size() ) != ( numVerts * sizeof(Vector3) * 2 ) )
+				reorderVertices = false;
+			break;
+		}
+	}
+
+	std::vector< unsigned int >	oldToNew( numVerts );
+	for ( size_t i = 0; i < numVerts; i++ )
+		oldToNew[i] = (unsigned int) i;
+	std::vector< unsigned int >	newToOld;
+	if ( reorderVertices ) {
+		oldToNew = vertexFetchRemap( indices, numVerts );
+		newToOld = invertRemap( oldToNew );
+		for ( auto & v : indices )
+			v = oldToNew[v];
+	}
+	s.analyze( indices, numVerts, true );
+
+	if ( !newToOld.empty() && !tangentSpace.isEmpty() ) {
+		QByteArray	tmp( tangentSpace );
+		const Vector3 *	src = reinterpret_cast< const Vector3 * >( tmp.constData() );
+		Vector3 *	dst = reinterpret_cast< Vector3 * >( tangentSpace.data() );
+		for ( size_t i = 0; i < numVerts; i++ ) {
+			dst[i] = src[newToOld[i]];
+			dst[numVerts + i] = src[numVerts + newToOld[i]];
+		}
+	}
+
+	// partition triangles use local vertex numbers, only their order is optimized
+	// the partitions contain the same triangles as the shape, and are what skinned shapes are rendered with,
+	// so if there are any, the statistics are those of the partitions instead of the shape data
+	VertexCacheStats	partStats;
+	struct PartitionData {
+		QModelIndex	iPart;
+		QVector< int >	vertexMap;
+		std::vector< unsigned int >	indices;
+	};
+	std::vector< PartitionData >	partitions;
+	for ( int p = 0; p < nif->rowCount( iPartitions ); p++ ) {
+		PartitionData &	part = partitions.emplace_back();
+		part.iPart = QModelIndex_child( iPartitions, p );
+		part.vertexMap = nif->getArray<int>( part.iPart, "Vertex Map" );
+		size_t	numPartVerts = size_t( part.vertexMap.size() );
+		for ( auto & v : part.vertexMap ) {
+			if ( v < 0 || size_t( v ) >= numVerts )
+				throw QString( Spell::tr( "Invalid vertex index in skin partition" ) );
+		}
+		if ( nif->get<int>( part.iPart, "Num Strips" ) != 0 )
+			continue;
+
+		getIndices( part.indices, nif->getArray<Triangle>( part.iPart, "Triangles" ), numPartVerts );
+		if ( part.indices.empty() )
+			continue;
+		std::vector< float >	partPositions( numPartVerts * 3 );
+		for ( size_t i = 0; i < numPartVerts; i++ ) {
+			size_t	v = size_t( part.vertexMap.at( qsizetype(i) ) );
+			std::memcpy( partPositions.data() + ( i * 3 ), positions.data() + ( v * 3 ), sizeof(float) * 3 );
+		}
+		partStats.analyze( part.indices, numPartVerts, false );
+		optimizeTriangles( part.indices, {}, partPositions, numPartVerts );
+		partStats.analyze( part.indices, numPartVerts, true );
+	}
+	if ( partStats.triangles )
+		s = partStats;
+
+	nif->setArray<Triangle>( iData, "Triangles", getTriangles( indices ) );
+
+	if ( !newToOld.empty() ) {
+		reorderArray<Vector3>( nif, nif->getIndex( iData, "Vertices" ), newToOld );
+		reorderArray<Vector3>( nif, nif->getIndex( iData, "Normals" ), newToOld );
+		reorderArray<Vector3>( nif, nif->getIndex( iData, "Tangents" ), newToOld );
+		reorderArray<Vector3>( nif, nif->getIndex( iData, "Bitangents" ), newToOld );
+		reorderArray<Color4>( nif, nif->getIndex( iData, "Vertex Colors" ), newToOld );
+		QModelIndex	iUVSets = nif->getIndex( iData, "UV Sets" );
+		for ( int r = 0; r < nif->rowCount( iUVSets ); r++ )
+			reorderArray<Vector2>( nif, QModelIndex_child( iUVSets, r ), newToOld );
+		if ( iTSpace.isValid() && !tangentSpace.isEmpty() )
+			nif->set<QByteArray>( iTSpace, "Binary Data", tangentSpace );
+
+		// groups of vertices with shared normals
+		QModelIndex	iMatchGroups = nif->getIndex( iData, "Match Groups" );
+		for ( int g = 0; g < nif->rowCount( iMatchGroups ); g++ ) {
+			QModelIndex	iGroup = nif->getIndex( QModelIndex_child( iMatchGroups, g ), "Vertex Indices" );
+			QVector< quint16 >	group = nif->getArray<quint16>( iGroup );
+			for ( auto & v : group ) {
+				if ( size_t( v ) < numVerts )
+					v = quint16( oldToNew[v] );
+			}
+			nif->setArray<quint16>( iGroup, group );
+		}
+
+		// morph targets
+		QModelIndex	iCtrl = nif->getBlockIndex( nif->getLink( iShape, "Controller" ) );
+		for ( int n = 0; iCtrl.isValid() && n < 256; n++ ) {
+			if ( nif->isNiBlock( iCtrl, "NiGeomMorpherController" ) ) {
+				QModelIndex	iMorphData = nif->getBlockIndex( nif->getLink( iCtrl, "Data" ), "NiMorphData" );
+				QModelIndex	iMorphs = nif->getIndex( iMorphData, "Morphs" );
+				for ( int m = 0; m < nif->rowCount( iMorphs ); m++ )
+					reorderArray<Vector3>( nif, nif->getIndex( QModelIndex_child( iMorphs, m ), "Vectors" ), newToOld );
+			}
+			iCtrl = nif->getBlockIndex( nif->getLink( iCtrl, "Next Controller" ) );
+		}
+
+		remapSkinData( nif, iSkinData, oldToNew );
+	}
+
+	for ( PartitionData & part : partitions ) {
+		if ( !newToOld.empty() ) {
+			for ( auto & v : part.vertexMap )
+				v = int( oldToNew[v] );
+			nif->setArray<int>( part.iPart, "Vertex Map", part.vertexMap );
+		}
+		if ( !part.indices.empty() )
+			nif->setArray<Triangle>( part.iPart, "Triangles", getTriangles( part.indices ) );
+	}
+
+	stats.add( s );
+}
+
+void spOptimizeVertexCache::optimizeBSTriShape( NifModel * nif, const QModelIndex & iShape, VertexCacheStats & stats )
+{
+	auto	vf = nif->get<BSVertexDesc>( iShape, "Vertex Desc" );
+	if ( ( vf & VertexFlags::VF_SKINNED ) && nif->getBSVersion() == 100 ) {
+		optimizeSSESkinPartition( nif, iShape, stats );
+		return;
+	}
+
+	QModelIndex	iVertData = nif->getIndex( iShape, "Vertex Data" );
+	size_t	numVerts = size_t( nif->rowCount( iVertData ) );
+	if ( !numVerts )
+		return;
+	QVector< Vector3 >	verts;
+	verts.reserve( qsizetype(numVerts) );
+	for ( size_t i = 0; i < numVerts; i++ )
+		verts.append( nif->get<Vector3>( nif->index( int(i), 0, iVertData ), "Vertex" ) );
+	std::vector< unsigned int >	indices;
+	getIndices( indices, nif->getArray<Triangle>( iShape, "Triangles" ), numVerts );
+	if ( indices.empty() )
+		return;
+	std::vector< float >	positions = getPositions( verts );
+	VertexCacheStats	s;
+	s.analyze( indices, numVerts, false );
+
+	std::vector< size_t >	boundaries;
+	if ( nif->isNiBlock( iShape, "BSMeshLODTriShape" ) ) {
+		boundaries.push_back( nif->get<quint32>( iShape, "LOD0 Size" ) );
+		boundaries.push_back( boundaries.back() + nif->get<quint32>( iShape, "LOD1 Size" ) );
+	} else if ( nif->isNiBlock( iShape, "BSSubIndexTriShape" ) ) {
+		QModelIndex	iSegments = nif->getIndex( iShape, "Segment" );
+		for ( int n = 0; n < nif->rowCount( iSegments ); n++ ) {
+			QModelIndex	iSegment = QModelIndex_child( iSegments, n );
+			size_t	first = nif->get<quint32>( iSegment, "Start Index" ) / 3U;
+			boundaries.push_back( first );
+			boundaries.push_back( first + nif->get<quint32>( iSegment, "Num Primitives" ) );
+			QModelIndex	iSubSegments = nif->getIndex( iSegment, "Sub Segment" );
+			for ( int i = 0; i < nif->rowCount( iSubSegments ); i++ ) {
+				QModelIndex	iSubSegment = QModelIndex_child( iSubSegments, i );
+				first = nif->get<quint32>( iSubSegment, "Start Index" ) / 3U;
+				boundaries.push_back( first );
+				boundaries.push_back( first + nif->get<quint32>( iSubSegment, "Num Primitives" ) );
+			}
+		}
+	}
+	optimizeTriangles( indices, boundaries, positions, numVerts );
+
+	std::vector< unsigned int >	oldToNew = vertexFetchRemap( indices, numVerts );
+	std::vector< unsigned int >	newToOld = invertRemap( oldToNew );
+	for ( auto & v : indices )
+		v = oldToNew[v];
+	s.analyze( indices, numVerts, true );
+
+	// the model is only modified after the vertex data has been checked
+	if ( !newToOld.empty() && !canReorderRows( nif, iVertData, numVerts ) )
+		throw QString( Spell::tr( "Vertex array size differs" ) );
+
+	nif->setArray<Triangle>( iShape, "Triangles", getTriangles( indices ) );
+	if ( !newToOld.empty() ) {
+		reorderRows( nif, iVertData, newToOld );
+		if ( nif->isNiBlock( iShape, "BSDynamicTriShape" ) )
+			reorderArray<Vector4>( nif, nif->getIndex( iShape, "Vertices" ), newToOld );
+	}
+
+	stats.add( s );
+}
+
+void spOptimizeVertexCache::optimizeSSESkinPartition( NifModel * nif, const QModelIndex & iShape, VertexCacheStats & stats )
+{
+	QModelIndex	iSkinInst = nif->getBlockIndex( nif->getLink( iShape, "Skin" ), "NiSkinInstance" );
+	QModelIndex	iSkinData = nif->getBlockIndex( nif->getLink( iSkinInst, "Data" ), "NiSkinData" );
+	QModelIndex	iSkinPart = nif->getBlockIndex( nif->getLink( iSkinInst, "Skin Partition" ), "NiSkinPartition" );
+	QModelIndex	iVertData = nif->getIndex( iSkinPart, "Vertex Data" );
+	QModelIndex	iPartitions = nif->getIndex( iSkinPart, "Partitions" );
+	size_t	numVerts = size_t( nif->rowCount( iVertData ) );
+	int	numParts = nif->rowCount( iPartitions );
+	if ( !numVerts || numParts < 1 )
+		return;
+
+	QVector< Vector3 >	verts;
+	verts.reserve( qsizetype(numVerts) );
+	for ( size_t i = 0; i < numVerts; i++ )
+		verts.append( nif->get<Vector3>( nif->index( int(i), 0, iVertData ), "Vertex" ) );
+	std::vector< float >	positions = getPositions( verts );
+
+	// the partition triangles of Skyrim SE refer to the shared vertex data
+	std::vector< unsigned int >	indices;
+	std::vector< size_t >	boundaries;
+	bool	reorderVertices = true;
+	for ( int p = 0; p < numParts; p++ ) {
+		QModelIndex	iPart = QModelIndex_child( iPartitions, p );
+		if ( nif->get<int>( iPart, "Num Strips" ) != 0 )
+			throw QString( Spell::tr( "Skin partitions with strips are not supported" ) );
+		if ( nif->getArray<int>( iPart, "Vertex Map" ).isEmpty() )
+			reorderVertices = false;
+		std::vector< unsigned int >	partIndices;
+		getIndices( partIndices, nif->getArray<Triangle>( iPart, "Triangles" ), numVerts );
+		boundaries.push_back( indices.size() / 3 );
+		indices.insert( indices.end(), partIndices.begin(), partIndices.end() );
+	}
+	if ( indices.empty() )
+		return;
+	VertexCacheStats	s;
+	s.analyze( indices, numVerts, false );
+	optimizeTriangles( indices, boundaries, positions, numVerts );
+
+	std::vector< unsigned int >	oldToNew;
+	std::vector< unsigned int >	newToOld;
+	if ( reorderVertices ) {
+		oldToNew = vertexFetchRemap( indices, numVerts );
+		newToOld = invertRemap( oldToNew );
+		for ( auto & v : indices )
+			v = oldToNew[v];
+	}
+	s.analyze( indices, numVerts, true );
+
+	if ( !newToOld.empty() && !canReorderRows( nif, iVertData, numVerts ) )
+		throw QString( Spell::tr( "Vertex array size differs" ) );
+
+	boundaries.push_back( indices.size() / 3 );
+	for ( int p = 0; p < numParts; p++ ) {
+		QModelIndex	iPart = QModelIndex_child( iPartitions, p );
+		QVector< Triangle >	tris = getTriangles( indices, boundaries[p], boundaries[p + 1] );
+		nif->setArray<Triangle>( iPart, "Triangles", tris );
+		QModelIndex	iTrianglesCopy = nif->getIndex( iPart, "Triangles Copy" );
+		if ( iTrianglesCopy.isValid() && nif->rowCount( iTrianglesCopy ) == tris.size() )
+			nif->setArray<Triangle>( iTrianglesCopy, tris );
+		if ( !newToOld.empty() ) {
+			QVector< int >	vertexMap = nif->getArray<int>( iPart, "Vertex Map" );
+			for ( auto & v : vertexMap ) {
+				if ( v >= 0 && size_t( v ) < numVerts )
+					v = int( oldToNew[v] );
+			}
+			nif->setArray<int>( iPart, "Vertex Map", vertexMap );
+		}
+	}
+
+	if ( !newToOld.empty() ) {
+		reorderRows( nif, iVertData, newToOld );
+		remapSkinData( nif, iSkinData, oldToNew );
+	}
+
+	stats.add( s );
+}
+
+void spOptimizeVertexCache::optimizeSFMesh( NifModel * nif, const QModelIndex & iMesh, VertexCacheStats & stats )
+{
+	QModelIndex	iMeshData = nif->getIndex( iMesh, "Mesh Data" );
+	if ( !iMeshData.isValid() )
+		return;
+
+	std::uint32_t	numVerts = nif->get<quint32>( iMeshData, "Num Verts" );
+	if ( !numVerts )
+		return;
+	std::uint32_t	weightsPerVertex = nif->get<quint32>( iMeshData, "Weights Per Vertex" );
+	std::uint32_t	numUVs = nif->get<quint32>( iMeshData, "Num UVs" );
+	std::uint32_t	numUVs2 = nif->get<quint32>( iMeshData, "Num UVs 2" );
+	std::uint32_t	numColors = nif->get<quint32>( iMeshData, "Num Vertex Colors" );
+	std::uint32_t	numNormals = nif->get<quint32>( iMeshData, "Num Normals" );
+	std::uint32_t	numTangents = nif->get<quint32>( iMeshData, "Num Tangents" );
+	std::uint32_t	numWeights = nif->get<quint32>( iMeshData, "Num Weights" );
+	if ( ( numUVs && numUVs != numVerts ) || ( numUVs2 && numUVs2 != numVerts )
+		|| ( numColors && numColors != numVerts ) || ( numNormals && numNormals != numVerts )
+		|| ( numTangents && numTangents != numVerts ) || ( numWeights != ( size_t(numVerts) * weightsPerVertex ) ) ) {
+		throw QString( Spell::tr( "Mesh has inconsistent number of vertex attributes" ) );
+	}
+
+	std::vector< float >	positions( size_t(numVerts) * 3 );
+	for ( auto i = nif->getItem( iMeshData, "Vertices" ); i; ) {
+		for ( std::uint32_t j = 0; j < numVerts; j++ ) {
+			Vector3	v = nif->get<Vector3>( i->child( int(j) ) );
+			positions[size_t(j) * 3] = v[0];
+			positions[size_t(j) * 3 + 1] = v[1];
+			positions[size_t(j) * 3 + 2] = v[2];
+		}
+		break;
+	}
+
+	// the base triangle list and the LODs of skinned meshes are optimized separately
+	std::vector< QModelIndex >	triangleLists;
+	triangleLists.push_back( iMeshData );
+	QModelIndex	iLODs = nif->getIndex( iMeshData, "LODs" );
+	for ( int l = 0; l < int( nif->get<quint32>( iMeshData, "Num LODs" ) ) && l < nif->rowCount( iLODs ); l++ )
+		triangleLists.push_back( QModelIndex_child( iLODs, l ) );
+
+	std::vector< unsigned int >	indices;
+	std::vector< size_t >	listOffsets;
+	for ( const auto & iList : triangleLists ) {
+		std::vector< unsigned int >	listIndices;
+		getIndices( listIndices, nif->getArray<Triangle>( iList, "Triangles" ), numVerts );
+		stats.analyze( listIndices, numVerts, false );
+		optimizeTriangles( listIndices, {}, positions, numVerts );
+		listOffsets.push_back( indices.size() / 3 );
+		indices.insert( indices.end(), listIndices.begin(), listIndices.end() );
+	}
+	listOffsets.push_back( indices.size() / 3 );
+	if ( indices.empty() )
+		return;
+
+	std::vector< unsigned int >	oldToNew = vertexFetchRemap( indices, numVerts );
+	std::vector< unsigned int >	newToOld = invertRemap( oldToNew );
+	for ( auto & v : indices )
+		v = oldToNew[v];
+	for ( size_t l = 0; l < triangleLists.size(); l++ ) {
+		QVector< Triangle >	tris = getTriangles( indices, listOffsets[l], listOffsets[l + 1] );
+		nif->setArray<Triangle>( triangleLists[l], "Triangles", tris );
+		std::vector< unsigned int >	listIndices( indices.begin() + std::ptrdiff_t( listOffsets[l] * 3 ),
+		                                          indices.begin() + std::ptrdiff_t( listOffsets[l + 1] * 3 ) );
+		stats.analyze( listIndices, numVerts, true );
+	}
+
+	if ( !newToOld.empty() ) {
+		reorderRows( nif, nif->getIndex( iMeshData, "Vertices" ), newToOld );
+		if ( numUVs )
+			reorderRows( nif, nif->getIndex( iMeshData, "UVs" ), newToOld );
+		if ( numUVs2 )
+			reorderRows( nif, nif->getIndex( iMeshData, "UVs 2" ), newToOld );
+		if ( numColors )
+			reorderRows( nif, nif->getIndex( iMeshData, "Vertex Colors" ), newToOld );
+		if ( numNormals )
+			reorderRows( nif, nif->getIndex( iMeshData, "Normals" ), newToOld );
+		if ( numTangents )
+			reorderRows( nif, nif->getIndex( iMeshData, "Tangents" ), newToOld );
+		if ( numWeights )
+			reorderRows( nif, nif->getIndex( iMeshData, "Weights" ), newToOld, weightsPerVertex );
+	}
+
+	// meshlets depend on the order of triangles
+	if ( nif->get<quint32>( iMeshData, "Num Meshlets" ) > 0 ) {
+		MeshFile	meshFile( nif, iMesh );
+		spGenerateMeshlets::updateMeshlets( nif, iMeshData, meshFile );
+	}
+}
+
+void spOptimizeVertexCache::optimizeShape( NifModel * nif, const QModelIndex & index, VertexCacheStats & stats )
+{
+	if ( nif->blockInherits( index, "BSGeometry" ) ) {
+		if ( !( nif->get<quint32>(index, "Flags") & 0x0200 ) )
+			return;
+		QModelIndex	iMeshes = nif->getIndex( index, "Meshes" );
+		for ( int l = 0; l < nif->rowCount( iMeshes ); l++ ) {
+			QModelIndex	iMesh = QModelIndex_child( iMeshes, l );
+			if ( nif->get<bool>( iMesh, "Has Mesh" ) )
+				optimizeSFMesh( nif, nif->getIndex( iMesh, "Mesh" ), stats );
+		}
+	} else if ( nif->isNiBlock( index, { "NiTriShape", "BSLODTriShape" } ) ) {
+		optimizeTriShape( nif, index, stats );
+	} else if ( nif->isNiBlock( index, { "BSTriShape", "BSMeshLODTriShape", "BSSubIndexTriShape", "BSDynamicTriShape" } ) ) {
+		optimizeBSTriShape( nif, index, stats );
+	}
+}
+
+REGISTER_SPELL( spOptimizeVertexCache )
+
+//! Optimizes the vertex cache of all shapes
+class spOptimizeAllVertexCaches final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Optimize Vertex Cache of All Shapes" ); }
+	QString page() const override final { return Spell::tr( "Optimize" ); }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid();
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		VertexCacheStats	stats;
+		QStringList	details;
+		QStringList	errors;
+		int	shapeCnt = 0;
+
+		nif->setState( BaseModel::Processing );
+		for ( int b = 0; b < nif->getBlockCount(); b++ ) {
+			QModelIndex	iBlock = nif->getBlockIndex( b );
+			if ( !( iBlock.isValid() && spOptimizeVertexCache::isOptimizable( nif, iBlock ) ) )
+				continue;
+			VertexCacheStats	s;
+			try {
+				spOptimizeVertexCache::optimizeShape( nif, iBlock, s );
+			} catch ( QString & e ) {
+				errors.append( QString( "%1 (%2): %3" ).arg( b ).arg( nif->itemName( iBlock ), e ) );
+				continue;
+			}
+			if ( !s.triangles )
+				continue;
+			details.append( QString( "%1 (%2): %3" ).arg( b ).arg( nif->itemName( iBlock ), s.toString() ) );
+			stats.add( s );
+			shapeCnt++;
+		}
+		nif->restoreState();
+
+		if ( !errors.isEmpty() )
+			Message::warning( nullptr, Spell::tr( "There were errors during the operation" ), errors.join( "\n" ) );
+		Message::info( nullptr, Spell::tr( "Optimized %1 shapes\n%2" ).arg( shapeCnt ).arg( stats.toString() ), details.join( "\n" ) );
+		return index;
+	}
+};
+
+REGISTER_SPELL( spOptimizeAllVertexCaches )
@@ -41,10 +41,15 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QApplication>
 #include <QMimeData>
 #include <QClipboard>
+#include <QElapsedTimer>
 #include <QKeyEvent>
+#include <QTimer>
 
 #include <vector>
 
+//! Time in milliseconds that updating the row visibility may take before the rest is done in a later event
+static const qint64 conditionTimeBudget = 10;
+
 NifTreeView::NifTreeView( QWidget * parent, Qt::WindowFlags flags ) : QTreeView()
 {
 	Q_UNUSED( flags );
@@ -53,6 +58,14 @@ NifTreeView::NifTreeView( QWidget * parent, Qt::WindowFlags flags ) : QTreeView(
 
 	connect( this, &NifTreeView::expanded, this, &NifTreeView::scrollExpand );
 	connect( this, &NifTreeView::collapsed, this, &NifTreeView::onItemCollapsed );
+
+	// The rows of collapsed items are only updated when they are expanded
+	connect( this, &NifTreeView::expanded, this, &NifTreeView::updateConditionRecurse );
+
+	conditionTimer = new QTimer( this );
+	conditionTimer->setSingleShot( true );
+	conditionTimer->setInterval( 0 );
+	connect( conditionTimer, &QTimer::timeout, this, &NifTreeView::processConditions );
 }
 
 NifTreeView::~NifTreeView()
@@ -61,15 +74,23 @@ NifTreeView::~NifTreeView()
 
 void NifTreeView::setModel( QAbstractItemModel * model )
 {
-	if ( nif )
+	if ( nif ) {
 		disconnect( nif, &BaseModel::dataChanged, this, &NifTreeView::updateConditions );
+		disconnect( nif, &BaseModel::layoutAboutToBeChanged, this, &NifTreeView::restartConditions );
+	}
 
 	nif = qobject_cast<BaseModel *>( model );
 
+	hiddenItems.clear();
+	pendingConditions.clear();
+	restartConditions();
+
 	QTreeView::setModel( model );
 
-	if ( nif )
+	if ( nif ) {
 		connect( nif, &BaseModel::dataChanged, this, &NifTreeView::updateConditions );
+		connect( nif, &BaseModel::layoutAboutToBeChanged, this, &NifTreeView::restartConditions );
+	}
 }
 
 void NifTreeView::setRootIndex( const QModelIndex & index )
@@ -98,7 +119,10 @@ void NifTreeView::setRowHiding( bool show )
 		connect( nif, &BaseModel::dataChanged, this, &NifTreeView::updateConditions );
 
 	// refresh
-	updateConditionRecurse( rootIndex() );
+	if ( nif ) {
+		pendingConditions.append( { rootIndex(), !rootIndex().isValid() } );
+		processConditions();
+	}
 	doItemsLayout();
 }
 
@@ -288,12 +312,11 @@ void NifTreeView::updateConditions( const QModelIndex & topLeft, const QModelInd
 
 	Q_UNUSED( bottomRight );
 	updateConditionRecurse( topLeft.parent() );
-	doItemsLayout();
 }
 
 void NifTreeView::updateConditionRecurse( const QModelIndex & index )
 {
-	if ( nif->getState() != BaseModel::Default )
+	if ( !nif || nif->getState() != BaseModel::Default )
 		return;
 
 	NifItem * item = static_cast<NifItem *>(index.internalPointer());
@@ -304,12 +327,153 @@ void NifTreeView::updateConditionRecurse( const QModelIndex & index )
 	if ( item->parent() && item->parent()->isArray() && !item->childCount() )
 		return;
 
-	for ( int r = 0; r < model()->rowCount( index ); r++ ) {
-		QModelIndex child = model()->index( r, 0, index );
-		updateConditionRecurse( child );
+	// Nothing to do if the index is in a subtree that is already queued, the traversal of the first subtree
+	// may already have passed the index if it has been started
+	for ( qsizetype n = ( conditionsStarted ? 1 : 0 ); n < pendingConditions.size(); n++ ) {
+		const PendingConditions & p = pendingConditions.at( n );
+		if ( p.all )
+			return;
+		for ( QModelIndex i = index; i.isValid(); i = i.parent() ) {
+			if ( i == p.index )
+				return;
+		}
+	}
+
+	pendingConditions.append( { index, false } );
+	processConditions();
+}
+
+void NifTreeView::processConditions()
+{
+	if ( !nif || nif->getState() != BaseModel::Default )
+		return;
+
+	QElapsedTimer timer;
+	timer.start();
+	int steps = 0;
+
+	while ( !pendingConditions.isEmpty() ) {
+		if ( conditionStack.empty() ) {
+			if ( conditionsStarted ) {
+				// Subtree finished
+				pendingConditions.removeFirst();
+				conditionsStarted = false;
+				continue;
+			}
+
+			const PendingConditions & p = pendingConditions.first();
+			QModelIndex root = p.index;
+			conditionsStarted = true;
+
+			if ( !p.all ) {
+				// Removed from the model
+				if ( !root.isValid() )
+					continue;
+
+				updateRowHidden( root );
+
+				// The children of the subtree root are updated even if it is collapsed
+				const NifItem * item = static_cast<const NifItem *>( root.internalPointer() );
+				if ( !item || !item->childCount() || ( item->isArray() && !item->child( 0 )->childCount() ) )
+					continue;
+			}
+
+			conditionStack.emplace_back( root, 0 );
+		}
+
+		auto & top = conditionStack.back();
+		if ( top.second >= model()->rowCount( top.first ) ) {
+			conditionStack.pop_back();
+			continue;
+		}
+
+		QModelIndex child = model()->index( top.second++, 0, top.first );
+		if ( updateRowHidden( child ) )
+			conditionStack.emplace_back( child, 0 );
+
+		if ( ( ++steps & 255 ) == 0 && timer.elapsed() >= conditionTimeBudget ) {
+			conditionTimer->start();
+			return;
+		}
+	}
+}
+
+bool NifTreeView::updateRowHidden( const QModelIndex & index )
+{
+	const NifItem * item = static_cast<const NifItem *>( index.internalPointer() );
+	if ( !item )
+		return false;
+
+	// Skip flat array items
+	if ( item->parent() && item->parent()->isArray() && !item->childCount() )
+		return false;
+
+	bool hide = isRowHidden( item );
+	if ( hide != hiddenItems.contains( item ) ) {
+		if ( hide )
+			hiddenItems.insert( item );
+		else
+			hiddenItems.remove( item );
+
+		setRowHidden( index.row(), index.parent(), hide );
+	}
+
+	// Rows in hidden or collapsed subtrees are updated when they are shown
+	if ( hide || !item->childCount() || !isExpanded( index ) )
+		return false;
+
+	return !( item->isArray() && !item->child( 0 )->childCount() );
+}
+
+void NifTreeView::restartConditions()
+{
+	conditionStack.clear();
+	conditionsStarted = false;
+
+	if ( !pendingConditions.isEmpty() )
+		conditionTimer->start();
+}
+
+void NifTreeView::reset()
+{
+	hiddenItems.clear();
+	pendingConditions.clear();
+	restartConditions();
+
+	QTreeView::reset();
+}
+
+void NifTreeView::rowsInserted( const QModelIndex & parent, int start, int end )
+{
+	// The row numbers in the traversal stack may have changed
+	restartConditions();
+
+	QTreeView::rowsInserted( parent, start, end );
+}
+
+void NifTreeView::rowsAboutToBeRemoved( const QModelIndex & parent, int start, int end )
+{
+	restartConditions();
+
+	// Forget the hidden items that are removed, including the children of removed rows
+	const NifItem * parentItem = static_cast<const NifItem *>( parent.internalPointer() );
+	for ( auto i = hiddenItems.begin(); i != hiddenItems.end(); ) {
+		bool removed = false;
+		for ( const NifItem * a = *i; a && a->parent(); a = a->parent() ) {
+			bool sameParent = ( parentItem ? a->parent() == parentItem : !a->parent()->parent() );
+			if ( sameParent ) {
+				removed = ( a->row() >= start && a->row() <= end );
+				break;
+			}
+		}
+
+		if ( removed )
+			i = hiddenItems.erase( i );
+		else
+			++i;
 	}
 
-	setRowHidden( index.row(), index.parent(), isRowHidden(item) );
+	QTreeView::rowsAboutToBeRemoved( parent, start, end );
 }
 
 auto splitMime = []( QString format ) {
@@ -36,7 +36,13 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QTreeView> // Inherited
 #include <data/nifvalue.h>
 
+#include <QList>
+#include <QPersistentModelIndex>
+#include <QSet>
+
 #include <memory>
+#include <utility>
+#include <vector>
 
 class NifItem;
 
@@ -62,6 +68,8 @@ public:
 	bool isRowHidden( int row, const QModelIndex & parent ) const;
 protected:
 	bool isRowHidden( const NifItem * rowItem ) const;
+	//! Hides or shows the row of an item if its condition changed, returns true if its children should be updated
+	bool updateRowHidden( const QModelIndex & index );
 
 public:
 	//! Minimum size
@@ -85,8 +93,12 @@ public slots:
 	//! Updates version conditions (connect to dataChanged)
 	void updateConditions( const QModelIndex & topLeft, const QModelIndex & bottomRight );
 protected slots:
-	//! Recursively updates version conditions
+	//! Recursively updates version conditions, large subtrees are processed over several events
 	void updateConditionRecurse( const QModelIndex & index );
+	//! Continues updating the queued subtrees until the time budget of the event is used up
+	void processConditions();
+	//! Restarts the subtree being updated, called before the rows of the model change
+	void restartConditions();
 	//! Called when the current index changes
 	void currentChanged( const QModelIndex & current, const QModelIndex & previous ) override final;
 
@@ -96,6 +108,10 @@ protected slots:
 	void onItemCollapsed( const QModelIndex & index );
 
 protected:
+	void reset() override final;
+	void rowsInserted( const QModelIndex & parent, int start, int end ) override final;
+	void rowsAboutToBeRemoved( const QModelIndex & parent, int start, int end ) override final;
+
 	void drawBranches( QPainter * painter, const QRect & rect, const QModelIndex & index ) const override final;
 	void keyPressEvent( QKeyEvent * e ) override final;
 	void mousePressEvent( QMouseEvent * event ) override final;
@@ -121,6 +137,21 @@ protected:
 
 	class BaseModel * nif = nullptr;
 
+	//! Items whose rows have been hidden, setRowHidden() is only called when the state of a row changes
+	QSet<const NifItem *> hiddenItems;
+
+	//! Subtree waiting for its row visibility to be updated, an invalid index with all set is the whole model
+	struct PendingConditions
+	{
+		QPersistentModelIndex	index;
+		bool	all = false;
+	};
+	QList<PendingConditions> pendingConditions;
+	//! Parent index and next row of the traversal of the first pending subtree
+	std::vector<std::pair<QModelIndex, int>> conditionStack;
+	bool conditionsStarted = false;
+	class QTimer * conditionTimer = nullptr;
+
 	//! Row Copy
 	void copy();
 	//! Row Paste
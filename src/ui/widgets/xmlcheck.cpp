@@ -1,5 +1,6 @@
 #include "xmlcheck.h"
 
+#include "gamemanager.h"
 #include "message.h"
 #include "model/kfmmodel.h"
 #include "model/nifmodel.h"
@@ -9,9 +10,12 @@
 #include "spells/sanitize.h"
 
 #include <QAction>
+#include <QBuffer>
 #include <QCheckBox>
 #include <QCloseEvent>
 #include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
 #include <QGroupBox>
 #include <QLabel>
 #include <QLayout>
@@ -26,6 +30,15 @@
 #include <QToolButton>
 #include <QComboBox>
 #include <QQueue>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
 
 #define NUM_THREADS 4
 
@@ -48,6 +61,20 @@ TestShredder::TestShredder()
 	directory = new FileSelector( FileSelector::Folder, "Dir", QBoxLayout::RightToLeft );
 	directory->setText( settings.value( "Directory" ).toString() );
 
+	source = new QComboBox( this );
+	source->addItem( tr( "Folder" ), -1 );
+	for ( int game = int( Game::MORROWIND ); game < int( Game::NUM_GAMES ); game++ )
+		source->addItem( tr( "%1 archives" ).arg( Game::StringForMode( Game::GameMode( game ) ) ), game );
+	source->setCurrentIndex( std::max( source->findData( settings.value( "Source", -1 ).toInt() ), 0 ) );
+	source->setToolTip( tr( "Check the files in the selected folder, or all files in the archives of a game" ) );
+
+	useIndex = new QCheckBox( tr( "Index" ), this );
+	useIndex->setChecked( settings.value( "Use Index", false ).toBool() );
+	useIndex->setToolTip( tr( "Save a summary of the checked files, and answer later searches for block types, versions and values of the same field from it" ) );
+
+	indexFile = new FileSelector( FileSelector::SaveFile, "Index File", QBoxLayout::RightToLeft );
+	indexFile->setText( settings.value( "Index File" ).toString() );
+
 	recursive = new QCheckBox( tr( "Recursive" ), this );
 	recursive->setChecked( settings.value( "Recursive", true ).toBool() );
 	recursive->setToolTip( tr( "Recurse into sub directories" ) );
@@ -124,6 +151,7 @@ TestShredder::TestShredder()
 
 	QHBoxLayout * hbox = new QHBoxLayout();
 	lay->addLayout( hbox );
+	hbox->addWidget( source );
 	hbox->addWidget( directory );
 	hbox->addWidget( recursive );
 	hbox->addWidget( chkNif );
@@ -151,6 +179,10 @@ TestShredder::TestShredder()
 	hbox->addWidget( new QLabel( tr( "Version Match:" ) ) );
 	hbox->addWidget( verMatch );
 
+	lay->addLayout( hbox = new QHBoxLayout() );
+	hbox->addWidget( useIndex );
+	hbox->addWidget( indexFile );
+
 	lay->addWidget( text );
 
 	lay->addLayout( hbox = new QHBoxLayout() );
@@ -162,6 +194,15 @@ TestShredder::TestShredder()
 	hbox->addWidget( btXML );
 	hbox->addWidget( btClose );
 
+	// the folder options are not used when checking archives
+	auto updateSource = [this]() {
+		bool folder = ( source->currentData().toInt() < 0 );
+		directory->setEnabled( folder );
+		recursive->setEnabled( folder );
+	};
+	connect( source, &QComboBox::currentIndexChanged, this, updateSource );
+	updateSource();
+
 	renumberThreads( count->value() );
 
 	settings.endGroup();
@@ -173,6 +214,9 @@ TestShredder::~TestShredder()
 	settings.beginGroup( "XML Checker" );
 
 	settings.setValue( "Directory", directory->text() );
+	settings.setValue( "Source", source->currentData().toInt() );
+	settings.setValue( "Use Index", useIndex->isChecked() );
+	settings.setValue( "Index File", indexFile->text() );
 	settings.setValue( "Recursive", recursive->isChecked() );
 	settings.setValue( "Check NIF", chkNif->isChecked() );
 	settings.setValue( "Check KF", chkKf->isChecked() );
@@ -216,6 +260,7 @@ void TestShredder::renumberThreads( int num )
 		thread->valueName = valueName->text();
 		thread->valueMatch = valueMatch->text();
 		thread->op = OpType(valueOps->currentIndex());
+		thread->index = ( indexToSave.isEmpty() ? nullptr : &index );
 
 		if ( btRun->isChecked() ) {
 			thread->start();
@@ -233,6 +278,8 @@ void TestShredder::run()
 	errorCount = 0;
 	progress->setMaximum( progress->maximum() - queue.count() );
 	queue.clear();
+	// an interrupted scan does not produce a complete index
+	indexToSave.clear();
 
 	if ( !btRun->isChecked() )
 		return;
@@ -253,7 +300,33 @@ void TestShredder::run()
 	if ( chkKfm->isChecked() )
 		extensions << "*.kfm";
 
-	queue.init( directory->text(), extensions, recursive->isChecked() );
+	int game = source->currentData().toInt();
+	QString sourceName;
+	if ( game < 0 )
+		sourceName = QDir( directory->text() ).absolutePath() + ( recursive->isChecked() ? "/**" : "/*" );
+	else
+		sourceName = Game::StringForMode( Game::GameMode( game ) );
+	sourceName += " " + extensions.join( ";" );
+
+	if ( useIndex->isChecked() && !indexFile->text().isEmpty() ) {
+		if ( runIndexed( sourceName, extensions ) ) {
+			btRun->setChecked( false );
+			return;
+		}
+
+		// scan the files again and create a new index
+		index.clear();
+		index.source = sourceName;
+		index.sourceFiles = XmlCheckIndex::listSourceFiles( game, directory->text(), extensions, recursive->isChecked() );
+		// values are only read from fully loaded files
+		index.valueName = ( hdrOnly->isChecked() ? QString() : valueName->text() );
+		indexToSave = indexFile->text();
+	}
+
+	if ( game < 0 )
+		queue.init( directory->text(), extensions, recursive->isChecked() );
+	else
+		queue.initArchives( game, extensions );
 
 	time = QDateTime::currentDateTime();
 
@@ -269,11 +342,106 @@ void TestShredder::run()
 		thread->valueName = valueName->text();
 		thread->valueMatch = valueMatch->text();
 		thread->op = OpType(valueOps->currentIndex());
+		thread->index = ( indexToSave.isEmpty() ? nullptr : &index );
 
 		thread->start();
 	}
 }
 
+//! Returns the first line of the report of a file
+static QString fileResult( const QString & filepath, bool archived, const QString & version, quint32 userVersion, quint32 bsVersion )
+{
+	if ( archived )
+		return QString( "%1 (%2, %3, %4)" ).arg( filepath.toHtmlEscaped(), version ).arg( userVersion ).arg( bsVersion );
+	return QString( "<a href=\"nif:%1\">%1</a> (%2, %3, %4)" ).arg( filepath, version ).arg( userVersion ).arg( bsVersion );
+}
+
+//! Returns the message for a value that matches the search
+static QString valueMatchMessage( int block, const QString & valueName, OpType op, const QString & valueMatch, const QString & value )
+{
+	return QString( "[%1] Found Match: %2 %3 %4 | Value: %5" ).arg(block)
+			.arg(valueName).arg(ops_ord[int(op)].toHtmlEscaped())
+			.arg(valueMatch).arg(value);
+}
+
+bool TestShredder::runIndexed( const QString & sourceName, const QStringList & extensions )
+{
+	// error checking needs the fully loaded files
+	if ( chkCheckErrors->isChecked() )
+		return false;
+
+	QElapsedTimer timer;
+	timer.start();
+
+	if ( !( index.load( indexFile->text() ) && index.source == sourceName ) )
+		return false;
+
+	// files added, removed or modified since the index was created
+	int game = source->currentData().toInt();
+	if ( index.sourceFiles != XmlCheckIndex::listSourceFiles( game, directory->text(), extensions, recursive->isChecked() ) ) {
+		text->append( tr( "The index %1 is out of date, the files are scanned again" ).arg( indexFile->text() ) );
+		return false;
+	}
+
+	QString blkMatch = blockMatch->text();
+	QString vName = valueName->text();
+	QString vMatch = valueMatch->text();
+	bool matchValues = ( !vName.isEmpty() && !vMatch.isEmpty() );
+	if ( matchValues && vName != index.valueName )
+		return false;
+
+	quint32 ver = NifModel::version2number( verMatch->text() );
+	OpType op = OpType( valueOps->currentIndex() );
+	bool reportAll = !repErr->isChecked();
+	bool archived = ( game >= 0 );
+
+	// used for the block type inheritance
+	NifModel nif;
+
+	for ( const XmlCheckIndex::Entry & e : index.entries ) {
+		if ( ver && e.version != ver )
+			continue;
+
+		QStringList messages;
+		bool blk_match = false;
+		bool val_match = false;
+		QList<bool> blockMatches;
+		for ( const QString & t : e.blockTypes ) {
+			bool current_match = !blkMatch.isEmpty() && nif.inherits( t, blkMatch );
+			blockMatches.append( current_match );
+			blk_match |= current_match;
+		}
+
+		if ( matchValues ) {
+			for ( const XmlCheckIndex::Value & v : e.values ) {
+				if ( !blkMatch.isEmpty() && !blockMatches.value( v.block, false ) )
+					continue;
+				if ( xmlCheckValueMatch( op, v, vMatch ) ) {
+					messages.append( valueMatchMessage( v.block, vName, op, vMatch, v.asStr ) );
+					val_match = true;
+				}
+			}
+		}
+
+		if ( !( blkMatch.isEmpty() || blk_match || val_match ) )
+			continue;
+
+		if ( reportAll || ( blk_match && vMatch.isEmpty() ) || !messages.isEmpty() ) {
+			QString result = fileResult( e.path, archived, NifModel::version2string( e.version ), e.userVersion, e.bsVersion );
+			for ( const QString & m : messages )
+				result += "<br>" + m;
+			text->append( result );
+		}
+	}
+
+	progress->setRange( 0, 1 );
+	progress->setValue( 1 );
+	label->setText( tr( "%1 files from index in %2 ms" ).arg( index.entries.count() ).arg( timer.elapsed() ) );
+	label->setVisible( true );
+
+	return true;
+}
+
 void TestShredder::threadStarted()
 {
 	progress->setValue( progress->maximum() - queue.count() );
@@ -293,6 +461,12 @@ void TestShredder::threadFinished()
 		label->setText( tr( "%1 files in %2 seconds" ).arg( progress->maximum() ).arg( time.secsTo( QDateTime::currentDateTime() ) ) );
 		label->setVisible( true );
 
+		if ( !indexToSave.isEmpty() ) {
+			if ( !index.save( indexToSave ) )
+				text->append( tr( "Could not write index %1" ).arg( indexToSave ) );
+			indexToSave.clear();
+		}
+
 		for ( TestThread* thread : threads ) {
 			if ( thread->isFinished() )
 				finishedThreads++;
@@ -348,6 +522,7 @@ void TestShredder::closeEvent( QCloseEvent * e )
 		if ( thread->isRunning() ) {
 			e->ignore();
 			queue.clear();
+			indexToSave.clear();
 		}
 	}
 }
@@ -385,6 +560,36 @@ void FileQueue::init( const QString & dname, const QStringList & extensions, boo
 
 	mutex.lock();
 	this->queue = paths;
+	archive = -1;
+	mutex.unlock();
+}
+
+static bool archiveFileFilter( void * p, const std::string_view & fileName )
+{
+	for ( const std::string & e : *( reinterpret_cast< const std::vector< std::string > * >( p ) ) ) {
+		if ( fileName.ends_with( e ) )
+			return true;
+	}
+	return false;
+}
+
+void FileQueue::initArchives( int game, const QStringList & extensions )
+{
+	// "*.nif" -> ".nif", archived file names are in lower case
+	std::vector< std::string > suffixes;
+	for ( const QString & e : extensions )
+		suffixes.push_back( e.mid( e.indexOf( '.' ) ).toLower().toStdString() );
+
+	std::set< std::string_view > fileSet;
+	Game::GameManager::list_files( fileSet, Game::GameMode( game ), &archiveFileFilter, &suffixes );
+
+	QQueue<QString> paths;
+	for ( const auto & f : fileSet )
+		paths.enqueue( QString::fromUtf8( f.data(), qsizetype( f.length() ) ) );
+
+	mutex.lock();
+	this->queue = paths;
+	archive = game;
 	mutex.unlock();
 }
 
@@ -428,11 +633,114 @@ TestThread::~TestThread()
 	}
 }
 
+//! Reads the value of an item for matching
+static XmlCheckIndex::Value blockValue( const NifModel & nif, int block, const QModelIndex & nameIdx )
+{
+	XmlCheckIndex::Value v;
+	NifValue value = nif.getValue( nameIdx );
+
+	v.block = block;
+	v.isInt = value.isCount() && !value.isFloat();
+	v.isStr = value.isString() || value.type() == NifValue::tStringIndex || value.isFloat();
+	v.asInt = qint64( value.toCount( nullptr, nullptr ) );
+	v.asStr = ( value.type() == NifValue::tStringIndex ) ? nif.resolveString( nameIdx ) : value.toString();
+
+	return v;
+}
+
+bool xmlCheckValueMatch( OpType op, const XmlCheckIndex::Value & v, const QString & valueMatch )
+{
+	switch ( op ) {
+	case OP_EQ:
+		if ( v.isInt )
+			return (v.asInt == valueMatch.toInt(nullptr, 0));
+		else if ( v.isStr )
+			return (v.asStr == valueMatch);
+		break;
+	case OP_NEQ:
+		if ( v.isInt )
+			return (v.asInt != valueMatch.toInt(nullptr, 0));
+		else if ( v.isStr )
+			return (v.asStr != valueMatch);
+		break;
+	case OP_AND:
+		if ( !v.isInt )
+			break;
+		return (v.asInt & valueMatch.toInt(nullptr, 0));
+	case OP_AND_S:
+		if ( !v.isInt )
+			break;
+		return (v.asInt & (1 << valueMatch.toInt(nullptr, 0)));
+	case OP_NAND:
+		if ( !v.isInt )
+			break;
+		return !(v.asInt & valueMatch.toInt(nullptr, 0));
+	case OP_STR_S:
+		return v.asStr.startsWith(valueMatch, Qt::CaseInsensitive);
+	case OP_STR_E:
+		return v.asStr.endsWith(valueMatch, Qt::CaseInsensitive);
+	case OP_STR_NS:
+		return !v.asStr.startsWith(valueMatch, Qt::CaseInsensitive);
+	case OP_STR_NE:
+		return !v.asStr.endsWith(valueMatch, Qt::CaseInsensitive);
+	case OP_CONT:
+		return v.asStr.contains(valueMatch, Qt::CaseInsensitive);
+	default:
+		break;
+	}
+	return false;
+}
+
+//! Creates the index entry of a loaded file
+static XmlCheckIndex::Entry indexEntry( const NifModel & nif, const QString & filepath, const QString & valueName, bool headerOnly )
+{
+	XmlCheckIndex::Entry e;
+	e.path = filepath;
+	e.version = nif.getVersionNumber();
+	e.userVersion = nif.getUserVersion();
+	e.bsVersion = nif.getBSVersion();
+
+	const NifItem * header = nif.getHeaderItem();
+	if ( !headerOnly ) {
+		for ( int b = 0; b < nif.getBlockCount(); b++ ) {
+			auto blk = nif.getBlockIndex( b );
+			e.blockTypes.append( nif.itemName( blk ) );
+			if ( !valueName.isEmpty() ) {
+				auto nameIdx = nif.getIndex( blk, valueName );
+				if ( nameIdx.isValid() )
+					e.values.append( blockValue( nif, b, nameIdx ) );
+			}
+		}
+	} else if ( const NifItem * typeIndex = nif.getItem( header, "Block Type Index" ); typeIndex ) {
+		QVector<QString> types = nif.getArray<QString>( header, "Block Types" );
+		for ( int t : nif.getArray<int>( typeIndex ) )
+			e.blockTypes.append( types.value( t & 0x7FFF ) );
+	}
+
+	if ( const NifItem * strings = nif.getItem( header, "Strings" ); strings )
+		e.strings = nif.getArray<QString>( strings );
+
+	return e;
+}
+
 void TestThread::run()
 {
 	NifModel nif;
 	KfmModel kfm;
 
+	// Files are only checked as stored, the mesh conversion would load resources on this thread
+	nif.setConvertMeshesOnLoad( false );
+
+	bool archived = ( queue->archiveGame() >= 0 );
+	QByteArray fileData;
+	QBuffer buffer;
+
+	// Without error checking only the blocks that match are decoded, unless the index needs all values
+	bool selective = ( !checkFile && !blockMatch.isEmpty() && !( index && !valueName.isEmpty() ) );
+	NifModel::BlockFilter filter = [this, &nif]( const QString & blockType ) {
+		return nif.inherits( blockType, blockMatch );
+	};
+
 	QString filepath = queue->dequeue();
 
 	while ( !filepath.isEmpty() ) {
@@ -448,16 +756,56 @@ void TestThread::run()
 
 		bool kf = ( filepath.endsWith( ".KF", Qt::CaseInsensitive ) || filepath.endsWith( ".KFA", Qt::CaseInsensitive ) );
 
-		{
+		// Archived files are extracted by the thread and loaded from memory
+		bool readable = true;
+		if ( archived ) {
+			buffer.close();
+			QString err;
+			readable = Game::GameManager::extract_file( fileData, Game::GameMode( queue->archiveGame() ), filepath.toStdString(), &err );
+			if ( readable ) {
+				buffer.setData( fileData );
+				buffer.open( QIODevice::ReadOnly );
+			} else {
+				emit sigReady( err.toHtmlEscaped() );
+				emit incrementError();
+			}
+		}
+
+		if ( readable ) {
 			// lock the XML lock
 			QReadLocker lck( lock );
 
 			QString result;
-			if ( model == &nif && nif.earlyRejection( filepath, blockMatch, verMatch ) ) {
-				bool loaded = (headerOnly) ? nif.loadHeaderOnly(filepath) : model->loadFromFile(filepath);
+			bool accepted = false;
+			bool loaded = false;
+			if ( model == &nif ) {
+				if ( archived ) {
+					accepted = nif.earlyRejection( buffer, blockMatch, verMatch );
+					buffer.seek( 0 );
+				} else {
+					accepted = nif.earlyRejection( filepath, blockMatch, verMatch );
+				}
+
+				// the index also needs the files that do not match the current search
+				if ( accepted || index ) {
+					if ( headerOnly ) {
+						loaded = archived ? nif.loadHeaderOnly(buffer) : nif.loadHeaderOnly(filepath);
+					} else if ( archived ) {
+						loaded = selective ? nif.loadSelective(buffer, filter) : nif.load(buffer);
+					} else if ( selective ) {
+						QFile f( filepath );
+						loaded = f.open( QIODevice::ReadOnly ) && nif.loadSelective( f, filter, filepath.toStdString().c_str() );
+					} else {
+						loaded = model->loadFromFile(filepath);
+					}
+
+					if ( index && loaded )
+						index->add( indexEntry( nif, filepath, valueName, headerOnly ) );
+				}
+			}
 
-				result = QString( "<a href=\"nif:%1\">%1</a> (%2, %3, %4)" )
-					.arg( filepath, model->getVersion() ).arg( nif.getUserVersion() ).arg( nif.getBSVersion() );
+			if ( accepted ) {
+				result = fileResult( filepath, archived, model->getVersion(), nif.getUserVersion(), nif.getBSVersion() );
 				QList<TestMessage> messages = model->getMessages();
 
 				bool blk_match = false;
@@ -469,74 +817,15 @@ void TestThread::run()
 						bool current_match = !blockMatch.isEmpty() && nif.inherits(nif.itemName(blk), blockMatch);
 						blk_match |= current_match;
 
-						NifValue value;
 						if ( (blockMatch.isEmpty() || current_match) && !valueName.isEmpty() && !valueMatch.isEmpty() ) {
 							auto nameIdx = nif.getIndex(blk, valueName);
 							bool hasName = nameIdx.isValid();
 							if ( hasName ) {
-								value = nif.getValue(nameIdx);
-
-								bool isInt = value.isCount() && !value.isFloat();
-								bool isStr = value.isString() || value.type() == NifValue::tStringIndex || value.isFloat();
-
-								qint64 asInt = qint64( value.toCount( nullptr, nullptr) );
-								auto asStr = ( value.type() == NifValue::tStringIndex ) ? nif.resolveString(nameIdx) : value.toString();
-
-								bool current_match = false;
-
-								switch ( op ) {
-								case OP_EQ:
-									if ( isInt )
-										current_match = (asInt == valueMatch.toInt(nullptr, 0));
-									else if ( isStr )
-										current_match = (asStr == valueMatch);
-									break;
-								case OP_NEQ:
-									if ( isInt )
-										current_match = (asInt != valueMatch.toInt(nullptr, 0));
-									else if ( isStr )
-										current_match = (asStr != valueMatch);
-									break;
-								case OP_AND:
-									if ( !isInt )
-										break;
-									current_match = (asInt & valueMatch.toInt(nullptr, 0));
-									break;
-								case OP_AND_S:
-									if ( !isInt )
-										break;
-									current_match = (asInt & (1 << valueMatch.toInt(nullptr, 0)));
-									break;
-								case OP_NAND:
-									if ( !isInt )
-										break;
-									current_match = !(asInt & valueMatch.toInt(nullptr, 0));
-									break;
-								case OP_STR_S:
-									current_match = asStr.startsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_STR_E:
-									current_match = asStr.endsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_STR_NS:
-									current_match = !asStr.startsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_STR_NE:
-									current_match = !asStr.endsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_CONT:
-									current_match = asStr.contains(valueMatch, Qt::CaseInsensitive);
-									break;
-								default:
-									current_match = false;
-									break;
-								}
+								XmlCheckIndex::Value value = blockValue( nif, b, nameIdx );
+								current_match = xmlCheckValueMatch( op, value, valueMatch );
 
 								if ( current_match )
-									messages += TestMessage( QtInfoMsg ) <<
-												QString( "[%1] Found Match: %2 %3 %4 | Value: %5" ).arg(b)
-												.arg(valueName).arg(ops_ord[int(op)].toHtmlEscaped())
-												.arg(valueMatch).arg(asStr);
+									messages += TestMessage( QtInfoMsg ) << valueMatchMessage( b, valueName, op, valueMatch, value.asStr );
 							} else {
 								current_match = false;
 							}
@@ -634,3 +923,126 @@ QList<TestMessage> TestThread::checkLinks( const NifModel * nif, const QModelInd
 
 	return messages;
 }
+
+/*
+ *  Index
+ */
+
+//! "NSXI"
+static const quint32 indexMagic = 0x4958534E;
+static const quint32 indexFormatVersion = 2;
+
+void XmlCheckIndex::clear()
+{
+	QMutexLocker lock( &mutex );
+	source.clear();
+	sourceFiles.clear();
+	valueName.clear();
+	entries.clear();
+}
+
+void XmlCheckIndex::add( const Entry & entry )
+{
+	QMutexLocker lock( &mutex );
+	entries.append( entry );
+}
+
+bool XmlCheckIndex::load( const QString & fileName )
+{
+	QFile f( fileName );
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	QDataStream ds( &f );
+	ds.setVersion( QDataStream::Qt_6_0 );
+	quint32 magic = 0, formatVersion = 0;
+	ds >> magic >> formatVersion;
+	if ( magic != indexMagic || formatVersion != indexFormatVersion )
+		return false;
+
+	QMutexLocker lock( &mutex );
+	qint32 n = 0;
+	ds >> source >> valueName >> n;
+	sourceFiles.clear();
+	for ( qint32 i = 0; i < n && ds.status() == QDataStream::Ok; i++ ) {
+		SourceFile & s = sourceFiles.emplace_back();
+		ds >> s.path >> s.size >> s.modified;
+	}
+	n = 0;
+	ds >> n;
+	entries.clear();
+	for ( qint32 i = 0; i < n && ds.status() == QDataStream::Ok; i++ ) {
+		Entry & e = entries.emplace_back();
+		qint32 numValues = 0;
+		ds >> e.path >> e.version >> e.userVersion >> e.bsVersion >> e.blockTypes >> e.strings >> numValues;
+		for ( qint32 j = 0; j < numValues && ds.status() == QDataStream::Ok; j++ ) {
+			Value & v = e.values.emplace_back();
+			ds >> v.block >> v.isInt >> v.isStr >> v.asInt >> v.asStr;
+		}
+	}
+
+	if ( ds.status() != QDataStream::Ok ) {
+		sourceFiles.clear();
+		entries.clear();
+		return false;
+	}
+	return true;
+}
+
+bool XmlCheckIndex::save( const QString & fileName ) const
+{
+	QSaveFile f( fileName );
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return false;
+
+	QDataStream ds( &f );
+	ds.setVersion( QDataStream::Qt_6_0 );
+	ds << indexMagic << indexFormatVersion;
+	ds << source << valueName << qint32( sourceFiles.count() );
+	for ( const SourceFile & s : sourceFiles )
+		ds << s.path << s.size << s.modified;
+	ds << qint32( entries.count() );
+	for ( const Entry & e : entries ) {
+		ds << e.path << e.version << e.userVersion << e.bsVersion << e.blockTypes << e.strings << qint32( e.values.count() );
+		for ( const Value & v : e.values )
+			ds << v.block << v.isInt << v.isStr << v.asInt << v.asStr;
+	}
+
+	return ( ds.status() == QDataStream::Ok && f.commit() );
+}
+
+QList<XmlCheckIndex::SourceFile> XmlCheckIndex::listSourceFiles( int game, const QString & directory, const QStringList & extensions, bool recursive )
+{
+	QStringList paths;
+	QStringList nameFilters( extensions );
+	if ( game < 0 ) {
+		paths.append( directory );
+	} else {
+		paths = Game::GameManager::folders( Game::GameMode( game ) );
+		nameFilters << "*.bsa" << "*.ba2";
+		recursive = true;
+	}
+
+	QList<SourceFile> files;
+	auto addFile = [&files]( const QFileInfo & fi ) {
+		files.append( SourceFile{ fi.absoluteFilePath(), fi.size(), fi.lastModified().toMSecsSinceEpoch() } );
+	};
+	for ( const QString & p : paths ) {
+		QFileInfo fi( p );
+		if ( !fi.isDir() ) {
+			if ( fi.exists() )
+				addFile( fi );
+			continue;
+		}
+		QDirIterator it( p, nameFilters, QDir::Files, ( recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags ) );
+		while ( it.hasNext() ) {
+			it.next();
+			addFile( it.fileInfo() );
+		}
+	}
+
+	std::sort( files.begin(), files.end(), []( const SourceFile & a, const SourceFile & b ) {
+		return a.path < b.path;
+	} );
+	return files;
+}
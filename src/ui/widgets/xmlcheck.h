@@ -70,15 +70,94 @@ public:
 	int count();
 
 	void init( const QString & directory, const QStringList & extensions, bool recursive );
+	//! Queues the files of the archives of a game (Game::GameMode) that match \a extensions
+	void initArchives( int game, const QStringList & extensions );
 	void clear();
 
+	//! Game of the archives the queued files are extracted from, or -1 for loose files
+	int archiveGame() const { return archive; }
+
 protected:
 	QQueue<QString> make( const QString & directory, const QStringList & extensions, bool recursive );
 
 	QMutex mutex;
 	QQueue<QString> queue;
+	int archive = -1;
 };
 
+/*! Summary of scanned files that is saved by the XML checker
+ *
+ * The index stores the versions, block types and header strings of each file, and the
+ * values of one field for every block, so that later searches for block types, versions
+ * or values of that field do not need to load the files again. The size and modification
+ * time of the loose files and archives it was created from are also stored, the index is
+ * not used if any of them has changed.
+ */
+class XmlCheckIndex final
+{
+public:
+	struct Value
+	{
+		qint32 block = -1;
+		bool isInt = false;
+		bool isStr = false;
+		qint64 asInt = 0;
+		QString asStr;
+	};
+
+	struct Entry
+	{
+		QString path;
+		quint32 version = 0;
+		quint32 userVersion = 0;
+		quint32 bsVersion = 0;
+		//! Type of each block, or the block types of the header if only the header was loaded
+		QStringList blockTypes;
+		QStringList strings;
+		QList<Value> values;
+	};
+
+	//! Loose file or archive the index was created from
+	struct SourceFile
+	{
+		QString path;
+		qint64 size = 0;
+		//! Modification time in milliseconds since the epoch
+		qint64 modified = 0;
+
+		bool operator==( const SourceFile & ) const = default;
+	};
+
+	//! Files or archives the index was created from
+	QString source;
+	//! Size and modification time of each source file, sorted by path
+	QList<SourceFile> sourceFiles;
+	//! Name of the field whose values are stored
+	QString valueName;
+	QList<Entry> entries;
+
+	void clear();
+	//! Adds an entry, may be called from multiple threads
+	void add( const Entry & entry );
+
+	bool load( const QString & fileName );
+	bool save( const QString & fileName ) const;
+
+	/*! Returns the files of a directory that match \a extensions, or the data paths of
+	 * a game (Game::GameMode) if \a game is not negative
+	 *
+	 * For the data paths of a game, archives and loose files matching \a extensions
+	 * are listed in all subfolders.
+	 */
+	static QList<SourceFile> listSourceFiles( int game, const QString & directory, const QStringList & extensions, bool recursive );
+
+protected:
+	QMutex mutex;
+};
+
+//! Returns true if a value matches valueMatch with the operator op
+bool xmlCheckValueMatch( OpType op, const XmlCheckIndex::Value & value, const QString & valueMatch );
+
 class TestThread final : public QThread
 {
 	Q_OBJECT
@@ -95,6 +174,8 @@ public:
 	bool reportAll = true;
 	bool headerOnly = false;
 	bool checkFile = true;
+	//! Entries for all loaded files are added to the index if not nullptr
+	XmlCheckIndex * index = nullptr;
 
 signals:
 	void sigStart( const QString & file );
@@ -137,7 +218,13 @@ protected slots:
 protected:
 	void closeEvent( QCloseEvent * ) override final;
 
+	//! Answers the query from the index, returns false if the index cannot be used or is out of date
+	bool runIndexed( const QString & source, const QStringList & extensions );
+
 	FileSelector * directory;
+	QComboBox * source;
+	QCheckBox * useIndex;
+	FileSelector * indexFile;
 	QLineEdit * blockMatch;
 	QLineEdit * valueName;
 	QLineEdit * valueMatch;
@@ -153,6 +240,9 @@ protected:
 	QPushButton * btRun;
 
 	FileQueue queue;
+	XmlCheckIndex index;
+	//! Index file to write when all threads have finished, or empty
+	QString indexToSave;
 
 	QList<TestThread *> threads;
 